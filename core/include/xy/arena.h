@@ -0,0 +1,67 @@
+#ifndef XY_ARENA
+#define XY_ARENA
+
+
+#include <vector>
+#include <cstddef>
+#include <memory_resource>
+
+
+// Linear allocator for the temporaries of one piece of work, such as
+// loading an asset, used through std::pmr containers. Allocations bump a
+// pointer through chunks taken from upstream and are never freed one by
+// one: Reset drops them all at once. A reset arena keeps one chunk as
+// large as all of its chunks were, so a reused arena stops going upstream.
+// One thread at a time.
+class Arena : public std::pmr::memory_resource {
+public:
+	struct Stats {
+		std::size_t num_allocs, num_resets;
+		// Taken from upstream.
+		std::size_t num_chunks, chunk_bytes;
+		// Most bytes handed out between two resets, alignment included.
+		std::size_t peak_bytes;
+	};
+
+	explicit Arena(
+		std::size_t chunk_bytes = std::size_t{ 1 } << 16,
+		std::pmr::memory_resource *upstream = std::pmr::new_delete_resource());
+	Arena(Arena const&) = delete;
+	Arena& operator=(Arena const&) = delete;
+
+	void Reset();
+
+	// Handed out since the last Reset.
+	std::size_t BytesUsed() const { return used_; }
+	const Stats &GetStats() const { return stats_; }
+
+	~Arena();
+
+private:
+	struct Chunk {
+		unsigned char *data;
+		std::size_t bytes;
+	};
+
+	void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+	// Memory comes back on Reset.
+	void do_deallocate(void*, std::size_t, std::size_t) override {}
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+
+	void AddChunk(std::size_t bytes);
+	void FreeChunks();
+
+	std::pmr::memory_resource *upstream_;
+	std::size_t chunk_bytes_;
+	std::vector<Chunk> chunks_;
+	// Next free byte of the last chunk.
+	std::size_t head_;
+	std::size_t used_;
+	Stats stats_;
+};
+
+// High-water mark of the process's resident memory, 0 where unknown.
+std::size_t PeakResidentBytes();
+
+
+#endif // !XY_ARENA
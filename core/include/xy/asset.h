@@ -2,15 +2,54 @@
 #define XY_ASSET
 
 #include <vector>
+#include <map>
+#include <memory>
 #include <fstream>
+#include <functional>
 #include "glad/glad.h"
 
 #include "xy_ext.h"
 #include "xy_calc.h"
 #include "gpu_array.h"
+#include "aabb.h"
+#include "arena.h"
 
 
+// Texels of an image file. Decoding needs no GL, so it may run on any
+// thread; CreateGpuRes uploads on the GL thread.
+struct TextureImage {
+	int width, height, num_channels;
+	std::shared_ptr<unsigned char> texels;
+};
+
+// Whole fibers of a hair file read by FiberAsset::StreamFromFile, with
+// their tangents and scales. Reused from chunk to chunk.
+struct FiberChunk {
+	std::size_t first_fiber, first_vert;
+	std::vector<int> num_verts_per_fiber;
+	std::vector<xy::vec3> positions;
+	std::vector<xy::vec3> tangents;
+	std::vector<float> scales;
+};
+
+// Where FiberAsset::StreamFromFile puts the chunks. GL() reserves the
+// position, tangent and scale buffers of vao up front and uploads each
+// chunk into them; a stand-in may check the chunks instead, without GL.
+struct FiberUploadApi {
+	// Once, with the totals of the file header, before the first chunk.
+	std::function<void(std::size_t num_fibers, std::size_t num_verts)> reserve;
+	std::function<void(const FiberChunk&)> upload;
+
+	static FiberUploadApi GL(GpuArray &vao);
+};
+
 struct FiberAsset {
+	struct StreamStats {
+		std::size_t num_fibers, num_verts, num_chunks;
+		// Capacity of the chunk, the host memory streaming holds.
+		std::size_t peak_chunk_bytes;
+	};
+
 	std::vector<xy::vec3> positions;
 	std::vector<xy::vec3> tangents;
 	std::vector<float> scales;
@@ -27,10 +66,39 @@ struct FiberAsset {
 		std::string model_path, 
 		std::string base_color_texture_path,
 		std::string specular_random_offset_texture_path);
+	// Temporaries go to scratch, for the caller to reset.
+	void LoadFromFile(
+		std::string model_path,
+		std::string base_color_texture_path,
+		std::string specular_random_offset_texture_path,
+		Arena &scratch);
+	// Reads fibers_per_chunk fibers at a time and uploads every chunk into
+	// the buffers of vao, so host memory stays at one chunk however large
+	// the groom. The GL thread only. positions, tangents, scales and
+	// num_verts_per_fiber stay empty, CreateGpuRes then only loads the
+	// textures.
+	StreamStats StreamFromFile(
+		std::string model_path,
+		std::string base_color_texture_path,
+		std::string specular_random_offset_texture_path,
+		int fibers_per_chunk = 1 << 16);
+	// IND_HAIR data from in, chunks to api. Tangents, scales and bounds
+	// come out as LoadFromFile computes them.
+	StreamStats StreamFromFile(std::istream &in, int fibers_per_chunk, const FiberUploadApi &api);
+	// Optional, decodes the textures ahead of CreateGpuRes.
+	void DecodeTextures();
 	void CreateGpuRes();
 
+	// Vertex data went to the GPU while loading.
+	bool streamed = false;
+
+	// By path, until uploaded.
+	std::map<std::string, TextureImage> decoded_textures;
+
 	xy::mat4 model_matrix;
 	std::string description;
+	// Model space bounds of positions.
+	AABB bounds;
 };
  
 struct ObjShape {
@@ -65,8 +133,16 @@ struct ObjAsset {
 	std::vector<ObjShape> shapes;
 
 	void LoadFromFile(std::string obj_path, std::string mtl_dirpath);
+	// Temporaries go to scratch, for the caller to reset. tinyobjloader
+	// allocates its own.
+	void LoadFromFile(std::string obj_path, std::string mtl_dirpath, Arena &scratch);
+	// Optional, decodes the textures ahead of CreateGpuRes, as jobs.
+	void DecodeTextures();
 	void CreateGpuRes();
 
+	// By path, until uploaded.
+	std::map<std::string, TextureImage> decoded_textures;
+
 	xy::mat4 model_matrix;
 	std::string description;
 };
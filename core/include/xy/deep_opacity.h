@@ -0,0 +1,92 @@
+#ifndef XY_DEEP_OPACITY
+#define XY_DEEP_OPACITY
+
+
+#include <vector>
+#include "xy_calc.h"
+
+
+// CPU reference of the deep opacity map built by DOM in src/shader.h
+// and looked up by shader/dom_lookup.glsl.
+class DeepOpacityMap {
+public:
+	static constexpr int max_layers = 8;
+
+	DeepOpacityMap();
+
+	void Build(
+		const std::vector<xy::vec3> &positions,
+		const std::vector<int> &num_verts_per_fiber,
+		const xy::mat4 &light_view_proj,
+		int width, int height,
+		int num_layers,
+		float layer_size,
+		float fiber_opacity);
+
+	float Transmittance(const xy::mat4 &light_view_proj, const xy::vec3 &position, float absorption) const;
+
+	// Calls fn(x, y, depth) for every texel a fiber segment covers, depth
+	// in [0,1] as gl_FragCoord.z. Shared endpoints are visited once.
+	template<typename FN>
+	static void RasterizeFibers(
+		const std::vector<xy::vec3> &positions,
+		const std::vector<int> &num_verts_per_fiber,
+		const xy::mat4 &view_proj,
+		int width, int height,
+		FN fn);
+
+	float FirstDepth(int x, int y) const { return depth_[y*width_ + x]; }
+	float Opacity(int x, int y, int layer) const { return layers_[(y*width_ + x)*num_layers_ + layer]; }
+	std::size_t MemoryBytes() const;
+
+private:
+	int width_, height_, num_layers_;
+	float layer_size_;
+	std::vector<float> depth_;
+	// Interleaved, num_layers_ floats per texel.
+	std::vector<float> layers_;
+};
+
+template<typename FN>
+void DeepOpacityMap::RasterizeFibers(
+	const std::vector<xy::vec3> &positions,
+	const std::vector<int> &num_verts_per_fiber,
+	const xy::mat4 &view_proj,
+	int width, int height,
+	FN fn)
+{
+	auto to_window = [&](const xy::vec3 &p) {
+		auto tmp = view_proj * xy::vec4(p.x, p.y, p.z, 1.f);
+		tmp /= tmp.w;
+		return xy::vec3(
+			(tmp.x*.5f + .5f)*width,
+			(tmp.y*.5f + .5f)*height,
+			tmp.z*.5f + .5f);
+	};
+
+	std::size_t kthvert = 0;
+	for (auto nverts : num_verts_per_fiber) {
+		auto p0 = to_window(positions[kthvert]);
+		for (int i = 1; i < nverts; ++i) {
+			auto p1 = to_window(positions[kthvert + i]);
+
+			// DDA, one sample per texel along the major axis, end excluded.
+			float dx = p1.x - p0.x, dy = p1.y - p0.y;
+			int nsteps = static_cast<int>(ceilf(xy::Max(fabsf(dx), fabsf(dy))));
+			for (int s = 0; s < nsteps; ++s) {
+				float t = (s + .5f) / nsteps;
+				int x = static_cast<int>(floorf(p0.x + t * dx));
+				int y = static_cast<int>(floorf(p0.y + t * dy));
+				float z = p0.z + t * (p1.z - p0.z);
+				if (x < 0 || y < 0 || x >= width || y >= height || z < 0.f || z > 1.f)
+					continue;
+				fn(x, y, z);
+			}
+			p0 = p1;
+		}
+		kthvert += nverts;
+	}
+}
+
+
+#endif // !XY_DEEP_OPACITY
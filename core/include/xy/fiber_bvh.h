@@ -0,0 +1,111 @@
+#ifndef XY_FIBER_BVH
+#define XY_FIBER_BVH
+
+
+#include <vector>
+#include <cstdint>
+#include "xy_calc.h"
+#include "job_system.h"
+
+
+struct FiberAsset;
+
+// Bounding volume hierarchy over fiber segments. Every segment (two
+// consecutive vertices of one fiber) is treated as a capsule of radius
+// Radius(). Nodes are stored depth-first, the left child of an interior
+// node always follows its parent directly.
+class FiberBVH {
+public:
+
+	// 32 bytes, two nodes per cache line.
+	struct Node {
+		xy::vec3 inf;
+		// Leaf: index of first segment. Interior: distance to right child.
+		int offset;
+		xy::vec3 sup;
+		// Zero for interior nodes.
+		uint16_t num_segs;
+		uint16_t axis;
+	};
+
+	struct Ray {
+		xy::vec3 o, d;
+		float tmin, tmax;
+	};
+
+	struct Hit {
+		float t;
+		// Segment as index of its first vertex in the fiber asset.
+		int vert;
+		// Parametric position along the segment, in [0,1].
+		float u;
+		xy::vec3 p;
+	};
+
+	struct BuildStats {
+		int num_nodes;
+		int num_leaves;
+		int max_depth;
+		double build_ms;
+	};
+
+	FiberBVH();
+
+	// Subtrees are built as jobs on jobs.
+	void Build(const FiberAsset &asset, float radius, JobSystem &jobs = JobSystem::Global());
+	void Build(
+		const std::vector<xy::vec3> &positions,
+		const std::vector<int> &num_verts_per_fiber,
+		float radius,
+		JobSystem &jobs = JobSystem::Global());
+
+	// Recomputes bounds for moved vertices. Topology must be unchanged.
+	void Refit(const std::vector<xy::vec3> &positions);
+
+	// Nearest capsule hit along the ray inside [tmin,tmax].
+	bool Intersect(const Ray &ray, Hit *hit) const;
+	// Any capsule hit, for shadow rays.
+	bool Occluded(const Ray &ray) const;
+	// Closest point on any segment axis within max_dist of p.
+	bool ClosestPoint(const xy::vec3 &p, float max_dist, Hit *hit) const;
+
+	int FiberOf(int vert) const;
+
+	float Radius() const { return radius_; }
+	const std::vector<Node> &Nodes() const { return nodes_; }
+	const BuildStats &Stats() const { return stats_; }
+	std::size_t NumSegments() const { return seg_verts_.size(); }
+
+private:
+	struct Segment {
+		xy::vec3 p0, p1;
+	};
+
+	struct BuildRef {
+		xy::vec3 inf, sup, centroid;
+		int vert;
+	};
+
+	void BuildRecursive(
+		std::vector<BuildRef> &refs,
+		int begin, int end,
+		int depth,
+		int par_depth,
+		JobSystem &jobs,
+		std::vector<Node> &out);
+
+	void UpdateLeafSegments(const std::vector<xy::vec3> &positions);
+	void RefitBounds();
+
+	float radius_;
+	std::vector<Node> nodes_;
+	// Leaf order.
+	std::vector<Segment> segs_;
+	std::vector<int> seg_verts_;
+	// Prefix sum of vertex counts, for FiberOf().
+	std::vector<int> fiber_first_vert_;
+	BuildStats stats_;
+};
+
+
+#endif // !XY_FIBER_BVH
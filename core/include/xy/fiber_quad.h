@@ -0,0 +1,48 @@
+#ifndef XY_FIBER_QUAD
+#define XY_FIBER_QUAD
+
+
+#include "xy_calc.h"
+
+
+// CPU reference of shader/fiber_quad.glsl, the screen facing quad every
+// fiber segment is drawn as, and of how shader/ppll_store.vert pulls its
+// corners by gl_VertexID.
+struct FiberQuadParams {
+	xy::mat4 view_proj;
+	xy::vec3 eye;
+	xy::vec2 win_size;
+	float hair_radius;
+};
+
+// Corners 0 and 2 are at p0, 1 and 3 at p1; 0 and 1 on the e0 side.
+struct FiberCorner {
+	// NDC with w 1.
+	xy::vec4 position;
+	xy::vec3 world;
+	xy::vec4 tangent;
+	// Both sides of the quad at this end.
+	xy::vec4 win_e0e1;
+};
+
+// World space ends and tangents of a segment, scales in the tangent w.
+FiberCorner ExpandFiberCorner(
+	const FiberQuadParams &params,
+	const xy::vec3 &p0, const xy::vec3 &p1,
+	const xy::vec4 &t0, const xy::vec4 &t1,
+	int corner);
+
+// Two triangles of the corners of a segment, as GpuArray::DrawLineStripsPulled
+// indexes them.
+constexpr int fiber_quad_indices[6] = { 0,1,2,2,1,3 };
+
+// First vertex of the segment, and the corner, that vertex vertex_id of a
+// pulled draw stands for. The draw covers a run of strips of num_verts
+// vertices from first_vert, from segment first_segment of the run on.
+struct PulledCorner {
+	int vert, corner;
+};
+PulledCorner PullFiberCorner(int first_vert, int num_verts, int first_segment, int vertex_id);
+
+
+#endif // !XY_FIBER_QUAD
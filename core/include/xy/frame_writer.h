@@ -0,0 +1,40 @@
+#ifndef XY_FRAME_WRITER
+#define XY_FRAME_WRITER
+
+
+#include <string>
+#include <atomic>
+#include "readback_ring.h"
+
+
+// Writes frames of a framebuffer to PNG files without stalling the render
+// loop. Frames are read back through a ReadbackRing and encoded on its
+// worker straight from the mapped buffer; the CPU only waits when every
+// ring slot is still being read or encoded.
+class FrameWriter {
+public:
+	FrameWriter();
+	FrameWriter(FrameWriter const&) = delete;
+	FrameWriter& operator=(FrameWriter const&) = delete;
+
+	void Init(int width, int height, int ring_size = 3);
+
+	// RGBA8 color attachment 0 of a single-sample framebuffer.
+	void Capture(GLuint framebuffer, const std::string &path);
+	// Hands finished readbacks to the encoder without waiting.
+	void Poll() { ring_.Poll(); }
+	// Waits until every capture is on disk.
+	void Finish() { ring_.Finish(); }
+
+	std::size_t NumWritten() const { return num_written_; }
+	// Captures that had to wait for a ring slot.
+	std::size_t NumStalls() { return ring_.Stats().num_stalls; }
+	ReadbackStats Stats() { return ring_.Stats(); }
+
+private:
+	ReadbackRing ring_;
+	std::atomic<std::size_t> num_written_;
+};
+
+
+#endif // !XY_FRAME_WRITER
@@ -0,0 +1,97 @@
+#ifndef XY_GL_STATE
+#define XY_GL_STATE
+
+
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <functional>
+#include "glad/glad.h"
+
+
+// GL entry points the state cache goes through. GL() forwards to the
+// driver; a stand-in can record the calls and run without a context.
+struct GlStateApi {
+	std::function<void(GLuint)> use_program;
+	std::function<void(GLenum, GLuint)> bind_framebuffer;
+	// glEnable on true, glDisable on false.
+	std::function<void(GLenum, bool)> set_capability;
+	std::function<void(GLboolean)> depth_mask;
+	std::function<void(GLenum)> active_texture;
+	std::function<void(GLenum, GLuint)> bind_texture;
+	std::function<void(GLuint)> bind_vertex_array;
+	// glEnableVertexArrayAttrib on true, needs no binding.
+	std::function<void(GLuint, GLuint, bool)> set_vertex_attrib;
+
+	static GlStateApi GL();
+};
+
+// Shadows the bindings and switches the passes set every frame, and only
+// forwards the calls that change something. Vertex attrib enables are
+// recorded per vertex array, so a draw enables the attribs it needs once
+// instead of toggling them around every draw.
+//
+// State changed behind the cache, by ImGui, loaders or deleted objects,
+// is unknown after Invalidate; Draw invalidates at the start of a frame.
+class GlStateCache {
+public:
+	struct Stats {
+		// Calls made to the cache, and those forwarded to GL.
+		std::size_t num_requests, num_issued;
+	};
+
+	static GlStateCache &Global();
+
+	explicit GlStateCache(GlStateApi api);
+	GlStateCache(GlStateCache const&) = delete;
+	GlStateCache& operator=(GlStateCache const&) = delete;
+
+	void UseProgram(GLuint program);
+	// GL_FRAMEBUFFER binds both draw and read.
+	void BindFramebuffer(GLenum target, GLuint framebuffer);
+	void Enable(GLenum cap) { SetCapability(cap, true); }
+	void Disable(GLenum cap) { SetCapability(cap, false); }
+	void SetCapability(GLenum cap, bool enabled);
+	void DepthMask(GLboolean flag);
+	// Makes unit active only when the binding changes.
+	void BindTexture(GLuint unit, GLenum target, GLuint texture);
+	void BindVertexArray(GLuint vao);
+	// Bit i of attribs enables attrib i of vao, the others are disabled.
+	void SetVertexAttribs(GLuint vao, std::uint32_t attribs);
+	// Call when vao is deleted, GL may hand its name out again.
+	void ForgetVertexArray(GLuint vao);
+
+	// Everything unknown, the next call of each kind is forwarded.
+	void Invalidate();
+
+	const Stats &GetStats() const { return stats_; }
+	// Share of requests filtered out, 0 without requests.
+	double RedundantRatio() const;
+	void ResetStats();
+
+private:
+	static constexpr GLuint unknown = ~0u;
+
+	struct TextureBinding {
+		GLenum target;
+		GLuint texture;
+	};
+
+	// Counts the request; true when it has to be forwarded.
+	bool Request(bool changed);
+
+	GlStateApi api_;
+	Stats stats_;
+
+	GLuint program_, draw_framebuffer_, read_framebuffer_, vao_;
+	GLenum active_unit_;
+	int depth_mask_;
+	std::vector<std::pair<GLenum, bool>> caps_;
+	std::vector<TextureBinding> units_;
+	// Enabled attribs of every vertex array seen, vertex array state
+	// survives Invalidate.
+	std::map<GLuint, std::uint32_t> vao_attribs_;
+};
+
+
+#endif // !XY_GL_STATE
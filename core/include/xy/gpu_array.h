@@ -3,11 +3,32 @@
 
 
 #include <vector>
+#include <cstdint>
 #include "glad/glad.h"
+#include "xy_calc.h"
+#include "gl_state.h"
+#include "stream_buffer.h"
 
 
+// Per-instance attribs of the instance buffer: the model matrix, and the
+// normal matrix derived from it once here rather than per vertex, the
+// inverse transpose of its upper 3x3 as three columns.
+struct InstanceTransform {
+	xy::mat4 model;
+	xy::vec4 normal[3];
+
+	static InstanceTransform FromModel(const xy::mat4 &model);
+};
+
 class GpuArray {
 public:
+	// Counts of lines written on the GPU, at the head of what
+	// SetAsIndirectLines reads them from: the indices of the GL_LINES
+	// draw and the vertices of the pulled quads, two and six per segment.
+	struct IndirectLineCounts {
+		std::uint32_t num_line_indices, num_quad_verts;
+	};
+
 	GpuArray();
 	GpuArray(const GpuArray &) = delete;
 	GpuArray& operator= (const GpuArray&) = delete;
@@ -16,45 +37,153 @@ public:
 	template <typename T>
 	void SubmitBuf(const std::vector<T> &buf, const std::vector<int> &&attrib_sizes)
 	{
-		if (!initialized) {
-			Init();
-			initialized = true;
-		}
-
-		if (vertex_count_ == 0)
-			vertex_count_ = static_cast<int>(buf.size());
-		if (vertex_count_ != buf.size())
-			XY_Die("buffer has unequal length");
-
-		if (cur_buf_binding_ >= 16)
-			XY_Die("too many buffers");
-
-		glGenBuffers(1, &bufs_[cur_buf_binding_]);
-
-		glBindVertexArray(vao_);
-		glBindBuffer(GL_ARRAY_BUFFER, bufs_[cur_buf_binding_]);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(T)*buf.size(), buf.data(), GL_STATIC_DRAW);
-
-		int offset = 0;
-		for (auto attrib_size : attrib_sizes) {
-			glVertexAttribPointer(cur_attrib_binding_, attrib_size, GL_FLOAT, GL_FALSE, sizeof(T), (void*)(offset));
-			++cur_attrib_binding_;
-			offset += attrib_size * sizeof(float);
-		}
-		++cur_buf_binding_;
+		CreateBuf(buf.size(), buf.data(), static_cast<int>(sizeof(T)), attrib_sizes, GL_STATIC_DRAW);
 	}
 
-	void SetAsLineStrips(std::vector<int> num_lsverts);
+	// A buffer of num_verts uninitialized vertices of type T, filled by
+	// UpdateBuf, for data uploaded in pieces.
+	template <typename T>
+	void ReserveBuf(std::size_t num_verts, const std::vector<int> &&attrib_sizes)
+	{
+		CreateBuf(num_verts, nullptr, static_cast<int>(sizeof(T)), attrib_sizes, GL_STATIC_DRAW);
+	}
+
+	// Overwrites vertices [first_vert, first_vert + count) of buffer buf.
+	template <typename T>
+	void UpdateBuf(int buf, std::size_t first_vert, const T *data, std::size_t count)
+	{
+		if (buf >= static_cast<int>(buf_layouts_.size()))
+			XY_Die("no such buffer");
+		if (buf_layouts_[buf].stride != sizeof(T))
+			XY_Die("buffer has another vertex type");
+		if (first_vert + count > static_cast<std::size_t>(vertex_count_))
+			XY_Die("update out of the buffer");
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, bufs_[buf]);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(T)*first_vert, sizeof(T)*count, data);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	// Points the attribs of submitted buffer buf, in submission order, at
+	// a Vertex allocation of a stream buffer laid out the same, for vertex
+	// data rewritten every frame. Draws read it until the next StreamBuf
+	// or RestoreBuf.
+	void StreamBuf(int buf, const StreamAlloc &data);
+	// Same for vertices written on the GPU into buffer from offset, as
+	// many as the strips drawn need.
+	void PointBuf(int buf, GLuint buffer, std::size_t offset);
+	// Back to the submitted data.
+	void RestoreBuf(int buf);
+	// Frees the storage of buffer buf while its attribs read elsewhere,
+	// keeping its layout; ResubmitBuf fills it again.
+	void ReleaseBuf(int buf);
+	template <typename T>
+	void ResubmitBuf(int buf, const std::vector<T> &data)
+	{
+		if (buf < 0 || buf >= cur_buf_binding_)
+			XY_Die("resubmitted buffer was never submitted");
+		if (buf_layouts_[buf].stride != sizeof(T) || data.size() != static_cast<std::size_t>(vertex_count_))
+			XY_Die("resubmitted buffer changed shape");
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, bufs_[buf]);
+		glBufferData(GL_COPY_WRITE_BUFFER, sizeof(T)*data.size(), data.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		buf_layouts_[buf].released = false;
+		RestoreBuf(buf);
+	}
+
+	void SetAsLineStrips(const std::vector<int> &num_lsverts);
+	// Segments written on the GPU in place of strips: vertex index pairs
+	// in lines from lines_offset, of the at most max_verts vertices the
+	// buffers point at, counted by the IndirectLineCounts in counts at
+	// counts_offset. Draws take their counts from there, all segments
+	// whatever the keep ratio, until SetAsLineStrips.
+	void SetAsIndirectLines(GLuint lines, std::size_t lines_offset, GLuint counts, std::size_t counts_offset, std::size_t max_verts);
+	// Adds num_strips strips of num_verts vertices after the last ones.
+	void AppendLineStrips(int num_strips, int num_verts);
+
+	// Per-instance transforms, one column per attrib from instance_attrib
+	// on, advanced once per instance. May be resubmitted.
+	void SubmitInstances(const std::vector<InstanceTransform> &transforms);
+	// Per-frame transforms, num_instances of them at a Vertex allocation
+	// of a stream buffer. Draws read them until the next Submit or Stream.
+	void StreamInstances(const StreamAlloc &transforms, int num_instances);
 
 	void Draw(GLenum mode, const std::vector<int> &&attribs) const;
 	void DrawLineStrips(const std::vector<int> &&attribs, float keep_ratio) const;
 
+	// Instances [first_instance, first_instance + num_instances) of the
+	// submitted matrices; the instance attribs are enabled with attribs.
+	void DrawInstanced(GLenum mode, const std::vector<int> &&attribs, int first_instance, int num_instances) const;
+	void DrawLineStripsInstanced(const std::vector<int> &&attribs, float keep_ratio, int first_instance, int num_instances) const;
+	// The line strips as one quad per segment, four vertices the shader
+	// pulls from the first three buffers, bound as storage buffers from
+	// pull_binding on, by gl_VertexID; see shader/ppll_store.vert. Every
+	// strip is drawn. Indirect lines take six vertices a segment, their
+	// pairs bound after the buffers.
+	void DrawLineStripsPulled(int first_instance, int num_instances) const;
+
+	int NumInstances() const { return num_instances_; }
+	// Vertices the line strips take, at most the buffer length.
+	std::size_t NumStripVerts() const;
+
+	// mat4 vs_Model takes locations 4 to 7 in every instanced shader,
+	// mat3 vs_NormalMatrix 8 to 10.
+	static constexpr int instance_attrib = 4;
+	static constexpr int num_instance_attribs = 7;
+	static constexpr int pull_binding = 5;
+	// Segments of one pulled draw, so their corners take 16 bit indices.
+	static constexpr int pull_segments_per_draw = 1 << 14;
+
 private:
 	bool initialized;
 	GLuint vao_, bufs_[16];
 	int cur_buf_binding_, cur_attrib_binding_;
 	int vertex_count_;
-	std::vector<int> num_lsverts_;
+	// Line strips, consecutive ones of one length as a run, so a groom of
+	// equal fibers takes a few runs.
+	struct StripRun {
+		int num_strips, num_verts;
+	};
+	std::vector<StripRun> strip_runs_;
+	GLuint instance_buf_;
+	int num_instances_;
+
+	// Attribs of each submitted buffer.
+	struct BufLayout {
+		int first_attrib, stride;
+		std::vector<int> attrib_sizes;
+		// Where the attribs read now, for pulled draws.
+		GLuint source;
+		std::size_t source_offset;
+		bool released;
+	};
+	std::vector<BufLayout> buf_layouts_;
+
+	// Of SetAsIndirectLines, lines 0 while drawing strips. The draws
+	// write their commands to indirect_buf_, the count copied in.
+	struct IndirectLines {
+		GLuint lines;
+		std::size_t lines_offset;
+		GLuint counts;
+		std::size_t counts_offset;
+		std::size_t max_verts;
+	};
+	IndirectLines indirect_;
+	GLuint indirect_buf_;
+
+	// New buffer of num_verts vertices of stride bytes, from data unless
+	// null.
+	void CreateBuf(std::size_t num_verts, const void *data, int stride, const std::vector<int> &attrib_sizes, GLenum usage);
+	// Binds the vertex array with exactly these attribs enabled, through
+	// the state cache, so repeated draws issue no enables.
+	void Bind(const std::vector<int> &attribs, bool instanced) const;
+	// Instance attribs read InstanceTransforms from buffer at offset.
+	void PointInstanceAttribs(GLuint buffer, std::size_t offset);
+	// Attribs of submitted buffer buf read buffer from offset.
+	void PointBufAttribs(int buf, GLuint buffer, std::size_t offset);
+	// One draw of the indirect lines, as GL_LINES or as pulled quads.
+	void DrawIndirectLines(bool quads, int first_instance, int num_instances) const;
 
 	void Init();
 };
@@ -0,0 +1,133 @@
+#ifndef XY_GPU_SYNC
+#define XY_GPU_SYNC
+
+
+#include <vector>
+#include <string>
+#include <functional>
+#include "glad/glad.h"
+
+
+// GL entry points the sync objects go through. GL() forwards to the
+// driver; a stand-in can count the calls and run without a context.
+struct GpuSyncApi {
+	std::function<void(GLbitfield)> memory_barrier;
+	std::function<GLsync()> fence;
+	// True once the fence has signaled, waiting at most timeout_ns.
+	std::function<bool(GLsync, GLuint64)> client_wait;
+	std::function<void(GLsync)> delete_sync;
+	std::function<void()> finish;
+
+	static GpuSyncApi GL();
+};
+
+// How a command touches a resource. Image, storage buffer and atomic
+// counter writes are incoherent, every later access of the resource
+// needs the barrier bit of its kind first. Render target writes and
+// transfers (clears, uploads) are ordered by GL and leave the resource
+// clean.
+enum class GpuAccess {
+	StorageRead,
+	StorageWrite,
+	AtomicCounter,
+	ImageRead,
+	ImageWrite,
+	TextureFetch,
+	IndirectRead,
+	RenderTarget,
+	Transfer,
+	Readback
+};
+
+// Issues the glMemoryBarrier a command needs from the accesses it
+// declares, and only the bits not already issued since the last
+// incoherent write of each resource.
+class GpuHazardTracker {
+public:
+	struct Use {
+		int resource;
+		GpuAccess access;
+	};
+
+	GpuHazardTracker();
+	explicit GpuHazardTracker(GpuSyncApi api);
+
+	int Register(const std::string &name);
+
+	// Call before the command; returns the bits issued.
+	GLbitfield Access(std::initializer_list<Use> uses);
+	GLbitfield Access(const std::vector<Use> &uses);
+
+	// Contents of unknown origin, as after an incoherent write: the next
+	// access of any kind waits.
+	void MarkWritten(int resource);
+
+	static GLbitfield BarrierBit(GpuAccess access);
+	static bool IsIncoherentWrite(GpuAccess access);
+	static bool IsCoherentWrite(GpuAccess access);
+
+	const std::string &Name(int resource) const { return resources_[resource].name; }
+	std::size_t NumBarriers() const { return num_barriers_; }
+	std::size_t NumAccesses() const { return num_accesses_; }
+
+private:
+	struct Resource {
+		std::string name;
+		bool written;
+		// Barrier bits issued since the last incoherent write.
+		GLbitfield visible;
+	};
+
+	GpuSyncApi api_;
+	std::vector<Resource> resources_;
+	std::size_t num_barriers_, num_accesses_;
+};
+
+// Keeps at most frames_in_flight frames queued on the GPU. BeginFrame
+// waits on the fence of the frame that used the slot before, EndFrame
+// fences the frame; the CPU only blocks when the GPU falls that far
+// behind. Finish is the counted full flush.
+class FramePacer {
+public:
+	struct Stats {
+		std::size_t num_frames;
+		std::size_t num_full_flushes;
+		std::size_t num_fence_waits, num_blocked_waits;
+		double blocked_ms;
+		// Frame of the last full flush, -1 for none.
+		long long last_flush_frame;
+	};
+
+	explicit FramePacer(int frames_in_flight = 2);
+	FramePacer(int frames_in_flight, GpuSyncApi api);
+	FramePacer(FramePacer const&) = delete;
+	FramePacer& operator=(FramePacer const&) = delete;
+
+	// Drains the pending fences, so only between frames.
+	void SetFramesInFlight(int frames_in_flight);
+	int FramesInFlight() const { return static_cast<int>(fences_.size()); }
+
+	// Repeated calls within a frame are ignored.
+	void BeginFrame();
+	void EndFrame();
+
+	void Finish();
+
+	// No full flush for longer than the frames in flight.
+	bool SteadyState() const;
+	const Stats &GetStats() const { return stats_; }
+
+	~FramePacer();
+
+private:
+	void WaitSlot(int slot);
+
+	GpuSyncApi api_;
+	std::vector<GLsync> fences_;
+	int slot_;
+	bool in_frame_;
+	Stats stats_;
+};
+
+
+#endif // !XY_GPU_SYNC
@@ -0,0 +1,105 @@
+#ifndef XY_JOB_SYSTEM
+#define XY_JOB_SYSTEM
+
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+
+
+// Where a job may run. Main jobs only run on the main thread of the job
+// system, so they may call GL.
+enum class JobAffinity {
+	Any,
+	Main
+};
+
+// Work-stealing scheduler. Every thread owns a deque of ready jobs: it
+// pushes and pops its own at the back, an idle thread steals from the
+// front of another's, so thieves take the oldest and usually largest
+// piece of work. A job becomes ready once the jobs it depends on are done.
+//
+// The thread creating the system is its main thread and one of its
+// threads. It never blocks on submission and runs jobs only while it
+// waits, or when it calls RunMainJobs. Threads outside the system may
+// submit and wait too; their jobs go to the main thread's deque.
+//
+// With one thread there are no workers and jobs run on the waiting thread
+// in an order fixed by the program, so runs repeat exactly for debugging.
+// XY_JOB_THREADS sets the number of threads of Global().
+class JobSystem {
+public:
+	struct Task;
+	// Empty handles count as done.
+	using Job = std::shared_ptr<Task>;
+
+	struct Stats {
+		std::size_t num_jobs, num_steals, num_main_jobs;
+	};
+
+	// num_threads <= 0 picks std::thread::hardware_concurrency().
+	explicit JobSystem(int num_threads = 0);
+	JobSystem(JobSystem const&) = delete;
+	JobSystem& operator=(JobSystem const&) = delete;
+
+	// Created by the first call, which has to come from the GL thread.
+	static JobSystem &Global();
+
+	// Runs fn once every job of deps is done.
+	Job Run(std::function<void()> fn, const std::vector<Job> &deps = {}, JobAffinity affinity = JobAffinity::Any);
+	// Runs other jobs until job is done.
+	void Wait(const Job &job);
+	static bool Done(const Job &job);
+
+	// fn(first, last) on pieces of [begin,end) at most grain long, the
+	// calling thread taking part. Returns when all pieces are done.
+	void ParallelFor(int begin, int end, int grain, const std::function<void(int, int)> &fn);
+
+	// Main thread, runs the ready main jobs, e.g. once a frame.
+	void RunMainJobs();
+
+	int NumThreads() const { return num_threads_; }
+	bool IsMainThread() const { return std::this_thread::get_id() == main_thread_; }
+	Stats GetStats() const;
+
+	// Queued jobs are dropped.
+	~JobSystem();
+
+private:
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	// Deque of the calling thread, 0 outside the workers.
+	int ThreadIndex() const;
+	// Called once per finished dependency, queues the job after the last.
+	void Release(const Job &job);
+	// The caller's own deque from the back, the main jobs on the main
+	// thread, then the other deques from the front.
+	Job Take(int index);
+	void Execute(const Job &job);
+	void Work(int index);
+
+	int num_threads_;
+	std::thread::id main_thread_;
+	std::vector<std::unique_ptr<Queue>> queues_;
+	Queue main_jobs_;
+	std::vector<std::thread> workers_;
+
+	// Workers sleep while no job of theirs is queued.
+	std::mutex sleep_mutex_;
+	std::condition_variable wake_;
+	std::atomic<int> num_queued_;
+	bool quit_;
+
+	std::atomic<std::size_t> num_jobs_, num_steals_, num_main_jobs_;
+};
+
+
+#endif // !XY_JOB_SYSTEM
@@ -0,0 +1,155 @@
+#ifndef XY_OIT
+#define XY_OIT
+
+
+#include <vector>
+#include <string>
+#include "xy_calc.h"
+
+
+// CPU references of the hair transparency resolves. Every resolve returns
+// premultiplied color with transmittance in alpha, which is what the GPU
+// resolve passes blend over the scene with (GL_ONE, GL_SRC_ALPHA).
+
+struct OITFragment {
+	// Straight color, coverage in alpha.
+	xy::vec4 color;
+	// Window depth, gl_FragCoord.z.
+	float depth;
+};
+
+// Per-pixel fragment lists packed in one array, pixel i owns
+// frags[offsets[i], offsets[i+1]). Within a pixel, fragments keep the
+// order the PPLL walk visits them (newest first).
+struct OITFragmentLists {
+	int width = 0, height = 0;
+	std::vector<int> offsets;
+	std::vector<OITFragment> frags;
+	// Arena node address of every fragment, when captured from the PPLL.
+	std::vector<unsigned> addrs;
+
+	int Count(int pixel) const { return offsets[pixel + 1] - offsets[pixel]; }
+	const OITFragment *Begin(int pixel) const { return frags.data() + offsets[pixel]; }
+	int NumPixels() const { return width * height; }
+};
+
+// CPU model of TiledPPLLForHair in src/shader.h, run on captured PPLL
+// lists. Contention counts atomic operations per counter address,
+// locality counts the cache lines the resolve of a tile touches.
+struct TiledOITStats {
+	int tile_size;
+	int num_tiles, num_active_tiles;
+	std::size_t num_frags, num_dropped;
+
+	// Every fragment hits the one PPLL counter, the tiled mode spreads
+	// them over the tile counters.
+	std::size_t ppll_counter_ops;
+	std::size_t max_tile_ops;
+	double mean_tile_ops;
+
+	// Distinct cache lines per active tile, and the arena span a tile's
+	// nodes lie in.
+	double ppll_lines_per_tile, tiled_lines_per_tile;
+	double ppll_span_bytes_per_tile, tiled_span_bytes_per_tile;
+};
+
+// CPU model of the PPLL resolve dispatches in src/shader.h, run on
+// captured lists. The lanes of a SIMD group step as long as the longest
+// list among them; utilization is list work over lane steps.
+struct DispatchCost {
+	int num_groups;
+	double lane_steps;
+	double utilization;
+};
+
+struct PPLLDispatchStats {
+	int num_pixels, num_active;
+	// Fragment blend over square screen blocks, compact list in pixel
+	// order, compact list sorted by length bucket as the GPU lays it out.
+	DispatchCost fullscreen, compact_unsorted, compact_sorted;
+	std::vector<int> bucket_counts;
+};
+
+struct ImageError {
+	double rmse;
+	float max_abs;
+	int num_diff_pixels;
+};
+
+namespace xy
+{
+
+
+inline vec4 BlendOver(vec4 dst, const vec4 &src)
+{
+	dst.r = (1.f - src.a)*dst.r + src.a*src.r;
+	dst.g = (1.f - src.a)*dst.g + src.a*src.g;
+	dst.b = (1.f - src.a)*dst.b + src.a*src.b;
+	dst.a = dst.a*Clamp(1.f - src.a, 0.f, 1.f);
+	return dst;
+}
+
+// Exact, every fragment blended back to front.
+vec4 ResolveSorted(const OITFragment *frags, int count);
+
+// Mirrors the K-buffer resolve shader/ppll_blend.frag had before the
+// sorted one: overflow replaces the first deeper entry, blending selects
+// the deepest entry K times.
+vec4 ResolvePPLLKBuffer(const OITFragment *frags, int count, int kbuf_size, std::size_t *num_comparisons = nullptr);
+
+// Mirrors shader/ppll_blend.frag and the per-pixel resolve of
+// shader/tiled_resolve.comp: the nearest kbuf_size fragments kept sorted
+// by insertion, the farther ones merged into a tail in list order. Depth
+// comparisons are added to num_comparisons.
+vec4 ResolveSortedKBuffer(const OITFragment *frags, int count, int kbuf_size, std::size_t *num_comparisons = nullptr);
+
+// Mirrors shader/wboit_store.frag and shader/wboit_composite.frag.
+// proj_z holds (P[2][2],P[3][2]) of the camera projection.
+float WeightedOITWeight(float window_depth, float alpha, vec2 proj_z);
+vec4 ResolveWeighted(const OITFragment *frags, int count, vec2 proj_z);
+
+// Mirror shader/mboit.glsl. Moments are taken over depth warped by
+// depth_range (view depths mapped to [0,1]) and normalized by the total
+// optical depth. overestimation blends between the lower and upper bound
+// of the optical depth in front.
+float MomentFractionInFront(vec4 b, float depth, float moment_bias, float overestimation);
+vec4 ResolveMoments(const OITFragment *frags, int count, vec2 proj_z, vec2 depth_range, float moment_bias, float overestimation);
+
+template<typename FN>
+std::vector<vec4> ResolveImage(const OITFragmentLists &lists, FN resolve)
+{
+	std::vector<vec4> image(lists.NumPixels(), vec4(0.f, 0.f, 0.f, 1.f));
+	for (int i = 0; i < lists.NumPixels(); ++i)
+		if (lists.Count(i) > 0)
+			image[i] = resolve(lists.Begin(i), lists.Count(i));
+	return image;
+}
+
+// Tile pools are laid out in tile order as the scan places them,
+// fragments of a tile in list order. Node sizes are those of the GPU
+// layouts.
+TiledOITStats AnalyzeTiledOIT(
+	const OITFragmentLists &lists,
+	int tile_size,
+	std::size_t tile_budget,
+	int ppll_node_bytes = 16,
+	int tiled_node_bytes = 12,
+	int cache_line_bytes = 128);
+
+// Bucket of a non-empty list, as shader/ppll_histogram.comp bins it.
+inline int PPLLLengthBucket(int count, int num_buckets) { return Min(count, num_buckets) - 1; }
+
+PPLLDispatchStats AnalyzePPLLDispatch(const OITFragmentLists &lists, int simd_width = 64, int num_buckets = 256);
+
+// Recorded lists, so resolves can be benchmarked without a GL context.
+void SaveOITFragmentLists(const OITFragmentLists &lists, const std::string &path);
+void LoadOITFragmentLists(OITFragmentLists &lists, const std::string &path);
+
+// Differences above threshold count as differing pixels.
+ImageError CompareImages(const std::vector<vec4> &a, const std::vector<vec4> &b, float threshold = 1.f / 255.f);
+
+
+}
+
+
+#endif // !XY_OIT
@@ -0,0 +1,121 @@
+#ifndef XY_PROFILER
+#define XY_PROFILER
+
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <functional>
+#include "glad/glad.h"
+
+
+// GL entry points of the GPU timers. GL() forwards to the driver; an
+// empty api records CPU zones only, a stand-in can fake the clock.
+struct GpuTimerApi {
+	std::function<void(GLuint*)> gen_query;
+	std::function<void(GLuint)> delete_query;
+	// glQueryCounter(query, GL_TIMESTAMP).
+	std::function<void(GLuint)> timestamp;
+	std::function<bool(GLuint)> available;
+	// Nanoseconds on the GPU clock.
+	std::function<GLuint64(GLuint)> result;
+	std::function<GLuint64()> gpu_now;
+
+	static GpuTimerApi GL();
+};
+
+struct ProfileZone {
+	std::string name;
+	// Nesting level within its timeline.
+	int depth;
+	// Milliseconds since the profiler started, GPU zones mapped onto the
+	// CPU clock.
+	double begin_ms, end_ms;
+};
+
+struct ProfileFrame {
+	long long index;
+	double begin_ms, end_ms;
+	std::vector<ProfileZone> cpu, gpu;
+};
+
+struct ProfileSummary {
+	std::string name;
+	bool gpu;
+	double mean_ms, max_ms;
+};
+
+// Frame profiler. GPU zones are bracketed by timestamp queries, kept in a
+// ring of ring_frames frames and read back only once available, so the
+// CPU never waits on them; a frame whose results are not in when its slot
+// comes round again is dropped.
+class Profiler {
+public:
+	explicit Profiler(int ring_frames = 4, std::size_t history_frames = 240);
+	Profiler(int ring_frames, std::size_t history_frames, GpuTimerApi api);
+	Profiler(Profiler const&) = delete;
+	Profiler& operator=(Profiler const&) = delete;
+
+	// Repeated calls within a frame are ignored.
+	void BeginFrame();
+	void EndFrame();
+
+	void BeginCpuZone(const char *name);
+	void EndCpuZone();
+	void BeginGpuZone(const char *name);
+	void EndGpuZone();
+
+	// Frames with every result in, oldest first.
+	const std::deque<ProfileFrame> &History() const { return history_; }
+	std::vector<ProfileSummary> Summarize() const;
+	std::size_t NumDroppedFrames() const { return num_dropped_; }
+	bool GpuEnabled() const { return static_cast<bool>(api_.gen_query); }
+
+	// Chrome trace event format, CPU zones on thread 0, GPU on thread 1.
+	void WriteChromeTrace(const std::string &path) const;
+
+	~Profiler();
+
+private:
+	struct Slot {
+		ProfileFrame frame;
+		// Begin and end query of gpu zone i at 2i and 2i+1.
+		std::vector<GLuint> queries;
+		bool pending;
+	};
+
+	double NowMs() const;
+	void Poll();
+
+	GpuTimerApi api_;
+	std::chrono::steady_clock::time_point start_;
+	std::vector<Slot> slots_;
+	int slot_;
+	bool in_frame_;
+	long long num_frames_;
+	std::size_t history_frames_, num_dropped_;
+	std::deque<ProfileFrame> history_;
+	// Open zones, indices into the current frame.
+	std::vector<int> cpu_stack_, gpu_stack_;
+	// GPU clock at cpu_base_ms_, taken at the first frame.
+	bool calibrated_;
+	GLuint64 gpu_base_ns_;
+	double cpu_base_ms_;
+};
+
+// CPU zone for the scope, bracketed by a GPU zone when gpu is set.
+class ProfileScope {
+public:
+	ProfileScope(Profiler &profiler, const char *name, bool gpu = false);
+	ProfileScope(ProfileScope const&) = delete;
+	ProfileScope& operator=(ProfileScope const&) = delete;
+	~ProfileScope();
+
+private:
+	Profiler &profiler_;
+	bool gpu_;
+};
+
+
+#endif // !XY_PROFILER
@@ -0,0 +1,106 @@
+#ifndef XY_READBACK_RING
+#define XY_READBACK_RING
+
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include "glad/glad.h"
+
+
+// One readback, valid only during its callback. Pixels point into the
+// mapped pack buffer; rows are stored bottom up as GL returns them.
+struct ReadbackView {
+	const unsigned char *data;
+	int width, height;
+	std::size_t row_bytes;
+	long long index;
+	// From Read to delivery.
+	double latency_ms;
+
+	// Row 0 is the top row.
+	const unsigned char *Row(int y) const { return data + (height - 1 - y)*row_bytes; }
+};
+
+struct ReadbackStats {
+	std::size_t num_issued, num_delivered;
+	// Reads that had to wait for a slot.
+	std::size_t num_stalls;
+	double mean_latency_ms, max_latency_ms;
+	// Since the first read.
+	double frames_per_sec, mb_per_sec;
+};
+
+// Asynchronous framebuffer readback. Every read goes into the next of
+// depth persistently mapped pack buffers and is fenced; Poll hands the
+// signaled ones to a worker thread, which runs the callbacks in read
+// order on the mapped memory itself. A slot is reused once its callback
+// returns, the GL thread only waits when all depth slots are taken.
+class ReadbackRing {
+public:
+	using Callback = std::function<void(const ReadbackView&)>;
+
+	ReadbackRing();
+	ReadbackRing(ReadbackRing const&) = delete;
+	ReadbackRing& operator=(ReadbackRing const&) = delete;
+
+	void Init(int width, int height, int depth = 3,
+		GLenum format = GL_RGBA, GLenum type = GL_UNSIGNED_BYTE, int pixel_bytes = 4);
+	bool Initialized() const { return !slots_.empty(); }
+
+	// Color attachment 0 of framebuffer, which must be single-sample.
+	void Read(GLuint framebuffer, Callback callback);
+	// GL thread, never waits.
+	void Poll();
+	// Waits until every callback has returned.
+	void Finish();
+
+	ReadbackStats Stats();
+	std::size_t SlotBytes() const { return static_cast<std::size_t>(height_)*row_bytes_; }
+
+	~ReadbackRing();
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	enum class SlotState { Free, InFlight, Delivering };
+
+	struct Slot {
+		GLuint pbo;
+		const unsigned char *mapped;
+		GLsync fence;
+		SlotState state;
+		Callback callback;
+		long long index;
+		Clock::time_point issue_time;
+	};
+
+	// Hands a signaled slot to the worker, waiting on the fence if asked.
+	bool Deliver(int slot, bool wait);
+	void Work();
+
+	int width_, height_;
+	GLenum format_, type_;
+	std::size_t row_bytes_;
+	std::vector<Slot> slots_;
+	int next_;
+	long long num_issued_;
+
+	std::thread worker_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::deque<int> queue_;
+	bool quit_;
+
+	std::size_t num_delivered_, num_stalls_;
+	double sum_latency_ms_, max_latency_ms_;
+	Clock::time_point first_issue_time_, last_delivery_time_;
+};
+
+
+#endif // !XY_READBACK_RING
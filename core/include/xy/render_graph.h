@@ -0,0 +1,139 @@
+#ifndef XY_RENDER_GRAPH
+#define XY_RENDER_GRAPH
+
+
+#include <vector>
+#include <map>
+#include <string>
+#include <functional>
+#include "glad/glad.h"
+#include "gpu_sync.h"
+
+
+// Part of a buffer handed to a pass, for glBindBufferRange.
+struct BufferRange {
+	GLuint buffer;
+	GLintptr offset;
+	GLsizeiptr size;
+};
+
+// Passes of a frame declared with the resources they touch. Compile culls
+// the passes nothing reads from, orders the rest by their dependencies and
+// places the transient resources in one heap, where resources with
+// disjoint lifetimes share memory. Execute issues the barriers each pass
+// needs through the hazard tracker.
+//
+// A pass depends on the passes declared before it that wrote what it
+// reads, or that read or wrote what it writes. Every write is taken as a
+// partial update, so a pass drawing over a target keeps the passes that
+// wrote it before.
+//
+// The graph itself never touches GL: the caller creates the heap buffer
+// from HeapBytes and binds the ranges at Offset.
+class RenderGraph {
+public:
+	struct Use {
+		int resource;
+		GpuAccess access;
+	};
+
+	struct Stats {
+		int num_passes, num_culled;
+		// Barriers issued by the last Execute.
+		std::size_t num_barriers;
+		// Imported bytes, transient bytes of the live passes one after
+		// another, and the heap holding them aliased.
+		std::size_t imported_bytes, transient_bytes, heap_bytes;
+
+		std::size_t PeakBytesUnaliased() const { return imported_bytes + transient_bytes; }
+		std::size_t PeakBytes() const { return imported_bytes + heap_bytes; }
+	};
+
+	// Transients start at multiples of this, above the storage buffer
+	// offset alignment of the drivers we run on.
+	static constexpr std::size_t heap_alignment = 256;
+
+	explicit RenderGraph(GpuHazardTracker &hazards);
+	RenderGraph(RenderGraph const&) = delete;
+	RenderGraph& operator=(RenderGraph const&) = delete;
+
+	// Resource owned by the caller that outlives the frame. Hazards are
+	// tracked across frames by name. Passes writing an output are never
+	// culled.
+	int Import(const std::string &name, std::size_t bytes, bool output = false);
+	// Resource only alive between its first and last pass of the frame.
+	int CreateTransient(const std::string &name, std::size_t bytes);
+
+	void AddPass(const std::string &name, std::vector<Use> uses, std::function<void()> run);
+
+	void Compile();
+	void Execute(
+		const std::function<void(const std::string&)> &begin_pass,
+		const std::function<void()> &end_pass);
+
+	// Passes and resources are dropped, hazard state is kept.
+	void Reset();
+
+	// Transient placement after Compile. Transients of culled passes have
+	// no place and Offset dies on them.
+	std::size_t Offset(int resource) const;
+	std::size_t Bytes(int resource) const { return resources_[resource].bytes; }
+	std::size_t HeapBytes() const { return heap_bytes_; }
+
+	// Live passes in execution order, as indices in declaration order.
+	const std::vector<int> &Order() const { return order_; }
+	const std::string &PassName(int pass) const { return passes_[pass].name; }
+	bool Culled(int pass) const { return !passes_[pass].live; }
+	// Transients sharing a slot share memory.
+	int Slot(int resource) const { return resources_[resource].slot; }
+
+	const Stats &GetStats() const { return stats_; }
+
+private:
+	struct Resource {
+		std::string name;
+		std::size_t bytes;
+		bool transient, output;
+		// Hazard id of an import, heap slot of a transient, -1 unplaced.
+		int hazard, slot;
+		// Positions in Order of the first and last live pass using it.
+		int first, last;
+	};
+
+	struct Pass {
+		std::string name;
+		std::vector<Use> uses;
+		std::function<void()> run;
+		bool live;
+		// Passes that have to run before it.
+		std::vector<int> deps;
+	};
+
+	struct HeapSlot {
+		std::size_t bytes, offset;
+		// First and last position of each transient placed in it.
+		std::vector<std::pair<int, int>> tenants;
+	};
+
+	void Cull();
+	void Sort();
+	void Place();
+
+	GpuHazardTracker &hazards_;
+	std::vector<Resource> resources_;
+	std::vector<Pass> passes_;
+	std::vector<int> order_;
+	std::vector<HeapSlot> slots_;
+	std::size_t heap_bytes_;
+	bool compiled_;
+	Stats stats_;
+
+	// Hazard ids survive Reset: imports by name, heap slots by index.
+	std::map<std::string, int> import_hazards_;
+	std::vector<int> slot_hazards_;
+	// Offset and bytes of each slot as last placed.
+	std::vector<std::pair<std::size_t, std::size_t>> last_layout_;
+};
+
+
+#endif // !XY_RENDER_GRAPH
@@ -51,6 +51,14 @@ public:
 	}
 
 	GLuint Get() { return handle_; }
+	bool Initialized() const { return handle_ != 0; }
+
+	// Frees the texture, Init may be called again.
+	void Release()
+	{
+		glDeleteTextures(1, &handle_);
+		handle_ = 0;
+	}
 
 	~TextureLayer()
 	{
@@ -58,8 +66,8 @@ public:
 	}
 
 private:
-	int width_, height_;
-	GLuint handle_;
+	int width_ = 0, height_ = 0;
+	GLuint handle_ = 0;
 
 };
 
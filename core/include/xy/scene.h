@@ -0,0 +1,99 @@
+#ifndef XY_SCENE
+#define XY_SCENE
+
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <functional>
+
+#include "xy_calc.h"
+#include "asset.h"
+#include "aabb.h"
+#include "stream_buffer.h"
+
+
+// Per-instance hair look, scales the global hair settings.
+struct HairMaterial {
+	std::string name;
+	float radius_scale;
+	float transparency_scale;
+};
+
+// One row of the instance table. Rows are sorted by asset then material,
+// so consecutive rows share vertex arrays, textures and hair uniforms.
+struct SceneInstance {
+	xy::mat4 model_matrix;
+	int asset;
+	int material;
+};
+
+// A run of instances sharing asset and material, one instanced draw per
+// pass. first_instance indexes the asset's own instance buffer.
+struct SceneBatch {
+	int asset;
+	int material;
+	int first_instance;
+	int num_instances;
+};
+
+// Scene description, one statement per line, '#' starts a comment:
+//
+//   mesh <name> <obj path> <mtl dir>
+//   fibers <name> <ind path> <base color map> <spec offset map> [stream]
+//   hair_material <name> <radius scale> <transparency scale>
+//   sun <direction xyz>
+//   camera <eye xyz> <target xyz>
+//   instance <asset> [material <name>] [translate <xyz>]
+//            [rotate <axis xyz> <degrees>] [scale <s>]
+//
+// Instances are placed translate * rotate * scale. Asset paths are passed
+// through resolve, e.g. to prepend the asset root. Fibers marked stream
+// go straight to the GPU in CreateGpuRes, a chunk of host memory at a
+// time, and keep no host copy to simulate or fit curves to.
+struct Scene {
+	// Deques, assets hold GL objects and do not move.
+	std::deque<ObjAsset> meshes;
+	std::deque<FiberAsset> fibers;
+	std::vector<std::string> mesh_names, fiber_names;
+	// Resolved ind path of each groom marked stream, empty for the rest.
+	std::vector<std::string> fiber_stream_paths;
+	// Model space bounds of every mesh, fibers carry their own.
+	std::vector<AABB> mesh_bounds;
+
+	// Entry 0 is the default, scales of 1.
+	std::vector<HairMaterial> hair_materials;
+
+	std::vector<SceneInstance> mesh_instances;
+	std::vector<SceneInstance> fiber_instances;
+	std::vector<SceneBatch> mesh_batches;
+	std::vector<SceneBatch> fiber_batches;
+
+	xy::vec3 sun_light_dir;
+	bool has_camera;
+	xy::vec3 camera_eye, camera_target;
+
+	// World bounds of every instance.
+	AABB bounds;
+	// Parsing and asset loading, without GPU resources.
+	long long load_ms;
+
+	Scene();
+
+	void LoadFromFile(const std::string &path, std::function<std::string(const std::string&)> resolve);
+	// Sorts the instance tables, groups them into batches and bounds them.
+	// LoadFromFile builds; call again after editing the instance tables.
+	void Build();
+	// Asset buffers plus the instance buffers.
+	void CreateGpuRes();
+	// Model matrices of each asset's instances, after Build.
+	void UploadInstances();
+	// Same through this frame's part of stream, Draw::Render does it
+	// every frame. Every shape of an asset reads one allocation.
+	void StreamInstances(StreamBuffer &stream);
+
+	std::size_t NumInstances() const { return mesh_instances.size() + fiber_instances.size(); }
+};
+
+
+#endif // !XY_SCENE
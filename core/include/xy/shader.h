@@ -3,10 +3,18 @@
 
 
 #include <string>
+#include <vector>
+#include <map>
+#include <memory>
 #include "glad/glad.h"
 #include "xy_calc.h"
+#include "shader_library.h"
 
 
+// Compiles one stage. On failure returns false with the info log.
+bool CompileShader(GLenum type, const std::string &code, GLuint &shader, std::string &log);
+// Links the attached stages. On failure returns false with the info log.
+bool LinkProgram(GLuint program, std::string &log);
 
 class Shader {
 public:
@@ -14,6 +22,9 @@ public:
 	void Init(std::string comp_shader);
 	void Init(std::string vert_shader, std::string frag_shader);
 	void Init(std::string vert_shader, std::string geom_shader, std::string frag_shader);
+	// From files, through ShaderLibrary::Global, so the program is cached
+	// and reloaded when its files change.
+	void Init(const std::vector<ShaderStage> &stages);
 	~Shader();
 	GLuint Get();
 
@@ -48,9 +59,24 @@ public:
 	}
 
 private:
+	friend class ShaderLibrary;
+
 	GLuint handle_;
 };
 
+// Permutations of one program, keyed by their defines. A permutation is
+// built on first use and kept, so switching back to it is free.
+class ShaderVariants {
+public:
+	// defines given to Get are added to every stage's own.
+	void Init(const std::vector<ShaderStage> &stages);
+	Shader &Get(const ShaderDefines &defines);
+	std::size_t NumBuilt() const { return variants_.size(); }
+
+private:
+	std::vector<ShaderStage> stages_;
+	std::map<ShaderDefines, std::unique_ptr<Shader>> variants_;
+};
 
 
 #endif // !XY_SHADER
@@ -0,0 +1,112 @@
+#ifndef XY_SHADER_LIBRARY
+#define XY_SHADER_LIBRARY
+
+
+#include <vector>
+#include <string>
+#include <map>
+#include <set>
+#include <chrono>
+#include "glad/glad.h"
+
+
+class Shader;
+
+// Emitted as #define NAME VALUE, in key order so equal sets give equal
+// sources and share a cached binary.
+using ShaderDefines = std::map<std::string, std::string>;
+
+// Source of one stage. The file may #include "name", resolved relative to
+// the including file and pasted once per stage. defines go right after
+// the #version line, one permutation per set.
+struct ShaderStage {
+	GLenum type;
+	std::string path;
+	ShaderDefines defines;
+};
+
+struct ShaderLibraryStats {
+	std::size_t num_programs;
+	// Programs created from a cached binary and from source.
+	std::size_t num_cache_hits, num_compiled;
+	// Cached binaries the driver refused, then compiled from source.
+	std::size_t num_stale_binaries;
+	std::size_t num_reloads, num_failed_reloads;
+	// Spent in Build, cache lookups included.
+	double build_ms;
+};
+
+// Builds every Shader initialized from files and keeps what it needs to
+// rebuild them. Linked programs are cached as glGetProgramBinary blobs,
+// keyed by a hash of the driver string and the stage sources, so a warm
+// start skips compiling. Watch and Poll recompile programs whose files,
+// included ones too, changed in place; a program that fails to compile
+// keeps the old one.
+class ShaderLibrary {
+public:
+	static ShaderLibrary &Global();
+
+	ShaderLibrary(ShaderLibrary const&) = delete;
+	ShaderLibrary& operator=(ShaderLibrary const&) = delete;
+
+	// Empty disables the binary cache.
+	void SetCacheDir(const std::string &dir);
+	const std::string &CacheDir() const { return cache_dir_; }
+
+	// Dies on compile errors.
+	void Build(Shader &shader, const std::vector<ShaderStage> &stages);
+	void Forget(Shader &shader);
+
+	// Starts watching the directories of every built program.
+	void Watch();
+	// Rebuilds programs whose files changed since the last poll, never
+	// waits. Returns the number of programs rebuilt.
+	int Poll();
+
+	const ShaderLibraryStats &Stats() const { return stats_; }
+
+	~ShaderLibrary();
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	ShaderLibrary();
+
+	struct Program {
+		std::vector<ShaderStage> stages;
+		// Every file read, includes too.
+		std::set<std::string> files;
+	};
+
+	// Stage source as handed to the compiler. The #line source string
+	// numbers index files.
+	struct StageSource {
+		std::string text;
+		std::vector<std::string> files;
+	};
+
+	static bool ReadSources(const std::vector<ShaderStage> &stages, std::vector<StageSource> &sources, std::string &log);
+	std::string CacheKey(const std::vector<ShaderStage> &stages, const std::vector<StageSource> &sources);
+	GLuint LoadBinary(const std::string &key);
+	void StoreBinary(const std::string &key, GLuint program);
+	// 0 with the log on failure.
+	GLuint Compile(const std::vector<ShaderStage> &stages, const std::vector<StageSource> &sources, std::string &log);
+	void WatchFiles(const Program &program);
+	void WatchPath(const std::string &path);
+	std::set<std::string> ChangedPaths();
+
+	std::string cache_dir_, driver_;
+	std::map<Shader*, Program> programs_;
+	ShaderLibraryStats stats_;
+
+	bool watching_;
+	int inotify_fd_;
+	// Directory of each inotify watch.
+	std::map<int, std::string> watch_dirs_;
+	// Without inotify, modification times of the watched files.
+	std::map<std::string, long long> mtimes_;
+	Clock::time_point last_scan_;
+};
+
+
+#endif // !XY_SHADER_LIBRARY
@@ -0,0 +1,104 @@
+#ifndef XY_STRAND_CURVES
+#define XY_STRAND_CURVES
+
+
+#include <vector>
+#include <cstdint>
+#include "xy_calc.h"
+#include "job_system.h"
+
+
+struct FiberAsset;
+
+// Fibers as uniform Catmull-Rom splines through a subset of their
+// vertices, the CPU side of HairCurves in src/shader.h and the reference
+// of shader/strand_resample.comp. The fitter starts from the root and the
+// tip and adds the vertex farthest from the curve until every vertex left
+// out is within the tolerance. The curve passes through the vertices kept,
+// so roots and tips stay where they were.
+//
+// Resampling cuts every segment into as many pieces as its length on
+// screen asks for, at most max_subdivisions, and packs the curves one
+// after the other. A frame takes at most MaxResampledVerts, half the
+// dense vertices, so curves never take more memory than the fibers they
+// stand for; views that ask for more get the pieces capped at half as
+// many, down to one, the controls alone. HairCurves leaves the assets
+// whose controls alone do not fit dense.
+class StrandCurves {
+public:
+	static constexpr int max_subdivisions = 8;
+	// Caps of strand_count.comp, max_subdivisions halved down to one.
+	static constexpr int num_caps = 4;
+	static_assert(max_subdivisions >> (num_caps - 1) == 1, "the last cap is one piece");
+
+	// std430 layout of strand_resample.comp. Every curve has two
+	// controls at least, fibers of fewer vertices draw nothing.
+	struct Curve {
+		std::uint32_t first_control, num_controls;
+	};
+
+	struct Stats {
+		int num_curves;
+		std::size_t num_dense_verts, num_controls;
+		// Farthest a dense vertex is from its curve.
+		float max_error;
+		// Dense vertex buffers of FiberAsset, control points with the
+		// curve table, and the most the resampled vertices and their
+		// segments take in a frame.
+		std::size_t dense_bytes, curve_bytes, resampled_bytes;
+		double fit_ms;
+	};
+
+	StrandCurves();
+
+	// Model space, fibers are fitted as jobs on jobs.
+	void Fit(const FiberAsset &asset, float tolerance, JobSystem &jobs = JobSystem::Global());
+	void Fit(
+		const std::vector<xy::vec3> &positions,
+		const std::vector<float> &scales,
+		const std::vector<int> &num_verts_per_fiber,
+		float tolerance,
+		JobSystem &jobs = JobSystem::Global());
+
+	// Segment from p1 to p2 at t in [0,1], p0 and p3 the controls around.
+	static xy::vec3 Evaluate(const xy::vec3 &p0, const xy::vec3 &p1, const xy::vec3 &p2, const xy::vec3 &p3, float t);
+	static xy::vec3 Derivative(const xy::vec3 &p0, const xy::vec3 &p1, const xy::vec3 &p2, const xy::vec3 &p3, float t);
+	// Pieces of the segment from a to b, which spans the pixels between
+	// their projections by model_view_proj onto a window of win_size.
+	// All of them once either end is behind the eye.
+	static int Subdivisions(
+		const xy::mat4 &model_view_proj, const xy::vec2 &win_size, float pixels_per_piece,
+		const xy::vec3 &a, const xy::vec3 &b);
+
+	// The vertices strand_resample.comp writes, in the layout of the dense
+	// vertex buffers: model space positions, unit tangents, scales. lines
+	// takes the vertex pair of every segment. Returns the most pieces a
+	// segment got, below max_subdivisions when the view asked for more
+	// than MaxResampledVerts.
+	int Resample(
+		const xy::mat4 &model_view_proj, const xy::vec2 &win_size, float pixels_per_piece,
+		std::vector<xy::vec3> &positions,
+		std::vector<xy::vec3> &tangents,
+		std::vector<float> &scales,
+		std::vector<std::uint32_t> &lines) const;
+
+	// Position in xyz, scale of the fiber vertex in w.
+	const std::vector<xy::vec4> &Controls() const { return controls_; }
+	const std::vector<Curve> &Curves() const { return curves_; }
+	std::size_t MaxResampledVerts() const { return max_resampled_verts_; }
+	// Bytes of a frame's vertices and segments, for MaxResampledVerts.
+	static std::size_t ResampledBytes(std::size_t max_resampled_verts);
+	const Stats &GetStats() const { return stats_; }
+
+private:
+	// Control i of curve, -1 and num_controls are mirrored past the ends.
+	xy::vec3 Control(const Curve &curve, int i) const;
+
+	std::vector<xy::vec4> controls_;
+	std::vector<Curve> curves_;
+	std::size_t max_resampled_verts_;
+	Stats stats_;
+};
+
+
+#endif // !XY_STRAND_CURVES
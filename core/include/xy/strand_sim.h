@@ -0,0 +1,107 @@
+#ifndef XY_STRAND_SIM
+#define XY_STRAND_SIM
+
+
+#include <vector>
+#include "xy_calc.h"
+#include "stream_buffer.h"
+#include "job_system.h"
+
+
+struct FiberAsset;
+class GpuArray;
+
+// Position based dynamics on the fibers of an asset. Every fiber is a
+// chain of particles kept at their rest distances, pulled back towards
+// its rest shape by a constraint between every other particle, and pinned
+// by its root segment to the model matrix. Gravity pulls in world space.
+//
+// Fibers are solved four at a time, one per SSE lane. Particles are stored
+// SoA in blocks of four consecutive fibers, row by row from the roots, and
+// the rows past the end of a shorter fiber are padding nothing moves.
+class StrandSim {
+public:
+	struct Params {
+		xy::vec3 gravity;
+		// Fraction of the velocity kept per step.
+		float damping;
+		// Constraint sweeps per step.
+		int num_iterations;
+		// Fraction of a violation removed per sweep, in [0,1].
+		float stretch_stiffness, bend_stiffness;
+	};
+
+	struct Stats {
+		int num_strands, num_blocks;
+		// Particles, and the padding solved along with them.
+		std::size_t num_particles, num_padding;
+		// Threads of the job system of the last Step.
+		int num_threads;
+		double step_ms;
+	};
+
+	static constexpr int lanes = 4;
+
+	static Params DefaultParams();
+
+	StrandSim();
+
+	// Rest pose in model space.
+	void Init(const FiberAsset &asset, const Params &params);
+	void Init(
+		const std::vector<xy::vec3> &positions,
+		const std::vector<int> &num_verts_per_fiber,
+		const Params &params);
+
+	// Pins the roots to model_matrix and advances by dt seconds. The first
+	// Step after Init or Reset places the rest pose there, at rest. Blocks
+	// are solved as jobs on jobs.
+	void Step(float dt, const xy::mat4 &model_matrix, JobSystem &jobs = JobSystem::Global());
+	void Reset();
+
+	// Pose after the last Step in the model space of its model matrix, in
+	// the asset's vertex order. Tangents as FiberAsset computes them.
+	const std::vector<xy::vec3> &Positions() const { return positions_; }
+	const std::vector<xy::vec3> &Tangents() const { return tangents_; }
+
+	// Writes the pose to this frame's part of stream and points the
+	// position and tangent buffers of vao at it.
+	void Stream(StreamBuffer &stream, GpuArray &vao) const;
+
+	Params &GetParams() { return params_; }
+	const Stats &GetStats() const { return stats_; }
+
+private:
+	struct Block {
+		// First row, rows are lanes floats apart in every SoA array.
+		std::size_t first_row;
+		int num_rows;
+		int first_strand, num_strands;
+	};
+
+	// Integrates, constrains and writes out blocks [begin,end).
+	void SolveBlocks(int begin, int end, float dt, const xy::mat4 &world, const xy::mat4 &model);
+
+	Params params_;
+	std::vector<Block> blocks_;
+	std::vector<int> num_verts_, first_vert_;
+	bool at_rest_;
+
+	// SoA, lanes floats per row: current and previous world positions,
+	// rest model positions.
+	std::vector<float> x_, y_, z_;
+	std::vector<float> px_, py_, pz_;
+	std::vector<float> rx_, ry_, rz_;
+	// 1 for particles that move, 0 for pinned ones and padding.
+	std::vector<float> inv_mass_;
+	// Rest distance to the particle one row and two rows up, and the share
+	// of a correction each end of the constraint takes.
+	std::vector<float> stretch_rest_, bend_rest_;
+	std::vector<float> stretch_w0_, stretch_w1_, bend_w0_, bend_w1_;
+
+	std::vector<xy::vec3> positions_, tangents_;
+	Stats stats_;
+};
+
+
+#endif // !XY_STRAND_SIM
@@ -0,0 +1,123 @@
+#ifndef XY_STREAM_BUFFER
+#define XY_STREAM_BUFFER
+
+
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include "glad/glad.h"
+#include "gpu_sync.h"
+
+
+// Storage of a stream buffer. GL() creates a persistently mapped,
+// coherent buffer; Host() plain host memory with buffer name 0, so the
+// allocator runs without a context.
+struct StreamBufferApi {
+	// Returns the mapping, sets the buffer name.
+	std::function<void*(std::size_t, GLuint&)> create;
+	std::function<void(GLuint, void*)> destroy;
+	// Value of GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT or
+	// GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT.
+	std::function<std::size_t(GLenum)> offset_alignment;
+
+	static StreamBufferApi GL();
+	static StreamBufferApi Host();
+};
+
+// What an allocation is bound as, sets its alignment.
+enum class StreamUse {
+	Vertex,
+	Uniform,
+	Storage,
+	Indirect
+};
+
+// Part of the stream buffer written by the CPU this frame. Valid until
+// the frame is fenced by EndFrame; the GPU reads it from buffer at offset.
+struct StreamAlloc {
+	unsigned char *data;
+	GLuint buffer;
+	std::size_t offset, size;
+
+	template <typename T>
+	T *As() const { return reinterpret_cast<T*>(data); }
+};
+
+// Per-frame dynamic data in one mapped buffer used as a ring. Allocations
+// of a frame follow each other, EndFrame fences them as one region, and
+// an allocation that would run into a region the GPU may still read waits
+// on its fence first. Writes through the coherent mapping need no flush.
+class StreamBuffer {
+public:
+	struct Stats {
+		std::size_t num_allocs, num_frames;
+		std::size_t bytes_allocated, peak_frame_bytes;
+		// Fences waited on to make room, and those not yet signaled.
+		std::size_t num_fence_waits, num_blocked_waits;
+		double blocked_ms;
+	};
+
+	// Every alignment handed out divides this, so does the capacity.
+	static constexpr std::size_t max_alignment = 256;
+
+	StreamBuffer();
+	StreamBuffer(StreamBufferApi api, GpuSyncApi sync);
+	StreamBuffer(StreamBuffer const&) = delete;
+	StreamBuffer& operator=(StreamBuffer const&) = delete;
+
+	// A frame may use at most capacity bytes, alignment included.
+	void Init(std::size_t capacity);
+	bool Initialized() const { return mapped_ != nullptr; }
+
+	StreamAlloc Allocate(std::size_t bytes, StreamUse use);
+
+	template <typename T>
+	StreamAlloc Write(const std::vector<T> &values, StreamUse use)
+	{
+		auto alloc = Allocate(sizeof(T)*values.size(), use);
+		std::copy(values.begin(), values.end(), reinterpret_cast<T*>(alloc.data));
+		return alloc;
+	}
+
+	// Fences the allocations since the last call.
+	void EndFrame();
+
+	GLuint Buffer() const { return buffer_; }
+	std::size_t Capacity() const { return capacity_; }
+	// Fenced regions the GPU may still read.
+	std::size_t NumPendingRegions() const { return regions_.size(); }
+	const Stats &GetStats() const { return stats_; }
+
+	~StreamBuffer();
+
+private:
+	// Allocations of one frame, positions counted from the first
+	// allocation ever, so they only grow.
+	struct Region {
+		std::size_t end;
+		GLsync fence;
+	};
+
+	std::size_t Alignment(StreamUse use) const;
+	// Waits on the oldest region, which frees everything before its end.
+	void RetireOldest();
+
+	StreamBufferApi api_;
+	GpuSyncApi sync_;
+	GLuint buffer_;
+	unsigned char *mapped_;
+	std::size_t capacity_;
+	std::size_t uniform_alignment_, storage_alignment_;
+
+	// Next free position, and everything before free_ is reusable.
+	std::size_t head_, free_;
+	std::size_t frame_begin_;
+	// Position of offset 0 in the current lap.
+	std::size_t lap_;
+	std::deque<Region> regions_;
+	Stats stats_;
+};
+
+
+#endif // !XY_STREAM_BUFFER
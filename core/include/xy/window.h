@@ -13,7 +13,8 @@
 
 
 struct GLFWWindowDesc {
-	GLFWWindowDesc(int width, int height, std::string title);
+	// A hidden window only provides the context, for offscreen rendering.
+	GLFWWindowDesc(int width, int height, std::string title, bool visible = true);
 
 	int width, height;
 	std::string title;
@@ -1298,7 +1298,71 @@ inline float __ComputeDet(
 	return det;
 }
 
-inline mat4 __ComputeInverse(
+// Inverse of a matrix whose last row is 0,0,0,1. The inverse of the
+// upper 3x3 has the cross products of its columns as rows, and the
+// translation is moved back through it.
+inline mat4 __ComputeAffineInverse(const mat4 &m)
+{
+	mat4 mat;
+
+#ifndef XY_FCALC3D_PURE
+	auto cross = [](__m128 v1, __m128 v2) {
+		__m128 v1_yzx = _mm_shuffle_ps(v1, v1, _MM_SHUFFLE(3, 0, 2, 1));
+		__m128 v2_yzx = _mm_shuffle_ps(v2, v2, _MM_SHUFFLE(3, 0, 2, 1));
+		__m128 tmp = _mm_sub_ps(_mm_mul_ps(v1, v2_yzx), _mm_mul_ps(v1_yzx, v2));
+		return _mm_shuffle_ps(tmp, tmp, _MM_SHUFFLE(3, 0, 2, 1));
+	};
+
+	auto &cols = reinterpret_cast<__m128 const (&)[4]>(m.data);
+	__m128 r0 = cross(cols[1], cols[2]);
+	__m128 r1 = cross(cols[2], cols[0]);
+	__m128 r2 = cross(cols[0], cols[1]);
+	__m128 r3 = _mm_setzero_ps();
+
+	__m128 prod = _mm_mul_ps(cols[0], r0);
+	__m128 det = _mm_add_ps(
+		_mm_add_ps(
+			_mm_shuffle_ps(prod, prod, _MM_SHUFFLE(0, 0, 0, 0)),
+			_mm_shuffle_ps(prod, prod, _MM_SHUFFLE(1, 1, 1, 1))),
+		_mm_shuffle_ps(prod, prod, _MM_SHUFFLE(2, 2, 2, 2)));
+	__m128 det_inv = _mm_div_ps(_mm_set_ps1(1.f), det);
+
+	// Rows to columns, w of each is 0.
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+	// Scaled by det_inv once, after the translation is moved.
+	__m128 t = cols[3];
+	__m128 moved = _mm_add_ps(
+		_mm_add_ps(
+			_mm_mul_ps(r0, _mm_shuffle_ps(t, t, _MM_SHUFFLE(0, 0, 0, 0))),
+			_mm_mul_ps(r1, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 1, 1, 1)))),
+		_mm_mul_ps(r2, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 2, 2, 2))));
+
+	auto &m128_ref = reinterpret_cast<__m128(&)[4]>(mat.data);
+	m128_ref[0] = _mm_mul_ps(r0, det_inv);
+	m128_ref[1] = _mm_mul_ps(r1, det_inv);
+	m128_ref[2] = _mm_mul_ps(r2, det_inv);
+	m128_ref[3] = _mm_sub_ps(_mm_set_ps(1.f, 0.f, 0.f, 0.f), _mm_mul_ps(moved, det_inv));
+#else
+	vec3 c0{ m[0].x, m[0].y, m[0].z };
+	vec3 c1{ m[1].x, m[1].y, m[1].z };
+	vec3 c2{ m[2].x, m[2].y, m[2].z };
+	vec3 t{ m[3].x, m[3].y, m[3].z };
+
+	auto r0 = Cross(c1, c2), r1 = Cross(c2, c0), r2 = Cross(c0, c1);
+	float det_inv = 1.f / Dot(c0, r0);
+
+	mat[0] = vec4{ r0.x, r1.x, r2.x, 0.f } * det_inv;
+	mat[1] = vec4{ r0.y, r1.y, r2.y, 0.f } * det_inv;
+	mat[2] = vec4{ r0.z, r1.z, r2.z, 0.f } * det_inv;
+	mat[3] = vec4{ -Dot(r0, t) * det_inv, -Dot(r1, t) * det_inv, -Dot(r2, t) * det_inv, 1.f };
+#endif
+
+	return mat;
+}
+
+// By cofactors, for any invertible matrix.
+inline mat4 __ComputeGeneralInverse(
 	float a, float b, float c, float d,
 	float e, float f, float g, float h,
 	float i, float j, float k, float l,
@@ -1351,6 +1415,19 @@ inline mat4 __ComputeInverse(
 	return mat;
 }
 
+inline mat4 __ComputeInverse(
+	float a, float b, float c, float d,
+	float e, float f, float g, float h,
+	float i, float j, float k, float l,
+	float m, float n, float o, float p)
+{
+	// Model and view matrices take the affine path.
+	if (d == 0.f && h == 0.f && l == 0.f && p == 1.f)
+		return __ComputeAffineInverse(mat4{ { a,b,c,d }, { e,f,g,h }, { i,j,k,l }, { m,n,o,p } });
+
+	return __ComputeGeneralInverse(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p);
+}
+
 inline float Det(const mat4 &m)
 {
 	return __ComputeDet(
@@ -0,0 +1,102 @@
+#include "arena.h"
+
+#include <cstdint>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+#include "xy_ext.h"
+
+
+Arena::Arena(std::size_t chunk_bytes, std::pmr::memory_resource *upstream)
+	:
+	upstream_{ upstream },
+	chunk_bytes_{ xy::Max(chunk_bytes, std::size_t{ 64 }) },
+	head_{ 0 },
+	used_{ 0 },
+	stats_{ 0, 0, 0, 0, 0 }
+{}
+
+void *Arena::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+	auto fit = [&]() -> void* {
+		if (chunks_.empty())
+			return nullptr;
+		auto &chunk = chunks_.back();
+		auto base = reinterpret_cast<std::uintptr_t>(chunk.data);
+		// Alignments are powers of two.
+		auto pos = ((base + head_ + alignment - 1) & ~(alignment - 1)) - base;
+		if (pos + bytes > chunk.bytes)
+			return nullptr;
+		used_ += pos + bytes - head_;
+		head_ = pos + bytes;
+		return chunk.data + pos;
+	};
+
+	auto p = fit();
+	if (!p) {
+		// Doubling, so a growing vector costs few chunks.
+		auto last = chunks_.empty() ? chunk_bytes_ / 2 : chunks_.back().bytes;
+		AddChunk(xy::Max(2 * last, bytes + alignment));
+		p = fit();
+	}
+
+	++stats_.num_allocs;
+	stats_.peak_bytes = xy::Max(stats_.peak_bytes, used_);
+	return p;
+}
+
+void Arena::AddChunk(std::size_t bytes)
+{
+	auto data = static_cast<unsigned char*>(upstream_->allocate(bytes, alignof(std::max_align_t)));
+	chunks_.push_back({ data, bytes });
+	head_ = 0;
+	++stats_.num_chunks;
+	stats_.chunk_bytes += bytes;
+}
+
+void Arena::Reset()
+{
+	if (chunks_.size() > 1) {
+		std::size_t total = 0;
+		for (const auto &chunk : chunks_)
+			total += chunk.bytes;
+		FreeChunks();
+		AddChunk(total);
+	}
+	head_ = 0;
+	used_ = 0;
+	++stats_.num_resets;
+}
+
+void Arena::FreeChunks()
+{
+	for (const auto &chunk : chunks_)
+		upstream_->deallocate(chunk.data, chunk.bytes, alignof(std::max_align_t));
+	chunks_.clear();
+}
+
+Arena::~Arena()
+{
+	FreeChunks();
+}
+
+std::size_t PeakResidentBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize;
+	return 0;
+#else
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	// Kilobytes on Linux.
+	return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+#endif
+}
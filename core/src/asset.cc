@@ -1,14 +1,23 @@
 #include "asset.h"
 
 #include <map>
+#include <cstring>
+#include <limits>
 #include "glad/glad.h"
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
 #include "xy_ext.h"
 #include "gpu_array.h"
+#include "job_system.h"
 
 
 void ObjAsset::LoadFromFile(std::string obj_path, std::string mtl_dir)
+{
+	Arena scratch;
+	LoadFromFile(obj_path, mtl_dir, scratch);
+}
+
+void ObjAsset::LoadFromFile(std::string obj_path, std::string mtl_dir, Arena &scratch)
 {
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> raw_shapes;
@@ -35,7 +44,8 @@ void ObjAsset::LoadFromFile(std::string obj_path, std::string mtl_dir)
 		auto &raw_shape = raw_shapes[kthshape];
 		auto &shape = shapes[kthshape];
 
-		std::vector<int> mtl_ids = raw_shape.mesh.material_ids;
+		const auto &face_mtl_ids = raw_shape.mesh.material_ids;
+		std::pmr::vector<int> mtl_ids(face_mtl_ids.begin(), face_mtl_ids.end(), &scratch);
 		{
 			std::sort(mtl_ids.begin(), mtl_ids.end());
 			auto last = std::unique(mtl_ids.begin(), mtl_ids.end());
@@ -43,15 +53,16 @@ void ObjAsset::LoadFromFile(std::string obj_path, std::string mtl_dir)
 
 			auto num_blobs = mtl_ids.size();
 
-			std::vector<ObjShape::Blob>(num_blobs).swap(shape.blobs);
-			std::vector<xy::vec3>(num_blobs).swap(shape.Ka);
-			std::vector<xy::vec3>(num_blobs).swap(shape.Kd);
-			std::vector<xy::vec3>(num_blobs).swap(shape.Ks);
-			std::vector<std::string>(num_blobs, "").swap(shape.map_Ka_image_paths);
-			std::vector<std::string>(num_blobs, "").swap(shape.map_Kd_image_paths);
-			std::vector<std::string>(num_blobs, "").swap(shape.map_Ks_image_paths);
-			std::vector<std::string>(num_blobs, "").swap(shape.map_d_image_paths);
-			std::vector<std::string>(num_blobs, "").swap(shape.mtl_desc);
+			// The shape is fresh, sizing it is enough.
+			shape.blobs.resize(num_blobs);
+			shape.Ka.resize(num_blobs);
+			shape.Kd.resize(num_blobs);
+			shape.Ks.resize(num_blobs);
+			shape.map_Ka_image_paths.resize(num_blobs);
+			shape.map_Kd_image_paths.resize(num_blobs);
+			shape.map_Ks_image_paths.resize(num_blobs);
+			shape.map_d_image_paths.resize(num_blobs);
+			shape.mtl_desc.resize(num_blobs);
 
 			for (int i = 0; i < num_blobs; ++i) {
 				auto &mtl = materials[mtl_ids[i]];
@@ -70,12 +81,25 @@ void ObjAsset::LoadFromFile(std::string obj_path, std::string mtl_dir)
 				shape.mtl_desc[i] = mtl.name;
 			}
 
-			std::vector<int> blob_lookup(materials.size(), -1);
+			std::pmr::vector<int> blob_lookup(materials.size(), -1, &scratch);
 			{
 				for (int i = 0; i < mtl_ids.size(); ++i)
 					blob_lookup[mtl_ids[i]] = i;
 			}
 
+			// Blobs are sized up front and never regrow.
+			std::pmr::vector<std::size_t> blob_verts(num_blobs, 0, &scratch);
+			for (auto mtl_id : face_mtl_ids)
+				blob_verts[blob_lookup[mtl_id]] += 3;
+			for (int i = 0; i < num_blobs; ++i) {
+				if (!attrib.vertices.empty())
+					shape.blobs[i].positions.reserve(blob_verts[i]);
+				if (!attrib.normals.empty())
+					shape.blobs[i].normals.reserve(blob_verts[i]);
+				if (!attrib.texcoords.empty())
+					shape.blobs[i].texcoords.reserve(blob_verts[i]);
+			}
+
 			auto num_faces = raw_shape.mesh.num_face_vertices.size();
 			int index_offset = 0;
 
@@ -112,13 +136,21 @@ void ObjAsset::LoadFromFile(std::string obj_path, std::string mtl_dir)
 	}
 }
 
-GLuint LoadTextureFromFile(std::string tex_path)
+TextureImage DecodeTexture(const std::string &tex_path)
 {
-	int width, height, num_channels;
+	TextureImage image;
 	stbi_set_flip_vertically_on_load(true);
-	unsigned char *data = stbi_load(tex_path.c_str(), &width, &height, &num_channels, 0);
+	unsigned char *data = stbi_load(tex_path.c_str(), &image.width, &image.height, &image.num_channels, 0);
 	if (data == nullptr)
 		XY_Die(std::string("failed to load texture(") + tex_path + ")");
+	image.texels.reset(data, stbi_image_free);
+	return image;
+}
+
+GLuint UploadTexture(const TextureImage &image)
+{
+	int width = image.width, height = image.height, num_channels = image.num_channels;
+	const unsigned char *data = image.texels.get();
 
 	GLuint tex;
 	glGenTextures(1, &tex);
@@ -138,10 +170,45 @@ GLuint LoadTextureFromFile(std::string tex_path)
 		XY_Die("Unsupported texture format(#channels not 3 or 4)");
 
 	glGenerateMipmap(GL_TEXTURE_2D);
-	stbi_image_free(data);
 	return tex;
 }
 
+GLuint LoadTextureFromFile(std::string tex_path)
+{
+	return UploadTexture(DecodeTexture(tex_path));
+}
+
+// Decoded ahead if DecodeTextures ran, else decoded now.
+GLuint LoadTexture(std::map<std::string, TextureImage> &decoded, const std::string &tex_path)
+{
+	auto image = decoded.find(tex_path);
+	if (image == decoded.end())
+		return LoadTextureFromFile(tex_path);
+
+	GLuint tex = UploadTexture(image->second);
+	decoded.erase(image);
+	return tex;
+}
+
+void ObjAsset::DecodeTextures()
+{
+	std::vector<std::string> paths;
+	for (const auto &shape : shapes)
+		for (const auto *keys : { &shape.map_d_image_paths, &shape.map_Ka_image_paths, &shape.map_Kd_image_paths, &shape.map_Ks_image_paths })
+			for (const auto &key : *keys)
+				if (key != "" && decoded_textures.count(key) == 0 && std::find(paths.begin(), paths.end(), key) == paths.end())
+					paths.push_back(key);
+
+	std::vector<TextureImage> images(paths.size());
+	JobSystem::Global().ParallelFor(0, static_cast<int>(paths.size()), 1, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
+			images[i] = DecodeTexture(paths[i]);
+	});
+
+	for (std::size_t i = 0; i < paths.size(); ++i)
+		decoded_textures[paths[i]] = images[i];
+}
+
 void ObjAsset::CreateGpuRes()
 {
 	std::map<std::string, GLuint> map;
@@ -149,16 +216,16 @@ void ObjAsset::CreateGpuRes()
 	for (int i = 0; i < shapes.size(); ++i) {
 		for (auto &key : shapes[i].map_d_image_paths)
 			if (map.count(key) == 0)
-				map[key] = LoadTextureFromFile(key);
+				map[key] = LoadTexture(decoded_textures, key);
 		for (auto &key : shapes[i].map_Ka_image_paths)
 			if (map.count(key) == 0)
-				map[key] = LoadTextureFromFile(key);
+				map[key] = LoadTexture(decoded_textures, key);
 		for (auto &key : shapes[i].map_Kd_image_paths)
 			if (map.count(key) == 0)
-				map[key] = LoadTextureFromFile(key);
+				map[key] = LoadTexture(decoded_textures, key);
 		for (auto &key : shapes[i].map_Ks_image_paths)
 			if (map.count(key) == 0)
-				map[key] = LoadTextureFromFile(key);
+				map[key] = LoadTexture(decoded_textures, key);
 	}
 
 	for (int i = 0; i < shapes.size(); ++i) {
@@ -188,32 +255,69 @@ void FiberAsset::LoadFromFile(
 	std::string model_path,
 	std::string base_color_texture_path,
 	std::string specular_random_offset_texture_path)
+{
+	Arena scratch;
+	LoadFromFile(model_path, base_color_texture_path, specular_random_offset_texture_path, scratch);
+}
+
+void FiberAsset::LoadFromFile(
+	std::string model_path,
+	std::string base_color_texture_path,
+	std::string specular_random_offset_texture_path,
+	Arena &scratch)
 {
 	map_bc_path = base_color_texture_path;
 	map_sro_path = specular_random_offset_texture_path;
 
+	// Parsed through a fixed window in scratch, refilled from the file,
+	// so only the decoded data grows with the groom.
+	constexpr std::size_t window_bytes = std::size_t{ 1 } << 16;
 	std::ifstream fp(model_path, std::ios::binary);
+	if (!fp)
+		XY_Die("failed to open hair file " + model_path);
+	std::pmr::vector<char> window(window_bytes, &scratch);
+	std::size_t offset = 0, filled = 0;
+
+	auto read = [&](void *dst, std::size_t n) {
+		auto out = static_cast<char*>(dst);
+		while (n > 0) {
+			if (offset == filled) {
+				fp.read(window.data(), window.size());
+				offset = 0;
+				filled = static_cast<std::size_t>(fp.gcount());
+				if (filled == 0)
+					XY_Die("hair file truncated");
+			}
+			auto count = xy::Min(n, filled - offset);
+			std::memcpy(out, window.data() + offset, count);
+			offset += count;
+			out += count;
+			n -= count;
+		}
+	};
 
 	char header[9];
-	fp.read(header, 8);
+	read(header, 8);
 	header[8] = '\0';
 	if (strcmp(header, "IND_HAIR") != 0)
 		XY_Die("Hair file's header not match!\n");
 
-	auto read_unsigned = [&fp]()->unsigned {
+	auto read_unsigned = [&read]()->unsigned {
 		unsigned n;
-		fp.read(reinterpret_cast<char*>(&n), sizeof(n));
+		read(&n, sizeof(n));
 		return n;
 	};
 
-	auto read_float = [&fp]()->float {
+	auto read_float = [&read]()->float {
 		float n;
-		fp.read(reinterpret_cast<char*>(&n), sizeof(n));
+		read(&n, sizeof(n));
 		return n;
 	};
 
 	unsigned num_fibers = read_unsigned();
 	unsigned num_total_verts = read_unsigned();
+	num_verts_per_fiber.reserve(num_verts_per_fiber.size() + num_fibers);
+	positions.reserve(positions.size() + num_total_verts);
 
 	for (unsigned kthfib = 1; kthfib <= num_fibers; ++kthfib) {
 		auto vert_count = read_unsigned();
@@ -261,18 +365,149 @@ void FiberAsset::LoadFromFile(
 		}
 	}
 
+	bounds = AABB(positions);
+
 	vao.SetAsLineStrips(num_verts_per_fiber);
 }
 
+FiberUploadApi FiberUploadApi::GL(GpuArray &vao)
+{
+	FiberUploadApi api;
+	api.reserve = [&vao](std::size_t, std::size_t num_verts) {
+		if (num_verts > static_cast<std::size_t>(std::numeric_limits<int>::max()))
+			XY_Die("too many hair vertices for one vertex array");
+		vao.ReserveBuf<xy::vec3>(num_verts, { 3 });
+		vao.ReserveBuf<xy::vec3>(num_verts, { 3 });
+		vao.ReserveBuf<float>(num_verts, { 1 });
+	};
+	api.upload = [&vao](const FiberChunk &chunk) {
+		auto count = chunk.positions.size();
+		vao.UpdateBuf(0, chunk.first_vert, chunk.positions.data(), count);
+		vao.UpdateBuf(1, chunk.first_vert, chunk.tangents.data(), count);
+		vao.UpdateBuf(2, chunk.first_vert, chunk.scales.data(), count);
+		for (auto nverts : chunk.num_verts_per_fiber)
+			vao.AppendLineStrips(1, nverts);
+	};
+	return api;
+}
+
+FiberAsset::StreamStats FiberAsset::StreamFromFile(
+	std::string model_path,
+	std::string base_color_texture_path,
+	std::string specular_random_offset_texture_path,
+	int fibers_per_chunk)
+{
+	map_bc_path = base_color_texture_path;
+	map_sro_path = specular_random_offset_texture_path;
+
+	std::ifstream fp(model_path, std::ios::binary);
+	if (!fp)
+		XY_Die("failed to open hair file " + model_path);
+	return StreamFromFile(fp, fibers_per_chunk, FiberUploadApi::GL(vao));
+}
+
+FiberAsset::StreamStats FiberAsset::StreamFromFile(std::istream &in, int fibers_per_chunk, const FiberUploadApi &api)
+{
+	auto read = [&in](void *dst, std::size_t n) {
+		if (!in.read(static_cast<char*>(dst), n))
+			XY_Die("hair file truncated");
+	};
+
+	char header[9];
+	read(header, 8);
+	header[8] = '\0';
+	if (strcmp(header, "IND_HAIR") != 0)
+		XY_Die("Hair file's header not match!\n");
+
+	unsigned num_fibers, num_total_verts;
+	read(&num_fibers, sizeof(num_fibers));
+	read(&num_total_verts, sizeof(num_total_verts));
+	api.reserve(num_fibers, num_total_verts);
+
+	streamed = true;
+	bounds = AABB();
+	fibers_per_chunk = xy::Max(fibers_per_chunk, 1);
+
+	StreamStats stats{ 0, 0, 0, 0 };
+	FiberChunk chunk;
+	// Same sequence as LoadFromFile, across chunks.
+	xy::RandomEngine eng{ 0xc01dbeef };
+	// A fiber of one vertex points away from the vertex before, which
+	// may end the last chunk.
+	xy::vec3 last_position{ 0.f };
+
+	for (unsigned kthfib = 0; kthfib < num_fibers;) {
+		chunk.first_fiber = kthfib;
+		chunk.first_vert = stats.num_verts;
+		chunk.num_verts_per_fiber.clear();
+		chunk.positions.clear();
+
+		for (; kthfib < num_fibers && chunk.num_verts_per_fiber.size() < fibers_per_chunk; ++kthfib) {
+			unsigned vert_count;
+			read(&vert_count, sizeof(vert_count));
+			chunk.num_verts_per_fiber.push_back(vert_count);
+
+			auto first = chunk.positions.size();
+			chunk.positions.resize(first + vert_count);
+			read(chunk.positions.data() + first, sizeof(xy::vec3)*vert_count);
+		}
+		if (stats.num_verts + chunk.positions.size() > num_total_verts)
+			XY_Die("hair file has more vertices than its header");
+
+		chunk.tangents.resize(chunk.positions.size());
+		chunk.scales.resize(chunk.positions.size());
+		const auto &ps = chunk.positions;
+		std::size_t kthvert = 0;
+		for (auto nvert : chunk.num_verts_per_fiber) {
+			int fibrandom = xy::Unif<1, 99>(eng);
+			if (nvert == 0)
+				continue;
+
+			for (int i = 0; i < nvert - 1; ++i) {
+				chunk.tangents[kthvert] = xy::Normalize(ps[kthvert + 1] - ps[kthvert]);
+				chunk.scales[kthvert] = fibrandom + .99f;
+				++kthvert;
+			}
+			auto before = kthvert > 0 ? ps[kthvert - 1] : last_position;
+			chunk.tangents[kthvert] = xy::Normalize(ps[kthvert] - before);
+			chunk.scales[kthvert] = fibrandom + .25f;
+			++kthvert;
+		}
+		if (!ps.empty())
+			last_position = ps.back();
+
+		bounds.Extend(chunk.positions);
+		api.upload(chunk);
+
+		stats.num_fibers += chunk.num_verts_per_fiber.size();
+		stats.num_verts += chunk.positions.size();
+		++stats.num_chunks;
+		stats.peak_chunk_bytes = xy::Max(stats.peak_chunk_bytes,
+			sizeof(int)*chunk.num_verts_per_fiber.capacity() +
+			sizeof(xy::vec3)*(chunk.positions.capacity() + chunk.tangents.capacity()) +
+			sizeof(float)*chunk.scales.capacity());
+	}
+
+	return stats;
+}
+
 void FiberAsset::CreateGpuRes()
 {
 	if (positions.size() != tangents.size() || positions.size() != scales.size())
 		XY_Die("Incomplete fiber asset!");
-	vao.SubmitBuf(positions, { 3 });
-	vao.SubmitBuf(tangents, { 3 });
-	vao.SubmitBuf(scales, { 1 });
+	if (!streamed) {
+		vao.SubmitBuf(positions, { 3 });
+		vao.SubmitBuf(tangents, { 3 });
+		vao.SubmitBuf(scales, { 1 });
+	}
 
 	// TODO: Add base color & specular random offset texture.
-	map_base_color = LoadTextureFromFile(map_bc_path);
-	map_spec_offset = LoadTextureFromFile(map_sro_path);
+	map_base_color = LoadTexture(decoded_textures, map_bc_path);
+	map_spec_offset = LoadTexture(decoded_textures, map_sro_path);
+}
+
+void FiberAsset::DecodeTextures()
+{
+	decoded_textures[map_bc_path] = DecodeTexture(map_bc_path);
+	decoded_textures[map_sro_path] = DecodeTexture(map_sro_path);
 }
@@ -0,0 +1,103 @@
+#include "deep_opacity.h"
+
+#include "xy_ext.h"
+
+
+DeepOpacityMap::DeepOpacityMap()
+	:
+	width_{ 0 },
+	height_{ 0 },
+	num_layers_{ 0 },
+	layer_size_{ 0.f }
+{}
+
+void DeepOpacityMap::Build(
+	const std::vector<xy::vec3> &positions,
+	const std::vector<int> &num_verts_per_fiber,
+	const xy::mat4 &light_view_proj,
+	int width, int height,
+	int num_layers,
+	float layer_size,
+	float fiber_opacity)
+{
+	if (num_layers <= 0 || num_layers > max_layers)
+		XY_Die("unsupported number of deep opacity layers");
+
+	width_ = width;
+	height_ = height;
+	num_layers_ = num_layers;
+	layer_size_ = layer_size;
+
+	////
+	// First pass: depth of the first occluder.
+	////
+
+	std::vector<float>(width_*height_, 1.f).swap(depth_);
+
+	RasterizeFibers(positions, num_verts_per_fiber, light_view_proj, width_, height_,
+		[this](int x, int y, float z) {
+		auto &d = depth_[y*width_ + x];
+		d = xy::Min(d, z);
+	});
+
+	////
+	// Second pass: accumulate opacity into every layer whose far
+	// boundary lies beyond the fragment.
+	////
+
+	std::vector<float>(width_*height_*num_layers_, 0.f).swap(layers_);
+
+	RasterizeFibers(positions, num_verts_per_fiber, light_view_proj, width_, height_,
+		[this, fiber_opacity](int x, int y, float z) {
+		int texel = y * width_ + x;
+		float layer = (z - depth_[texel]) / layer_size_;
+		auto opacities = &layers_[texel*num_layers_];
+		for (int k = 0; k < num_layers_; ++k)
+			if (layer <= k + 1 || k == num_layers_ - 1)
+				opacities[k] += fiber_opacity;
+	});
+}
+
+float DeepOpacityMap::Transmittance(const xy::mat4 &light_view_proj, const xy::vec3 &position, float absorption) const
+{
+	auto tmp = light_view_proj * xy::vec4(position.x, position.y, position.z, 1.f);
+	tmp /= tmp.w;
+	tmp = tmp * .5f + .5f;
+
+	// Depth is fetched nearest, layers bilinearly (clamp to edge), as the
+	// GPU textures are set up.
+	auto clamp_x = [this](int x) { return xy::Min(xy::Max(x, 0), width_ - 1); };
+	auto clamp_y = [this](int y) { return xy::Min(xy::Max(y, 0), height_ - 1); };
+
+	int nx = clamp_x(static_cast<int>(floorf(tmp.x*width_)));
+	int ny = clamp_y(static_cast<int>(floorf(tmp.y*height_)));
+	float layer = (tmp.z - depth_[ny*width_ + nx]) / layer_size_;
+	if (layer <= 0.f)
+		return 1.f;
+
+	float fx = tmp.x*width_ - .5f, fy = tmp.y*height_ - .5f;
+	int x0 = static_cast<int>(floorf(fx)), y0 = static_cast<int>(floorf(fy));
+	float wx = fx - x0, wy = fy - y0;
+
+	float opacities[max_layers + 1] = {};
+	for (int j = 0; j < 2; ++j) {
+		for (int i = 0; i < 2; ++i) {
+			int x = clamp_x(x0 + i);
+			int y = clamp_y(y0 + j);
+			float w = (i ? wx : 1.f - wx) * (j ? wy : 1.f - wy);
+			for (int k = 0; k < num_layers_; ++k)
+				opacities[k + 1] += w * Opacity(x, y, k);
+		}
+	}
+
+	layer = xy::Min(layer, static_cast<float>(num_layers_));
+	int k = xy::Min(static_cast<int>(layer), num_layers_ - 1);
+	float opacity = xy::Lerp(opacities[k], opacities[k + 1], layer - k);
+
+	return expf(-absorption * opacity);
+}
+
+std::size_t DeepOpacityMap::MemoryBytes() const
+{
+	return (depth_.size() + layers_.size()) * sizeof(float);
+}
@@ -0,0 +1,570 @@
+#include "fiber_bvh.h"
+
+#include <algorithm>
+#include <chrono>
+#include "asset.h"
+#include "xy_ext.h"
+
+
+namespace
+{
+
+
+constexpr int kNumBins = 16;
+constexpr int kMaxLeafSegs = 8;
+constexpr int kMaxStackDepth = 64;
+// Nodes this deep split at the median, which halves the segments every
+// level, so even coincident or collinear segments stay within
+// kMaxStackDepth levels.
+constexpr int kMaxSahDepth = kMaxStackDepth - 33;
+// Subtrees smaller than this are never handed to another thread.
+constexpr int kMinParallelSegs = 4096;
+
+float SurfaceArea(const xy::vec3 &inf, const xy::vec3 &sup)
+{
+	auto d = sup - inf;
+	if (d.x < 0.f || d.y < 0.f || d.z < 0.f)
+		return 0.f;
+	return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+// Slab test, returns entry distance or -1 on miss.
+float RayBoxEntry(
+	const xy::vec3 &inf, const xy::vec3 &sup,
+	const xy::vec3 &o, const xy::vec3 &inv_d,
+	float tmin, float tmax)
+{
+	for (int i = 0; i < 3; ++i) {
+		float t0 = (inf[i] - o[i]) * inv_d[i];
+		float t1 = (sup[i] - o[i]) * inv_d[i];
+		if (t0 > t1)
+			std::swap(t0, t1);
+		tmin = t0 > tmin ? t0 : tmin;
+		tmax = t1 < tmax ? t1 : tmax;
+		if (tmin > tmax)
+			return -1.f;
+	}
+	return tmin;
+}
+
+float PointBoxDist2(const xy::vec3 &inf, const xy::vec3 &sup, const xy::vec3 &p)
+{
+	auto d = xy::CompMax(xy::CompMax(inf - p, p - sup), xy::vec3(0.f));
+	return xy::Dot(d, d);
+}
+
+// Entry distance, or the lowest float on miss so it stays behind the
+// ray when the caller shifts the distance.
+float RaySphere(const xy::vec3 &o, const xy::vec3 &d, const xy::vec3 &c, float r)
+{
+	auto oc = o - c;
+	float b = xy::Dot(oc, d);
+	float h = b * b - (xy::Dot(oc, oc) - r * r);
+	if (h < 0.f)
+		return -std::numeric_limits<float>::max();
+	return -b - sqrtf(h);
+}
+
+// Ray against capsule [p0,p1] of radius r, d normalized.
+// Returns entry distance (negative on miss) and the axis parameter in *u.
+float RayCapsule(
+	const xy::vec3 &ray_o, const xy::vec3 &d,
+	const xy::vec3 &p0, const xy::vec3 &p1,
+	float r, float *u)
+{
+	// Solved from the ray point nearest p0: from the ray origin, the
+	// quadratic terms grow with the squared distance and cancel the
+	// radius out of the entry distance.
+	float t_shift = xy::Dot(p0 - ray_o, d);
+	auto o = ray_o + t_shift * d;
+
+	auto ba = p1 - p0;
+	auto oa = o - p0;
+	float baba = xy::Dot(ba, ba);
+	float bard = xy::Dot(ba, d);
+	float baoa = xy::Dot(ba, oa);
+
+	float a = baba - bard * bard;
+	if (a > xy::big_eps<float> * baba) {
+		float b = baba * xy::Dot(d, oa) - baoa * bard;
+		float c = baba * xy::Dot(oa, oa) - baoa * baoa - r * r * baba;
+		float h = b * b - a * c;
+		if (h < 0.f)
+			return -1.f;
+		float t = (-b - sqrtf(h)) / a;
+		float y = baoa + t * bard;
+		if (y > 0.f && y < baba) {
+			*u = y / baba;
+			return t + t_shift;
+		}
+	}
+
+	// Hemispherical caps.
+	float t0 = RaySphere(o, d, p0, r) + t_shift;
+	float t1 = RaySphere(o, d, p1, r) + t_shift;
+	if (t1 >= 0.f && (t0 < 0.f || t1 < t0)) {
+		*u = 1.f;
+		return t1;
+	}
+	*u = 0.f;
+	return t0;
+}
+
+xy::vec3 ClosestOnSegment(const xy::vec3 &p, const xy::vec3 &p0, const xy::vec3 &p1, float *u)
+{
+	auto ba = p1 - p0;
+	float baba = xy::Dot(ba, ba);
+	float t = baba > 0.f ? xy::Dot(p - p0, ba) / baba : 0.f;
+	t = xy::Clamp(t, 0.f, 1.f);
+	*u = t;
+	return p0 + t * ba;
+}
+
+
+}
+
+FiberBVH::FiberBVH()
+	:
+	radius_{ 0.f },
+	stats_{ 0, 0, 0, 0. }
+{}
+
+void FiberBVH::Build(const FiberAsset &asset, float radius, JobSystem &jobs)
+{
+	Build(asset.positions, asset.num_verts_per_fiber, radius, jobs);
+}
+
+void FiberBVH::Build(
+	const std::vector<xy::vec3> &positions,
+	const std::vector<int> &num_verts_per_fiber,
+	float radius,
+	JobSystem &jobs)
+{
+	auto op_time = std::chrono::high_resolution_clock::now();
+
+	radius_ = radius;
+
+	////
+	// Gather segment references.
+	////
+
+	fiber_first_vert_.resize(num_verts_per_fiber.size());
+	std::vector<BuildRef> refs;
+	refs.reserve(positions.size());
+
+	int first_vert = 0;
+	for (std::size_t kthfib = 0; kthfib < num_verts_per_fiber.size(); ++kthfib) {
+		fiber_first_vert_[kthfib] = first_vert;
+		int nverts = num_verts_per_fiber[kthfib];
+		for (int i = 0; i < nverts - 1; ++i) {
+			int vert = first_vert + i;
+			auto &p0 = positions[vert];
+			auto &p1 = positions[vert + 1];
+
+			BuildRef ref;
+			ref.inf = xy::CompMin(p0, p1) - radius_;
+			ref.sup = xy::CompMax(p0, p1) + radius_;
+			ref.centroid = (p0 + p1) * .5f;
+			ref.vert = vert;
+			refs.push_back(ref);
+		}
+		first_vert += nverts;
+	}
+
+	if (first_vert != positions.size())
+		XY_Die("fiber vertex count mismatch");
+
+	////
+	// Build.
+	////
+
+	// A few subtrees per thread, for the thieves to balance.
+	int par_depth = 0;
+	while (jobs.NumThreads() > 1 && (1 << par_depth) < 4 * jobs.NumThreads())
+		++par_depth;
+
+	nodes_.clear();
+	if (!refs.empty()) {
+		nodes_.reserve(2 * refs.size() / kMaxLeafSegs + 1);
+		BuildRecursive(refs, 0, static_cast<int>(refs.size()), 0, par_depth, jobs, nodes_);
+	}
+	nodes_.shrink_to_fit();
+
+	seg_verts_.resize(refs.size());
+	for (std::size_t i = 0; i < refs.size(); ++i)
+		seg_verts_[i] = refs[i].vert;
+	segs_.resize(refs.size());
+	UpdateLeafSegments(positions);
+
+	////
+	// Stats.
+	////
+
+	stats_.num_nodes = static_cast<int>(nodes_.size());
+	stats_.num_leaves = 0;
+	stats_.max_depth = 0;
+
+	if (!nodes_.empty()) {
+		std::vector<std::pair<int, int>> stack{ {0,1} };
+		while (!stack.empty()) {
+			auto cur = stack.back();
+			stack.pop_back();
+			auto &node = nodes_[cur.first];
+			stats_.max_depth = xy::Max(stats_.max_depth, cur.second);
+			if (node.num_segs > 0) {
+				++stats_.num_leaves;
+				continue;
+			}
+			stack.emplace_back(cur.first + 1, cur.second + 1);
+			stack.emplace_back(cur.first + node.offset, cur.second + 1);
+		}
+	}
+
+	auto ed_time = std::chrono::high_resolution_clock::now();
+	stats_.build_ms = std::chrono::duration<double, std::milli>(ed_time - op_time).count();
+}
+
+void FiberBVH::BuildRecursive(
+	std::vector<BuildRef> &refs,
+	int begin, int end,
+	int depth,
+	int par_depth,
+	JobSystem &jobs,
+	std::vector<Node> &out)
+{
+	int count = end - begin;
+
+	Node node;
+	node.inf = xy::vec3(std::numeric_limits<float>::max());
+	node.sup = xy::vec3(std::numeric_limits<float>::lowest());
+	xy::vec3 cinf = node.inf, csup = node.sup;
+	for (int i = begin; i < end; ++i) {
+		node.inf = xy::CompMin(node.inf, refs[i].inf);
+		node.sup = xy::CompMax(node.sup, refs[i].sup);
+		cinf = xy::CompMin(cinf, refs[i].centroid);
+		csup = xy::CompMax(csup, refs[i].centroid);
+	}
+
+	auto make_leaf = [&]() {
+		node.offset = begin;
+		node.num_segs = static_cast<uint16_t>(count);
+		node.axis = 0;
+		out.push_back(node);
+	};
+
+	if (count <= 2) {
+		make_leaf();
+		return;
+	}
+
+	////
+	// Binned SAH along the widest centroid axis.
+	////
+
+	auto cext = csup - cinf;
+	int axis = 0;
+	if (cext.y > cext[axis]) axis = 1;
+	if (cext.z > cext[axis]) axis = 2;
+
+	int mid = begin + count / 2;
+
+	if (cext[axis] <= 0.f || depth >= kMaxSahDepth) {
+		// Degenerate centroids, SAH cannot separate them, or too deep to
+		// follow it.
+		if (count <= kMaxLeafSegs) {
+			make_leaf();
+			return;
+		}
+	}
+	else {
+		struct Bin {
+			xy::vec3 inf, sup;
+			int count;
+		};
+		Bin bins[kNumBins];
+		for (auto &bin : bins) {
+			bin.inf = xy::vec3(std::numeric_limits<float>::max());
+			bin.sup = xy::vec3(std::numeric_limits<float>::lowest());
+			bin.count = 0;
+		}
+
+		float scale = kNumBins / cext[axis];
+		auto bin_of = [&](const BuildRef &ref) {
+			int b = static_cast<int>((ref.centroid[axis] - cinf[axis]) * scale);
+			return b < kNumBins - 1 ? b : kNumBins - 1;
+		};
+
+		for (int i = begin; i < end; ++i) {
+			auto &bin = bins[bin_of(refs[i])];
+			bin.inf = xy::CompMin(bin.inf, refs[i].inf);
+			bin.sup = xy::CompMax(bin.sup, refs[i].sup);
+			++bin.count;
+		}
+
+		// Sweep from the right to collect suffix areas.
+		float right_area[kNumBins];
+		int right_count[kNumBins];
+		{
+			xy::vec3 inf = bins[kNumBins - 1].inf, sup = bins[kNumBins - 1].sup;
+			int acc = 0;
+			for (int b = kNumBins - 1; b > 0; --b) {
+				inf = xy::CompMin(inf, bins[b].inf);
+				sup = xy::CompMax(sup, bins[b].sup);
+				acc += bins[b].count;
+				right_area[b] = SurfaceArea(inf, sup);
+				right_count[b] = acc;
+			}
+		}
+
+		float best_cost = std::numeric_limits<float>::max();
+		int best_split = -1;
+		{
+			xy::vec3 inf = bins[0].inf, sup = bins[0].sup;
+			int acc = 0;
+			for (int b = 0; b < kNumBins - 1; ++b) {
+				inf = xy::CompMin(inf, bins[b].inf);
+				sup = xy::CompMax(sup, bins[b].sup);
+				acc += bins[b].count;
+				if (acc == 0 || right_count[b + 1] == 0)
+					continue;
+				float cost = SurfaceArea(inf, sup) * acc + right_area[b + 1] * right_count[b + 1];
+				if (cost < best_cost) {
+					best_cost = cost;
+					best_split = b;
+				}
+			}
+		}
+
+		// Traversal cost relative to a segment test is taken as 1.
+		float node_area = SurfaceArea(node.inf, node.sup);
+		float split_cost = 1.f + best_cost / node_area;
+		if (count <= kMaxLeafSegs && (best_split < 0 || split_cost >= count)) {
+			make_leaf();
+			return;
+		}
+
+		if (best_split >= 0) {
+			auto pivot = std::partition(refs.begin() + begin, refs.begin() + end,
+				[&](const BuildRef &ref) { return bin_of(ref) <= best_split; });
+			mid = static_cast<int>(pivot - refs.begin());
+		}
+	}
+
+	if (mid == begin || mid == end || depth >= kMaxSahDepth) {
+		mid = begin + count / 2;
+		std::nth_element(refs.begin() + begin, refs.begin() + mid, refs.begin() + end,
+			[axis](const BuildRef &a, const BuildRef &b) { return a.centroid[axis] < b.centroid[axis]; });
+	}
+
+	////
+	// Children. The two halves own disjoint ranges of refs, so the left
+	// one may be built on another thread into its own node array.
+	////
+
+	node.axis = static_cast<uint16_t>(axis);
+	node.num_segs = 0;
+
+	auto node_idx = out.size();
+	out.push_back(node);
+
+	if (depth < par_depth && count >= kMinParallelSegs) {
+		std::vector<Node> left;
+		auto left_job = jobs.Run([&]() {
+			left.reserve(2 * (mid - begin) / kMaxLeafSegs + 1);
+			BuildRecursive(refs, begin, mid, depth + 1, par_depth, jobs, left);
+		});
+
+		std::vector<Node> right;
+		right.reserve(2 * (end - mid) / kMaxLeafSegs + 1);
+		BuildRecursive(refs, mid, end, depth + 1, par_depth, jobs, right);
+		jobs.Wait(left_job);
+
+		out[node_idx].offset = static_cast<int>(left.size() + 1);
+		out.insert(out.end(), left.begin(), left.end());
+		out.insert(out.end(), right.begin(), right.end());
+	}
+	else {
+		BuildRecursive(refs, begin, mid, depth + 1, par_depth, jobs, out);
+		out[node_idx].offset = static_cast<int>(out.size() - node_idx);
+		BuildRecursive(refs, mid, end, depth + 1, par_depth, jobs, out);
+	}
+}
+
+void FiberBVH::Refit(const std::vector<xy::vec3> &positions)
+{
+	UpdateLeafSegments(positions);
+	RefitBounds();
+}
+
+void FiberBVH::UpdateLeafSegments(const std::vector<xy::vec3> &positions)
+{
+	for (std::size_t i = 0; i < seg_verts_.size(); ++i) {
+		segs_[i].p0 = positions[seg_verts_[i]];
+		segs_[i].p1 = positions[seg_verts_[i] + 1];
+	}
+}
+
+void FiberBVH::RefitBounds()
+{
+	// Children always live after their parent, so a reverse sweep sees
+	// them first.
+	for (int i = static_cast<int>(nodes_.size()) - 1; i >= 0; --i) {
+		auto &node = nodes_[i];
+		if (node.num_segs > 0) {
+			node.inf = xy::vec3(std::numeric_limits<float>::max());
+			node.sup = xy::vec3(std::numeric_limits<float>::lowest());
+			for (int k = node.offset; k < node.offset + node.num_segs; ++k) {
+				node.inf = xy::CompMin(node.inf, xy::CompMin(segs_[k].p0, segs_[k].p1));
+				node.sup = xy::CompMax(node.sup, xy::CompMax(segs_[k].p0, segs_[k].p1));
+			}
+			node.inf -= radius_;
+			node.sup += radius_;
+		}
+		else {
+			auto &left = nodes_[i + 1];
+			auto &right = nodes_[i + node.offset];
+			node.inf = xy::CompMin(left.inf, right.inf);
+			node.sup = xy::CompMax(left.sup, right.sup);
+		}
+	}
+}
+
+bool FiberBVH::Intersect(const Ray &ray, Hit *hit) const
+{
+	if (nodes_.empty())
+		return false;
+
+	auto inv_d = 1.f / ray.d;
+	float tmax = ray.tmax;
+	bool found = false;
+
+	int stack[kMaxStackDepth];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0) {
+		auto &node = nodes_[stack[--top]];
+
+		if (node.num_segs > 0) {
+			for (int k = node.offset; k < node.offset + node.num_segs; ++k) {
+				float u;
+				float t = RayCapsule(ray.o, ray.d, segs_[k].p0, segs_[k].p1, radius_, &u);
+				if (t >= ray.tmin && t < tmax) {
+					tmax = t;
+					found = true;
+					hit->t = t;
+					hit->u = u;
+					hit->vert = seg_verts_[k];
+				}
+			}
+			continue;
+		}
+
+		int idx = static_cast<int>(&node - nodes_.data());
+		int near_idx = idx + 1, far_idx = idx + node.offset;
+		if (ray.d[node.axis] < 0.f)
+			std::swap(near_idx, far_idx);
+
+		float tnear = RayBoxEntry(nodes_[near_idx].inf, nodes_[near_idx].sup, ray.o, inv_d, ray.tmin, tmax);
+		float tfar = RayBoxEntry(nodes_[far_idx].inf, nodes_[far_idx].sup, ray.o, inv_d, ray.tmin, tmax);
+
+		// Far child goes below near child on the stack.
+		if (tfar >= 0.f)
+			stack[top++] = far_idx;
+		if (tnear >= 0.f)
+			stack[top++] = near_idx;
+	}
+
+	if (found)
+		hit->p = ray.o + hit->t * ray.d;
+	return found;
+}
+
+bool FiberBVH::Occluded(const Ray &ray) const
+{
+	if (nodes_.empty())
+		return false;
+
+	auto inv_d = 1.f / ray.d;
+
+	int stack[kMaxStackDepth];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0) {
+		int idx = stack[--top];
+		auto &node = nodes_[idx];
+
+		if (RayBoxEntry(node.inf, node.sup, ray.o, inv_d, ray.tmin, ray.tmax) < 0.f)
+			continue;
+
+		if (node.num_segs > 0) {
+			for (int k = node.offset; k < node.offset + node.num_segs; ++k) {
+				float u;
+				float t = RayCapsule(ray.o, ray.d, segs_[k].p0, segs_[k].p1, radius_, &u);
+				if (t >= ray.tmin && t < ray.tmax)
+					return true;
+			}
+			continue;
+		}
+
+		stack[top++] = idx + node.offset;
+		stack[top++] = idx + 1;
+	}
+	return false;
+}
+
+bool FiberBVH::ClosestPoint(const xy::vec3 &p, float max_dist, Hit *hit) const
+{
+	if (nodes_.empty())
+		return false;
+
+	float best_dist2 = max_dist * max_dist;
+	bool found = false;
+
+	int stack[kMaxStackDepth];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0) {
+		int idx = stack[--top];
+		auto &node = nodes_[idx];
+
+		if (PointBoxDist2(node.inf, node.sup, p) > best_dist2)
+			continue;
+
+		if (node.num_segs > 0) {
+			for (int k = node.offset; k < node.offset + node.num_segs; ++k) {
+				float u;
+				auto q = ClosestOnSegment(p, segs_[k].p0, segs_[k].p1, &u);
+				auto d = q - p;
+				float dist2 = xy::Dot(d, d);
+				if (dist2 <= best_dist2) {
+					best_dist2 = dist2;
+					found = true;
+					hit->u = u;
+					hit->p = q;
+					hit->vert = seg_verts_[k];
+				}
+			}
+			continue;
+		}
+
+		int near_idx = idx + 1, far_idx = idx + node.offset;
+		if (PointBoxDist2(nodes_[near_idx].inf, nodes_[near_idx].sup, p) >
+			PointBoxDist2(nodes_[far_idx].inf, nodes_[far_idx].sup, p))
+			std::swap(near_idx, far_idx);
+		stack[top++] = far_idx;
+		stack[top++] = near_idx;
+	}
+
+	if (found)
+		hit->t = sqrtf(best_dist2);
+	return found;
+}
+
+int FiberBVH::FiberOf(int vert) const
+{
+	auto it = std::upper_bound(fiber_first_vert_.begin(), fiber_first_vert_.end(), vert);
+	return static_cast<int>(it - fiber_first_vert_.begin()) - 1;
+}
@@ -0,0 +1,79 @@
+#include "fiber_quad.h"
+
+#include <cmath>
+#include <utility>
+
+
+namespace
+{
+
+// Screen space sideways direction of the fiber at p.
+xy::vec2 FiberProjRight(const FiberQuadParams &params, const xy::vec3 &p, const xy::vec4 &t, xy::vec3 &right)
+{
+	auto view_dir = xy::Normalize(p - params.eye);
+	right = xy::Normalize(xy::Cross(xy::Normalize(xy::vec3(t.x, t.y, t.z)), view_dir));
+	auto proj = params.view_proj * xy::vec4(right.x, right.y, right.z, 0.f);
+	return xy::Normalize(xy::vec2(proj.x, proj.y));
+}
+
+xy::vec4 FiberEdge(
+	const FiberQuadParams &params,
+	const xy::vec3 &p, const xy::vec3 &right, const xy::vec2 &proj_right,
+	float ratio, float side)
+{
+	float radius = params.hair_radius * ratio * (1.f / xy::Max(params.win_size.x, params.win_size.y));
+	float expand_pixels = .71f;
+
+	auto q = p + side*right*radius;
+	auto tmp = params.view_proj * xy::vec4(q.x, q.y, q.z, 1.f);
+	auto offset = proj_right*expand_pixels / params.win_size.y;
+	return xy::vec4(
+		tmp.x / tmp.w + side*offset.x,
+		tmp.y / tmp.w + side*offset.y,
+		tmp.z / tmp.w,
+		1.f);
+}
+
+}
+
+FiberCorner ExpandFiberCorner(
+	const FiberQuadParams &params,
+	const xy::vec3 &p0, const xy::vec3 &p1,
+	const xy::vec4 &t0, const xy::vec4 &t1,
+	int corner)
+{
+	xy::vec3 right0, right1;
+	auto proj_right0 = FiberProjRight(params, p0, t0, right0);
+	auto proj_right1 = FiberProjRight(params, p1, t1, right1);
+
+	bool tip = (corner & 1) != 0;
+	const auto &p = tip ? p1 : p0;
+	const auto &t = tip ? t1 : t0;
+	const auto &right = tip ? right1 : right0;
+	const auto &proj_right = tip ? proj_right1 : proj_right0;
+
+	float ratio = t.w - std::floor(t.w);
+	auto e0 = FiberEdge(params, p, right, proj_right, ratio, -1.f);
+	auto e1 = FiberEdge(params, p, right, proj_right, ratio, 1.f);
+
+	// The tip sides swap where the fiber turns over on screen, or the
+	// quad comes out as a butterfly.
+	if (tip && xy::Dot(proj_right0, proj_right1) < 0.f)
+		std::swap(e0, e1);
+
+	FiberCorner c;
+	c.position = (corner & 2) != 0 ? e1 : e0;
+	c.world = p;
+	c.tangent = t;
+	c.win_e0e1 = xy::vec4(e0.x, e0.y, e1.x, e1.y);
+	return c;
+}
+
+PulledCorner PullFiberCorner(int first_vert, int num_verts, int first_segment, int vertex_id)
+{
+	int segment = first_segment + vertex_id / 4;
+	int strip_segments = num_verts - 1;
+	return {
+		first_vert + segment / strip_segments * num_verts + segment % strip_segments,
+		vertex_id & 3 };
+}
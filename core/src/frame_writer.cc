@@ -0,0 +1,29 @@
+#include "frame_writer.h"
+
+#include "xy_ext.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+
+FrameWriter::FrameWriter()
+	:
+	num_written_{ 0 }
+{}
+
+void FrameWriter::Init(int width, int height, int ring_size)
+{
+	ring_.Init(width, height, ring_size, GL_RGBA, GL_UNSIGNED_BYTE, 4);
+}
+
+void FrameWriter::Capture(GLuint framebuffer, const std::string &path)
+{
+	ring_.Read(framebuffer, [this, path](const ReadbackView &view) {
+		// A negative stride walks the bottom-up rows top down.
+		int stride = -static_cast<int>(view.row_bytes);
+		if (stbi_write_png(path.c_str(), view.width, view.height, 4, view.Row(0), stride))
+			++num_written_;
+		else
+			xy::Print("failed to write {}\n", path);
+	});
+}
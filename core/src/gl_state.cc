@@ -0,0 +1,171 @@
+#include "gl_state.h"
+
+#include "xy_ext.h"
+
+
+GlStateApi GlStateApi::GL()
+{
+	GlStateApi api;
+	api.use_program = [](GLuint program) { glUseProgram(program); };
+	api.bind_framebuffer = [](GLenum target, GLuint framebuffer) { glBindFramebuffer(target, framebuffer); };
+	api.set_capability = [](GLenum cap, bool enabled) {
+		if (enabled)
+			glEnable(cap);
+		else
+			glDisable(cap);
+	};
+	api.depth_mask = [](GLboolean flag) { glDepthMask(flag); };
+	api.active_texture = [](GLenum unit) { glActiveTexture(unit); };
+	api.bind_texture = [](GLenum target, GLuint texture) { glBindTexture(target, texture); };
+	api.bind_vertex_array = [](GLuint vao) { glBindVertexArray(vao); };
+	api.set_vertex_attrib = [](GLuint vao, GLuint index, bool enabled) {
+		if (enabled)
+			glEnableVertexArrayAttrib(vao, index);
+		else
+			glDisableVertexArrayAttrib(vao, index);
+	};
+	return api;
+}
+
+GlStateCache &GlStateCache::Global()
+{
+	static GlStateCache cache(GlStateApi::GL());
+	return cache;
+}
+
+GlStateCache::GlStateCache(GlStateApi api)
+	:
+	api_{ std::move(api) },
+	stats_{ 0, 0 }
+{
+	Invalidate();
+}
+
+bool GlStateCache::Request(bool changed)
+{
+	++stats_.num_requests;
+	if (changed)
+		++stats_.num_issued;
+	return changed;
+}
+
+void GlStateCache::UseProgram(GLuint program)
+{
+	if (Request(program != program_)) {
+		api_.use_program(program);
+		program_ = program;
+	}
+}
+
+void GlStateCache::BindFramebuffer(GLenum target, GLuint framebuffer)
+{
+	bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+	bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+
+	bool changed =
+		(draw && draw_framebuffer_ != framebuffer) ||
+		(read && read_framebuffer_ != framebuffer);
+	if (Request(changed)) {
+		api_.bind_framebuffer(target, framebuffer);
+		if (draw)
+			draw_framebuffer_ = framebuffer;
+		if (read)
+			read_framebuffer_ = framebuffer;
+	}
+}
+
+void GlStateCache::SetCapability(GLenum cap, bool enabled)
+{
+	auto known = caps_.begin();
+	while (known != caps_.end() && known->first != cap)
+		++known;
+
+	if (Request(known == caps_.end() || known->second != enabled)) {
+		api_.set_capability(cap, enabled);
+		if (known == caps_.end())
+			caps_.push_back({ cap, enabled });
+		else
+			known->second = enabled;
+	}
+}
+
+void GlStateCache::DepthMask(GLboolean flag)
+{
+	if (Request(depth_mask_ != flag)) {
+		api_.depth_mask(flag);
+		depth_mask_ = flag;
+	}
+}
+
+void GlStateCache::BindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+	if (unit >= units_.size())
+		units_.resize(unit + 1, { GL_NONE, unknown });
+	auto &binding = units_[unit];
+
+	if (!Request(binding.target != target || binding.texture != texture))
+		return;
+
+	// Counted with the bind, it is only issued for it.
+	if (active_unit_ != GL_TEXTURE0 + unit) {
+		api_.active_texture(GL_TEXTURE0 + unit);
+		active_unit_ = GL_TEXTURE0 + unit;
+	}
+	api_.bind_texture(target, texture);
+	binding = { target, texture };
+}
+
+void GlStateCache::BindVertexArray(GLuint vao)
+{
+	if (Request(vao != vao_)) {
+		api_.bind_vertex_array(vao);
+		vao_ = vao;
+	}
+}
+
+void GlStateCache::SetVertexAttribs(GLuint vao, std::uint32_t attribs)
+{
+	auto known = vao_attribs_.find(vao);
+	// A new vertex array starts with every attrib disabled.
+	std::uint32_t enabled = known == vao_attribs_.end() ? 0 : known->second;
+
+	for (GLuint index = 0; index < 32; ++index) {
+		std::uint32_t bit = 1u << index;
+		if (!(attribs & bit) && !(enabled & bit))
+			continue;
+		if (Request((attribs & bit) != (enabled & bit)))
+			api_.set_vertex_attrib(vao, index, (attribs & bit) != 0);
+	}
+	vao_attribs_[vao] = attribs;
+}
+
+void GlStateCache::ForgetVertexArray(GLuint vao)
+{
+	vao_attribs_.erase(vao);
+	if (vao_ == vao)
+		vao_ = unknown;
+}
+
+void GlStateCache::Invalidate()
+{
+	program_ = unknown;
+	draw_framebuffer_ = unknown;
+	read_framebuffer_ = unknown;
+	vao_ = unknown;
+	active_unit_ = unknown;
+	depth_mask_ = -1;
+	caps_.clear();
+	units_.clear();
+}
+
+double GlStateCache::RedundantRatio() const
+{
+	if (stats_.num_requests == 0)
+		return 0.;
+	return 1. - static_cast<double>(stats_.num_issued) / stats_.num_requests;
+}
+
+void GlStateCache::ResetStats()
+{
+	stats_ = { 0, 0 };
+}
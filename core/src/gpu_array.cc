@@ -1,66 +1,393 @@
 #include "gpu_array.h"
 
 #include <vector>
+#include <cstddef>
 #include "glad/glad.h"
 #include "xy_ext.h"
+#include "gl_state.h"
 
 
+InstanceTransform InstanceTransform::FromModel(const xy::mat4 &model)
+{
+	auto inv = xy::Inverse(model);
+
+	InstanceTransform transform;
+	transform.model = model;
+	for (int col = 0; col < 3; ++col)
+		transform.normal[col] = xy::vec4{ inv[0][col], inv[1][col], inv[2][col], 0.f };
+	return transform;
+}
+
 GpuArray::GpuArray()
 	:
+	initialized{ false },
 	vao_{ 0 },
 	bufs_{ 0 },
 	cur_buf_binding_{ 0 },
 	cur_attrib_binding_{ 0 },
 	vertex_count_{ 0 },
-	initialized{ false }
+	instance_buf_{ 0 },
+	num_instances_{ 0 },
+	indirect_{ 0, 0, 0, 0, 0 },
+	indirect_buf_{ 0 }
 {}
 
 GpuArray::~GpuArray()
 {
+	// Never touched GL, as for assets loaded without a context.
+	if (!initialized)
+		return;
+
+	if (vao_ != 0)
+		GlStateCache::Global().ForgetVertexArray(vao_);
 	glDeleteVertexArrays(1, &vao_);
 	glDeleteBuffers(16, bufs_);
+	glDeleteBuffers(1, &instance_buf_);
+	glDeleteBuffers(1, &indirect_buf_);
+}
+
+void GpuArray::SetAsLineStrips(const std::vector<int> &num_lsverts)
+{
+	indirect_.lines = 0;
+	strip_runs_.clear();
+	for (auto nverts : num_lsverts)
+		AppendLineStrips(1, nverts);
 }
 
-void GpuArray::SetAsLineStrips(std::vector<int> num_lsverts)
+void GpuArray::AppendLineStrips(int num_strips, int num_verts)
 {
-	num_lsverts_.swap(num_lsverts);
+	if (num_strips <= 0)
+		return;
+	if (!strip_runs_.empty() && strip_runs_.back().num_verts == num_verts)
+		strip_runs_.back().num_strips += num_strips;
+	else
+		strip_runs_.push_back({ num_strips, num_verts });
+}
+
+void GpuArray::SetAsIndirectLines(GLuint lines, std::size_t lines_offset, GLuint counts, std::size_t counts_offset, std::size_t max_verts)
+{
+	if (lines_offset % sizeof(GLuint) != 0)
+		XY_Die("indirect lines are not aligned to their indices");
+	if (indirect_buf_ == 0) {
+		glGenBuffers(1, &indirect_buf_);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buf_);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, 5 * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	strip_runs_.clear();
+	indirect_ = { lines, lines_offset, counts, counts_offset, max_verts };
+}
+
+void GpuArray::CreateBuf(std::size_t num_verts, const void *data, int stride, const std::vector<int> &attrib_sizes, GLenum usage)
+{
+	if (!initialized) {
+		Init();
+		initialized = true;
+	}
+
+	if (vertex_count_ == 0)
+		vertex_count_ = static_cast<int>(num_verts);
+	if (vertex_count_ != num_verts)
+		XY_Die("buffer has unequal length");
+
+	if (cur_buf_binding_ >= 16)
+		XY_Die("too many buffers");
+
+	glGenBuffers(1, &bufs_[cur_buf_binding_]);
+
+	GlStateCache::Global().BindVertexArray(vao_);
+	glBindBuffer(GL_ARRAY_BUFFER, bufs_[cur_buf_binding_]);
+	glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(stride*num_verts), data, usage);
+
+	buf_layouts_.push_back({ cur_attrib_binding_, stride, attrib_sizes, 0, 0, false });
+	PointBufAttribs(cur_buf_binding_, bufs_[cur_buf_binding_], 0);
+	cur_attrib_binding_ += static_cast<int>(attrib_sizes.size());
+	++cur_buf_binding_;
+}
+
+void GpuArray::SubmitInstances(const std::vector<InstanceTransform> &transforms)
+{
+	if (!initialized) {
+		Init();
+		initialized = true;
+	}
+	if (cur_attrib_binding_ > instance_attrib)
+		XY_Die("vertex attribs overlap the instance attribs");
+
+	if (instance_buf_ == 0)
+		glGenBuffers(1, &instance_buf_);
+	PointInstanceAttribs(instance_buf_, 0);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(InstanceTransform)*transforms.size(), transforms.data(), GL_DYNAMIC_DRAW);
+
+	num_instances_ = static_cast<int>(transforms.size());
+}
+
+void GpuArray::StreamInstances(const StreamAlloc &transforms, int num_instances)
+{
+	if (!initialized) {
+		Init();
+		initialized = true;
+	}
+	if (cur_attrib_binding_ > instance_attrib)
+		XY_Die("vertex attribs overlap the instance attribs");
+	if (transforms.size < sizeof(InstanceTransform)*num_instances)
+		XY_Die("stream allocation smaller than the instances");
+
+	PointInstanceAttribs(transforms.buffer, transforms.offset);
+	num_instances_ = num_instances;
+}
+
+void GpuArray::StreamBuf(int buf, const StreamAlloc &data)
+{
+	if (buf < 0 || buf >= cur_buf_binding_)
+		XY_Die("streamed buffer was never submitted");
+	if (data.size < static_cast<std::size_t>(buf_layouts_[buf].stride)*vertex_count_)
+		XY_Die("stream allocation smaller than the buffer");
+
+	PointBufAttribs(buf, data.buffer, data.offset);
+}
+
+void GpuArray::PointBuf(int buf, GLuint buffer, std::size_t offset)
+{
+	if (buf < 0 || buf >= cur_buf_binding_)
+		XY_Die("pointed buffer was never submitted");
+
+	PointBufAttribs(buf, buffer, offset);
+}
+
+void GpuArray::RestoreBuf(int buf)
+{
+	if (buf < 0 || buf >= cur_buf_binding_)
+		XY_Die("restored buffer was never submitted");
+	if (buf_layouts_[buf].released)
+		XY_Die("restored buffer was released");
+
+	PointBufAttribs(buf, bufs_[buf], 0);
+}
+
+void GpuArray::ReleaseBuf(int buf)
+{
+	if (buf < 0 || buf >= cur_buf_binding_)
+		XY_Die("released buffer was never submitted");
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, bufs_[buf]);
+	glBufferData(GL_COPY_WRITE_BUFFER, 0, nullptr, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	buf_layouts_[buf].released = true;
+}
+
+void GpuArray::PointBufAttribs(int buf, GLuint buffer, std::size_t offset)
+{
+	auto &layout = buf_layouts_[buf];
+	layout.source = buffer;
+	layout.source_offset = offset;
+
+	GlStateCache::Global().BindVertexArray(vao_);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	for (std::size_t i = 0; i < layout.attrib_sizes.size(); ++i) {
+		glVertexAttribPointer(layout.first_attrib + static_cast<int>(i), layout.attrib_sizes[i], GL_FLOAT, GL_FALSE, layout.stride, (void*)(offset));
+		offset += layout.attrib_sizes[i] * sizeof(float);
+	}
+}
+
+void GpuArray::PointInstanceAttribs(GLuint buffer, std::size_t offset)
+{
+	GlStateCache::Global().BindVertexArray(vao_);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	for (int col = 0; col < 4; ++col) {
+		glVertexAttribPointer(instance_attrib + col, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceTransform),
+			(void*)(offset + offsetof(InstanceTransform, model) + col * sizeof(xy::vec4)));
+		glVertexAttribDivisor(instance_attrib + col, 1);
+	}
+	for (int col = 0; col < 3; ++col) {
+		glVertexAttribPointer(instance_attrib + 4 + col, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceTransform),
+			(void*)(offset + offsetof(InstanceTransform, normal) + col * sizeof(xy::vec4)));
+		glVertexAttribDivisor(instance_attrib + 4 + col, 1);
+	}
 }
 
 void GpuArray::Draw(GLenum mode, const std::vector<int> &&attribs) const
 {
-	glBindVertexArray(vao_);
-	for (auto attrib : attribs)
-		glEnableVertexAttribArray(attrib);
+	Bind(attribs, false);
 
 	glDrawArrays(mode, 0, vertex_count_);
-
-	for (auto attrib : attribs)
-		glDisableVertexAttribArray(attrib);
-	glBindVertexArray(0);
 }
 
 void GpuArray::DrawLineStrips(const std::vector<int> &&attribs, float keep_ratio) const
 {
-	glBindVertexArray(vao_);
-	for (auto attrib : attribs)
-		glEnableVertexAttribArray(attrib);
+	Bind(attribs, false);
+	if (indirect_.lines != 0) {
+		DrawIndirectLines(false, 0, 1);
+		return;
+	}
+
+	int accsum = 0;
+
+	int keep = static_cast<int>(keep_ratio * 100.);
+
+	int i = 0;
+	for (const auto &run : strip_runs_) {
+		for (int k = 0; k < run.num_strips; ++k, ++i) {
+			if (i % 100 < keep)
+				glDrawArrays(GL_LINE_STRIP, accsum, run.num_verts);
+
+			accsum += run.num_verts;
+		}
+	}
+}
+
+void GpuArray::DrawInstanced(GLenum mode, const std::vector<int> &&attribs, int first_instance, int num_instances) const
+{
+	if (first_instance + num_instances > num_instances_)
+		XY_Die("instance range out of the instance buffer");
+
+	Bind(attribs, true);
+
+	glDrawArraysInstancedBaseInstance(mode, 0, vertex_count_, num_instances, first_instance);
+}
+
+void GpuArray::DrawLineStripsInstanced(const std::vector<int> &&attribs, float keep_ratio, int first_instance, int num_instances) const
+{
+	if (first_instance + num_instances > num_instances_)
+		XY_Die("instance range out of the instance buffer");
+
+	Bind(attribs, true);
+	if (indirect_.lines != 0) {
+		DrawIndirectLines(false, first_instance, num_instances);
+		return;
+	}
 
 	int accsum = 0;
 
 	int keep = static_cast<int>(keep_ratio * 100.);
 
-	for (int i = 0; i < num_lsverts_.size(); ++i) {
-		int nverts = num_lsverts_[i];
+	// One call per strip for the whole batch, not per strip and instance.
+	int i = 0;
+	for (const auto &run : strip_runs_) {
+		for (int k = 0; k < run.num_strips; ++k, ++i) {
+			if (i % 100 < keep)
+				glDrawArraysInstancedBaseInstance(GL_LINE_STRIP, accsum, run.num_verts, num_instances, first_instance);
+
+			accsum += run.num_verts;
+		}
+	}
+}
+
+void GpuArray::DrawLineStripsPulled(int first_instance, int num_instances) const
+{
+	if (first_instance + num_instances > num_instances_)
+		XY_Die("instance range out of the instance buffer");
+	if (buf_layouts_.size() < 3)
+		XY_Die("pulled strips need positions, tangents and scales");
+
+	// Corners 0,1,2 and 2,1,3 of every segment, shared by all arrays.
+	static GLuint quad_indices = 0;
+	if (quad_indices == 0) {
+		std::vector<GLushort> indices;
+		indices.reserve(6 * pull_segments_per_draw);
+		for (int i = 0; i < pull_segments_per_draw; ++i)
+			for (auto corner : { 0,1,2,2,1,3 })
+				indices.push_back(static_cast<GLushort>(4 * i + corner));
+		glGenBuffers(1, &quad_indices);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, quad_indices);
+		glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GLushort)*indices.size(), indices.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	// Only the instance attribs are read as attribs. The element buffer
+	// binding is vertex array state, shared with the indirect lines.
+	Bind({}, true);
+
+	// Six vertices a segment, the pairs of lines bound after the buffers.
+	if (indirect_.lines != 0) {
+		for (int i = 0; i < 3; ++i) {
+			const auto &layout = buf_layouts_[i];
+			glBindBufferRange(GL_SHADER_STORAGE_BUFFER, pull_binding + i, layout.source,
+				static_cast<GLintptr>(layout.source_offset),
+				static_cast<GLsizeiptr>(layout.stride * indirect_.max_verts));
+		}
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, pull_binding + 3, indirect_.lines,
+			static_cast<GLintptr>(indirect_.lines_offset),
+			static_cast<GLsizeiptr>(2 * sizeof(GLuint) * indirect_.max_verts));
+		glUniform3i(0, 0, 0, 0);
+		DrawIndirectLines(true, first_instance, num_instances);
+		return;
+	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quad_indices);
+
+	auto num_verts = NumStripVerts();
+	if (num_verts == 0)
+		return;
+	for (int i = 0; i < 3; ++i) {
+		const auto &layout = buf_layouts_[i];
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, pull_binding + i, layout.source,
+			static_cast<GLintptr>(layout.source_offset),
+			static_cast<GLsizeiptr>(layout.stride * num_verts));
+	}
 
-		if (i % 100 < keep)
-			glDrawArrays(GL_LINE_STRIP, accsum, nverts);
+	int first_vert = 0;
+	for (const auto &run : strip_runs_) {
+		if (run.num_verts >= 2) {
+			int num_segments = run.num_strips * (run.num_verts - 1);
+			for (int first = 0; first < num_segments; first += pull_segments_per_draw) {
+				int count = xy::Min(num_segments - first, pull_segments_per_draw);
+				glUniform3i(0, first_vert, run.num_verts, first);
+				glDrawElementsInstancedBaseInstance(GL_TRIANGLES, 6 * count, GL_UNSIGNED_SHORT, nullptr, num_instances, first_instance);
+			}
+		}
+		first_vert += run.num_strips * run.num_verts;
+	}
+}
 
-		accsum += nverts;
+void GpuArray::DrawIndirectLines(bool quads, int first_instance, int num_instances) const
+{
+	// The instances from here, the count copied in from the GPU.
+	auto first = static_cast<GLuint>(indirect_.lines_offset / sizeof(GLuint));
+	auto instances = static_cast<GLuint>(num_instances), base = static_cast<GLuint>(first_instance);
+	const GLuint arrays_command[4] = { 0, instances, 0, base };
+	const GLuint elements_command[5] = { 0, instances, first, 0, base };
+	auto count_offset = indirect_.counts_offset + (quads ?
+		offsetof(IndirectLineCounts, num_quad_verts) : offsetof(IndirectLineCounts, num_line_indices));
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buf_);
+	if (quads)
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(arrays_command), arrays_command);
+	else
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(elements_command), elements_command);
+	glBindBuffer(GL_COPY_READ_BUFFER, indirect_.counts);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_DRAW_INDIRECT_BUFFER, static_cast<GLintptr>(count_offset), 0, sizeof(GLuint));
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	if (quads) {
+		glDrawArraysIndirect(GL_TRIANGLES, nullptr);
+	}
+	else {
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indirect_.lines);
+		glDrawElementsIndirect(GL_LINES, GL_UNSIGNED_INT, nullptr);
 	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+std::size_t GpuArray::NumStripVerts() const
+{
+	std::size_t num_verts = 0;
+	for (const auto &run : strip_runs_)
+		num_verts += static_cast<std::size_t>(run.num_strips) * run.num_verts;
+	return num_verts;
+}
 
+void GpuArray::Bind(const std::vector<int> &attribs, bool instanced) const
+{
+	std::uint32_t enabled = 0;
 	for (auto attrib : attribs)
-		glDisableVertexAttribArray(attrib);
-	glBindVertexArray(0);
+		enabled |= 1u << attrib;
+	if (instanced)
+		enabled |= ((1u << num_instance_attribs) - 1) << instance_attrib;
+
+	auto &state = GlStateCache::Global();
+	state.BindVertexArray(vao_);
+	state.SetVertexAttribs(vao_, enabled);
 }
 
 void GpuArray::Init()
@@ -0,0 +1,216 @@
+#include "gpu_sync.h"
+
+#include <chrono>
+#include "xy_ext.h"
+
+
+GpuSyncApi GpuSyncApi::GL()
+{
+	GpuSyncApi api;
+	api.memory_barrier = [](GLbitfield bits) { glMemoryBarrier(bits); };
+	api.fence = []() { return glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0); };
+	api.client_wait = [](GLsync sync, GLuint64 timeout_ns) {
+		auto res = glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, timeout_ns);
+		if (res == GL_WAIT_FAILED)
+			XY_Die("glClientWaitSync failed");
+		return res == GL_ALREADY_SIGNALED || res == GL_CONDITION_SATISFIED;
+	};
+	api.delete_sync = [](GLsync sync) { glDeleteSync(sync); };
+	api.finish = []() { glFinish(); };
+	return api;
+}
+
+////
+// GpuHazardTracker.
+////
+
+GpuHazardTracker::GpuHazardTracker()
+	:
+	GpuHazardTracker(GpuSyncApi::GL())
+{}
+
+GpuHazardTracker::GpuHazardTracker(GpuSyncApi api)
+	:
+	api_{ std::move(api) },
+	num_barriers_{ 0 },
+	num_accesses_{ 0 }
+{}
+
+int GpuHazardTracker::Register(const std::string &name)
+{
+	resources_.push_back({ name, false, 0 });
+	return static_cast<int>(resources_.size()) - 1;
+}
+
+void GpuHazardTracker::MarkWritten(int resource)
+{
+	resources_[resource].written = true;
+	resources_[resource].visible = 0;
+}
+
+GLbitfield GpuHazardTracker::BarrierBit(GpuAccess access)
+{
+	switch (access) {
+	case GpuAccess::StorageRead:
+	case GpuAccess::StorageWrite:
+		return GL_SHADER_STORAGE_BARRIER_BIT;
+	case GpuAccess::AtomicCounter:
+		return GL_ATOMIC_COUNTER_BARRIER_BIT;
+	case GpuAccess::ImageRead:
+	case GpuAccess::ImageWrite:
+		return GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+	case GpuAccess::TextureFetch:
+		return GL_TEXTURE_FETCH_BARRIER_BIT;
+	case GpuAccess::IndirectRead:
+		return GL_COMMAND_BARRIER_BIT;
+	case GpuAccess::RenderTarget:
+		return GL_FRAMEBUFFER_BARRIER_BIT;
+	case GpuAccess::Transfer:
+		return GL_BUFFER_UPDATE_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT;
+	case GpuAccess::Readback:
+		return GL_BUFFER_UPDATE_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT;
+	default:
+		XY_Die("unknown gpu access");
+	}
+	return 0;
+}
+
+bool GpuHazardTracker::IsIncoherentWrite(GpuAccess access)
+{
+	return access == GpuAccess::StorageWrite ||
+		access == GpuAccess::AtomicCounter ||
+		access == GpuAccess::ImageWrite;
+}
+
+bool GpuHazardTracker::IsCoherentWrite(GpuAccess access)
+{
+	return access == GpuAccess::RenderTarget || access == GpuAccess::Transfer;
+}
+
+GLbitfield GpuHazardTracker::Access(std::initializer_list<Use> uses)
+{
+	return Access(std::vector<Use>(uses));
+}
+
+GLbitfield GpuHazardTracker::Access(const std::vector<Use> &uses)
+{
+	GLbitfield bits = 0;
+	for (const auto &use : uses) {
+		const auto &res = resources_[use.resource];
+		auto bit = BarrierBit(use.access);
+		if (res.written && (res.visible & bit) != bit)
+			bits |= bit;
+	}
+
+	if (bits != 0) {
+		api_.memory_barrier(bits);
+		++num_barriers_;
+		// glMemoryBarrier is global, it covers every resource.
+		for (auto &res : resources_)
+			res.visible |= bits;
+	}
+
+	for (const auto &use : uses) {
+		auto &res = resources_[use.resource];
+		if (IsIncoherentWrite(use.access)) {
+			res.written = true;
+			res.visible = 0;
+		}
+		else if (IsCoherentWrite(use.access)) {
+			res.written = false;
+		}
+	}
+
+	num_accesses_ += uses.size();
+	return bits;
+}
+
+////
+// FramePacer.
+////
+
+FramePacer::FramePacer(int frames_in_flight)
+	:
+	FramePacer(frames_in_flight, GpuSyncApi::GL())
+{}
+
+FramePacer::FramePacer(int frames_in_flight, GpuSyncApi api)
+	:
+	api_{ std::move(api) },
+	slot_{ 0 },
+	in_frame_{ false },
+	stats_{ 0, 0, 0, 0, 0., -1 }
+{
+	SetFramesInFlight(frames_in_flight);
+}
+
+void FramePacer::SetFramesInFlight(int frames_in_flight)
+{
+	if (frames_in_flight <= 0)
+		XY_Die("at least one frame in flight");
+	if (frames_in_flight == FramesInFlight())
+		return;
+
+	for (int i = 0; i < FramesInFlight(); ++i)
+		WaitSlot(i);
+	fences_.assign(frames_in_flight, nullptr);
+	slot_ = 0;
+}
+
+void FramePacer::WaitSlot(int slot)
+{
+	auto &fence = fences_[slot];
+	if (!fence)
+		return;
+
+	++stats_.num_fence_waits;
+	if (!api_.client_wait(fence, 0)) {
+		++stats_.num_blocked_waits;
+		auto op_time = std::chrono::steady_clock::now();
+		while (!api_.client_wait(fence, 1000000000ull))
+			;
+		stats_.blocked_ms += std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - op_time).count();
+	}
+
+	api_.delete_sync(fence);
+	fence = nullptr;
+}
+
+void FramePacer::BeginFrame()
+{
+	if (in_frame_)
+		return;
+	in_frame_ = true;
+	WaitSlot(slot_);
+}
+
+void FramePacer::EndFrame()
+{
+	if (!in_frame_)
+		return;
+	in_frame_ = false;
+
+	fences_[slot_] = api_.fence();
+	slot_ = (slot_ + 1) % FramesInFlight();
+	++stats_.num_frames;
+}
+
+void FramePacer::Finish()
+{
+	api_.finish();
+	++stats_.num_full_flushes;
+	stats_.last_flush_frame = static_cast<long long>(stats_.num_frames);
+}
+
+bool FramePacer::SteadyState() const
+{
+	return static_cast<long long>(stats_.num_frames) - stats_.last_flush_frame > FramesInFlight();
+}
+
+FramePacer::~FramePacer()
+{
+	for (auto fence : fences_)
+		if (fence)
+			api_.delete_sync(fence);
+}
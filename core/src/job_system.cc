@@ -0,0 +1,245 @@
+#include "job_system.h"
+
+#include <cstdlib>
+#include "xy_ext.h"
+
+
+struct JobSystem::Task {
+	std::function<void()> fn;
+	JobAffinity affinity;
+	// Unfinished dependencies, plus one while Run adds them.
+	std::atomic<int> num_waiting;
+
+	std::mutex mutex;
+	std::atomic<bool> done;
+	std::vector<Job> dependents;
+};
+
+namespace
+{
+
+// Deque index of a worker thread, by job system.
+thread_local const JobSystem *tls_system = nullptr;
+thread_local int tls_index = 0;
+
+}
+
+JobSystem::JobSystem(int num_threads)
+	:
+	num_threads_{ num_threads > 0 ? num_threads : static_cast<int>(std::thread::hardware_concurrency()) },
+	main_thread_{ std::this_thread::get_id() },
+	num_queued_{ 0 },
+	quit_{ false },
+	num_jobs_{ 0 },
+	num_steals_{ 0 },
+	num_main_jobs_{ 0 }
+{
+	num_threads_ = xy::Max(num_threads_, 1);
+	for (int i = 0; i < num_threads_; ++i)
+		queues_.push_back(std::make_unique<Queue>());
+	for (int i = 1; i < num_threads_; ++i)
+		workers_.emplace_back(&JobSystem::Work, this, i);
+}
+
+JobSystem &JobSystem::Global()
+{
+	static JobSystem jobs(std::getenv("XY_JOB_THREADS") ? std::atoi(std::getenv("XY_JOB_THREADS")) : 0);
+	return jobs;
+}
+
+JobSystem::Job JobSystem::Run(std::function<void()> fn, const std::vector<Job> &deps, JobAffinity affinity)
+{
+	auto job = std::make_shared<Task>();
+	job->fn = std::move(fn);
+	job->affinity = affinity;
+	job->num_waiting = 1;
+	job->done = false;
+
+	for (const auto &dep : deps) {
+		if (!dep)
+			continue;
+		std::lock_guard<std::mutex> lock(dep->mutex);
+		if (!dep->done) {
+			dep->dependents.push_back(job);
+			++job->num_waiting;
+		}
+	}
+	Release(job);
+	return job;
+}
+
+void JobSystem::Release(const Job &job)
+{
+	if (--job->num_waiting > 0)
+		return;
+
+	if (job->affinity == JobAffinity::Main) {
+		std::lock_guard<std::mutex> lock(main_jobs_.mutex);
+		main_jobs_.jobs.push_back(job);
+		return;
+	}
+
+	auto &queue = *queues_[ThreadIndex()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(job);
+	}
+	++num_queued_;
+	// Taking the lock orders the push before a worker's check.
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex_);
+	}
+	wake_.notify_one();
+}
+
+bool JobSystem::Done(const Job &job)
+{
+	return !job || job->done;
+}
+
+int JobSystem::ThreadIndex() const
+{
+	return tls_system == this ? tls_index : 0;
+}
+
+JobSystem::Job JobSystem::Take(int index)
+{
+	Job job;
+	{
+		auto &own = *queues_[index];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.jobs.empty()) {
+			job = std::move(own.jobs.back());
+			own.jobs.pop_back();
+		}
+	}
+
+	if (!job && IsMainThread()) {
+		std::lock_guard<std::mutex> lock(main_jobs_.mutex);
+		if (!main_jobs_.jobs.empty()) {
+			job = std::move(main_jobs_.jobs.front());
+			main_jobs_.jobs.pop_front();
+			return job;
+		}
+	}
+
+	for (int i = 1; !job && i < num_threads_; ++i) {
+		auto &victim = *queues_[(index + i) % num_threads_];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.jobs.empty()) {
+			job = std::move(victim.jobs.front());
+			victim.jobs.pop_front();
+			++num_steals_;
+		}
+	}
+
+	if (job)
+		--num_queued_;
+	return job;
+}
+
+void JobSystem::Execute(const Job &job)
+{
+	job->fn();
+	job->fn = nullptr;
+
+	std::vector<Job> dependents;
+	{
+		std::lock_guard<std::mutex> lock(job->mutex);
+		job->done = true;
+		dependents.swap(job->dependents);
+	}
+	for (const auto &dependent : dependents)
+		Release(dependent);
+
+	++num_jobs_;
+	if (job->affinity == JobAffinity::Main)
+		++num_main_jobs_;
+}
+
+void JobSystem::Wait(const Job &job)
+{
+	int index = ThreadIndex();
+	while (!Done(job)) {
+		auto next = Take(index);
+		if (next)
+			Execute(next);
+		else if (num_threads_ == 1)
+			XY_Die("waited on a job that can never run");
+		else
+			std::this_thread::yield();
+	}
+}
+
+void JobSystem::ParallelFor(int begin, int end, int grain, const std::function<void(int, int)> &fn)
+{
+	grain = xy::Max(grain, 1);
+
+	// Upper halves go to the deque while the caller splits the lower one,
+	// so a thief takes the largest half left.
+	std::vector<Job> halves;
+	while (end - begin > grain) {
+		int mid = begin + (end - begin) / 2;
+		halves.push_back(Run([this, mid, end, grain, &fn]() { ParallelFor(mid, end, grain, fn); }));
+		end = mid;
+	}
+	if (begin < end)
+		fn(begin, end);
+
+	// Smallest first, it is on top of the deque unless stolen.
+	for (auto half = halves.rbegin(); half != halves.rend(); ++half)
+		Wait(*half);
+}
+
+void JobSystem::RunMainJobs()
+{
+	if (!IsMainThread())
+		XY_Die("main jobs run on the main thread only");
+
+	for (;;) {
+		Job job;
+		{
+			std::lock_guard<std::mutex> lock(main_jobs_.mutex);
+			if (main_jobs_.jobs.empty())
+				return;
+			job = std::move(main_jobs_.jobs.front());
+			main_jobs_.jobs.pop_front();
+		}
+		Execute(job);
+	}
+}
+
+void JobSystem::Work(int index)
+{
+	tls_system = this;
+	tls_index = index;
+
+	for (;;) {
+		auto job = Take(index);
+		if (job) {
+			Execute(job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleep_mutex_);
+		wake_.wait(lock, [this]() { return quit_ || num_queued_ > 0; });
+		if (quit_)
+			return;
+	}
+}
+
+JobSystem::Stats JobSystem::GetStats() const
+{
+	return { num_jobs_, num_steals_, num_main_jobs_ };
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex_);
+		quit_ = true;
+	}
+	wake_.notify_all();
+	for (auto &worker : workers_)
+		worker.join();
+}
@@ -0,0 +1,426 @@
+#include "oit.h"
+
+#include <algorithm>
+#include <fstream>
+#include "xy_ext.h"
+
+
+namespace xy
+{
+
+
+vec4 ResolveSorted(const OITFragment *frags, int count)
+{
+	std::vector<OITFragment> sorted(frags, frags + count);
+	std::stable_sort(sorted.begin(), sorted.end(),
+		[](const OITFragment &a, const OITFragment &b) { return a.depth > b.depth; });
+
+	vec4 color{ 0.f,0.f,0.f,1.f };
+	for (auto &frag : sorted)
+		color = BlendOver(color, frag.color);
+	return color;
+}
+
+vec4 ResolvePPLLKBuffer(const OITFragment *frags, int count, int kbuf_size, std::size_t *num_comparisons)
+{
+	constexpr float depth_null = std::numeric_limits<float>::max();
+
+	std::vector<OITFragment> kbuf(kbuf_size, OITFragment{ vec4(0.f), depth_null });
+	std::size_t ncmp = 0;
+
+	int kthnode = 0;
+	for (; kthnode < kbuf_size && kthnode < count; ++kthnode)
+		kbuf[kthnode] = frags[kthnode];
+
+	// Overflow replaces the first entry that is deeper, not the deepest.
+	for (; kthnode < count; ++kthnode) {
+		for (auto &elem : kbuf) {
+			++ncmp;
+			if (elem.depth > frags[kthnode].depth) {
+				elem = frags[kthnode];
+				break;
+			}
+		}
+	}
+
+	vec4 color{ 0.f,0.f,0.f,1.f };
+	for (int kth_blend = 0; kth_blend < kbuf_size; ++kth_blend) {
+		int maxnode = -1;
+		float maxdepth = -1.f;
+		for (int j = 0; j < kbuf_size; ++j) {
+			++ncmp;
+			if (kbuf[j].depth > maxdepth) {
+				maxdepth = kbuf[j].depth;
+				maxnode = j;
+			}
+		}
+		if (maxnode < 0)
+			break;
+
+		kbuf[maxnode].depth = -1.f;
+		if (maxdepth != depth_null)
+			color = BlendOver(color, kbuf[maxnode].color);
+	}
+
+	if (num_comparisons)
+		*num_comparisons += ncmp;
+	return color;
+}
+
+vec4 ResolveSortedKBuffer(const OITFragment *frags, int count, int kbuf_size, std::size_t *num_comparisons)
+{
+	std::vector<OITFragment> kbuf(kbuf_size);
+	int num_kbuf = 0;
+	vec4 tail{ 0.f,0.f,0.f,1.f };
+	std::size_t ncmp = 0;
+
+	for (int i = 0; i < count; ++i) {
+		auto &frag = frags[i];
+		if (num_kbuf == kbuf_size) {
+			++ncmp;
+			if (frag.depth >= kbuf[kbuf_size - 1].depth) {
+				tail = BlendOver(tail, frag.color);
+				continue;
+			}
+			tail = BlendOver(tail, kbuf[kbuf_size - 1].color);
+			--num_kbuf;
+		}
+
+		int j = num_kbuf;
+		for (; j > 0; --j) {
+			++ncmp;
+			if (!(kbuf[j - 1].depth > frag.depth))
+				break;
+			kbuf[j] = kbuf[j - 1];
+		}
+		kbuf[j] = frag;
+		++num_kbuf;
+	}
+
+	vec4 color = tail;
+	for (int j = num_kbuf - 1; j >= 0; --j)
+		color = BlendOver(color, kbuf[j].color);
+
+	if (num_comparisons)
+		*num_comparisons += ncmp;
+	return color;
+}
+
+float WeightedOITWeight(float window_depth, float alpha, vec2 proj_z)
+{
+	float view_depth = proj_z.y / (2.f*window_depth - 1.f + proj_z.x);
+	float z = view_depth / 5.f;
+	float w = 1.f / (1e-5f + z * z + powf(view_depth / 200.f, 6.f));
+	return alpha * Clamp(w, 1e-3f, 3e2f);
+}
+
+vec4 ResolveWeighted(const OITFragment *frags, int count, vec2 proj_z)
+{
+	vec4 accum{ 0.f };
+	float revealage = 1.f;
+	for (int i = 0; i < count; ++i) {
+		auto &c = frags[i].color;
+		float w = WeightedOITWeight(frags[i].depth, c.a, proj_z);
+		accum += vec4(c.r*c.a, c.g*c.a, c.b*c.a, c.a)*w;
+		revealage *= 1.f - c.a;
+	}
+
+	if (revealage >= 1.f)
+		return vec4(0.f, 0.f, 0.f, 1.f);
+
+	float inv_a = 1.f / Max(accum.a, 1e-5f);
+	return vec4(
+		accum.r*inv_a*(1.f - revealage),
+		accum.g*inv_a*(1.f - revealage),
+		accum.b*inv_a*(1.f - revealage),
+		revealage);
+}
+
+float MomentFractionInFront(vec4 b, float depth, float moment_bias, float overestimation)
+{
+	b = Lerp(b, vec4(.5f, .5f, .5f, .5f), moment_bias);
+
+	vec3 z;
+	z[0] = depth;
+
+	// Cholesky decomposition of the Hankel matrix, as in the moment
+	// shadow lookup.
+	float l32_d22 = -b.x*b.y + b.z;
+	float d22 = -b.x*b.x + b.y;
+	float squared_depth_variance = -b.y*b.y + b.w;
+
+	float d33_d22 = Dot(vec2(squared_depth_variance, -l32_d22), vec2(d22, l32_d22));
+	float inv_d22 = 1.f / d22;
+	float l32 = l32_d22 * inv_d22;
+
+	vec3 c(1.f, z[0], z[0] * z[0]);
+	c.y -= b.x;
+	c.z -= b.y + l32 * c.y;
+	c.y *= inv_d22;
+	c.z *= d22 / d33_d22;
+	c.y -= l32 * c.z;
+	c.x -= Dot(vec2(c.y, c.z), vec2(b.x, b.y));
+
+	float inv_c2 = 1.f / c.z;
+	float p = c.y * inv_c2;
+	float q = c.x * inv_c2;
+	float r = sqrtf(Max((p * p * .25f) - q, 0.f));
+
+	z[1] = -p * .5f - r;
+	z[2] = -p * .5f + r;
+
+	// Weights of the three-point distribution matching the moments.
+	auto weight = [&b](float zi, float zj, float zk) {
+		return (zj*zk - b.x*(zj + zk) + b.y) / ((zi - zj)*(zi - zk));
+	};
+	float w0 = weight(z[0], z[1], z[2]);
+	float w1 = weight(z[1], z[0], z[2]);
+	float w2 = weight(z[2], z[0], z[1]);
+
+	// Lower bound counts the points in front, the upper bound adds the
+	// fragment's own point.
+	float in_front = (z[1] < z[0] ? w1 : 0.f) + (z[2] < z[0] ? w2 : 0.f);
+	return Clamp(in_front + overestimation * w0, 0.f, 1.f);
+}
+
+vec4 ResolveMoments(const OITFragment *frags, int count, vec2 proj_z, vec2 depth_range, float moment_bias, float overestimation)
+{
+	auto warp = [proj_z, depth_range](float window_depth) {
+		float view_depth = proj_z.y / (2.f*window_depth - 1.f + proj_z.x);
+		return Clamp((view_depth - depth_range.x) / (depth_range.y - depth_range.x), 0.f, 1.f);
+	};
+	auto optical_depth = [](float alpha) { return -logf(1.f - Min(alpha, .999f)); };
+
+	float total_optical_depth = 0.f;
+	vec4 moments{ 0.f };
+	for (int i = 0; i < count; ++i) {
+		float od = optical_depth(frags[i].color.a);
+		float z = warp(frags[i].depth);
+		total_optical_depth += od;
+		moments += vec4(z, z*z, z*z*z, z*z*z*z)*od;
+	}
+
+	if (total_optical_depth < 1e-4f)
+		return vec4(0.f, 0.f, 0.f, 1.f);
+
+	auto b = moments / total_optical_depth;
+	vec4 accum{ 0.f };
+	for (int i = 0; i < count; ++i) {
+		auto &c = frags[i].color;
+		float in_front = MomentFractionInFront(b, warp(frags[i].depth), moment_bias, overestimation);
+		float t = expf(-total_optical_depth * in_front);
+		accum += vec4(c.r*c.a, c.g*c.a, c.b*c.a, c.a)*t;
+	}
+
+	float transmittance = expf(-total_optical_depth);
+	float inv_a = 1.f / Max(accum.a, 1e-5f);
+	return vec4(
+		accum.r*inv_a*(1.f - transmittance),
+		accum.g*inv_a*(1.f - transmittance),
+		accum.b*inv_a*(1.f - transmittance),
+		transmittance);
+}
+
+TiledOITStats AnalyzeTiledOIT(
+	const OITFragmentLists &lists,
+	int tile_size,
+	std::size_t tile_budget,
+	int ppll_node_bytes,
+	int tiled_node_bytes,
+	int cache_line_bytes)
+{
+	int num_tiles_x = (lists.width + tile_size - 1) / tile_size;
+	int num_tiles_y = (lists.height + tile_size - 1) / tile_size;
+
+	TiledOITStats stats{};
+	stats.tile_size = tile_size;
+	stats.num_tiles = num_tiles_x * num_tiles_y;
+	stats.num_frags = lists.frags.size();
+	stats.ppll_counter_ops = lists.frags.size();
+
+	std::vector<std::size_t> tile_counts(stats.num_tiles, 0);
+	std::vector<std::vector<unsigned>> tile_addrs(lists.addrs.empty() ? 0 : stats.num_tiles);
+	for (int y = 0; y < lists.height; ++y) {
+		for (int x = 0; x < lists.width; ++x) {
+			int pixel = y * lists.width + x;
+			int tile = (y / tile_size)*num_tiles_x + x / tile_size;
+			tile_counts[tile] += lists.Count(pixel);
+			if (!tile_addrs.empty())
+				for (int i = lists.offsets[pixel]; i < lists.offsets[pixel + 1]; ++i)
+					tile_addrs[tile].push_back(lists.addrs[i]);
+		}
+	}
+
+	std::size_t sum_tile_ops = 0;
+	std::size_t sum_tiled_lines = 0;
+	double sum_tiled_span = 0.;
+	std::size_t tile_offset = 0;
+	for (auto count : tile_counts) {
+		if (count == 0)
+			continue;
+		++stats.num_active_tiles;
+		sum_tile_ops += count;
+		stats.max_tile_ops = Max(stats.max_tile_ops, count);
+
+		auto size = Min(count, tile_budget);
+		stats.num_dropped += count - size;
+
+		// Contiguous pool, lines counted from the pool's first byte.
+		std::size_t first_byte = tile_offset * tiled_node_bytes;
+		std::size_t last_byte = (tile_offset + size) * tiled_node_bytes;
+		sum_tiled_lines += (last_byte + cache_line_bytes - 1) / cache_line_bytes - first_byte / cache_line_bytes;
+		sum_tiled_span += static_cast<double>(last_byte - first_byte);
+		tile_offset += size;
+	}
+
+	std::size_t sum_ppll_lines = 0;
+	double sum_ppll_span = 0.;
+	for (auto &addrs : tile_addrs) {
+		if (addrs.empty())
+			continue;
+		std::vector<std::size_t> lines;
+		lines.reserve(addrs.size());
+		for (auto addr : addrs)
+			lines.push_back(static_cast<std::size_t>(addr)*ppll_node_bytes / cache_line_bytes);
+		std::sort(lines.begin(), lines.end());
+		sum_ppll_lines += std::unique(lines.begin(), lines.end()) - lines.begin();
+
+		auto minmax = std::minmax_element(addrs.begin(), addrs.end());
+		sum_ppll_span += (static_cast<double>(*minmax.second) - *minmax.first + 1.)*ppll_node_bytes;
+	}
+
+	if (stats.num_active_tiles > 0) {
+		double num_active = stats.num_active_tiles;
+		stats.mean_tile_ops = sum_tile_ops / num_active;
+		stats.tiled_lines_per_tile = sum_tiled_lines / num_active;
+		stats.tiled_span_bytes_per_tile = sum_tiled_span / num_active;
+		stats.ppll_lines_per_tile = sum_ppll_lines / num_active;
+		stats.ppll_span_bytes_per_tile = sum_ppll_span / num_active;
+	}
+	return stats;
+}
+
+PPLLDispatchStats AnalyzePPLLDispatch(const OITFragmentLists &lists, int simd_width, int num_buckets)
+{
+	PPLLDispatchStats stats{};
+	stats.num_pixels = lists.NumPixels();
+	stats.bucket_counts.assign(num_buckets, 0);
+
+	std::size_t total_work = lists.frags.size();
+	auto finish = [total_work](DispatchCost &cost) {
+		cost.utilization = cost.lane_steps > 0. ? total_work / cost.lane_steps : 1.;
+	};
+
+	// Fullscreen: every pixel is a lane, groups are square screen blocks.
+	int block = Max(1, static_cast<int>(sqrtf(static_cast<float>(simd_width))));
+	for (int by = 0; by < lists.height; by += block) {
+		for (int bx = 0; bx < lists.width; bx += block) {
+			int longest = 0;
+			for (int y = by; y < Min(by + block, lists.height); ++y)
+				for (int x = bx; x < Min(bx + block, lists.width); ++x)
+					longest = Max(longest, lists.Count(y*lists.width + x));
+			++stats.fullscreen.num_groups;
+			stats.fullscreen.lane_steps += static_cast<double>(longest) * block * block;
+		}
+	}
+	finish(stats.fullscreen);
+
+	std::vector<int> compact;
+	for (int i = 0; i < lists.NumPixels(); ++i) {
+		if (lists.Count(i) > 0) {
+			compact.push_back(i);
+			++stats.bucket_counts[PPLLLengthBucket(lists.Count(i), num_buckets)];
+		}
+	}
+	stats.num_active = static_cast<int>(compact.size());
+
+	auto compact_cost = [&](const std::vector<int> &order, DispatchCost &cost) {
+		for (std::size_t first = 0; first < order.size(); first += simd_width) {
+			int longest = 0;
+			for (std::size_t i = first; i < Min(first + simd_width, order.size()); ++i)
+				longest = Max(longest, lists.Count(order[i]));
+			++cost.num_groups;
+			cost.lane_steps += static_cast<double>(longest) * simd_width;
+		}
+		finish(cost);
+	};
+
+	compact_cost(compact, stats.compact_unsorted);
+
+	// Longest bucket first, pixel order within a bucket.
+	std::stable_sort(compact.begin(), compact.end(), [&](int a, int b) {
+		return PPLLLengthBucket(lists.Count(a), num_buckets) > PPLLLengthBucket(lists.Count(b), num_buckets);
+	});
+	compact_cost(compact, stats.compact_sorted);
+
+	return stats;
+}
+
+void SaveOITFragmentLists(const OITFragmentLists &lists, const std::string &path)
+{
+	std::ofstream fs(path, std::ios::binary);
+	if (!fs)
+		XY_Die(std::string("fail to write ") + path);
+
+	auto write = [&fs](const void *data, std::size_t size) {
+		fs.write(reinterpret_cast<const char*>(data), size);
+	};
+	uint64_t num_frags = lists.frags.size();
+	uint64_t num_addrs = lists.addrs.size();
+	write(&lists.width, sizeof(int));
+	write(&lists.height, sizeof(int));
+	write(&num_frags, sizeof(num_frags));
+	write(&num_addrs, sizeof(num_addrs));
+	write(lists.offsets.data(), lists.offsets.size() * sizeof(int));
+	write(lists.frags.data(), lists.frags.size() * sizeof(OITFragment));
+	write(lists.addrs.data(), lists.addrs.size() * sizeof(unsigned));
+}
+
+void LoadOITFragmentLists(OITFragmentLists &lists, const std::string &path)
+{
+	std::ifstream fs(path, std::ios::binary);
+	if (!fs)
+		XY_Die(std::string("fail to read ") + path);
+
+	auto read = [&fs](void *data, std::size_t size) {
+		fs.read(reinterpret_cast<char*>(data), size);
+	};
+	uint64_t num_frags = 0, num_addrs = 0;
+	read(&lists.width, sizeof(int));
+	read(&lists.height, sizeof(int));
+	read(&num_frags, sizeof(num_frags));
+	read(&num_addrs, sizeof(num_addrs));
+	lists.offsets.resize(lists.NumPixels() + 1);
+	lists.frags.resize(num_frags);
+	lists.addrs.resize(num_addrs);
+	read(lists.offsets.data(), lists.offsets.size() * sizeof(int));
+	read(lists.frags.data(), lists.frags.size() * sizeof(OITFragment));
+	read(lists.addrs.data(), lists.addrs.size() * sizeof(unsigned));
+	if (!fs)
+		XY_Die(std::string("truncated fragment lists ") + path);
+}
+
+ImageError CompareImages(const std::vector<vec4> &a, const std::vector<vec4> &b, float threshold)
+{
+	if (a.size() != b.size())
+		XY_Die("images differ in size");
+
+	ImageError err{ 0., 0.f, 0 };
+	for (std::size_t i = 0; i < a.size(); ++i) {
+		float pixel_max = 0.f;
+		for (int c = 0; c < 4; ++c) {
+			float d = fabsf(a[i][c] - b[i][c]);
+			err.rmse += d * d;
+			pixel_max = Max(pixel_max, d);
+		}
+		err.max_abs = Max(err.max_abs, pixel_max);
+		if (pixel_max > threshold)
+			++err.num_diff_pixels;
+	}
+	if (!a.empty())
+		err.rmse = sqrt(err.rmse / (4. * a.size()));
+	return err;
+}
+
+
+}
@@ -0,0 +1,273 @@
+#include "profiler.h"
+
+#include <fstream>
+#include "xy_ext.h"
+
+
+GpuTimerApi GpuTimerApi::GL()
+{
+	GpuTimerApi api;
+	api.gen_query = [](GLuint *query) { glGenQueries(1, query); };
+	api.delete_query = [](GLuint query) { glDeleteQueries(1, &query); };
+	api.timestamp = [](GLuint query) { glQueryCounter(query, GL_TIMESTAMP); };
+	api.available = [](GLuint query) {
+		GLint available = GL_FALSE;
+		glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+		return available == GL_TRUE;
+	};
+	api.result = [](GLuint query) {
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+		return ns;
+	};
+	api.gpu_now = []() {
+		GLint64 ns = 0;
+		glGetInteger64v(GL_TIMESTAMP, &ns);
+		return static_cast<GLuint64>(ns);
+	};
+	return api;
+}
+
+////
+// Profiler.
+////
+
+Profiler::Profiler(int ring_frames, std::size_t history_frames)
+	:
+	Profiler(ring_frames, history_frames, GpuTimerApi::GL())
+{}
+
+Profiler::Profiler(int ring_frames, std::size_t history_frames, GpuTimerApi api)
+	:
+	api_{ std::move(api) },
+	start_{ std::chrono::steady_clock::now() },
+	slot_{ 0 },
+	in_frame_{ false },
+	num_frames_{ 0 },
+	history_frames_{ history_frames },
+	num_dropped_{ 0 },
+	calibrated_{ false },
+	gpu_base_ns_{ 0 },
+	cpu_base_ms_{ 0. }
+{
+	if (ring_frames <= 0)
+		XY_Die("profiler ring needs a frame");
+	slots_.resize(ring_frames);
+	for (auto &slot : slots_)
+		slot.pending = false;
+}
+
+double Profiler::NowMs() const
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count();
+}
+
+void Profiler::BeginFrame()
+{
+	if (in_frame_)
+		return;
+	in_frame_ = true;
+
+	if (GpuEnabled() && !calibrated_) {
+		gpu_base_ns_ = api_.gpu_now();
+		cpu_base_ms_ = NowMs();
+		calibrated_ = true;
+	}
+
+	auto &slot = slots_[slot_];
+	if (slot.pending) {
+		// The GPU is a whole ring behind, the frame is not waited for.
+		slot.pending = false;
+		++num_dropped_;
+	}
+
+	slot.frame.index = num_frames_;
+	slot.frame.begin_ms = NowMs();
+	slot.frame.cpu.clear();
+	slot.frame.gpu.clear();
+	cpu_stack_.clear();
+	gpu_stack_.clear();
+}
+
+void Profiler::EndFrame()
+{
+	if (!in_frame_)
+		return;
+	in_frame_ = false;
+
+	while (!cpu_stack_.empty())
+		EndCpuZone();
+	while (!gpu_stack_.empty())
+		EndGpuZone();
+
+	auto &slot = slots_[slot_];
+	slot.frame.end_ms = NowMs();
+	slot.pending = true;
+
+	slot_ = (slot_ + 1) % static_cast<int>(slots_.size());
+	++num_frames_;
+
+	Poll();
+}
+
+void Profiler::BeginCpuZone(const char *name)
+{
+	if (!in_frame_)
+		return;
+	auto &frame = slots_[slot_].frame;
+	cpu_stack_.push_back(static_cast<int>(frame.cpu.size()));
+	frame.cpu.push_back({ name, static_cast<int>(cpu_stack_.size()) - 1, NowMs(), 0. });
+}
+
+void Profiler::EndCpuZone()
+{
+	if (!in_frame_ || cpu_stack_.empty())
+		return;
+	slots_[slot_].frame.cpu[cpu_stack_.back()].end_ms = NowMs();
+	cpu_stack_.pop_back();
+}
+
+void Profiler::BeginGpuZone(const char *name)
+{
+	if (!in_frame_ || !GpuEnabled())
+		return;
+	auto &slot = slots_[slot_];
+	int zone = static_cast<int>(slot.frame.gpu.size());
+	while (slot.queries.size() < 2 * static_cast<std::size_t>(zone + 1)) {
+		GLuint query = 0;
+		api_.gen_query(&query);
+		slot.queries.push_back(query);
+	}
+
+	gpu_stack_.push_back(zone);
+	slot.frame.gpu.push_back({ name, static_cast<int>(gpu_stack_.size()) - 1, 0., 0. });
+	api_.timestamp(slot.queries[2 * zone]);
+}
+
+void Profiler::EndGpuZone()
+{
+	if (!in_frame_ || gpu_stack_.empty())
+		return;
+	api_.timestamp(slots_[slot_].queries[2 * gpu_stack_.back() + 1]);
+	gpu_stack_.pop_back();
+}
+
+void Profiler::Poll()
+{
+	// Oldest first, so history stays in frame order.
+	for (std::size_t i = 0; i < slots_.size(); ++i) {
+		auto &slot = slots_[(slot_ + i) % slots_.size()];
+		if (!slot.pending)
+			continue;
+
+		std::size_t num_queries = 2 * slot.frame.gpu.size();
+		bool ready = true;
+		for (std::size_t q = num_queries; q > 0 && ready; --q)
+			ready = api_.available(slot.queries[q - 1]);
+		if (!ready)
+			break;
+
+		auto to_ms = [this](GLuint64 ns) {
+			return cpu_base_ms_ + (static_cast<double>(ns) - static_cast<double>(gpu_base_ns_)) * 1e-6;
+		};
+		for (std::size_t z = 0; z < slot.frame.gpu.size(); ++z) {
+			slot.frame.gpu[z].begin_ms = to_ms(api_.result(slot.queries[2 * z]));
+			slot.frame.gpu[z].end_ms = to_ms(api_.result(slot.queries[2 * z + 1]));
+		}
+
+		slot.pending = false;
+		history_.push_back(slot.frame);
+		if (history_.size() > history_frames_)
+			history_.pop_front();
+	}
+}
+
+std::vector<ProfileSummary> Profiler::Summarize() const
+{
+	std::vector<ProfileSummary> summary;
+	std::vector<int> counts;
+
+	auto add = [&](const ProfileZone &zone, bool gpu) {
+		double ms = zone.end_ms - zone.begin_ms;
+		std::size_t i = 0;
+		while (i < summary.size() && (summary[i].gpu != gpu || summary[i].name != zone.name))
+			++i;
+		if (i == summary.size()) {
+			summary.push_back({ zone.name, gpu, 0., 0. });
+			counts.push_back(0);
+		}
+		summary[i].mean_ms += ms;
+		summary[i].max_ms = xy::Max(summary[i].max_ms, ms);
+		++counts[i];
+	};
+
+	for (const auto &frame : history_) {
+		for (const auto &zone : frame.cpu)
+			add(zone, false);
+		for (const auto &zone : frame.gpu)
+			add(zone, true);
+	}
+
+	for (std::size_t i = 0; i < summary.size(); ++i)
+		summary[i].mean_ms /= counts[i];
+	return summary;
+}
+
+void Profiler::WriteChromeTrace(const std::string &path) const
+{
+	std::ofstream out(path);
+	if (!out)
+		XY_Die("failed to open " + path);
+
+	out << "{\"traceEvents\":[\n";
+	bool first = true;
+	auto event = [&](const std::string &name, const char *cat, int tid, double begin_ms, double end_ms) {
+		if (!first)
+			out << ",\n";
+		first = false;
+		out << "{\"name\":\"" << name << "\",\"cat\":\"" << cat
+			<< "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << tid
+			<< ",\"ts\":" << begin_ms * 1e3
+			<< ",\"dur\":" << (end_ms - begin_ms) * 1e3 << "}";
+	};
+
+	for (const auto &frame : history_) {
+		event("frame " + std::to_string(frame.index), "frame", 0, frame.begin_ms, frame.end_ms);
+		for (const auto &zone : frame.cpu)
+			event(zone.name, "cpu", 0, zone.begin_ms, zone.end_ms);
+		for (const auto &zone : frame.gpu)
+			event(zone.name, "gpu", 1, zone.begin_ms, zone.end_ms);
+	}
+
+	out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+Profiler::~Profiler()
+{
+	if (!GpuEnabled())
+		return;
+	for (auto &slot : slots_)
+		for (auto query : slot.queries)
+			api_.delete_query(query);
+}
+
+////
+// ProfileScope.
+////
+
+ProfileScope::ProfileScope(Profiler &profiler, const char *name, bool gpu)
+	:
+	profiler_{ profiler },
+	gpu_{ gpu }
+{
+	profiler_.BeginCpuZone(name);
+	if (gpu_)
+		profiler_.BeginGpuZone(name);
+}
+
+ProfileScope::~ProfileScope()
+{
+	if (gpu_)
+		profiler_.EndGpuZone();
+	profiler_.EndCpuZone();
+}
@@ -0,0 +1,219 @@
+#include "readback_ring.h"
+
+#include "xy_ext.h"
+#include "gl_state.h"
+
+
+ReadbackRing::ReadbackRing()
+	:
+	width_{ 0 },
+	height_{ 0 },
+	format_{ GL_RGBA },
+	type_{ GL_UNSIGNED_BYTE },
+	row_bytes_{ 0 },
+	next_{ 0 },
+	num_issued_{ 0 },
+	quit_{ false },
+	num_delivered_{ 0 },
+	num_stalls_{ 0 },
+	sum_latency_ms_{ 0. },
+	max_latency_ms_{ 0. }
+{}
+
+void ReadbackRing::Init(int width, int height, int depth, GLenum format, GLenum type, int pixel_bytes)
+{
+	if (Initialized())
+		XY_Die("readback ring initialized twice");
+	if (depth <= 0)
+		XY_Die("readback ring needs a slot");
+
+	width_ = width;
+	height_ = height;
+	format_ = format;
+	type_ = type;
+	row_bytes_ = static_cast<std::size_t>(width_)*pixel_bytes;
+
+	// Coherent, so a signaled fence is all the worker needs to read.
+	GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	slots_.resize(depth);
+	for (auto &slot : slots_) {
+		glGenBuffers(1, &slot.pbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+		glBufferStorage(GL_PIXEL_PACK_BUFFER, SlotBytes(), nullptr, flags);
+		slot.mapped = static_cast<const unsigned char*>(
+			glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, SlotBytes(), flags));
+		if (!slot.mapped)
+			XY_Die("failed to map readback buffer");
+		slot.fence = nullptr;
+		slot.state = SlotState::Free;
+		slot.index = -1;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	worker_ = std::thread([this]() { Work(); });
+}
+
+void ReadbackRing::Read(GLuint framebuffer, Callback callback)
+{
+	Poll();
+
+	auto &slot = slots_[next_];
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (slot.state != SlotState::Free) {
+		++num_stalls_;
+		if (slot.state == SlotState::InFlight) {
+			lock.unlock();
+			Deliver(next_, true);
+			lock.lock();
+		}
+		cv_.wait(lock, [&slot]() { return slot.state == SlotState::Free; });
+	}
+	lock.unlock();
+
+	GlStateCache::Global().BindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width_, height_, format_, type_, nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	GlStateCache::Global().BindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.callback = std::move(callback);
+	slot.index = num_issued_;
+	slot.issue_time = Clock::now();
+	if (num_issued_ == 0)
+		first_issue_time_ = slot.issue_time;
+	++num_issued_;
+
+	lock.lock();
+	slot.state = SlotState::InFlight;
+	lock.unlock();
+
+	next_ = (next_ + 1) % static_cast<int>(slots_.size());
+}
+
+void ReadbackRing::Poll()
+{
+	// Oldest first, callbacks run in read order.
+	for (std::size_t i = 0; i < slots_.size(); ++i) {
+		int slot = static_cast<int>((next_ + i) % slots_.size());
+		if (slots_[slot].fence && !Deliver(slot, false))
+			break;
+	}
+}
+
+bool ReadbackRing::Deliver(int slot_index, bool wait)
+{
+	auto &slot = slots_[slot_index];
+	while (true) {
+		auto res = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000ull : 0);
+		if (res == GL_WAIT_FAILED)
+			XY_Die("glClientWaitSync failed");
+		if (res == GL_ALREADY_SIGNALED || res == GL_CONDITION_SATISFIED)
+			break;
+		if (!wait)
+			return false;
+	}
+	glDeleteSync(slot.fence);
+	slot.fence = nullptr;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	slot.state = SlotState::Delivering;
+	queue_.push_back(slot_index);
+	cv_.notify_all();
+	return true;
+}
+
+void ReadbackRing::Work()
+{
+	while (true) {
+		int slot_index;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			cv_.wait(lock, [this]() { return quit_ || !queue_.empty(); });
+			if (queue_.empty())
+				return;
+			slot_index = queue_.front();
+			queue_.pop_front();
+		}
+
+		auto &slot = slots_[slot_index];
+		auto now = Clock::now();
+		ReadbackView view;
+		view.data = slot.mapped;
+		view.width = width_;
+		view.height = height_;
+		view.row_bytes = row_bytes_;
+		view.index = slot.index;
+		view.latency_ms = std::chrono::duration<double, std::milli>(now - slot.issue_time).count();
+
+		if (slot.callback)
+			slot.callback(view);
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		slot.callback = nullptr;
+		slot.state = SlotState::Free;
+		++num_delivered_;
+		sum_latency_ms_ += view.latency_ms;
+		max_latency_ms_ = xy::Max(max_latency_ms_, view.latency_ms);
+		last_delivery_time_ = Clock::now();
+		cv_.notify_all();
+	}
+}
+
+void ReadbackRing::Finish()
+{
+	for (std::size_t i = 0; i < slots_.size(); ++i) {
+		int slot = static_cast<int>((next_ + i) % slots_.size());
+		if (slots_[slot].fence)
+			Deliver(slot, true);
+	}
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	cv_.wait(lock, [this]() {
+		for (const auto &slot : slots_)
+			if (slot.state != SlotState::Free)
+				return false;
+		return true;
+	});
+}
+
+ReadbackStats ReadbackRing::Stats()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	ReadbackStats stats;
+	stats.num_issued = static_cast<std::size_t>(num_issued_);
+	stats.num_delivered = num_delivered_;
+	stats.num_stalls = num_stalls_;
+	stats.mean_latency_ms = num_delivered_ > 0 ? sum_latency_ms_ / num_delivered_ : 0.;
+	stats.max_latency_ms = max_latency_ms_;
+
+	double secs = num_delivered_ > 0 ?
+		std::chrono::duration<double>(last_delivery_time_ - first_issue_time_).count() : 0.;
+	stats.frames_per_sec = secs > 0. ? num_delivered_ / secs : 0.;
+	stats.mb_per_sec = stats.frames_per_sec * SlotBytes() / (1024.*1024.);
+	return stats;
+}
+
+ReadbackRing::~ReadbackRing()
+{
+	if (!Initialized())
+		return;
+
+	Finish();
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		quit_ = true;
+		cv_.notify_all();
+	}
+	worker_.join();
+
+	for (auto &slot : slots_) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glDeleteBuffers(1, &slot.pbo);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
@@ -0,0 +1,302 @@
+#include "render_graph.h"
+
+#include <algorithm>
+#include "xy_ext.h"
+
+
+namespace
+{
+
+bool IsWrite(GpuAccess access)
+{
+	return GpuHazardTracker::IsIncoherentWrite(access) ||
+		GpuHazardTracker::IsCoherentWrite(access);
+}
+
+std::size_t AlignUp(std::size_t bytes, std::size_t alignment)
+{
+	return (bytes + alignment - 1) / alignment * alignment;
+}
+
+}
+
+RenderGraph::RenderGraph(GpuHazardTracker &hazards)
+	:
+	hazards_{ hazards },
+	heap_bytes_{ 0 },
+	compiled_{ false },
+	stats_{ 0, 0, 0, 0, 0, 0 }
+{}
+
+int RenderGraph::Import(const std::string &name, std::size_t bytes, bool output)
+{
+	auto known = import_hazards_.find(name);
+	if (known == import_hazards_.end())
+		known = import_hazards_.emplace(name, hazards_.Register(name)).first;
+
+	resources_.push_back({ name, bytes, false, output, known->second, -1, -1, -1 });
+	return static_cast<int>(resources_.size()) - 1;
+}
+
+int RenderGraph::CreateTransient(const std::string &name, std::size_t bytes)
+{
+	resources_.push_back({ name, bytes, true, false, -1, -1, -1, -1 });
+	return static_cast<int>(resources_.size()) - 1;
+}
+
+void RenderGraph::AddPass(const std::string &name, std::vector<Use> uses, std::function<void()> run)
+{
+	if (compiled_)
+		XY_Die("pass added to a compiled render graph");
+	for (const auto &use : uses)
+		if (use.resource < 0 || use.resource >= static_cast<int>(resources_.size()))
+			XY_Die("pass " + name + " uses an unknown resource");
+
+	passes_.push_back({ name, std::move(uses), std::move(run), false, {} });
+}
+
+void RenderGraph::Compile()
+{
+	if (compiled_)
+		XY_Die("render graph compiled twice");
+	compiled_ = true;
+
+	// Dependencies in declaration order: reads after the last writer,
+	// writes after the last writer and every reader since.
+	int num_resources = static_cast<int>(resources_.size());
+	std::vector<int> last_writer(num_resources, -1);
+	std::vector<std::vector<int>> readers(num_resources);
+
+	for (int pass = 0; pass < static_cast<int>(passes_.size()); ++pass) {
+		auto &deps = passes_[pass].deps;
+		auto depend = [&](int other) {
+			if (other >= 0 && other != pass && std::find(deps.begin(), deps.end(), other) == deps.end())
+				deps.push_back(other);
+		};
+
+		for (const auto &use : passes_[pass].uses) {
+			depend(last_writer[use.resource]);
+			if (IsWrite(use.access))
+				for (auto reader : readers[use.resource])
+					depend(reader);
+		}
+		for (const auto &use : passes_[pass].uses) {
+			if (IsWrite(use.access)) {
+				last_writer[use.resource] = pass;
+				readers[use.resource].clear();
+			}
+			else {
+				readers[use.resource].push_back(pass);
+			}
+		}
+	}
+
+	Cull();
+	Sort();
+	Place();
+
+	stats_.num_passes = static_cast<int>(order_.size());
+	stats_.num_culled = static_cast<int>(passes_.size() - order_.size());
+	stats_.num_barriers = 0;
+	stats_.imported_bytes = 0;
+	stats_.transient_bytes = 0;
+	for (const auto &res : resources_) {
+		if (!res.transient)
+			stats_.imported_bytes += res.bytes;
+		else if (res.slot >= 0)
+			stats_.transient_bytes += res.bytes;
+	}
+	stats_.heap_bytes = heap_bytes_;
+}
+
+void RenderGraph::Cull()
+{
+	// Backwards from the outputs. A write only matters when a live pass
+	// after it uses the resource.
+	std::vector<bool> needed(resources_.size());
+	for (std::size_t i = 0; i < resources_.size(); ++i)
+		needed[i] = resources_[i].output;
+
+	for (auto pass = passes_.rbegin(); pass != passes_.rend(); ++pass) {
+		pass->live = false;
+		for (const auto &use : pass->uses)
+			if (IsWrite(use.access) && needed[use.resource])
+				pass->live = true;
+
+		if (pass->live)
+			for (const auto &use : pass->uses)
+				needed[use.resource] = true;
+	}
+
+	// Dependencies on culled passes are met by not running them.
+	for (auto &pass : passes_)
+		pass.deps.erase(
+			std::remove_if(pass.deps.begin(), pass.deps.end(),
+				[&](int dep) { return !passes_[dep].live; }),
+			pass.deps.end());
+}
+
+void RenderGraph::Sort()
+{
+	int num_passes = static_cast<int>(passes_.size());
+	std::vector<int> num_waiting(num_passes, 0);
+	std::vector<std::vector<int>> dependents(num_passes);
+	std::vector<int> ready;
+	for (int pass = 0; pass < num_passes; ++pass) {
+		if (!passes_[pass].live)
+			continue;
+		num_waiting[pass] = static_cast<int>(passes_[pass].deps.size());
+		for (auto dep : passes_[pass].deps)
+			dependents[dep].push_back(pass);
+		if (num_waiting[pass] == 0)
+			ready.push_back(pass);
+	}
+
+	// Of the ready passes the first declared, unless it reads what the
+	// pass just issued wrote incoherently and another one does not: a
+	// pass in between gives the barrier something to overlap with.
+	order_.clear();
+	while (!ready.empty()) {
+		std::sort(ready.begin(), ready.end());
+
+		auto waits_on_last = [&](int pass) {
+			if (order_.empty())
+				return false;
+			for (const auto &write : passes_[order_.back()].uses) {
+				if (!GpuHazardTracker::IsIncoherentWrite(write.access))
+					continue;
+				for (const auto &use : passes_[pass].uses)
+					if (use.resource == write.resource)
+						return true;
+			}
+			return false;
+		};
+
+		auto next = std::find_if_not(ready.begin(), ready.end(), waits_on_last);
+		if (next == ready.end())
+			next = ready.begin();
+
+		int pass = *next;
+		ready.erase(next);
+		order_.push_back(pass);
+
+		for (auto dependent : dependents[pass])
+			if (--num_waiting[dependent] == 0)
+				ready.push_back(dependent);
+	}
+}
+
+void RenderGraph::Place()
+{
+	for (auto &res : resources_) {
+		res.first = -1;
+		res.last = -1;
+		res.slot = -1;
+	}
+	for (int pos = 0; pos < static_cast<int>(order_.size()); ++pos) {
+		for (const auto &use : passes_[order_[pos]].uses) {
+			auto &res = resources_[use.resource];
+			if (res.first < 0)
+				res.first = pos;
+			res.last = pos;
+		}
+	}
+
+	std::vector<int> transients;
+	for (int i = 0; i < static_cast<int>(resources_.size()); ++i)
+		if (resources_[i].transient && resources_[i].first >= 0)
+			transients.push_back(i);
+	// Largest first, each into the smallest slot whose tenants are all
+	// dead before it starts or born after it ends, or a new slot. Slots
+	// are as large as their first tenant.
+	std::stable_sort(transients.begin(), transients.end(), [&](int a, int b) {
+		return resources_[a].bytes > resources_[b].bytes;
+	});
+
+	slots_.clear();
+	for (auto i : transients) {
+		auto &res = resources_[i];
+
+		int best = -1;
+		for (int slot = 0; slot < static_cast<int>(slots_.size()); ++slot) {
+			bool disjoint = true;
+			for (const auto &tenant : slots_[slot].tenants)
+				disjoint = disjoint && (tenant.second < res.first || tenant.first > res.last);
+			if (disjoint && (best < 0 || slots_[slot].bytes < slots_[best].bytes))
+				best = slot;
+		}
+
+		if (best < 0) {
+			slots_.push_back({ res.bytes, 0, {} });
+			best = static_cast<int>(slots_.size()) - 1;
+		}
+		slots_[best].tenants.push_back({ res.first, res.last });
+		res.slot = best;
+	}
+
+	heap_bytes_ = 0;
+	for (auto &slot : slots_) {
+		slot.offset = heap_bytes_;
+		heap_bytes_ += AlignUp(slot.bytes, heap_alignment);
+	}
+
+	while (slot_hazards_.size() < slots_.size())
+		slot_hazards_.push_back(hazards_.Register("transient slot " + std::to_string(slot_hazards_.size())));
+
+	// Slots are tracked by index. When they move, memory a slot now
+	// covers may have been written through another one last frame.
+	std::vector<std::pair<std::size_t, std::size_t>> layout;
+	for (const auto &slot : slots_)
+		layout.push_back({ slot.offset, slot.bytes });
+	if (layout != last_layout_) {
+		for (auto hazard : slot_hazards_)
+			hazards_.MarkWritten(hazard);
+		last_layout_ = layout;
+	}
+}
+
+std::size_t RenderGraph::Offset(int resource) const
+{
+	const auto &res = resources_[resource];
+	if (!res.transient || res.slot < 0)
+		XY_Die(res.name + " has no place in the heap");
+	return slots_[res.slot].offset;
+}
+
+void RenderGraph::Execute(
+	const std::function<void(const std::string&)> &begin_pass,
+	const std::function<void()> &end_pass)
+{
+	if (!compiled_)
+		XY_Die("render graph executed before Compile");
+
+	std::vector<GpuHazardTracker::Use> uses;
+	auto num_barriers = hazards_.NumBarriers();
+
+	for (auto pass : order_) {
+		uses.clear();
+		for (const auto &use : passes_[pass].uses) {
+			const auto &res = resources_[use.resource];
+			// Transients sharing a slot are one resource to the tracker,
+			// so the next tenant waits for the writes of the last.
+			uses.push_back({ res.transient ? slot_hazards_[res.slot] : res.hazard, use.access });
+		}
+
+		begin_pass(passes_[pass].name);
+		hazards_.Access(uses);
+		passes_[pass].run();
+		end_pass();
+	}
+
+	stats_.num_barriers = hazards_.NumBarriers() - num_barriers;
+}
+
+void RenderGraph::Reset()
+{
+	resources_.clear();
+	passes_.clear();
+	order_.clear();
+	slots_.clear();
+	heap_bytes_ = 0;
+	compiled_ = false;
+}
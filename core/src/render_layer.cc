@@ -2,6 +2,7 @@
 
 #include "glad/glad.h"
 #include "xy_ext.h"
+#include "gl_state.h"
 
 
 void FrameLayer::Init(GLenum color_format, GLenum depth_format, GLsizei msaa_level, int width, int height)
@@ -72,8 +73,9 @@ void FrameLayer::Init(GLenum color_format, int width, int height)
 
 void FrameLayer::BlitColor(const FrameLayer & dest) const
 {
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, handle_);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, dest.handle_);
+	auto &state = GlStateCache::Global();
+	state.BindFramebuffer(GL_READ_FRAMEBUFFER, handle_);
+	state.BindFramebuffer(GL_DRAW_FRAMEBUFFER, dest.handle_);
 	glBlitFramebuffer(0, 0, width_, height_, 0, 0, dest.Width(), dest.Height(), GL_COLOR_BUFFER_BIT, GL_LINEAR);
 }
 
@@ -84,8 +86,9 @@ GLuint FrameLayer::GetColor() const
 
 void FrameLayer::BlitDepth(const FrameLayer & dest) const
 {
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, handle_);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, dest.handle_);
+	auto &state = GlStateCache::Global();
+	state.BindFramebuffer(GL_READ_FRAMEBUFFER, handle_);
+	state.BindFramebuffer(GL_DRAW_FRAMEBUFFER, dest.handle_);
 	glBlitFramebuffer(0, 0, width_, height_, 0, 0, dest.Width(), dest.Height(), GL_DEPTH_BUFFER_BIT, GL_NEAREST);
 }
 
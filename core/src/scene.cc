@@ -0,0 +1,293 @@
+#include "scene.h"
+
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include "xy_ext.h"
+#include "job_system.h"
+
+
+Scene::Scene()
+	:
+	hair_materials{ { "default", 1.f, 1.f } },
+	sun_light_dir{ 1.f, 1.f, 1.f },
+	has_camera{ false },
+	load_ms{ 0 }
+{}
+
+void Scene::LoadFromFile(const std::string &path, std::function<std::string(const std::string&)> resolve)
+{
+	std::ifstream fp(path);
+	if (!fp)
+		XY_Die("failed to open scene " + path);
+
+	load_ms = xy::TimeProfile([&]() {
+		// Assets load as jobs while the statements are read. Deques keep
+		// the assets in place as more are added.
+		auto &jobs = JobSystem::Global();
+		std::vector<JobSystem::Job> loads;
+
+		auto find = [](const std::vector<std::string> &names, const std::string &name) {
+			return static_cast<int>(std::find(names.begin(), names.end(), name) - names.begin());
+		};
+
+		std::string line;
+		for (int line_no = 1; std::getline(fp, line); ++line_no) {
+			auto comment = line.find('#');
+			if (comment != std::string::npos)
+				line.erase(comment);
+
+			std::istringstream in(line);
+			std::string cmd;
+			if (!(in >> cmd))
+				continue;
+
+			auto where = path + ":" + std::to_string(line_no) + ": ";
+			auto expect = [&](bool ok) {
+				if (!ok || in.bad())
+					XY_Die(where + "malformed " + cmd);
+			};
+			auto read_vec3 = [&]() {
+				xy::vec3 v;
+				expect(static_cast<bool>(in >> v.x >> v.y >> v.z));
+				return v;
+			};
+
+			if (cmd == "mesh") {
+				std::string name, obj_path, mtl_dir;
+				expect(static_cast<bool>(in >> name >> obj_path >> mtl_dir));
+				meshes.emplace_back();
+				auto &mesh = meshes.back();
+				mesh.model_matrix = xy::mat4(1.f);
+				mesh_names.push_back(name);
+				loads.push_back(jobs.Run([&mesh, obj_path = resolve(obj_path), mtl_dir = resolve(mtl_dir)]() {
+					mesh.LoadFromFile(obj_path, mtl_dir);
+				}));
+			}
+			else if (cmd == "fibers") {
+				std::string name, ind_path, base_color_path, spec_offset_path, mode;
+				expect(static_cast<bool>(in >> name >> ind_path >> base_color_path >> spec_offset_path));
+				bool stream = static_cast<bool>(in >> mode);
+				if (stream && mode != "stream")
+					XY_Die(where + "unknown fibers option " + mode);
+				fibers.emplace_back();
+				auto &fiber = fibers.back();
+				fiber.model_matrix = xy::mat4(1.f);
+				fiber_names.push_back(name);
+				fiber_stream_paths.push_back(stream ? resolve(ind_path) : "");
+				if (stream) {
+					// CreateGpuRes streams it, the textures decode as usual.
+					fiber.map_bc_path = resolve(base_color_path);
+					fiber.map_sro_path = resolve(spec_offset_path);
+					continue;
+				}
+				loads.push_back(jobs.Run([&fiber, ind_path = resolve(ind_path),
+					base_color_path = resolve(base_color_path), spec_offset_path = resolve(spec_offset_path)]() {
+					fiber.LoadFromFile(ind_path, base_color_path, spec_offset_path);
+				}));
+			}
+			else if (cmd == "hair_material") {
+				HairMaterial material;
+				expect(static_cast<bool>(in >> material.name >> material.radius_scale >> material.transparency_scale));
+				hair_materials.push_back(material);
+			}
+			else if (cmd == "sun") {
+				sun_light_dir = read_vec3();
+			}
+			else if (cmd == "camera") {
+				camera_eye = read_vec3();
+				camera_target = read_vec3();
+				has_camera = true;
+			}
+			else if (cmd == "instance") {
+				std::string asset;
+				expect(static_cast<bool>(in >> asset));
+
+				SceneInstance instance;
+				instance.material = 0;
+				xy::vec3 translate{ 0.f }, axis{ 0.f, 1.f, 0.f };
+				float degrees = 0.f, scale = 1.f;
+
+				std::string key;
+				while (in >> key) {
+					if (key == "material") {
+						std::string material;
+						expect(static_cast<bool>(in >> material));
+						instance.material = 0;
+						while (instance.material < hair_materials.size() && hair_materials[instance.material].name != material)
+							++instance.material;
+						if (instance.material == hair_materials.size())
+							XY_Die(where + "unknown hair material " + material);
+					}
+					else if (key == "translate") {
+						translate = read_vec3();
+					}
+					else if (key == "rotate") {
+						axis = read_vec3();
+						expect(static_cast<bool>(in >> degrees));
+					}
+					else if (key == "scale") {
+						expect(static_cast<bool>(in >> scale));
+					}
+					else {
+						XY_Die(where + "unknown instance key " + key);
+					}
+				}
+
+				instance.model_matrix =
+					xy::Translation(translate) *
+					xy::QuatToMat4(xy::AngleAxisToQuat(xy::DegreeToRadian(degrees), axis)) *
+					xy::Scale(xy::vec3(scale));
+
+				int mesh = find(mesh_names, asset), fiber = find(fiber_names, asset);
+				if (mesh < mesh_names.size()) {
+					instance.asset = mesh;
+					mesh_instances.push_back(instance);
+				}
+				else if (fiber < fiber_names.size()) {
+					instance.asset = fiber;
+					fiber_instances.push_back(instance);
+				}
+				else {
+					XY_Die(where + "unknown asset " + asset);
+				}
+			}
+			else {
+				XY_Die(where + "unknown statement " + cmd);
+			}
+		}
+
+		for (const auto &load : loads)
+			jobs.Wait(load);
+
+		mesh_bounds.clear();
+		for (const auto &mesh : meshes) {
+			AABB mesh_bound;
+			for (const auto &shape : mesh.shapes)
+				for (const auto &blob : shape.blobs)
+					mesh_bound.Extend(blob.positions);
+			mesh_bounds.push_back(mesh_bound);
+		}
+
+		Build();
+	}, 1);
+
+	if (NumInstances() == 0)
+		XY_Die(path + " places no instance");
+}
+
+void Scene::Build()
+{
+	mesh_batches.clear();
+	fiber_batches.clear();
+	bounds = AABB();
+
+	auto by_state = [](const SceneInstance &a, const SceneInstance &b) {
+		return a.asset != b.asset ? a.asset < b.asset : a.material < b.material;
+	};
+	std::stable_sort(mesh_instances.begin(), mesh_instances.end(), by_state);
+	std::stable_sort(fiber_instances.begin(), fiber_instances.end(), by_state);
+
+	auto batch = [&by_state](const std::vector<SceneInstance> &instances, std::vector<SceneBatch> &batches) {
+		int asset_first = 0;
+		for (int i = 0; i < instances.size(); ++i) {
+			const auto &instance = instances[i];
+			if (i == 0 || instance.asset != instances[i - 1].asset)
+				asset_first = i;
+			if (i == 0 || by_state(instances[i - 1], instance))
+				batches.push_back({ instance.asset, instance.material, i - asset_first, 0 });
+			++batches.back().num_instances;
+		}
+	};
+	batch(mesh_instances, mesh_batches);
+	batch(fiber_instances, fiber_batches);
+
+	auto extend = [this](const SceneInstance &instance, const AABB &local) {
+		for (int corner = 0; corner < 8; ++corner) {
+			xy::vec4 p(
+				corner & 1 ? local.sup.x : local.inf.x,
+				corner & 2 ? local.sup.y : local.inf.y,
+				corner & 4 ? local.sup.z : local.inf.z,
+				1.f);
+			auto q = instance.model_matrix * p;
+			bounds.Extend(xy::vec3(q.x, q.y, q.z));
+		}
+	};
+	for (const auto &instance : mesh_instances)
+		extend(instance, mesh_bounds[instance.asset]);
+	for (const auto &instance : fiber_instances)
+		extend(instance, fibers[instance.asset].bounds);
+}
+
+void Scene::CreateGpuRes()
+{
+	// Textures decode on the workers, each asset uploads on this thread
+	// once its own are decoded.
+	auto &jobs = JobSystem::Global();
+	std::vector<JobSystem::Job> uploads;
+	for (auto &mesh : meshes) {
+		auto decode = jobs.Run([&mesh]() { mesh.DecodeTextures(); });
+		uploads.push_back(jobs.Run([&mesh]() { mesh.CreateGpuRes(); }, { decode }, JobAffinity::Main));
+	}
+	bool any_streamed = false;
+	for (int i = 0; i < fibers.size(); ++i) {
+		auto &fiber = fibers[i];
+		const auto &stream_path = fiber_stream_paths[i];
+		auto decode = jobs.Run([&fiber]() { fiber.DecodeTextures(); });
+		uploads.push_back(jobs.Run([&fiber, &stream_path]() {
+			if (!stream_path.empty())
+				fiber.StreamFromFile(stream_path, fiber.map_bc_path, fiber.map_sro_path);
+			fiber.CreateGpuRes();
+		}, { decode }, JobAffinity::Main));
+		any_streamed |= !stream_path.empty();
+	}
+	for (const auto &upload : uploads)
+		jobs.Wait(upload);
+
+	// Streamed grooms are bounded only now.
+	if (any_streamed)
+		Build();
+	UploadInstances();
+}
+
+namespace
+{
+
+// Normal matrices are derived here once per instance and frame.
+std::vector<InstanceTransform> InstanceTransforms(const std::vector<SceneInstance> &instances, int asset)
+{
+	std::vector<InstanceTransform> transforms;
+	for (const auto &instance : instances)
+		if (instance.asset == asset)
+			transforms.push_back(InstanceTransform::FromModel(instance.model_matrix));
+	return transforms;
+}
+
+}
+
+void Scene::UploadInstances()
+{
+	for (int i = 0; i < meshes.size(); ++i) {
+		auto transforms = InstanceTransforms(mesh_instances, i);
+		for (auto &shape : meshes[i].shapes)
+			for (auto &vao : shape.vaos)
+				vao.SubmitInstances(transforms);
+	}
+	for (int i = 0; i < fibers.size(); ++i)
+		fibers[i].vao.SubmitInstances(InstanceTransforms(fiber_instances, i));
+}
+
+void Scene::StreamInstances(StreamBuffer &stream)
+{
+	for (int i = 0; i < meshes.size(); ++i) {
+		auto transforms = InstanceTransforms(mesh_instances, i);
+		auto alloc = stream.Write(transforms, StreamUse::Vertex);
+		for (auto &shape : meshes[i].shapes)
+			for (auto &vao : shape.vaos)
+				vao.StreamInstances(alloc, static_cast<int>(transforms.size()));
+	}
+	for (int i = 0; i < fibers.size(); ++i) {
+		auto transforms = InstanceTransforms(fiber_instances, i);
+		fibers[i].vao.StreamInstances(stream.Write(transforms, StreamUse::Vertex), static_cast<int>(transforms.size()));
+	}
+}
@@ -4,44 +4,75 @@
 #include "xy_ext.h"
 
 
-GLuint CreateShader(GLenum type, std::string code)
+static const char *ShaderTypeName(GLenum type)
+{
+	switch (type) {
+	case GL_VERTEX_SHADER:
+		return "Vertex shader";
+	case GL_FRAGMENT_SHADER:
+		return "Fragment shader";
+	case GL_GEOMETRY_SHADER:
+		return "Geometry shader";
+	case GL_COMPUTE_SHADER:
+		return "Compute shader";
+	default:
+		XY_Die("Unknown shader type");
+	}
+	return nullptr;
+}
+
+bool CompileShader(GLenum type, const std::string &code, GLuint &shader, std::string &log)
 {
-	GLuint shader_handle = glCreateShader(type);
+	shader = glCreateShader(type);
 	auto code_ = code.c_str();
-	glShaderSource(shader_handle, 1, &code_, nullptr);
-	glCompileShader(shader_handle);
+	glShaderSource(shader, 1, &code_, nullptr);
+	glCompileShader(shader);
 
 	int success = 0, log_len = 0;
-	glGetShaderiv(shader_handle, GL_COMPILE_STATUS, &success);
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+	if (success)
+		return true;
+
+	glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &log_len);
+	if (log_len <= 0)
+		log = std::string(ShaderTypeName(type)) + ": no log found";
+	else {
+		std::string info(log_len, '\0');
+		glGetShaderInfoLog(shader, log_len, &log_len, &info[0]);
+		log = std::string(ShaderTypeName(type)) + " compile log: " + info.c_str();
+	}
+	glDeleteShader(shader);
+	shader = 0;
+	return false;
+}
 
-	if (!success) {
-		std::string shader_type_name{ "Unknown shader" };
-		switch (type) {
-		case GL_VERTEX_SHADER:
-			shader_type_name = "Vertex shader";
-			break;
-		case GL_FRAGMENT_SHADER:
-			shader_type_name = "Fragment shader";
-			break;
-		case GL_GEOMETRY_SHADER:
-			shader_type_name = "Geometry shader";
-			break;
-		case GL_COMPUTE_SHADER:
-			shader_type_name = "Compute shader";
-			break;
-		default:
-			XY_Die("Unknown shader type");
-		}
+bool LinkProgram(GLuint program, std::string &log)
+{
+	glLinkProgram(program);
 
-		glGetShaderiv(shader_handle, GL_INFO_LOG_LENGTH, &log_len);
-		if (log_len <= 0)
-			xy::Print("{}: no log found", shader_type_name);
-		else {
-			auto log = std::unique_ptr<char>(new char[log_len]);
-			glGetShaderInfoLog(shader_handle, log_len, &log_len, log.get());
-			xy::Print("{} compile log: {}", shader_type_name, log.get());
-		}
-		XY_Die(shader_type_name + " compile error");
+	int success = 0, log_len = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (success)
+		return true;
+
+	glGetProgramiv(program, GL_INFO_LOG_LENGTH, &log_len);
+	if (log_len <= 0)
+		log = "No log found";
+	else {
+		std::string info(log_len, '\0');
+		glGetProgramInfoLog(program, log_len, nullptr, &info[0]);
+		log = std::string("Program compile log: ") + info.c_str();
+	}
+	return false;
+}
+
+GLuint CreateShader(GLenum type, std::string code)
+{
+	GLuint shader_handle;
+	std::string log;
+	if (!CompileShader(type, code, shader_handle, log)) {
+		xy::Print("{}", log);
+		XY_Die(std::string(ShaderTypeName(type)) + " compile error");
 	}
 	return shader_handle;
 }
@@ -70,6 +101,8 @@ void Shader::Init(std::string comp_shader)
 {
 	GLuint compobj = CreateShader(GL_COMPUTE_SHADER, comp_shader);
 
+	// Re-initializing replaces the program.
+	glDeleteProgram(handle_);
 	handle_ = glCreateProgram();
 	glAttachShader(handle_, compobj);
 	glLinkProgram(handle_);
@@ -84,6 +117,8 @@ void Shader::Init(std::string vert_shader, std::string frag_shader)
 	auto vertobj = CreateShader(GL_VERTEX_SHADER, vert_shader);
 	auto fragobj = CreateShader(GL_FRAGMENT_SHADER, frag_shader);
 
+	// Re-initializing replaces the program.
+	glDeleteProgram(handle_);
 	handle_ = glCreateProgram();
 	glAttachShader(handle_, vertobj);
 	glAttachShader(handle_, fragobj);
@@ -101,6 +136,8 @@ void Shader::Init(std::string vert_shader, std::string geom_shader, std::string
 	auto geomobj = CreateShader(GL_GEOMETRY_SHADER, geom_shader);
 	auto fragobj = CreateShader(GL_FRAGMENT_SHADER, frag_shader);
 
+	// Re-initializing replaces the program.
+	glDeleteProgram(handle_);
 	handle_ = glCreateProgram();
 	glAttachShader(handle_, vertobj);
 	glAttachShader(handle_, geomobj);
@@ -114,9 +151,35 @@ void Shader::Init(std::string vert_shader, std::string geom_shader, std::string
 	glDeleteShader(fragobj);
 }
 
+void Shader::Init(const std::vector<ShaderStage> &stages)
+{
+	ShaderLibrary::Global().Build(*this, stages);
+}
+
 Shader::~Shader()
 {
+	ShaderLibrary::Global().Forget(*this);
 	glDeleteProgram(handle_);
 }
 
-GLuint Shader::Get() { return handle_; }
\ No newline at end of file
+GLuint Shader::Get() { return handle_; }
+
+void ShaderVariants::Init(const std::vector<ShaderStage> &stages)
+{
+	stages_ = stages;
+	variants_.clear();
+}
+
+Shader &ShaderVariants::Get(const ShaderDefines &defines)
+{
+	auto &variant = variants_[defines];
+	if (!variant) {
+		auto stages = stages_;
+		for (auto &stage : stages)
+			for (const auto &define : defines)
+				stage.defines[define.first] = define.second;
+		variant.reset(new Shader);
+		variant->Init(stages);
+	}
+	return *variant;
+}
\ No newline at end of file
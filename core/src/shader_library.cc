@@ -0,0 +1,486 @@
+#include "shader_library.h"
+
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <algorithm>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <climits>
+#endif
+#ifdef _WIN32
+#include <direct.h>
+#endif
+#include "shader.h"
+#include "xy_ext.h"
+
+
+namespace
+{
+
+bool ReadText(const std::string &path, std::string &text)
+{
+	std::ifstream fin(path, std::ios::binary);
+	if (!fin)
+		return false;
+	std::ostringstream ss;
+	ss << fin.rdbuf();
+	text = ss.str();
+	return true;
+}
+
+std::string DirOf(const std::string &path)
+{
+	auto slash = path.find_last_of("/\\");
+	return slash == std::string::npos ? "." : path.substr(0, slash);
+}
+
+long long ModifiedTime(const std::string &path)
+{
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+		return -1;
+	return static_cast<long long>(info.st_mtime);
+}
+
+std::uint64_t Fnv1a(std::uint64_t hash, const std::string &bytes)
+{
+	for (unsigned char c : bytes) {
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// The name of an #include "name" line.
+bool ParseInclude(const std::string &line, std::string &name)
+{
+	std::istringstream in(line);
+	std::string directive;
+	if (!(in >> directive) || directive != "#include")
+		return false;
+	in >> std::quoted(name);
+	return !name.empty();
+}
+
+// Pastes included files in place, each once, the first time it is
+// included. #line directives keep compile logs pointing at the right file
+// and line; their source string number indexes files.
+bool ExpandIncludes(const std::string &path, std::vector<std::string> &files, std::string &source, std::string &log)
+{
+	std::string text;
+	if (!ReadText(path, text)) {
+		log = "failed to read " + path;
+		return false;
+	}
+	auto file_no = std::to_string(files.size());
+	files.push_back(path);
+
+	std::istringstream in(text);
+	std::string line, name;
+	for (int line_no = 1; std::getline(in, line); ++line_no) {
+		if (!ParseInclude(line, name)) {
+			source += line + '\n';
+			continue;
+		}
+
+		auto include_path = DirOf(path) + "/" + name;
+		if (std::find(files.begin(), files.end(), include_path) != files.end()) {
+			source += '\n';
+			continue;
+		}
+
+		source += "#line 1 " + std::to_string(files.size()) + "\n";
+		if (!ExpandIncludes(include_path, files, source, log)) {
+			log = path + ":" + std::to_string(line_no) + ": " + log;
+			return false;
+		}
+		source += "#line " + std::to_string(line_no + 1) + " " + file_no + "\n";
+	}
+	return true;
+}
+
+// Header of a cached binary, followed by the driver string and the blob.
+const char binary_magic[4] = { 'X', 'Y', 'P', 'B' };
+
+}
+
+ShaderLibrary &ShaderLibrary::Global()
+{
+	static ShaderLibrary library;
+	return library;
+}
+
+ShaderLibrary::ShaderLibrary()
+	:
+	stats_{ 0, 0, 0, 0, 0, 0, 0. },
+	watching_{ false },
+	inotify_fd_{ -1 }
+{}
+
+void ShaderLibrary::SetCacheDir(const std::string &dir)
+{
+	cache_dir_ = dir;
+	if (cache_dir_.empty())
+		return;
+#ifdef _WIN32
+	_mkdir(cache_dir_.c_str());
+#else
+	mkdir(cache_dir_.c_str(), 0755);
+#endif
+}
+
+bool ShaderLibrary::ReadSources(const std::vector<ShaderStage> &stages, std::vector<StageSource> &sources, std::string &log)
+{
+	sources.clear();
+	for (const auto &stage : stages) {
+		StageSource source;
+		if (!ExpandIncludes(stage.path, source.files, source.text, log))
+			return false;
+
+		if (!stage.defines.empty()) {
+			// #version has to come first.
+			auto version = source.text.find("#version");
+			if (version == std::string::npos) {
+				log = stage.path + ": defines need a #version line";
+				return false;
+			}
+			auto line_end = source.text.find('\n', version);
+			int version_line = 1 + static_cast<int>(std::count(source.text.begin(), source.text.begin() + version, '\n'));
+
+			std::string defines;
+			for (const auto &define : stage.defines)
+				defines += "#define " + define.first + " " + define.second + "\n";
+			defines += "#line " + std::to_string(version_line + 1) + " 0\n";
+			source.text.insert(line_end + 1, defines);
+		}
+		sources.push_back(source);
+	}
+	return true;
+}
+
+std::string ShaderLibrary::CacheKey(const std::vector<ShaderStage> &stages, const std::vector<StageSource> &sources)
+{
+	auto hash = Fnv1a(14695981039346656037ull, driver_);
+	for (std::size_t i = 0; i < stages.size(); ++i) {
+		hash = Fnv1a(hash, std::to_string(stages[i].type) + '\0');
+		hash = Fnv1a(hash, sources[i].text + '\0');
+	}
+
+	char key[17];
+	std::snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash));
+	return key;
+}
+
+GLuint ShaderLibrary::LoadBinary(const std::string &key)
+{
+	if (cache_dir_.empty())
+		return 0;
+
+	std::string blob;
+	if (!ReadText(cache_dir_ + "/" + key + ".bin", blob))
+		return 0;
+
+	// Magic, driver length, driver, format, binary.
+	std::size_t pos = 0;
+	auto read_u32 = [&blob, &pos](std::uint32_t &value) {
+		if (pos + sizeof(value) > blob.size())
+			return false;
+		std::memcpy(&value, blob.data() + pos, sizeof(value));
+		pos += sizeof(value);
+		return true;
+	};
+
+	std::uint32_t driver_len, format;
+	if (blob.compare(0, 4, binary_magic, 4) != 0)
+		return 0;
+	pos = 4;
+	if (!read_u32(driver_len) || pos + driver_len > blob.size() || blob.compare(pos, driver_len, driver_) != 0)
+		return 0;
+	pos += driver_len;
+	if (!read_u32(format) || pos >= blob.size())
+		return 0;
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, format, blob.data() + pos, static_cast<GLsizei>(blob.size() - pos));
+
+	int success = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (!success) {
+		// Same driver string, yet refused; rebuilt and overwritten.
+		glDeleteProgram(program);
+		++stats_.num_stale_binaries;
+		return 0;
+	}
+	return program;
+}
+
+void ShaderLibrary::StoreBinary(const std::string &key, GLuint program)
+{
+	if (cache_dir_.empty())
+		return;
+
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	std::string binary(length, '\0');
+	GLenum format;
+	glGetProgramBinary(program, length, nullptr, &format, &binary[0]);
+
+	std::ofstream fout(cache_dir_ + "/" + key + ".bin", std::ios::binary);
+	if (!fout) {
+		xy::Print("failed to write the shader cache in {}\n", cache_dir_);
+		return;
+	}
+
+	auto driver_len = static_cast<std::uint32_t>(driver_.size());
+	auto format_u32 = static_cast<std::uint32_t>(format);
+	fout.write(binary_magic, 4);
+	fout.write(reinterpret_cast<const char*>(&driver_len), sizeof(driver_len));
+	fout.write(driver_.data(), driver_.size());
+	fout.write(reinterpret_cast<const char*>(&format_u32), sizeof(format_u32));
+	fout.write(binary.data(), binary.size());
+}
+
+GLuint ShaderLibrary::Compile(const std::vector<ShaderStage> &stages, const std::vector<StageSource> &sources, std::string &log)
+{
+	std::vector<GLuint> objs;
+	auto release = [&objs]() {
+		for (auto obj : objs)
+			glDeleteShader(obj);
+	};
+
+	for (std::size_t i = 0; i < stages.size(); ++i) {
+		GLuint obj;
+		if (!CompileShader(stages[i].type, sources[i].text, obj, log)) {
+			// Logs name files by source string number.
+			std::string legend;
+			for (std::size_t j = 0; j < sources[i].files.size(); ++j)
+				legend += "  " + std::to_string(j) + ": " + sources[i].files[j] + "\n";
+			log = stages[i].path + ": " + log + legend;
+			release();
+			return 0;
+		}
+		objs.push_back(obj);
+	}
+
+	GLuint program = glCreateProgram();
+	for (auto obj : objs)
+		glAttachShader(program, obj);
+	glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+	bool linked = LinkProgram(program, log);
+	for (auto obj : objs)
+		glDetachShader(program, obj);
+	release();
+
+	if (!linked) {
+		log = stages.front().path + ": " + log;
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+void ShaderLibrary::Build(Shader &shader, const std::vector<ShaderStage> &stages)
+{
+	auto begin = Clock::now();
+
+	if (driver_.empty())
+		driver_ =
+			std::string(reinterpret_cast<const char*>(glGetString(GL_VENDOR))) + "|" +
+			reinterpret_cast<const char*>(glGetString(GL_RENDERER)) + "|" +
+			reinterpret_cast<const char*>(glGetString(GL_VERSION));
+
+	std::vector<StageSource> sources;
+	std::string log;
+	if (!ReadSources(stages, sources, log))
+		XY_Die(log);
+
+	auto key = CacheKey(stages, sources);
+	GLuint program = LoadBinary(key);
+	if (program != 0) {
+		++stats_.num_cache_hits;
+	}
+	else {
+		program = Compile(stages, sources, log);
+		if (program == 0) {
+			xy::Print("{}\n", log);
+			XY_Die("shader build failed");
+		}
+		++stats_.num_compiled;
+		StoreBinary(key, program);
+	}
+
+	glDeleteProgram(shader.handle_);
+	shader.handle_ = program;
+
+	auto &entry = programs_[&shader];
+	entry.stages = stages;
+	entry.files.clear();
+	for (const auto &source : sources)
+		entry.files.insert(source.files.begin(), source.files.end());
+	stats_.num_programs = programs_.size();
+
+	if (watching_)
+		WatchFiles(entry);
+
+	stats_.build_ms += std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+}
+
+void ShaderLibrary::Forget(Shader &shader)
+{
+	programs_.erase(&shader);
+	stats_.num_programs = programs_.size();
+}
+
+void ShaderLibrary::Watch()
+{
+	if (watching_)
+		return;
+	watching_ = true;
+
+#ifdef __linux__
+	inotify_fd_ = inotify_init1(IN_NONBLOCK);
+	if (inotify_fd_ < 0)
+		xy::Print("inotify unavailable, polling shader files\n");
+#endif
+
+	last_scan_ = Clock::now();
+	for (const auto &program : programs_)
+		WatchFiles(program.second);
+}
+
+void ShaderLibrary::WatchFiles(const Program &program)
+{
+	for (const auto &path : program.files)
+		WatchPath(path);
+}
+
+void ShaderLibrary::WatchPath(const std::string &path)
+{
+	if (inotify_fd_ < 0) {
+		if (mtimes_.count(path) == 0)
+			mtimes_[path] = ModifiedTime(path);
+		return;
+	}
+
+#ifdef __linux__
+	auto dir = DirOf(path);
+	for (const auto &watch : watch_dirs_)
+		if (watch.second == dir)
+			return;
+
+	// Editors either rewrite a file or rename a new one over it.
+	int wd = inotify_add_watch(inotify_fd_, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (wd < 0)
+		xy::Print("failed to watch {}\n", dir);
+	else
+		watch_dirs_[wd] = dir;
+#endif
+}
+
+std::set<std::string> ShaderLibrary::ChangedPaths()
+{
+	std::set<std::string> changed;
+
+	if (inotify_fd_ < 0) {
+		// Stat every file at most twice a second.
+		auto now = Clock::now();
+		if (now - last_scan_ < std::chrono::milliseconds(500))
+			return changed;
+		last_scan_ = now;
+
+		for (auto &file : mtimes_) {
+			auto mtime = ModifiedTime(file.first);
+			if (mtime != file.second) {
+				file.second = mtime;
+				changed.insert(file.first);
+			}
+		}
+		return changed;
+	}
+
+#ifdef __linux__
+	alignas(inotify_event) char buf[16 * (sizeof(inotify_event) + NAME_MAX + 1)];
+	while (true) {
+		auto len = read(inotify_fd_, buf, sizeof(buf));
+		if (len <= 0)
+			break;
+		for (char *p = buf; p < buf + len;) {
+			auto event = reinterpret_cast<const inotify_event*>(p);
+			auto dir = watch_dirs_.find(event->wd);
+			if (dir != watch_dirs_.end() && event->len > 0)
+				changed.insert(dir->second + "/" + event->name);
+			p += sizeof(inotify_event) + event->len;
+		}
+	}
+#endif
+	return changed;
+}
+
+int ShaderLibrary::Poll()
+{
+	if (!watching_)
+		return 0;
+
+	auto changed = ChangedPaths();
+	if (changed.empty())
+		return 0;
+
+	int num_rebuilt = 0;
+	for (auto &program : programs_) {
+		const auto &stages = program.second.stages;
+
+		bool stale = false;
+		for (const auto &path : program.second.files)
+			stale = stale || changed.count(path) > 0;
+		if (!stale)
+			continue;
+
+		auto begin = Clock::now();
+		std::vector<StageSource> sources;
+		std::string log;
+		GLuint handle = 0;
+		if (ReadSources(stages, sources, log))
+			handle = Compile(stages, sources, log);
+		if (handle == 0) {
+			// The frame loop goes on with the old program.
+			xy::Print("reload failed, {}\n", log);
+			++stats_.num_failed_reloads;
+			continue;
+		}
+
+		StoreBinary(CacheKey(stages, sources), handle);
+
+		auto &shader = *program.first;
+		glDeleteProgram(shader.handle_);
+		shader.handle_ = handle;
+
+		// The edit may have added includes.
+		for (const auto &source : sources)
+			program.second.files.insert(source.files.begin(), source.files.end());
+		WatchFiles(program.second);
+
+		++stats_.num_reloads;
+		++num_rebuilt;
+		stats_.build_ms += std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+		xy::Print("reloaded {}\n", stages.front().path);
+	}
+	return num_rebuilt;
+}
+
+ShaderLibrary::~ShaderLibrary()
+{
+#ifdef __linux__
+	if (inotify_fd_ >= 0)
+		close(inotify_fd_);
+#endif
+}
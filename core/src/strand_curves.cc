@@ -0,0 +1,290 @@
+#include "strand_curves.h"
+
+#include <cmath>
+#include <chrono>
+#include "xy_ext.h"
+#include "asset.h"
+
+
+namespace
+{
+
+// Second derivative of the segment from p1 to p2, for the closest point.
+xy::vec3 SecondDerivative(const xy::vec3 &p0, const xy::vec3 &p1, const xy::vec3 &p2, const xy::vec3 &p3, float t)
+{
+	return (2.f*p0 - 5.f*p1 + 4.f*p2 - p3) + 3.f*t*(-p0 + 3.f*p1 - 3.f*p2 + p3);
+}
+
+// Distance of v to the segment, from t0 on by Newton steps on the
+// squared distance.
+float CurveDistance(const xy::vec3 &p0, const xy::vec3 &p1, const xy::vec3 &p2, const xy::vec3 &p3, float t0, const xy::vec3 &v)
+{
+	float t = t0;
+	for (int i = 0; i < 4; ++i) {
+		auto d = StrandCurves::Evaluate(p0, p1, p2, p3, t) - v;
+		auto d1 = StrandCurves::Derivative(p0, p1, p2, p3, t);
+		auto d2 = SecondDerivative(p0, p1, p2, p3, t);
+		float num = xy::Dot(d, d1);
+		float den = xy::Dot(d1, d1) + xy::Dot(d, d2);
+		if (den <= 0.f)
+			break;
+		t = xy::Clamp(t - num / den, 0.f, 1.f);
+	}
+	return xy::Min(
+		(StrandCurves::Evaluate(p0, p1, p2, p3, t) - v).Norm(),
+		(StrandCurves::Evaluate(p0, p1, p2, p3, t0) - v).Norm());
+}
+
+// Greedy fit of one fiber of n vertices: indices of the vertices kept,
+// and how far the others are from the curve through them.
+std::vector<int> FitFiber(const xy::vec3 *v, int n, float tolerance, float &max_error)
+{
+	max_error = 0.f;
+	if (n <= 2) {
+		std::vector<int> kept;
+		for (int i = 0; i < n; ++i)
+			kept.push_back(i);
+		return kept;
+	}
+
+	// Dropped vertices start from their arc length share of the span.
+	std::vector<float> arc(n, 0.f);
+	for (int i = 1; i < n; ++i)
+		arc[i] = arc[i - 1] + (v[i] - v[i - 1]).Norm();
+
+	std::vector<int> kept{ 0, n - 1 };
+	// Per span between kept[i] and kept[i+1], its farthest vertex.
+	std::vector<float> span_error;
+	std::vector<int> span_worst;
+
+	auto control = [&](int i) {
+		int m = static_cast<int>(kept.size());
+		if (i < 0)
+			return 2.f*v[kept[0]] - v[kept[1]];
+		if (i >= m)
+			return 2.f*v[kept[m - 1]] - v[kept[m - 2]];
+		return v[kept[i]];
+	};
+	auto measure = [&](int span) {
+		int a = kept[span], b = kept[span + 1];
+		auto p0 = control(span - 1), p1 = control(span), p2 = control(span + 1), p3 = control(span + 2);
+		float len = arc[b] - arc[a];
+		span_error[span] = 0.f;
+		span_worst[span] = -1;
+		for (int k = a + 1; k < b; ++k) {
+			float t0 = len > 0.f ? (arc[k] - arc[a]) / len : static_cast<float>(k - a) / (b - a);
+			float error = CurveDistance(p0, p1, p2, p3, t0, v[k]);
+			if (error > span_error[span]) {
+				span_error[span] = error;
+				span_worst[span] = k;
+			}
+		}
+	};
+
+	span_error.resize(1);
+	span_worst.resize(1);
+	measure(0);
+
+	for (;;) {
+		int worst = 0;
+		for (int i = 1; i < static_cast<int>(span_error.size()); ++i)
+			if (span_error[i] > span_error[worst])
+				worst = i;
+		if (span_error[worst] <= tolerance) {
+			max_error = span_error[worst];
+			break;
+		}
+
+		// The new control changes its span and the ends of the neighbors.
+		kept.insert(kept.begin() + worst + 1, span_worst[worst]);
+		span_error.insert(span_error.begin() + worst + 1, 0.f);
+		span_worst.insert(span_worst.begin() + worst + 1, -1);
+		int num_spans = static_cast<int>(span_error.size());
+		for (int i = xy::Max(worst - 1, 0); i <= xy::Min(worst + 2, num_spans - 1); ++i)
+			measure(i);
+	}
+
+	for (auto error : span_error)
+		max_error = xy::Max(max_error, error);
+	return kept;
+}
+
+}
+
+StrandCurves::StrandCurves()
+	:
+	max_resampled_verts_{ 0 },
+	stats_{ 0, 0, 0, 0.f, 0, 0, 0, 0. }
+{}
+
+void StrandCurves::Fit(const FiberAsset &asset, float tolerance, JobSystem &jobs)
+{
+	Fit(asset.positions, asset.scales, asset.num_verts_per_fiber, tolerance, jobs);
+}
+
+void StrandCurves::Fit(
+	const std::vector<xy::vec3> &positions,
+	const std::vector<float> &scales,
+	const std::vector<int> &num_verts_per_fiber,
+	float tolerance,
+	JobSystem &jobs)
+{
+	if (positions.size() != scales.size())
+		XY_Die("curves are fitted to fibers with scales");
+
+	auto op_time = std::chrono::steady_clock::now();
+
+	int num_fibers = static_cast<int>(num_verts_per_fiber.size());
+	std::vector<std::size_t> first_vert(num_fibers + 1, 0);
+	for (int i = 0; i < num_fibers; ++i)
+		first_vert[i + 1] = first_vert[i] + num_verts_per_fiber[i];
+	if (first_vert.back() != positions.size())
+		XY_Die("fiber vertex counts do not add up");
+
+	std::vector<std::vector<int>> kept(num_fibers);
+	std::vector<float> max_error(num_fibers, 0.f);
+	jobs.ParallelFor(0, num_fibers, 256, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
+			kept[i] = FitFiber(positions.data() + first_vert[i], num_verts_per_fiber[i], tolerance, max_error[i]);
+	});
+
+	controls_.clear();
+	curves_.clear();
+	curves_.reserve(num_fibers);
+	stats_.max_error = 0.f;
+
+	for (int i = 0; i < num_fibers; ++i) {
+		if (kept[i].size() < 2)
+			continue;
+		Curve curve;
+		curve.first_control = static_cast<std::uint32_t>(controls_.size());
+		curve.num_controls = static_cast<std::uint32_t>(kept[i].size());
+		curves_.push_back(curve);
+
+		for (auto k : kept[i]) {
+			const auto &p = positions[first_vert[i] + k];
+			controls_.emplace_back(p.x, p.y, p.z, scales[first_vert[i] + k]);
+		}
+		stats_.max_error = xy::Max(stats_.max_error, max_error[i]);
+	}
+	max_resampled_verts_ = positions.size() / 2;
+
+	stats_.num_curves = static_cast<int>(curves_.size());
+	stats_.num_dense_verts = positions.size();
+	stats_.num_controls = controls_.size();
+	stats_.dense_bytes = positions.size() * (2 * sizeof(xy::vec3) + sizeof(float));
+	stats_.curve_bytes = controls_.size() * sizeof(xy::vec4) + curves_.size() * sizeof(Curve);
+	stats_.resampled_bytes = ResampledBytes(max_resampled_verts_);
+	stats_.fit_ms = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - op_time).count();
+}
+
+xy::vec3 StrandCurves::Evaluate(const xy::vec3 &p0, const xy::vec3 &p1, const xy::vec3 &p2, const xy::vec3 &p3, float t)
+{
+	auto a = -p0 + 3.f*p1 - 3.f*p2 + p3;
+	auto b = 2.f*p0 - 5.f*p1 + 4.f*p2 - p3;
+	auto c = p2 - p0;
+	return .5f*(((a*t + b)*t + c)*t + 2.f*p1);
+}
+
+xy::vec3 StrandCurves::Derivative(const xy::vec3 &p0, const xy::vec3 &p1, const xy::vec3 &p2, const xy::vec3 &p3, float t)
+{
+	auto a = -p0 + 3.f*p1 - 3.f*p2 + p3;
+	auto b = 2.f*p0 - 5.f*p1 + 4.f*p2 - p3;
+	auto c = p2 - p0;
+	return .5f*((3.f*a*t + 2.f*b)*t + c);
+}
+
+int StrandCurves::Subdivisions(
+	const xy::mat4 &model_view_proj, const xy::vec2 &win_size, float pixels_per_piece,
+	const xy::vec3 &a, const xy::vec3 &b)
+{
+	auto ca = model_view_proj * xy::vec4(a.x, a.y, a.z, 1.f);
+	auto cb = model_view_proj * xy::vec4(b.x, b.y, b.z, 1.f);
+	if (ca.w <= 1e-6f || cb.w <= 1e-6f)
+		return max_subdivisions;
+
+	auto dx = (ca.x / ca.w - cb.x / cb.w) * .5f * win_size.x;
+	auto dy = (ca.y / ca.w - cb.y / cb.w) * .5f * win_size.y;
+	float pixels = std::sqrt(dx*dx + dy*dy);
+	int pieces = static_cast<int>(std::ceil(pixels / xy::Max(pixels_per_piece, 1e-3f)));
+	return xy::Min(xy::Max(pieces, 1), max_subdivisions);
+}
+
+xy::vec3 StrandCurves::Control(const Curve &curve, int i) const
+{
+	auto at = [&](int k) {
+		const auto &c = controls_[curve.first_control + k];
+		return xy::vec3(c.x, c.y, c.z);
+	};
+	int n = static_cast<int>(curve.num_controls);
+	if (i < 0)
+		return 2.f*at(0) - at(1);
+	if (i >= n)
+		return 2.f*at(n - 1) - at(n - 2);
+	return at(i);
+}
+
+std::size_t StrandCurves::ResampledBytes(std::size_t max_resampled_verts)
+{
+	// Vertices, and a pair of indices per segment, fewer than vertices.
+	return max_resampled_verts * (2 * sizeof(xy::vec3) + sizeof(float) + 2 * sizeof(std::uint32_t));
+}
+
+int StrandCurves::Resample(
+	const xy::mat4 &model_view_proj, const xy::vec2 &win_size, float pixels_per_piece,
+	std::vector<xy::vec3> &positions,
+	std::vector<xy::vec3> &tangents,
+	std::vector<float> &scales,
+	std::vector<std::uint32_t> &lines) const
+{
+	// Pieces of every segment, and their sums under every cap, counted
+	// ahead as strand_count.comp does.
+	std::vector<int> pieces;
+	pieces.reserve(controls_.size());
+	std::size_t num_segments[num_caps] = {};
+	for (const auto &curve : curves_)
+		for (int s = 0; s < static_cast<int>(curve.num_controls) - 1; ++s) {
+			pieces.push_back(Subdivisions(model_view_proj, win_size, pixels_per_piece, Control(curve, s), Control(curve, s + 1)));
+			for (int level = 0; level < num_caps; ++level)
+				num_segments[level] += xy::Min(pieces.back(), max_subdivisions >> level);
+		}
+	int level = 0;
+	while (level < num_caps - 1 && num_segments[level] + curves_.size() > max_resampled_verts_)
+		++level;
+	int max_pieces = max_subdivisions >> level;
+
+	positions.clear();
+	tangents.clear();
+	scales.clear();
+	lines.clear();
+
+	std::size_t piece = 0;
+	for (const auto &curve : curves_) {
+		int n = static_cast<int>(curve.num_controls);
+		xy::vec3 p0, p1, p2, p3;
+		for (int s = 0; s < n - 1; ++s, ++piece) {
+			p0 = Control(curve, s - 1), p1 = Control(curve, s), p2 = Control(curve, s + 1), p3 = Control(curve, s + 2);
+			int num_pieces = xy::Min(pieces[piece], max_pieces);
+			float scale = controls_[curve.first_control + s].w;
+
+			for (int k = 0; k < num_pieces; ++k) {
+				float t = static_cast<float>(k) / num_pieces;
+				auto d = Derivative(p0, p1, p2, p3, t);
+				lines.push_back(static_cast<std::uint32_t>(positions.size()));
+				lines.push_back(static_cast<std::uint32_t>(positions.size() + 1));
+				positions.push_back(Evaluate(p0, p1, p2, p3, t));
+				tangents.push_back(xy::Dot(d, d) > 1e-20f ? xy::Normalize(d) : xy::Normalize(p2 - p1));
+				scales.push_back(scale);
+			}
+		}
+
+		// The tip, as the end of the last segment.
+		auto d = Derivative(p0, p1, p2, p3, 1.f);
+		const auto &tip = controls_[curve.first_control + n - 1];
+		positions.emplace_back(tip.x, tip.y, tip.z);
+		tangents.push_back(xy::Dot(d, d) > 1e-20f ? xy::Normalize(d) : xy::Normalize(p2 - p1));
+		scales.push_back(tip.w);
+	}
+	return max_pieces;
+}
@@ -0,0 +1,336 @@
+#include "strand_sim.h"
+
+#include <chrono>
+#include "xy_ext.h"
+#include "asset.h"
+#include "gpu_array.h"
+
+
+namespace
+{
+
+////
+// Four lanes of floats, SSE unless the math library is built pure.
+////
+
+#ifndef XY_FCALC3D_PURE
+using Lanes = __m128;
+
+inline Lanes Load(const float *p) { return _mm_loadu_ps(p); }
+inline void Store(float *p, Lanes v) { _mm_storeu_ps(p, v); }
+inline Lanes Splat(float v) { return _mm_set_ps1(v); }
+inline Lanes Add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+inline Lanes Sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+inline Lanes Mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+inline Lanes Div(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+inline Lanes Max(Lanes a, Lanes b) { return _mm_max_ps(a, b); }
+inline Lanes Sqrt(Lanes a) { return _mm_sqrt_ps(a); }
+#else
+struct Lanes {
+	float v[StrandSim::lanes];
+};
+
+template <typename FN>
+inline Lanes Map(FN fn)
+{
+	Lanes r;
+	for (int i = 0; i < StrandSim::lanes; ++i)
+		r.v[i] = fn(i);
+	return r;
+}
+
+inline Lanes Load(const float *p) { return Map([p](int i) { return p[i]; }); }
+inline void Store(float *p, Lanes v) { std::copy(v.v, v.v + StrandSim::lanes, p); }
+inline Lanes Splat(float v) { return Map([v](int) { return v; }); }
+inline Lanes Add(Lanes a, Lanes b) { return Map([&](int i) { return a.v[i] + b.v[i]; }); }
+inline Lanes Sub(Lanes a, Lanes b) { return Map([&](int i) { return a.v[i] - b.v[i]; }); }
+inline Lanes Mul(Lanes a, Lanes b) { return Map([&](int i) { return a.v[i] * b.v[i]; }); }
+inline Lanes Div(Lanes a, Lanes b) { return Map([&](int i) { return a.v[i] / b.v[i]; }); }
+inline Lanes Max(Lanes a, Lanes b) { return Map([&](int i) { return xy::Max(a.v[i], b.v[i]); }); }
+inline Lanes Sqrt(Lanes a) { return Map([&](int i) { return std::sqrt(a.v[i]); }); }
+#endif // !XY_FCALC3D_PURE
+
+// Affine m applied to the points (x,y,z) of four lanes.
+void Transform(const xy::mat4 &m, Lanes x, Lanes y, Lanes z, Lanes &ox, Lanes &oy, Lanes &oz)
+{
+	Lanes *out[3] = { &ox, &oy, &oz };
+	for (int r = 0; r < 3; ++r) {
+		*out[r] = Add(
+			Add(Mul(Splat(m.data[r]), x), Mul(Splat(m.data[4 + r]), y)),
+			Add(Mul(Splat(m.data[8 + r]), z), Splat(m.data[12 + r])));
+	}
+}
+
+// Moves a and b along their difference towards rest apart, removing
+// stiffness of the violation; a takes share w0 of it and b share w1.
+void Constrain(
+	float *ax, float *ay, float *az,
+	float *bx, float *by, float *bz,
+	const float *rest, const float *w0, const float *w1,
+	Lanes stiffness)
+{
+	Lanes pax = Load(ax), pay = Load(ay), paz = Load(az);
+	Lanes pbx = Load(bx), pby = Load(by), pbz = Load(bz);
+	Lanes dx = Sub(pbx, pax), dy = Sub(pby, pay), dz = Sub(pbz, paz);
+
+	Lanes len2 = Add(Add(Mul(dx, dx), Mul(dy, dy)), Mul(dz, dz));
+	Lanes len = Sqrt(Max(len2, Splat(1e-12f)));
+	Lanes s = Mul(stiffness, Sub(Splat(1.f), Div(Load(rest), len)));
+
+	Lanes sa = Mul(s, Load(w0)), sb = Mul(s, Load(w1));
+	Store(ax, Add(pax, Mul(sa, dx)));
+	Store(ay, Add(pay, Mul(sa, dy)));
+	Store(az, Add(paz, Mul(sa, dz)));
+	Store(bx, Sub(pbx, Mul(sb, dx)));
+	Store(by, Sub(pby, Mul(sb, dy)));
+	Store(bz, Sub(pbz, Mul(sb, dz)));
+}
+
+}
+
+StrandSim::Params StrandSim::DefaultParams()
+{
+	Params params;
+	params.gravity = { 0.f, -9.8f, 0.f };
+	params.damping = .98f;
+	params.num_iterations = 4;
+	params.stretch_stiffness = 1.f;
+	params.bend_stiffness = .5f;
+	return params;
+}
+
+StrandSim::StrandSim()
+	:
+	params_(DefaultParams()),
+	at_rest_{ true },
+	stats_{ 0, 0, 0, 0, 0, 0. }
+{}
+
+void StrandSim::Init(const FiberAsset &asset, const Params &params)
+{
+	Init(asset.positions, asset.num_verts_per_fiber, params);
+}
+
+void StrandSim::Init(
+	const std::vector<xy::vec3> &positions,
+	const std::vector<int> &num_verts_per_fiber,
+	const Params &params)
+{
+	params_ = params;
+	num_verts_ = num_verts_per_fiber;
+	first_vert_.clear();
+	int num_strands = static_cast<int>(num_verts_.size());
+
+	std::size_t first_vert = 0;
+	for (auto nverts : num_verts_) {
+		first_vert_.push_back(static_cast<int>(first_vert));
+		first_vert += nverts;
+	}
+	if (first_vert != positions.size())
+		XY_Die("fiber vertex count mismatch");
+
+	////
+	// Blocks.
+	////
+
+	blocks_.clear();
+	std::size_t num_rows = 0;
+	for (int first = 0; first < num_strands; first += lanes) {
+		Block block{ num_rows, 0, first, xy::Min(num_strands - first, static_cast<int>(lanes)) };
+		for (int i = 0; i < block.num_strands; ++i)
+			block.num_rows = xy::Max(block.num_rows, num_verts_[first + i]);
+		blocks_.push_back(block);
+		num_rows += block.num_rows;
+	}
+
+	for (auto arr : { &x_, &y_, &z_, &px_, &py_, &pz_, &rx_, &ry_, &rz_,
+		&inv_mass_, &stretch_rest_, &bend_rest_,
+		&stretch_w0_, &stretch_w1_, &bend_w0_, &bend_w1_ })
+		arr->assign(num_rows * lanes, 0.f);
+
+	////
+	// Rest pose and constraints.
+	////
+
+	for (const auto &block : blocks_) {
+		for (int l = 0; l < block.num_strands; ++l) {
+			int strand = block.first_strand + l;
+			int nverts = num_verts_[strand];
+			if (nverts == 0)
+				continue;
+
+			for (int r = 0; r < block.num_rows; ++r) {
+				auto i = (block.first_row + r) * lanes + l;
+				// Padding sits on the tip, out of every constraint.
+				auto &p = positions[first_vert_[strand] + xy::Min(r, nverts - 1)];
+				rx_[i] = p.x;
+				ry_[i] = p.y;
+				rz_[i] = p.z;
+				if (r >= nverts)
+					continue;
+				// The root segment is pinned.
+				inv_mass_[i] = r >= 2 ? 1.f : 0.f;
+
+				auto constrain = [&](int up, std::vector<float> &rest, std::vector<float> &w0, std::vector<float> &w1) {
+					auto j = i - up * lanes;
+					rest[i] = (p - positions[first_vert_[strand] + r - up]).Norm();
+					float sum = inv_mass_[j] + inv_mass_[i];
+					if (sum > 0.f) {
+						w0[i] = inv_mass_[j] / sum;
+						w1[i] = inv_mass_[i] / sum;
+					}
+				};
+				if (r >= 1)
+					constrain(1, stretch_rest_, stretch_w0_, stretch_w1_);
+				if (r >= 2)
+					constrain(2, bend_rest_, bend_w0_, bend_w1_);
+			}
+		}
+	}
+
+	positions_ = positions;
+	tangents_.resize(positions.size());
+	for (int strand = 0; strand < num_strands; ++strand) {
+		int first = first_vert_[strand], nverts = num_verts_[strand];
+		for (int r = 0; r < nverts - 1; ++r)
+			tangents_[first + r] = xy::Normalize(positions[first + r + 1] - positions[first + r]);
+		if (nverts >= 2)
+			tangents_[first + nverts - 1] = tangents_[first + nverts - 2];
+	}
+
+	at_rest_ = true;
+
+	stats_.num_strands = num_strands;
+	stats_.num_blocks = static_cast<int>(blocks_.size());
+	stats_.num_particles = positions.size();
+	stats_.num_padding = num_rows * lanes - positions.size();
+}
+
+void StrandSim::Reset()
+{
+	at_rest_ = true;
+}
+
+void StrandSim::Step(float dt, const xy::mat4 &model_matrix, JobSystem &jobs)
+{
+	auto op_time = std::chrono::high_resolution_clock::now();
+
+	if (xy::Det(model_matrix) == 0.f)
+		XY_Die("model matrix not invertible");
+	auto model = xy::Inverse(model_matrix);
+
+	// About a thousand fibers a piece.
+	constexpr int blocks_per_piece = 256;
+	jobs.ParallelFor(0, static_cast<int>(blocks_.size()), blocks_per_piece, [&](int begin, int end) {
+		SolveBlocks(begin, end, dt, model_matrix, model);
+	});
+
+	at_rest_ = false;
+
+	auto ed_time = std::chrono::high_resolution_clock::now();
+	stats_.num_threads = jobs.NumThreads();
+	stats_.step_ms = std::chrono::duration<double, std::milli>(ed_time - op_time).count();
+}
+
+void StrandSim::SolveBlocks(int begin, int end, float dt, const xy::mat4 &world, const xy::mat4 &model)
+{
+	Lanes damping = Splat(params_.damping);
+	Lanes gx = Splat(params_.gravity.x * dt * dt);
+	Lanes gy = Splat(params_.gravity.y * dt * dt);
+	Lanes gz = Splat(params_.gravity.z * dt * dt);
+	Lanes stretch = Splat(params_.stretch_stiffness);
+	Lanes bend = Splat(params_.bend_stiffness);
+
+	for (int b = begin; b < end; ++b) {
+		const auto &block = blocks_[b];
+		auto base = block.first_row * lanes;
+		float *x = &x_[base], *y = &y_[base], *z = &z_[base];
+		float *px = &px_[base], *py = &py_[base], *pz = &pz_[base];
+
+		////
+		// Integrate.
+		////
+
+		for (int r = 0; r < block.num_rows; ++r) {
+			auto i = r * lanes;
+			Lanes cx = Load(x + i), cy = Load(y + i), cz = Load(z + i);
+			Lanes nx, ny, nz;
+
+			if (at_rest_ || r < 2) {
+				Transform(world, Load(&rx_[base + i]), Load(&ry_[base + i]), Load(&rz_[base + i]), nx, ny, nz);
+				if (at_rest_) {
+					cx = nx;
+					cy = ny;
+					cz = nz;
+				}
+			}
+			else {
+				// Verlet, padding has no mass and never moved.
+				Lanes im = Load(&inv_mass_[base + i]);
+				nx = Add(cx, Mul(im, Add(Mul(damping, Sub(cx, Load(px + i))), gx)));
+				ny = Add(cy, Mul(im, Add(Mul(damping, Sub(cy, Load(py + i))), gy)));
+				nz = Add(cz, Mul(im, Add(Mul(damping, Sub(cz, Load(pz + i))), gz)));
+			}
+
+			Store(px + i, cx);
+			Store(py + i, cy);
+			Store(pz + i, cz);
+			Store(x + i, nx);
+			Store(y + i, ny);
+			Store(z + i, nz);
+		}
+
+		////
+		// Constrain, Gauss-Seidel from the roots. Length last, bending
+		// gives way to it.
+		////
+
+		for (int it = 0; !at_rest_ && it < params_.num_iterations; ++it) {
+			for (int r = 2; r < block.num_rows; ++r) {
+				auto i = r * lanes, j = i - lanes, k = i - 2 * lanes;
+				Constrain(
+					x + k, y + k, z + k, x + i, y + i, z + i,
+					&bend_rest_[base + i], &bend_w0_[base + i], &bend_w1_[base + i],
+					bend);
+				Constrain(
+					x + j, y + j, z + j, x + i, y + i, z + i,
+					&stretch_rest_[base + i], &stretch_w0_[base + i], &stretch_w1_[base + i],
+					stretch);
+			}
+		}
+
+		////
+		// Write out in model space.
+		////
+
+		for (int r = 0; r < block.num_rows; ++r) {
+			auto i = r * lanes;
+			Lanes mx, my, mz;
+			Transform(model, Load(x + i), Load(y + i), Load(z + i), mx, my, mz);
+			alignas(16) float ox[lanes], oy[lanes], oz[lanes];
+			Store(ox, mx);
+			Store(oy, my);
+			Store(oz, mz);
+			for (int l = 0; l < block.num_strands; ++l)
+				if (r < num_verts_[block.first_strand + l])
+					positions_[first_vert_[block.first_strand + l] + r] = { ox[l], oy[l], oz[l] };
+		}
+
+		for (int l = 0; l < block.num_strands; ++l) {
+			int strand = block.first_strand + l;
+			int first = first_vert_[strand], nverts = num_verts_[strand];
+			for (int r = 0; r < nverts - 1; ++r)
+				tangents_[first + r] = xy::Normalize(positions_[first + r + 1] - positions_[first + r]);
+			if (nverts >= 2)
+				tangents_[first + nverts - 1] = tangents_[first + nverts - 2];
+		}
+	}
+}
+
+void StrandSim::Stream(StreamBuffer &stream, GpuArray &vao) const
+{
+	// FiberAsset::CreateGpuRes submits positions, then tangents. Storage
+	// alignment, the hair passes pull them as storage buffers.
+	vao.StreamBuf(0, stream.Write(positions_, StreamUse::Storage));
+	vao.StreamBuf(1, stream.Write(tangents_, StreamUse::Storage));
+}
@@ -0,0 +1,188 @@
+#include "stream_buffer.h"
+
+#include <new>
+#include <chrono>
+#include "xy_ext.h"
+
+
+namespace
+{
+
+// Alignments are powers of two.
+std::size_t AlignUp(std::size_t pos, std::size_t alignment)
+{
+	return (pos + alignment - 1) & ~(alignment - 1);
+}
+
+}
+
+StreamBufferApi StreamBufferApi::GL()
+{
+	StreamBufferApi api;
+	api.create = [](std::size_t bytes, GLuint &buffer) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferStorage(GL_COPY_WRITE_BUFFER, bytes, nullptr, flags);
+		void *mapped = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, bytes, flags);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		if (!mapped)
+			XY_Die("failed to map stream buffer");
+		return mapped;
+	};
+	api.destroy = [](GLuint buffer, void*) {
+		// Deleting a buffer unmaps it.
+		glDeleteBuffers(1, &buffer);
+	};
+	api.offset_alignment = [](GLenum pname) {
+		GLint alignment = 0;
+		glGetIntegerv(pname, &alignment);
+		return static_cast<std::size_t>(alignment);
+	};
+	return api;
+}
+
+StreamBufferApi StreamBufferApi::Host()
+{
+	StreamBufferApi api;
+	api.create = [](std::size_t bytes, GLuint &buffer) {
+		buffer = 0;
+		return ::operator new(bytes, std::align_val_t(StreamBuffer::max_alignment));
+	};
+	api.destroy = [](GLuint, void *mapped) {
+		::operator delete(mapped, std::align_val_t(StreamBuffer::max_alignment));
+	};
+	api.offset_alignment = [](GLenum) { return StreamBuffer::max_alignment; };
+	return api;
+}
+
+StreamBuffer::StreamBuffer()
+	:
+	StreamBuffer(StreamBufferApi::GL(), GpuSyncApi::GL())
+{}
+
+StreamBuffer::StreamBuffer(StreamBufferApi api, GpuSyncApi sync)
+	:
+	api_{ std::move(api) },
+	sync_{ std::move(sync) },
+	buffer_{ 0 },
+	mapped_{ nullptr },
+	capacity_{ 0 },
+	uniform_alignment_{ 0 },
+	storage_alignment_{ 0 },
+	head_{ 0 },
+	free_{ 0 },
+	frame_begin_{ 0 },
+	lap_{ 0 },
+	stats_{ 0, 0, 0, 0, 0, 0, 0. }
+{}
+
+void StreamBuffer::Init(std::size_t capacity)
+{
+	if (Initialized())
+		XY_Die("stream buffer initialized twice");
+	if (capacity == 0)
+		XY_Die("stream buffer needs capacity");
+
+	uniform_alignment_ = api_.offset_alignment(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT);
+	storage_alignment_ = api_.offset_alignment(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT);
+	if (uniform_alignment_ == 0 || storage_alignment_ == 0 ||
+		max_alignment % uniform_alignment_ != 0 || max_alignment % storage_alignment_ != 0)
+		XY_Die("buffer offset alignment above 256 bytes");
+
+	// Laps start aligned, so aligned positions are aligned offsets.
+	capacity_ = AlignUp(capacity, max_alignment);
+	mapped_ = static_cast<unsigned char*>(api_.create(capacity_, buffer_));
+}
+
+std::size_t StreamBuffer::Alignment(StreamUse use) const
+{
+	switch (use) {
+	case StreamUse::Vertex:
+		// A vec4 attrib never straddles.
+		return 16;
+	case StreamUse::Uniform:
+		return uniform_alignment_;
+	case StreamUse::Storage:
+		return storage_alignment_;
+	case StreamUse::Indirect:
+		return sizeof(GLuint);
+	default:
+		XY_Die("unknown stream use");
+	}
+	return max_alignment;
+}
+
+StreamAlloc StreamBuffer::Allocate(std::size_t bytes, StreamUse use)
+{
+	if (!Initialized())
+		XY_Die("stream buffer used before Init");
+
+	auto pos = AlignUp(head_, Alignment(use));
+	// Never across the end, the rest of the lap is skipped.
+	if (pos - lap_ + bytes > capacity_) {
+		lap_ += capacity_;
+		pos = lap_;
+	}
+	if (pos + bytes - frame_begin_ > capacity_)
+		XY_Die("stream buffer too small for one frame");
+
+	// Regions of earlier frames are all that stands in the way, the
+	// current frame fits.
+	while (pos + bytes > free_ + capacity_)
+		RetireOldest();
+
+	head_ = pos + bytes;
+	++stats_.num_allocs;
+	stats_.bytes_allocated += bytes;
+
+	auto offset = pos - lap_;
+	return { mapped_ + offset, buffer_, offset, bytes };
+}
+
+void StreamBuffer::EndFrame()
+{
+	if (head_ != frame_begin_) {
+		regions_.push_back({ head_, sync_.fence() });
+		stats_.peak_frame_bytes = xy::Max(stats_.peak_frame_bytes, head_ - frame_begin_);
+		frame_begin_ = head_;
+	}
+	++stats_.num_frames;
+
+	// Signaled fences go right away, a ring used lightly would pile
+	// them up otherwise.
+	while (!regions_.empty() && sync_.client_wait(regions_.front().fence, 0)) {
+		sync_.delete_sync(regions_.front().fence);
+		free_ = regions_.front().end;
+		regions_.pop_front();
+	}
+}
+
+void StreamBuffer::RetireOldest()
+{
+	if (regions_.empty())
+		XY_Die("stream buffer has no region to retire");
+
+	auto &region = regions_.front();
+	++stats_.num_fence_waits;
+	if (!sync_.client_wait(region.fence, 0)) {
+		++stats_.num_blocked_waits;
+		auto op_time = std::chrono::steady_clock::now();
+		while (!sync_.client_wait(region.fence, 1000000000ull))
+			;
+		stats_.blocked_ms += std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - op_time).count();
+	}
+
+	sync_.delete_sync(region.fence);
+	free_ = region.end;
+	regions_.pop_front();
+}
+
+StreamBuffer::~StreamBuffer()
+{
+	for (auto &region : regions_)
+		sync_.delete_sync(region.fence);
+	if (mapped_)
+		api_.destroy(buffer_, mapped_);
+}
@@ -68,7 +68,7 @@ inline void DebugCallback(
 	return;
 }
 
-GLFWWindowDesc::GLFWWindowDesc(int width, int height, std::string title)
+GLFWWindowDesc::GLFWWindowDesc(int width, int height, std::string title, bool visible)
 	:width{ width }, height{ height }, title{ title }
 {
 	if (glfwInit() != GLFW_TRUE)
@@ -78,6 +78,7 @@ GLFWWindowDesc::GLFWWindowDesc(int width, int height, std::string title)
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
 	glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
 	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+	glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
 
 	wptr = glfwCreateWindow(width, height, title.c_str(), nullptr, nullptr);
 	if (wptr == nullptr) {
@@ -3,6 +3,7 @@
 
 
 #include <string>
+#include <cstdlib>
 #include <filesystem>
 
 #include "xy/xy_ext.h"
@@ -12,10 +13,37 @@ namespace xy_config
 {
 
 
-template<std::size_t N>
-inline std::string GetShaderPath(const char(&a)[N])
+// Shader and asset roots. XY_SHADER_ROOT and XY_ASSET_ROOT override the
+// defaults, the command line overrides both.
+inline std::string &ShaderRoot()
 {
-	auto path = xy::Concat("D:/jqlyg/ppll_rendering/shader/", a);
+	static std::string root = std::getenv("XY_SHADER_ROOT") ?
+		std::string(std::getenv("XY_SHADER_ROOT")) + "/" : "D:/jqlyg/ppll_rendering/shader/";
+	return root;
+}
+
+inline std::string &AssetRoot()
+{
+	static std::string root = std::getenv("XY_ASSET_ROOT") ?
+		std::string(std::getenv("XY_ASSET_ROOT")) + "/" : "D:/jqlyg/ppll_rendering/asset/";
+	return root;
+}
+
+inline void SetShaderRoot(const std::string &root) { ShaderRoot() = root + "/"; }
+inline void SetAssetRoot(const std::string &root) { AssetRoot() = root + "/"; }
+
+// Program binary cache, XY_SHADER_CACHE overrides the default; empty
+// disables it.
+inline std::string &ShaderCacheDir()
+{
+	static std::string dir = std::getenv("XY_SHADER_CACHE") ?
+		std::string(std::getenv("XY_SHADER_CACHE")) : "shader_cache";
+	return dir;
+}
+
+inline std::string GetShaderPath(const std::string &name)
+{
+	auto path = ShaderRoot() + name;
 
 	if (!std::experimental::filesystem::exists(path))
 		XY_Die(path + " does not exist");
@@ -23,10 +51,9 @@ inline std::string GetShaderPath(const char(&a)[N])
 	return path;
 }
 
-template<std::size_t N>
-inline std::string GetAssetPath(const char(&a)[N])
+inline std::string GetAssetPath(const std::string &name)
 {
-	auto path = xy::Concat("D:/jqlyg/ppll_rendering/asset/", a);
+	auto path = AssetRoot() + name;
 
 	if (!std::experimental::filesystem::exists(path))
 		XY_Die(path + " does not exist");
@@ -0,0 +1,4 @@
+#version 450 core
+
+// Depth only, the first occluder is kept by the depth test.
+void main() {}
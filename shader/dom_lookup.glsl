@@ -0,0 +1,34 @@
+
+////
+// Deep opacity map lookup.
+////
+
+layout(binding=3) uniform sampler2D g_DOMDepthMap;
+layout(binding=4) uniform sampler2D g_DOMLayerMap0;
+layout(binding=5) uniform sampler2D g_DOMLayerMap1;
+
+uniform float g_DOMLayerSize;
+uniform float g_DOMAbsorption;
+uniform int g_DOMNumLayers;
+
+float DOM_ComputeTransmittance(mat4 light_view_proj, vec3 position)
+{
+    vec4 tmp = light_view_proj * vec4(position,1.);
+    vec3 light_view_position = tmp.xyz / tmp.w;
+    light_view_position = .5*light_view_position+.5;
+
+    float first_depth = texture(g_DOMDepthMap,light_view_position.xy).r;
+    float layer = (light_view_position.z - first_depth) / g_DOMLayerSize;
+    if (layer <= 0.)
+        return 1.;
+
+    vec4 l0 = texture(g_DOMLayerMap0,light_view_position.xy);
+    vec4 l1 = texture(g_DOMLayerMap1,light_view_position.xy);
+    float opacities[9] = { 0., l0.x, l0.y, l0.z, l0.w, l1.x, l1.y, l1.z, l1.w };
+
+    layer = min(layer, float(g_DOMNumLayers));
+    int k = min(int(layer), g_DOMNumLayers - 1);
+    float opacity = mix(opacities[k], opacities[k + 1], layer - float(k));
+
+    return exp(-g_DOMAbsorption * opacity);
+}
@@ -0,0 +1,27 @@
+#version 450 core
+
+layout(location=0) out vec4 g_DOMLayers0;
+layout(location=1) out vec4 g_DOMLayers1;
+
+layout(binding=0) uniform sampler2D g_DOMDepth;
+
+uniform float g_DOMLayerSize;
+uniform float g_DOMFiberOpacity;
+uniform int g_DOMNumLayers;
+
+void main() {
+    float first_depth = texelFetch(g_DOMDepth, ivec2(gl_FragCoord.xy), 0).r;
+    float layer = (gl_FragCoord.z - first_depth) / g_DOMLayerSize;
+
+    // Layer k holds the opacity accumulated up to its far boundary k+1,
+    // the last layer extends to infinity.
+    vec4 bounds0 = vec4(1., 2., 3., 4.);
+    vec4 bounds1 = vec4(5., 6., 7., 8.);
+    if (g_DOMNumLayers <= 4)
+        bounds0.w = 1e30;
+    else
+        bounds1.w = 1e30;
+
+    g_DOMLayers0 = g_DOMFiberOpacity * step(layer, bounds0);
+    g_DOMLayers1 = g_DOMFiberOpacity * step(layer, bounds1);
+}
@@ -0,0 +1,71 @@
+////
+// Screen facing quad of a fiber segment, as the hair store passes draw
+// it. The quad is the segment widened by the hair radius on both sides,
+// plus sqrt(2)/2 pixel so thin fibers still cover pixel centers. See
+// ExpandFiberCorner in core/include/xy/fiber_quad.h for the CPU reference.
+////
+
+uniform float g_HairRadius;
+uniform vec3 g_Eye;
+uniform mat4 g_ViewProj;
+uniform vec2 g_WinSize;
+
+// Corners 0 and 2 are at p0, 1 and 3 at p1; 0 and 1 on the e0 side, in
+// triangle strip order.
+struct FiberCorner {
+    // NDC with w 1, fragments interpolate in screen space.
+    vec4 position;
+    vec3 world;
+    vec4 tangent;
+    // Both sides of the quad at this end.
+    vec4 win_e0e1;
+};
+
+// Screen space sideways direction of the fiber at p.
+vec2 FiberProjRight(vec3 p, vec4 t, out vec3 right)
+{
+    vec3 view_dir = normalize(p - g_Eye);
+    right = normalize(cross(normalize(t.xyz), view_dir));
+    return normalize((g_ViewProj*vec4(right, 0)).xy);
+}
+
+// Side -1 is e0, 1 is e1. The thickness varies from root to tip with
+// the fraction of the scale.
+vec4 FiberEdge(vec3 p, vec3 right, vec2 proj_right, float ratio, float side)
+{
+    float radius = g_HairRadius * ratio * (1./max(g_WinSize.x,g_WinSize.y));
+    float expand_pixels = 0.71;
+
+    vec4 tmp = g_ViewProj*vec4(p + side*right*radius, 1);
+    return vec4(tmp.xyz/tmp.w,1) + side*vec4(proj_right*expand_pixels/g_WinSize.y,0,0);
+}
+
+FiberCorner ExpandFiberCorner(vec3 p0, vec3 p1, vec4 t0, vec4 t1, int corner)
+{
+    vec3 right0, right1;
+    vec2 proj_right0 = FiberProjRight(p0, t0, right0);
+    vec2 proj_right1 = FiberProjRight(p1, t1, right1);
+
+    bool tip = (corner & 1) != 0;
+    vec3 p = tip ? p1 : p0;
+    vec4 t = tip ? t1 : t0;
+    vec3 right = tip ? right1 : right0;
+    vec2 proj_right = tip ? proj_right1 : proj_right0;
+
+    vec4 e0 = FiberEdge(p, right, proj_right, fract(t.w), -1.);
+    vec4 e1 = FiberEdge(p, right, proj_right, fract(t.w), 1.);
+
+    // Fixed: Quad may be rendered as a butterfly-shape.
+    if (tip && dot(proj_right0,proj_right1)<0) {
+        vec4 tmp = e1;
+        e1 = e0;
+        e0 = tmp;
+    }
+
+    FiberCorner c;
+    c.position = (corner & 2) != 0 ? e1 : e0;
+    c.world = p;
+    c.tangent = t;
+    c.win_e0e1 = vec4(e0.xy,e1.xy);
+    return c;
+}
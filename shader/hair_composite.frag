@@ -0,0 +1,15 @@
+#version 450 core
+
+out vec4 HairColor;
+
+layout(binding=0) uniform sampler2D g_HairColor;
+
+void main()
+{
+    // Premultiplied color, transmittance in alpha.
+    vec4 color = texelFetch(g_HairColor, ivec2(gl_FragCoord.xy), 0);
+    if (color.a >= 1.)
+        discard;
+
+    HairColor = color;
+}
@@ -0,0 +1,149 @@
+
+////
+// Hair fragment shading shared by the hair store passes.
+////
+
+#include "msm.glsl"
+#include "dom_lookup.glsl"
+
+in vec3 fs_Position;
+in vec4 fs_Tangent;
+in vec4 fs_WinE0E1;
+
+uniform vec3 g_Eye;
+uniform vec3 g_SunLightDir;
+uniform mat4 g_LightViewProj;
+uniform int g_ShadowMode;
+layout(binding=0) uniform sampler2D g_ShadowMap;
+layout(binding=1) uniform sampler2D g_HairBaseColorTex;
+layout(binding=2) uniform sampler2D g_HairSpecOffsetTex;
+
+uniform float g_HairTransparency;
+uniform vec2 g_WinSize;
+
+float ComputePixelCoverage(vec2 p0, vec2 p1, vec2 pixel_loc, vec2 win_size)
+{
+    p0 = (p0+1)*.5;
+    p1 = (p1+1)*.5;
+    p0 *= win_size;
+    p1 *= win_size;
+
+    float p0dist = length(p0 - pixel_loc);
+    float p1dist = length(p1 - pixel_loc);
+    float hairWidth = length(p0 - p1);
+
+    // will be 1.f if pixel outside hair, 0.f if pixel inside hair
+    float outside = max(step(hairWidth, p0dist), step(hairWidth, p1dist));
+
+    // if outside, set sign to -1, else set sign to 1
+    float sign = outside > 1e-3f ? -1.f : 1.f;
+
+    // signed distance (positive if inside hair, negative if outside hair)
+    float relDist = sign * clamp(min(p0dist, p1dist),0.,1.);
+
+    // returns coverage based on the relative distance
+    // 0, if completely outside hair edge
+    // 1, if completely inside hair edge
+    return (relDist + 1.f) * 0.5f;
+}
+
+vec3 HairShading(
+    vec3 eye_dir, 
+    vec3 light_dir, 
+    vec3 tangent, 
+    float scale,
+    int hair_id,
+    sampler2D base_color_tex,
+    sampler2D spec_offset_tex);
+
+// Coverage times transparency, without shading.
+float HairFragmentAlpha()
+{
+    float cov = ComputePixelCoverage(fs_WinE0E1.xy,fs_WinE0E1.zw,gl_FragCoord.xy,g_WinSize);
+    cov *= fract(fs_Tangent.w);
+    return cov*g_HairTransparency;
+}
+
+// Shaded hair color with coverage in alpha.
+vec4 HairFragmentColor()
+{
+
+    float litness = MSM_ComputeLitness(g_ShadowMap,g_LightViewProj,fs_Position);
+    // Deep opacity maps carry hair occlusion, the moment map meshes only.
+    if (g_ShadowMode == 1)
+        litness *= DOM_ComputeTransmittance(g_LightViewProj,fs_Position);
+
+    vec3 hair_color = vec3(0.,0.,0.);
+
+    if (litness > 1e-2)
+        hair_color = HairShading(
+            g_Eye - fs_Position,
+            g_SunLightDir,
+            fs_Tangent.xyz,
+            fract(fs_Tangent.w),
+            int(fs_Tangent.w),
+            g_HairBaseColorTex,
+            g_HairSpecOffsetTex
+        );
+
+    return vec4(litness*hair_color,HairFragmentAlpha());
+}
+
+
+vec3 HairShading(
+    vec3 eye_dir, 
+    vec3 light_dir, 
+    vec3 tangent, 
+    float scale,
+    int hair_id,
+    sampler2D base_color_tex,
+    sampler2D spec_offset_tex)
+{
+
+    vec2 hair_tex_idx = vec2(float(hair_id%100)/100., scale);
+    hair_tex_idx = clamp(hair_tex_idx,.1,.9);
+
+    vec3 hair_base_color = texture(base_color_tex,hair_tex_idx).rgb;
+
+    float randn = texture(spec_offset_tex,hair_tex_idx).r;
+    vec3 randv = vec3(.99,1.03,.97)*vec3(randn,randn,randn);
+
+    // define baseColor and Ka Kd Ks coefficient for hair
+    float Ka = 0.5, Kd = .5, Ks1 = .12, Ex1 = 24, Ks2 = .16, Ex2 = 6.;
+    // float Ka = 0., Kd = .4, Ks1 = .4, Ex1 = 80, Ks2 = .5, Ex2 = 8.;
+
+    light_dir = normalize(light_dir);
+    eye_dir = normalize(eye_dir);
+    tangent = normalize(tangent);// + In.Tangent*randv*4);
+
+    // in Kajiya's model: diffuse component: sin(t, l)
+    float cosTL = (dot(tangent, light_dir));
+    float sinTL = sqrt(1 - cosTL*cosTL);
+    float vDiffuse = sinTL; // here sinTL is apparently larger than 0
+
+    float alpha = (randn*10.)*3.1415926/180.; // tiled angle (5-10 dgree)
+
+    // in Kajiya's model: specular component: cos(t, rl)*cos(t, e) + sin(t, rl)sin(t, e)
+    float cosTRL = -cosTL;
+    float sinTRL = sinTL;
+    float cosTE = (dot(tangent, eye_dir));
+    float sinTE = sqrt(1- cosTE*cosTE);
+
+    // primary highlight: reflected direction shift towards root (2*Alpha)
+    float cosTRL_r = cosTRL*cos(2*alpha) - sinTRL*sin(2*alpha);
+    float sinTRL_r = sqrt(1 - cosTRL_r*cosTRL_r);
+    float vSpecular_r = max(0, cosTRL_r*cosTE + sinTRL_r*sinTE);
+
+    // secondary highlight: reflected direction shifted toward tip (3*Alpha)
+    float cosTRL_trt = cosTRL*cos(-3*alpha) - sinTRL*sin(-3*alpha);
+    float sinTRL_trt = sqrt(1 - cosTRL_trt*cosTRL_trt);
+    float vSpecular_trt = max(0, cosTRL_trt*cosTE + sinTRL_trt*sinTE);
+    
+    vec3 vColor = Ka * hair_base_color + // ambient
+                    1. * vec3(1,1,1) * (
+                    Kd * vDiffuse* hair_base_color + // diffuse
+                    Ks1 * pow(vSpecular_r, Ex1)  + // primary hightlight r
+                    Ks2 * pow(vSpecular_trt, Ex2) * hair_base_color); // secondary highlight rtr 
+    
+    return vColor;
+}
@@ -0,0 +1,86 @@
+
+////
+// Moment-based order-independent transparency (Muenstermann et al. 2018),
+// included by the MBOIT passes. Per pixel, optical depth -ln(1-alpha) is
+// accumulated together with its power moments over a warped depth, and
+// each fragment reconstructs the optical depth in front of it with the
+// Hamburger 4-moment solve of the shadow maps. Moments are summed in
+// 32-bit floats, so the optimized moment basis is not needed.
+////
+
+// Projection entries (P[2][2],P[3][2]) to linearize window depth.
+uniform vec2 g_ProjZ;
+// View depth range of the hair, mapped to [0,1].
+uniform vec2 g_MomentDepthRange;
+uniform float g_MBOITMomentBias;
+uniform float g_MBOITOverestimation;
+
+float MBOIT_WarpDepth(float window_depth)
+{
+    float view_depth = g_ProjZ.y / (2.*window_depth - 1. + g_ProjZ.x);
+    return clamp(
+        (view_depth - g_MomentDepthRange.x) / (g_MomentDepthRange.y - g_MomentDepthRange.x),
+        0., 1.);
+}
+
+float MBOIT_OpticalDepth(float alpha)
+{
+    return -log(1. - min(alpha, .999));
+}
+
+vec4 MBOIT_Moments(float z)
+{
+    float z_sq = z*z;
+    return vec4(z, z_sq, z_sq*z, z_sq*z_sq);
+}
+
+// Fraction of the optical depth in front of z. Same Cholesky and root
+// solve as MSM_ComputeLitness, but the weights of the three-point
+// distribution are kept so the fragment's own point can be blended in.
+float MBOIT_FractionInFront(vec4 b, float z0, float moment_bias, float overestimation)
+{
+    b = mix(b,vec4(.5,.5,.5,.5),moment_bias);
+
+    float l32_d22 = fma(-b.x, b.y, b.z);
+    float d22 = fma(-b.x, b.x, b.y);
+    float squared_depth_variance = fma(-b.y, b.y, b.w);
+
+    float d33_d22 = dot(
+        vec2(squared_depth_variance, -l32_d22), vec2(d22, l32_d22));
+    float inv_d22 = 1. / d22;
+    float l32 = l32_d22 * inv_d22;
+
+    vec3 c = vec3(1., z0, z0 * z0);
+    c.y -= b.x;
+    c.z -= b.y + l32 * c.y;
+    c.y *= inv_d22;
+    c.z *= d22 / d33_d22;
+    c.y -= l32 * c.z;
+    c.x -= dot(c.yz, b.xy);
+
+    float inv_c2 = 1. / c.z;
+    float p = c.y * inv_c2;
+    float q = c.x * inv_c2;
+    float r = sqrt(max((p * p * .25) - q, 0.));
+
+    float z1 = -p * .5 - r;
+    float z2 = -p * .5 + r;
+
+    float w0 = (z1*z2 - b.x*(z1 + z2) + b.y) / ((z0 - z1)*(z0 - z2));
+    float w1 = (z0*z2 - b.x*(z0 + z2) + b.y) / ((z1 - z0)*(z1 - z2));
+    float w2 = (z0*z1 - b.x*(z0 + z1) + b.y) / ((z2 - z0)*(z2 - z1));
+
+    float in_front = (z1 < z0 ? w1 : 0.) + (z2 < z0 ? w2 : 0.);
+    return clamp(in_front + overestimation*w0, 0., 1.);
+}
+
+// Transmittance of everything in front of depth z.
+float MBOIT_Transmittance(vec4 moments, float total_optical_depth, float z)
+{
+    if (total_optical_depth < 1e-4)
+        return 1.;
+
+    vec4 b = moments / total_optical_depth;
+    float in_front = MBOIT_FractionInFront(b, z, g_MBOITMomentBias, g_MBOITOverestimation);
+    return exp(-total_optical_depth*in_front);
+}
@@ -0,0 +1,23 @@
+#version 450 core
+
+out vec4 HairColor;
+
+layout(binding=0) uniform sampler2D g_Accum;
+layout(binding=1) uniform sampler2D g_OpticalDepth;
+
+void main()
+{
+    ivec2 pos = ivec2(gl_FragCoord.xy);
+
+    float total_optical_depth = texelFetch(g_OpticalDepth, pos, 0).r;
+    if (total_optical_depth < 1e-4)
+        discard;
+
+    // Reconstructed transmittances need not sum up exactly, the total is
+    // known though.
+    float transmittance = exp(-total_optical_depth);
+    vec4 accum = texelFetch(g_Accum, pos, 0);
+    vec3 avg_color = accum.rgb / max(accum.a, 1e-5);
+
+    HairColor = vec4(avg_color*(1. - transmittance), transmittance);
+}
@@ -0,0 +1,22 @@
+#version 450 core
+
+layout(early_fragment_tests) in;
+
+////
+// Ins & Outs.
+////
+
+layout(location=0) out vec4 g_Moments;
+layout(location=1) out vec4 g_OpticalDepth;
+
+#include "mboit.glsl"
+#include "hair_shading.glsl"
+
+void main()
+{
+    float optical_depth = MBOIT_OpticalDepth(HairFragmentAlpha());
+
+    // Both attachments add.
+    g_Moments = optical_depth*MBOIT_Moments(MBOIT_WarpDepth(gl_FragCoord.z));
+    g_OpticalDepth = vec4(optical_depth);
+}
@@ -0,0 +1,28 @@
+#version 450 core
+
+layout(early_fragment_tests) in;
+
+////
+// Ins & Outs.
+////
+
+layout(location=0) out vec4 g_Accum;
+
+layout(binding=6) uniform sampler2D g_MBOITMoments;
+layout(binding=7) uniform sampler2D g_MBOITOpticalDepth;
+
+#include "mboit.glsl"
+#include "hair_shading.glsl"
+
+void main()
+{
+    vec4 result = HairFragmentColor();
+
+    ivec2 pos = ivec2(gl_FragCoord.xy);
+    float transmittance = MBOIT_Transmittance(
+        texelFetch(g_MBOITMoments, pos, 0),
+        texelFetch(g_MBOITOpticalDepth, pos, 0).r,
+        MBOIT_WarpDepth(gl_FragCoord.z));
+
+    g_Accum = vec4(result.rgb*result.a, result.a)*transmittance;
+}
@@ -1,9 +1,11 @@
 #version 450 core
 
 layout (location = 0) in vec3 vs_Position;
+// Per instance.
+layout (location = 4) in mat4 vs_Model;
 
-uniform mat4 g_LightModelViewProj;
+uniform mat4 g_LightViewProj;
 
 void main() {
-	gl_Position = g_LightModelViewProj*vec4(vs_Position,1);
+	gl_Position = g_LightViewProj*vs_Model*vec4(vs_Position,1);
 }
@@ -0,0 +1,25 @@
+
+////
+// Color packing and front to back blending shared by the PPLL variants.
+////
+
+uint PackVec4IntoUint(vec4 val)
+{
+    return (uint(val.x * 255) << 24) | (uint(val.y * 255) << 16) | (uint(val.z * 255) << 8) | uint(val.w * 255);
+}
+
+vec4 UnpackUintIntoVec4(uint val)
+{
+    return vec4(
+        float((val & 0xFF000000) >> 24) / 255.0, 
+        float((val & 0x00FF0000) >> 16) / 255.0, 
+        float((val & 0x0000FF00) >> 8) / 255.0, 
+        float((val & 0x000000FF)) / 255.0);
+}
+
+vec4 BlendOver(vec4 color, vec4 node_color)
+{
+    color.rgb = (1.-node_color.a)*color.rgb+node_color.a*node_color.rgb;
+    color.a = color.a*clamp(1.-node_color.a,0.,1.);
+    return color;
+}
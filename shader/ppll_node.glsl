@@ -0,0 +1,42 @@
+
+////
+// PPLL node arena and per-pixel list heads, matching PPLLForHair::PPLLNode.
+////
+
+#define PPLL_NULL 0xffffffff
+
+struct PPLLNode {
+    uint depth;
+    uint data;
+    uint color;
+    uint next;
+};
+
+layout(binding=0,std430) 
+buffer PPLL { PPLLNode g_PPLL[]; };
+
+// One head per pixel, g_PPLLPitch heads per row.
+layout(binding=4,std430)
+buffer PPLLHeads { uint g_PPLLHeads[]; };
+
+uniform int g_PPLLPitch;
+
+uint PPLL_GetHeadIndex(ivec2 win_addr)
+{
+    return uint(win_addr.y*g_PPLLPitch + win_addr.x);
+}
+
+uint PPLL_GetHeadNodeAddr(ivec2 win_addr)
+{
+    return g_PPLLHeads[PPLL_GetHeadIndex(win_addr)];
+}
+
+uint PPLL_GetDepth(uint node_addr)
+{
+    return g_PPLL[node_addr].depth;
+}
+
+uint PPLL_GetNext(uint node_addr)
+{
+    return g_PPLL[node_addr].next;
+}
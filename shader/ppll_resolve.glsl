@@ -0,0 +1,53 @@
+
+////
+// PPLL resolve shared by the blend pass and the compute resolve. KBUF_SIZE
+// is set by the loader, see PPLLForHair::SetKBufferSize.
+////
+
+#include "ppll_node.glsl"
+#include "oit_pack.glsl"
+
+vec4 PPLL_GetColor(uint node_addr)
+{
+    return UnpackUintIntoVec4(g_PPLL[node_addr].color);
+}
+
+// The nearest KBUF_SIZE nodes are kept sorted front to back by insertion.
+// A node farther than all of them, or evicted from the back, is merged into
+// a tail that is blended behind the K-buffer.
+vec4 PPLL_Blend(uint node_addr)
+{
+    uint kbuf_depth[KBUF_SIZE];
+    vec4 kbuf_color[KBUF_SIZE];
+    int num_kbuf = 0;
+    vec4 tail = vec4(0,0,0,1);
+
+    for (;node_addr!=PPLL_NULL;node_addr = PPLL_GetNext(node_addr)) {
+
+        vec4 node_color = PPLL_GetColor(node_addr);
+        uint node_depth = PPLL_GetDepth(node_addr);
+
+        if (num_kbuf == KBUF_SIZE) {
+            if (node_depth >= kbuf_depth[KBUF_SIZE-1]) {
+                tail = BlendOver(tail, node_color);
+                continue;
+            }
+            tail = BlendOver(tail, kbuf_color[KBUF_SIZE-1]);
+            --num_kbuf;
+        }
+
+        int j = num_kbuf;
+        for (; j > 0 && kbuf_depth[j-1] > node_depth; --j) {
+            kbuf_depth[j] = kbuf_depth[j-1];
+            kbuf_color[j] = kbuf_color[j-1];
+        }
+        kbuf_depth[j] = node_depth;
+        kbuf_color[j] = node_color;
+        ++num_kbuf;
+    }
+
+    vec4 color = tail;
+    for (int j = num_kbuf-1; j >= 0; --j)
+        color = BlendOver(color, kbuf_color[j]);
+    return color;
+}
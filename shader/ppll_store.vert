@@ -1,18 +1,75 @@
 #version 450 core
 
-layout(location=0) in vec3 vs_Position;
-layout(location=1) in vec3 vs_Tangent;
-layout(location=2) in float vs_Scale;
+// Vertex pulling: four vertices per fiber segment, the corners of its
+// quad, picked by gl_VertexID from the fiber vertex buffers bound as
+// storage. Drawn by GpuArray::DrawLineStripsPulled, one draw per run of
+// equal strips and at most GpuArray::pull_segments_per_draw segments, or
+// one unindexed draw of six vertices a segment for lines written on the
+// GPU.
 
-out vec3 gs_Position;
-out vec4 gs_Tangent;
+layout(binding=5,std430)
+readonly buffer FiberPositions { float g_Positions[]; };
 
-uniform mat4 g_Model;
+layout(binding=6,std430)
+readonly buffer FiberTangents { float g_Tangents[]; };
+
+layout(binding=7,std430)
+readonly buffer FiberScales { float g_Scales[]; };
+
+// Vertex pair of every segment, for indirect lines.
+layout(binding=8,std430)
+readonly buffer FiberLines { uint g_Lines[]; };
+
+// First vertex of the run, vertices per strip, first segment of the draw;
+// no vertices per strip for indirect lines.
+layout(location=0) uniform ivec3 g_PullRun;
+
+// Per instance, the normal matrix derived on the CPU.
+layout(location=4) in mat4 vs_Model;
+layout(location=8) in mat3 vs_NormalMatrix;
+
+out vec3 fs_Position;
+out vec4 fs_Tangent;
+out vec4 fs_WinE0E1;
+
+#include "fiber_quad.glsl"
+
+vec3 FiberPosition(int vert)
+{
+    return vec3(g_Positions[3*vert], g_Positions[3*vert + 1], g_Positions[3*vert + 2]);
+}
+
+vec3 FiberTangent(int vert)
+{
+    return vec3(g_Tangents[3*vert], g_Tangents[3*vert + 1], g_Tangents[3*vert + 2]);
+}
 
 void main()
 {
-    gs_Position = (g_Model*vec4(vs_Position,1.)).xyz;
+    int vert, next, corner;
+    if (g_PullRun.y == 0) {
+        // Corners 0,1,2 and 2,1,3, as the quad indices.
+        int segment = gl_VertexID/6;
+        corner = (0x312210 >> 4*(gl_VertexID%6)) & 3;
+        vert = int(g_Lines[2*segment]);
+        next = int(g_Lines[2*segment + 1]);
+    }
+    else {
+        int segment = g_PullRun.z + gl_VertexID/4;
+        int strip_segments = g_PullRun.y - 1;
+        corner = gl_VertexID & 3;
+        vert = g_PullRun.x + segment/strip_segments*g_PullRun.y + segment%strip_segments;
+        next = vert + 1;
+    }
+
+    vec3 p0 = (vs_Model*vec4(FiberPosition(vert),1.)).xyz;
+    vec3 p1 = (vs_Model*vec4(FiberPosition(next),1.)).xyz;
+    vec4 t0 = vec4(vs_NormalMatrix*FiberTangent(vert), g_Scales[vert]);
+    vec4 t1 = vec4(vs_NormalMatrix*FiberTangent(next), g_Scales[next]);
 
-    gs_Tangent.xyz = mat3(transpose(inverse(g_Model)))*vs_Tangent;
-    gs_Tangent.w = vs_Scale;
+    FiberCorner c = ExpandFiberCorner(p0, p1, t0, t1, corner);
+    gl_Position = c.position;
+    fs_Position = c.world;
+    fs_Tangent = c.tangent;
+    fs_WinE0E1 = c.win_e0e1;
 }
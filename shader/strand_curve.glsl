@@ -0,0 +1,63 @@
+////
+// Curves of HairCurves and the frame layout of their resampled vertices,
+// matching StrandCurves::Curve and GpuArray::IndirectLineCounts.
+// MAX_SUBDIVISIONS is set by the loader. See StrandCurves for the CPU
+// reference.
+////
+
+struct Curve {
+    uint first_control;
+    uint num_controls;
+};
+
+// Position in xyz, scale in w.
+layout(binding=0,std430)
+readonly buffer CurveControls { vec4 g_Controls[]; };
+
+layout(binding=1,std430)
+readonly buffer CurveTable { Curve g_Curves[]; };
+
+layout(binding=2,std430)
+buffer ResampleLayout {
+    // Indices of the GL_LINES draw and vertices of the pulled quads.
+    uint g_NumLineIndices;
+    uint g_NumQuadVerts;
+    // Most pieces a segment gets, the finest cap that fits.
+    uint g_MaxPieces;
+    uint g_Pad;
+    // Pieces of every curve with segments capped at MAX_SUBDIVISIONS,
+    // half, a quarter and one; the first segment of it in x after the
+    // scan.
+    uvec4 g_Segments[];
+};
+
+uniform mat4 g_ModelViewProj;
+uniform vec2 g_WinSize;
+uniform float g_PixelsPerPiece;
+uniform uint g_NumCurves;
+uniform uint g_NumControls;
+uniform uint g_MaxVerts;
+
+vec3 Control(Curve curve, int i)
+{
+    int n = int(curve.num_controls);
+    if (i < 0)
+        return 2.*g_Controls[curve.first_control].xyz - g_Controls[curve.first_control + 1].xyz;
+    if (i >= n)
+        return 2.*g_Controls[curve.first_control + n - 1].xyz - g_Controls[curve.first_control + n - 2].xyz;
+    return g_Controls[curve.first_control + i].xyz;
+}
+
+// Pieces of the segment from a to b by its length on screen, at most
+// max_pieces.
+int Subdivisions(vec3 a, vec3 b, int max_pieces)
+{
+    vec4 ca = g_ModelViewProj*vec4(a,1.);
+    vec4 cb = g_ModelViewProj*vec4(b,1.);
+    if (ca.w <= 1e-6 || cb.w <= 1e-6)
+        return max_pieces;
+
+    vec2 d = (ca.xy/ca.w - cb.xy/cb.w)*.5*g_WinSize;
+    int pieces = int(ceil(length(d)/max(g_PixelsPerPiece, 1e-3)));
+    return clamp(pieces, 1, max_pieces);
+}
@@ -0,0 +1,14 @@
+#version 450 core
+
+layout(early_fragment_tests) in;
+
+out vec4 ColorResult;
+
+#include "tiled_ppll.glsl"
+
+void main()
+{
+    TiledPPLL_Count(ivec2(gl_FragCoord.xy));
+
+    ColorResult = vec4(0.);
+}
@@ -0,0 +1,21 @@
+
+////
+// Tile headers and nodes of the tiled PPLL, matching
+// TiledPPLLForHair::TileHeader and TiledNode. TILE_SIZE is set by the
+// loader from TiledPPLLForHair::tile_size.
+////
+
+#define TILE_PIXELS (TILE_SIZE*TILE_SIZE)
+
+struct TileHeader {
+    uint count;
+    uint offset;
+    uint size;
+    uint cursor;
+};
+
+struct TiledNode {
+    uint depth;
+    uint color;
+    uint pixel;
+};
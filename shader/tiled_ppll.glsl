@@ -0,0 +1,46 @@
+
+////
+// Tiled PPLL store, included by the tiled hair passes. Every screen tile
+// owns a contiguous range of the node arena, sized by a counting pass and
+// a scan, so allocation contends per tile instead of on one counter and a
+// tile's nodes can be sorted and blended together.
+////
+
+#include "tiled_layout.glsl"
+#include "oit_pack.glsl"
+
+layout(binding=0,std430)
+buffer TiledNodes { TiledNode g_TiledNodes[]; };
+
+layout(binding=1,std430)
+buffer Tiles { TileHeader g_Tiles[]; };
+
+uniform int g_NumTilesX;
+
+uint TiledPPLL_TileIndex(ivec2 pixel)
+{
+    ivec2 tile = pixel / TILE_SIZE;
+    return uint(tile.y*g_NumTilesX + tile.x);
+}
+
+void TiledPPLL_Count(ivec2 pixel)
+{
+    atomicAdd(g_Tiles[TiledPPLL_TileIndex(pixel)].count, 1u);
+}
+
+// Fragments past the tile budget are dropped.
+void TiledPPLL_Store(ivec2 pixel, vec4 color, float depth)
+{
+    uint tile_idx = TiledPPLL_TileIndex(pixel);
+
+    uint cursor = atomicAdd(g_Tiles[tile_idx].cursor, 1u);
+    if (cursor >= g_Tiles[tile_idx].size)
+        return;
+
+    ivec2 local_pixel = pixel % TILE_SIZE;
+    uint node_addr = g_Tiles[tile_idx].offset + cursor;
+
+    g_TiledNodes[node_addr].depth = floatBitsToUint(depth);
+    g_TiledNodes[node_addr].color = PackVec4IntoUint(color);
+    g_TiledNodes[node_addr].pixel = uint(local_pixel.y*TILE_SIZE + local_pixel.x);
+}
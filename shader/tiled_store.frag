@@ -0,0 +1,21 @@
+#version 450 core
+
+layout(early_fragment_tests) in;
+
+////
+// Ins & Outs.
+////
+
+out vec4 ColorResult;
+
+#include "tiled_ppll.glsl"
+#include "hair_shading.glsl"
+
+void main()
+{
+    vec4 result = HairFragmentColor();
+
+    TiledPPLL_Store(ivec2(gl_FragCoord.xy), result, gl_FragCoord.z);
+
+    ColorResult = result;
+}
@@ -0,0 +1,22 @@
+#version 450 core
+
+out vec4 HairColor;
+
+layout(binding=0) uniform sampler2D g_Accum;
+layout(binding=1) uniform sampler2D g_Revealage;
+
+void main()
+{
+    ivec2 pos = ivec2(gl_FragCoord.xy);
+
+    float revealage = texelFetch(g_Revealage, pos, 0).r;
+    if (revealage >= 1.)
+        discard;
+
+    vec4 accum = texelFetch(g_Accum, pos, 0);
+    vec3 avg_color = accum.rgb / max(accum.a, 1e-5);
+
+    // Same output as the PPLL resolve: premultiplied color, transmittance
+    // in alpha.
+    HairColor = vec4(avg_color*(1. - revealage), revealage);
+}
@@ -0,0 +1,38 @@
+#version 450 core
+
+layout(early_fragment_tests) in;
+
+////
+// Ins & Outs.
+////
+
+layout(location=0) out vec4 g_Accum;
+layout(location=1) out vec4 g_Revealage;
+
+// Projection entries (P[2][2],P[3][2]) to linearize window depth.
+uniform vec2 g_ProjZ;
+
+////
+// Weighted blended OIT, McGuire and Bavoil 2013. Weights are scaled down
+// from the paper to keep a few hundred hair layers inside RGBA16F.
+////
+
+float WBOIT_Weight(float window_depth, float alpha)
+{
+    float view_depth = g_ProjZ.y / (2.*window_depth - 1. + g_ProjZ.x);
+    float z = view_depth / 5.;
+    float w = 1. / (1e-5 + z*z + pow(view_depth / 200., 6.));
+    return alpha * clamp(w, 1e-3, 3e2);
+}
+
+#include "hair_shading.glsl"
+
+void main()
+{
+    vec4 result = HairFragmentColor();
+    float w = WBOIT_Weight(gl_FragCoord.z, result.a);
+
+    // Attachment 0 adds, attachment 1 multiplies by (1-alpha).
+    g_Accum = vec4(result.rgb*result.a, result.a)*w;
+    g_Revealage = vec4(result.a);
+}
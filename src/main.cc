@@ -10,8 +10,32 @@
 #include "xy_config.h"
 #include "xy/asset.h"
 #include "xy/aabb.h"
+#include "xy/fiber_bvh.h"
+#include "xy/strand_sim.h"
+#include "xy/strand_curves.h"
+#include "xy/fiber_quad.h"
+#include "xy/job_system.h"
+#include "xy/arena.h"
+#include "xy/deep_opacity.h"
+#include "xy/oit.h"
+#include "xy/gpu_sync.h"
+#include "xy/profiler.h"
+#include "xy/frame_writer.h"
+#include "xy/scene.h"
+#include "xy/shader_library.h"
+#include "xy/gl_state.h"
 #include "xy/xy_calc.h"
 
+#include <map>
+#include <array>
+#include <random>
+#include <atomic>
+#include <fstream>
+#include <cstdio>
+#include <chrono>
+#include <thread>
+#include <numeric>
+
 #include "shader.h"
 
 #include "imgui/imgui.h"
@@ -26,14 +50,67 @@ struct GameParams {
 	float ppll_hair_transparency;
 	float msm_moments_offset;
 	float msm_depth_offset;
+	int shadow_mode;
+	float dom_layer_size;
+	float dom_absorption;
+	int hair_mode;
+	bool compare_hair_modes;
+	int ppll_kbuf_size;
+	int frames_in_flight;
+	bool stream_readback;
+	float stream_mean;
+	bool simulate_hair;
+	double hair_sim_ms;
+	// Draw hair from curves resampled per frame, fit tolerance in model
+	// units and screen pixels per resampled piece.
+	bool hair_curves;
+	float curve_tolerance;
+	float curve_pixels;
+	// Vertex data of the fiber assets drawn as curves: the dense buffers
+	// released, the curves stored, and the most a frame resamples.
+	double curve_dense_mb, curve_mb, curve_resampled_mb;
+};
+
+GameParams DefaultGameParams();
+
+// Batch mode, see ParseOfflineArgs.
+struct OfflineArgs {
+	std::string scene;
+	// Keyframes, one "eye.xyz target.xyz" per line; a turntable if empty.
+	std::string camera_path;
+	std::string out_dir;
+	int width, height;
+	int num_frames;
+	int hair_mode;
+	// Times submission of the scene's first mesh and groom instead.
+	bool bench_instancing;
+	// Runs the checks that need no GL context instead, see RunSelfTests.
+	bool self_test;
+	// Runs one CPU benchmark by name instead, see RunBench.
+	std::string bench;
 };
 
+bool ParseOfflineArgs(int argc, char **argv, OfflineArgs &args);
+int RenderOffline(const OfflineArgs &args);
+int BenchInstancing(const OfflineArgs &args);
+int RunSelfTests();
+int RunBench(const std::string &name);
+
+// Time to first frame is measured from here.
+static const auto process_start = std::chrono::steady_clock::now();
+void ReportFirstFrame(Draw &draw);
+
+void LoadScene(const std::string &scene, Scene &out);
+
 void ImguiInit(GLFWwindow *window);
-void ImguiOverlay(GameParams &params);
+void ImguiOverlay(GameParams &params, Draw &draw);
+void ImguiProfiler(Profiler &profiler);
 void ImguiExit();
 
 int GameALL();
 
+void CompareHairModes(Draw &draw, Camera &camera, const Scene &scene, std::function<void(HairMode)> render);
+
 float MSMComputeShadow(
 	xy::vec4 moments,
 	float fragment_depth,
@@ -136,8 +213,1851 @@ void TestMSM()
 	}
 }
 
-int main()
+// The affine path of xy::Inverse against the general one on random model
+// matrices: rotations, scales from .01 to 100, a shear and translations.
+// Both are measured against the inverse in double, relative to its
+// largest entry; the affine path stays within twice the error of the
+// general one.
+// The time per inverse of each is printed.
+void TestAffineInverse(int num_matrices)
+{
+	std::mt19937 rng{ 7 };
+	std::uniform_real_distribution<float> unit{ -1.f, 1.f };
+	std::uniform_real_distribution<float> log_scale{ -2.f, 2.f };
+
+	std::vector<xy::mat4> matrices;
+	for (int i = 0; i < num_matrices; ++i) {
+		xy::vec3 axis{ unit(rng), unit(rng), unit(rng) };
+		if (xy::Dot(axis, axis) < 1e-4f)
+			axis = { 0.f, 1.f, 0.f };
+		xy::vec3 scale{ std::pow(10.f, log_scale(rng)), std::pow(10.f, log_scale(rng)), std::pow(10.f, log_scale(rng)) };
+		auto m = xy::Translation(100.f * xy::vec3{ unit(rng), unit(rng), unit(rng) }) *
+			xy::QuatToMat4(xy::AngleAxisToQuat(xy::pi<float> * unit(rng), xy::Normalize(axis))) *
+			xy::Scale(scale);
+		m[1][0] += unit(rng) * scale.y;
+		matrices.push_back(m);
+	}
+
+	auto general = [](const xy::mat4 &m) {
+		return xy::__ComputeGeneralInverse(
+			m[0][0], m[0][1], m[0][2], m[0][3],
+			m[1][0], m[1][1], m[1][2], m[1][3],
+			m[2][0], m[2][1], m[2][2], m[2][3],
+			m[3][0], m[3][1], m[3][2], m[3][3]);
+	};
+	// Same cross products in double, m[col][row].
+	auto reference = [](const xy::mat4 &m, double inv[4][4]) {
+		auto at = [&](int col, int row) { return static_cast<double>(m[col][row]); };
+		double r[3][3];
+		for (int i = 0; i < 3; ++i) {
+			int j = (i + 1) % 3, k = (i + 2) % 3;
+			for (int c = 0; c < 3; ++c) {
+				int c1 = (c + 1) % 3, c2 = (c + 2) % 3;
+				r[i][c] = at(j, c1) * at(k, c2) - at(j, c2) * at(k, c1);
+			}
+		}
+		double det = at(0, 0) * r[0][0] + at(0, 1) * r[0][1] + at(0, 2) * r[0][2];
+		for (int col = 0; col < 3; ++col) {
+			for (int row = 0; row < 3; ++row)
+				inv[col][row] = r[row][col] / det;
+			inv[col][3] = 0.;
+		}
+		for (int row = 0; row < 3; ++row)
+			inv[3][row] = -(r[row][0] * at(3, 0) + r[row][1] * at(3, 1) + r[row][2] * at(3, 2)) / det;
+		inv[3][3] = 1.;
+	};
+
+	double affine_error = 0., general_error = 0.;
+	std::size_t num_not_dispatched = 0;
+	for (const auto &m : matrices) {
+		auto a = xy::__ComputeAffineInverse(m);
+		auto g = general(m);
+		auto inv = xy::Inverse(m);
+		num_not_dispatched += std::memcmp(&inv, &a, sizeof(xy::mat4)) != 0;
+
+		double ref[4][4], largest = 0.;
+		reference(m, ref);
+		for (int col = 0; col < 4; ++col)
+			for (int row = 0; row < 4; ++row)
+				largest = xy::Max(largest, std::abs(ref[col][row]));
+		for (int col = 0; col < 4; ++col)
+			for (int row = 0; row < 4; ++row) {
+				affine_error = xy::Max(affine_error, std::abs(a[col][row] - ref[col][row]) / largest);
+				general_error = xy::Max(general_error, std::abs(g[col][row] - ref[col][row]) / largest);
+			}
+	}
+
+	auto time = [&](auto inverse) {
+		auto op_time = std::chrono::steady_clock::now();
+		float sum = 0.f;
+		for (int pass = 0; pass < 16; ++pass)
+			for (const auto &m : matrices)
+				sum += inverse(m)[3][0];
+		auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - op_time).count();
+		return std::make_pair(ns / (16. * matrices.size()), sum);
+	};
+	auto affine_time = time([](const xy::mat4 &m) { return xy::__ComputeAffineInverse(m); });
+	auto general_time = time(general);
+
+	xy::Print("affine inverse: {} matrices, max error {} affine, {} general, {}ns vs {}ns\n",
+		matrices.size(), affine_error, general_error, affine_time.first, general_time.first);
+	if (affine_time.second != affine_time.second || general_time.second != general_time.second)
+		XY_Die("inverse of a model matrix not finite");
+	if (num_not_dispatched != 0)
+		XY_Die("xy::Inverse skipped the affine path");
+	if (affine_error > 2. * general_error)
+		XY_Die("affine inverse less accurate than the general inverse");
+}
+
+void BenchFiberBVH()
+{
+	FiberAsset fiber_asset;
+	fiber_asset.LoadFromFile(
+		xy_config::GetAssetPath("hair/fibers_on_plane.ind"),
+		xy_config::GetAssetPath("hair/hair_base_color.jpg"),
+		xy_config::GetAssetPath("hair/hair_spec_offset.jpg"));
+
+	AABB bounds(fiber_asset.positions);
+	float radius = bounds.Lengths().Norm()*1e-4f;
+
+	FiberBVH bvh;
+	for (int num_threads : {1, 0}) {
+		JobSystem jobs(num_threads);
+		bvh.Build(fiber_asset, radius, jobs);
+		auto &stats = bvh.Stats();
+		xy::Print(
+			"bvh build(threads={}): {}ms, {} segs, {} nodes, {} leaves, depth {}\n",
+			jobs.NumThreads(), stats.build_ms, bvh.NumSegments(),
+			stats.num_nodes, stats.num_leaves, stats.max_depth);
+	}
+
+	constexpr int num_rays = 1 << 20;
+	xy::RandomEngine eng{ 0xc01dbeef };
+	std::vector<FiberBVH::Ray> rays(num_rays);
+	for (auto &ray : rays) {
+		xy::vec3 tgt = bounds.inf + bounds.Lengths()*xy::vec3(xy::Unif(eng), xy::Unif(eng), xy::Unif(eng));
+		ray.o = bounds.Center() + bounds.Lengths()*xy::vec3(0.f, 1.f, 1.f);
+		ray.d = xy::Normalize(tgt - ray.o);
+		ray.tmin = 0.f;
+		ray.tmax = std::numeric_limits<float>::max();
+	}
+
+	int num_hits = 0;
+	auto elapse = xy::TimeProfile([&]() {
+		for (auto &ray : rays) {
+			FiberBVH::Hit hit;
+			num_hits += bvh.Intersect(ray, &hit);
+		}
+	}, 1);
+	xy::Print("bvh closest hit: {} rays, {} hits, {}ms\n", num_rays, num_hits, elapse);
+
+	num_hits = 0;
+	elapse = xy::TimeProfile([&]() {
+		for (auto &ray : rays)
+			num_hits += bvh.Occluded(ray);
+	}, 1);
+	xy::Print("bvh any hit: {} rays, {} hits, {}ms\n", num_rays, num_hits, elapse);
+
+	num_hits = 0;
+	elapse = xy::TimeProfile([&]() {
+		for (auto &ray : rays) {
+			FiberBVH::Hit hit;
+			num_hits += bvh.ClosestPoint(ray.o + ray.d, radius * 100.f, &hit);
+		}
+	}, 1);
+	xy::Print("bvh closest point: {} queries, {} found, {}ms\n", num_rays, num_hits, elapse);
+
+	elapse = xy::TimeProfile([&]() { bvh.Refit(fiber_asset.positions); }, 10);
+	xy::Print("bvh refit: {}ms/10 loops\n", elapse);
+}
+
+// Builds the fiber BVH over segments SAH splits unevenly: from the origin
+// along each axis, with lengths doubling from 2^-max_exp to 2^max_exp,
+// which SAH peels off a few per level. The tree has to stay within the
+// traversal stack and closest point queries have to find the segments.
+void TestFiberBVHDegenerate(int max_exp)
+{
+	std::vector<xy::vec3> positions;
+	for (int e = -max_exp; e <= max_exp; ++e)
+		for (int axis = 0; axis < 3; ++axis) {
+			xy::vec3 p(0.f);
+			p[axis] = std::ldexp(1.f, e);
+			positions.push_back(xy::vec3(0.f));
+			positions.push_back(p);
+		}
+	std::vector<int> num_verts_per_fiber(positions.size() / 2, 2);
+
+	FiberBVH bvh;
+	bvh.Build(positions, num_verts_per_fiber, 0.f);
+	auto &stats = bvh.Stats();
+
+	// Beside the segments of length 2^e and longer on axis, at half their
+	// length from them. Small exponents only, so squared distances stay
+	// finite.
+	int num_lost = 0;
+	for (int e = -30; e <= 30; ++e)
+		for (int axis = 0; axis < 3; ++axis) {
+			float len = std::ldexp(1.f, e);
+			xy::vec3 p(0.f);
+			p[axis] = len;
+			p[(axis + 1) % 3] = .5f*len;
+
+			FiberBVH::Hit hit;
+			int seg = bvh.ClosestPoint(p, len, &hit) ? hit.vert / 2 : -1;
+			if (seg % 3 != axis || seg / 3 - max_exp < e || std::abs(hit.t - .5f*len) > 1e-4f*len)
+				++num_lost;
+		}
+
+	xy::Print("fiber bvh degenerate: {} segs, {} nodes, depth {}, {} lost\n",
+		bvh.NumSegments(), stats.num_nodes, stats.max_depth, num_lost);
+	if (stats.max_depth > 64)
+		XY_Die("fiber bvh deeper than its traversal stack");
+	if (num_lost != 0)
+		XY_Die("fiber bvh lost segments");
+}
+
+// Ray against capsule [p0,p1] of radius r, d normalized: the nearer of
+// the side entry, within the segment, and the entries of the end spheres.
+// Written apart from the BVH's, as the reference of TestFiberBVHRays.
+float RayCapsuleReference(const xy::vec3 &ray_o, const xy::vec3 &d, const xy::vec3 &p0, const xy::vec3 &p1, float r)
+{
+	// From the ray point nearest p0, so the quadratics stay at the scale
+	// of the capsule.
+	float t_shift = xy::Dot(p0 - ray_o, d);
+	auto o = ray_o + t_shift * d;
+	float t_min = std::numeric_limits<float>::max();
+
+	float len = (p1 - p0).Norm();
+	auto axis = (p1 - p0) / len;
+	auto d_perp = d - xy::Dot(d, axis)*axis;
+	auto o_perp = (o - p0) - xy::Dot(o - p0, axis)*axis;
+	float a = xy::Dot(d_perp, d_perp), b = xy::Dot(d_perp, o_perp), c = xy::Dot(o_perp, o_perp) - r * r;
+	if (a > 0.f && b * b - a * c >= 0.f) {
+		float t = (-b - sqrtf(b * b - a * c)) / a;
+		float s = xy::Dot(o + t * d - p0, axis);
+		if (s >= 0.f && s <= len)
+			t_min = t;
+	}
+
+	for (auto &center : { p0, p1 }) {
+		auto oc = o - center;
+		float h = xy::Dot(oc, d)*xy::Dot(oc, d) - (xy::Dot(oc, oc) - r * r);
+		if (h >= 0.f)
+			t_min = xy::Min(t_min, -xy::Dot(oc, d) - sqrtf(h));
+	}
+	return t_min + t_shift;
+}
+
+// Random rays from outside a tangle of random walk fibers, closest and
+// any hits of the BVH against every segment tested by brute force. A
+// closest hit may name a neighbour segment only at the same distance,
+// where the two share the joint sphere.
+void TestFiberBVHRays(int num_fibers, int num_rays)
+{
+	constexpr int num_verts = 16;
+	constexpr float radius = .01f;
+	xy::RandomEngine eng{ 0xc01dbeef };
+	auto unif3 = [&eng]() { return xy::vec3(xy::Unif(eng), xy::Unif(eng), xy::Unif(eng)); };
+
+	std::vector<xy::vec3> positions;
+	for (int fiber = 0; fiber < num_fibers; ++fiber) {
+		positions.push_back(unif3());
+		for (int i = 1; i < num_verts; ++i)
+			positions.push_back(positions.back() + .05f*xy::Normalize(unif3() - xy::vec3(.5f)));
+	}
+	std::vector<int> num_verts_per_fiber(num_fibers, num_verts);
+
+	FiberBVH bvh;
+	bvh.Build(positions, num_verts_per_fiber, radius);
+
+	// Closest entry at or past tmin, by brute force.
+	auto reference = [&](const FiberBVH::Ray &ray, int *vert) {
+		float t_min = std::numeric_limits<float>::max();
+		for (int fiber = 0; fiber < num_fibers; ++fiber)
+			for (int i = fiber * num_verts; i < (fiber + 1)*num_verts - 1; ++i) {
+				float t = RayCapsuleReference(ray.o, ray.d, positions[i], positions[i + 1], radius);
+				if (t >= ray.tmin && t < t_min) {
+					t_min = t;
+					*vert = i;
+				}
+			}
+		return t_min;
+	};
+
+	// Hits lie around 2 away, where a float step is 2.4e-7.
+	constexpr float t_tolerance = 1e-3f * radius;
+	float max_t_error = 0.f;
+	int num_hits = 0, num_closest_wrong = 0, num_occluded_wrong = 0;
+	for (int k = 0; k < num_rays; ++k) {
+		// Origins on a sphere the walks do not reach.
+		FiberBVH::Ray ray;
+		ray.o = xy::vec3(.5f) + 2.f*xy::Normalize(unif3() - xy::vec3(.5f));
+		ray.d = xy::Normalize(unif3() - ray.o);
+		ray.tmin = 0.f;
+		ray.tmax = std::numeric_limits<float>::max();
+
+		int ref_vert = -1;
+		float ref_t = reference(ray, &ref_vert);
+		bool ref_hit = ref_vert >= 0;
+		num_hits += ref_hit;
+
+		FiberBVH::Hit hit;
+		bool bvh_hit = bvh.Intersect(ray, &hit);
+		if (bvh_hit != ref_hit)
+			++num_closest_wrong;
+		else if (bvh_hit) {
+			float hit_vert_t = RayCapsuleReference(ray.o, ray.d, positions[hit.vert], positions[hit.vert + 1], radius);
+			max_t_error = xy::Max(max_t_error, fabsf(hit.t - ref_t));
+			if (fabsf(hit.t - ref_t) > t_tolerance || fabsf(hit_vert_t - ref_t) > t_tolerance)
+				++num_closest_wrong;
+		}
+
+		// Any hit up to a random distance, ending short of or past the
+		// closest hit.
+		ray.tmax = 4.f*xy::Unif(eng);
+		if (bvh.Occluded(ray) != (ref_t < ray.tmax))
+			++num_occluded_wrong;
+	}
+
+	xy::Print("fiber bvh rays: {} segs, {} rays, {} hits, max t error {}, {} closest wrong, {} any wrong\n",
+		bvh.NumSegments(), num_rays, num_hits, max_t_error, num_closest_wrong, num_occluded_wrong);
+	if (num_closest_wrong != 0)
+		XY_Die("fiber bvh closest hit differs from brute force");
+	if (num_occluded_wrong != 0)
+		XY_Die("fiber bvh any hit differs from brute force");
+}
+
+// Loader temporaries per asset through one arena, reset in between, with
+// the process's peak resident memory after each load. Assets missing
+// from the asset root are skipped.
+void BenchAssetLoading()
+{
+	Arena scratch;
+	std::size_t num_allocs = 0;
+	auto report = [&](const std::string &name) {
+		const auto &stats = scratch.GetStats();
+		xy::Print(
+			"load {}: {} arena allocs, {}KB in the arena, {} chunks so far, peak rss {}MB\n",
+			name, stats.num_allocs - num_allocs, scratch.BytesUsed() / 1024, stats.num_chunks,
+			PeakResidentBytes() / (1024 * 1024));
+		num_allocs = stats.num_allocs;
+	};
+	auto exists = [](const std::string &name) {
+		return std::experimental::filesystem::exists(xy_config::AssetRoot() + name);
+	};
+
+	for (auto name : { "simple_scene/simple_scene.obj", "blender_girl/blender_girl.obj", "yuksel/woman.obj" }) {
+		if (!exists(name))
+			continue;
+		auto dir = std::string(name).substr(0, std::string(name).find('/') + 1);
+		ObjAsset asset;
+		asset.LoadFromFile(xy_config::GetAssetPath(name), xy_config::GetAssetPath(dir), scratch);
+		report(name);
+		scratch.Reset();
+	}
+	for (auto name : { "hair/zigzag.ind", "hair/fibers_on_plane.ind", "simple_scene/simple_scene_fibers.ind",
+		"blender_girl/blender_girl_hair.ind", "yuksel/curly.ind" }) {
+		if (!exists(name))
+			continue;
+		FiberAsset asset;
+		asset.LoadFromFile(
+			xy_config::GetAssetPath(name),
+			xy_config::GetAssetPath("hair/hair_base_color.jpg"),
+			xy_config::GetAssetPath("hair/hair_spec_offset.jpg"),
+			scratch);
+		report(name);
+		scratch.Reset();
+	}
+}
+
+// Fits the hair assets, and curls of 64 vertices the short fibers of the
+// assets cannot stand for, as curves, reporting the memory of both forms
+// per asset, and runs the CPU reference of the resampling from near, far
+// and with pieces of a thousandth of a pixel. Fits stay within tolerance,
+// resampled curves pass through their controls, segments join consecutive
+// vertices, a frame stays within its vertices unless cut at the controls,
+// and the far view cuts fewer pieces.
+void TestStrandCurves(float tolerance)
+{
+	auto check = [tolerance](const std::string &name, const FiberAsset &asset) {
+		StrandCurves curves;
+		curves.Fit(asset, tolerance);
+		const auto &stats = curves.GetStats();
+		xy::Print("curves {}: {} fibers, {} verts to {} controls, {}KB dense, {}KB as curves, {}KB resampled, max error {}, {}ms\n",
+			name, stats.num_curves, stats.num_dense_verts, stats.num_controls,
+			stats.dense_bytes / 1024, stats.curve_bytes / 1024, stats.resampled_bytes / 1024,
+			stats.max_error, stats.fit_ms);
+		if (stats.max_error > tolerance)
+			XY_Die("curve fit out of tolerance");
+		if (stats.resampled_bytes > stats.dense_bytes)
+			XY_Die("resampled curves take more than the dense vertices");
+
+		auto center = asset.bounds.Center();
+		auto radius = asset.bounds.Lengths().Norm();
+		std::size_t num_pieces[3] = { 0, 0, 0 };
+		int max_pieces[3];
+		for (int view = 0; view < 3; ++view) {
+			float dist = view == 1 ? 100.f * radius : radius;
+			auto view_proj = xy::Perspective(xy::DegreeToRadian(45.f), 16.f / 9.f, dist * .01f, dist * 10.f) *
+				xy::LookAt(center + xy::vec3(0.f, 0.f, dist), center, { 0.f, 1.f, 0.f });
+
+			std::vector<xy::vec3> positions, tangents;
+			std::vector<float> scales;
+			std::vector<std::uint32_t> lines;
+			max_pieces[view] = curves.Resample(view_proj, { 1280.f, 720.f }, view == 2 ? 1e-3f : 4.f, positions, tangents, scales, lines);
+			if (positions.size() != tangents.size() || positions.size() != scales.size() ||
+				lines.size() != 2 * (positions.size() - curves.Curves().size()))
+				XY_Die("resampled curves are laid out wrong");
+			if (max_pieces[view] > 1 ? positions.size() > curves.MaxResampledVerts() : positions.size() != curves.Controls().size())
+				XY_Die("resampled curves overflow their frame");
+
+			// Controls in order among the vertices, curves in order too.
+			std::size_t num_bad = 0, vert = 0, num_matched = 0;
+			for (const auto &c : curves.Controls()) {
+				while (vert < positions.size() && (positions[vert].x != c.x || positions[vert].y != c.y || positions[vert].z != c.z))
+					++vert;
+				num_matched += vert < positions.size();
+			}
+			num_bad += num_matched != curves.Controls().size();
+			for (std::size_t i = 0; i < lines.size(); i += 2)
+				num_bad += lines[i + 1] != lines[i] + 1 || lines[i + 1] >= positions.size();
+			for (const auto &tangent : tangents)
+				num_bad += std::abs(tangent.Norm() - 1.f) > 1e-4f;
+			if (num_bad != 0)
+				XY_Die("resampled curves miss their controls");
+			num_pieces[view] = lines.size() / 2;
+		}
+		xy::Print("resample {}: {} pieces near of {} at most, {} far, {} fine of {} at most, in {} verts\n",
+			name, num_pieces[0], max_pieces[0], num_pieces[1], num_pieces[2], max_pieces[2], curves.MaxResampledVerts());
+		if (num_pieces[1] > num_pieces[0] || (max_pieces[0] > 1 && stats.num_controls > stats.num_curves && num_pieces[1] == num_pieces[0]))
+			XY_Die("far curves are not cut coarser");
+		return max_pieces[0];
+	};
+
+	for (auto name : { "hair/zigzag.ind", "hair/fibers_on_plane.ind", "simple_scene/simple_scene_fibers.ind",
+		"blender_girl/blender_girl_hair.ind", "yuksel/curly.ind" }) {
+		if (!std::experimental::filesystem::exists(xy_config::AssetRoot() + name))
+			continue;
+		FiberAsset asset;
+		asset.LoadFromFile(xy_config::GetAssetPath(name), "", "");
+		check(name, asset);
+	}
+
+	// Curls on a grid, a turn a fiber.
+	FiberAsset curls;
+	for (int fiber = 0; fiber < 1024; ++fiber) {
+		xy::vec3 root{ static_cast<float>(fiber % 32) * .05f, 0.f, static_cast<float>(fiber / 32) * .05f };
+		for (int k = 0; k < 64; ++k) {
+			float angle = k * 2.f * xy::pi<float> / 64.f;
+			curls.positions.push_back(root + xy::vec3(.02f * std::cos(angle), k * .01f, .02f * std::sin(angle)));
+			curls.scales.push_back(1.f - k / 64.f);
+			curls.bounds.Extend(curls.positions.back());
+		}
+		curls.num_verts_per_fiber.push_back(64);
+	}
+	if (check("curls", curls) == 1)
+		XY_Die("curls near are cut at their controls");
+}
+
+// The four vertices the removed ppll_store.geom emitted per segment, in
+// triangle strip order, as it computed them.
+std::array<FiberCorner, 4> GeometryShaderFiberQuad(
+	const FiberQuadParams &params,
+	const xy::vec3 &p0, const xy::vec3 &p1,
+	const xy::vec4 &t0, const xy::vec4 &t1)
+{
+	float ratio0 = t0.w - std::floor(t0.w), ratio1 = t1.w - std::floor(t1.w);
+	float radius_scale = 1.f / xy::Max(params.win_size.x, params.win_size.y);
+	float radius0 = params.hair_radius * ratio0 * radius_scale;
+	float radius1 = params.hair_radius * ratio1 * radius_scale;
+
+	auto proj_right = [&](const xy::vec3 &p, const xy::vec4 &t, xy::vec3 &right) {
+		auto view_dir = xy::Normalize(p - params.eye);
+		right = xy::Normalize(xy::Cross(xy::Normalize(xy::vec3(t.x, t.y, t.z)), view_dir));
+		auto proj = params.view_proj * xy::vec4(right.x, right.y, right.z, 0.f);
+		return xy::Normalize(xy::vec2(proj.x, proj.y));
+	};
+	xy::vec3 right0, right1;
+	auto proj_right0 = proj_right(p0, t0, right0);
+	auto proj_right1 = proj_right(p1, t1, right1);
+
+	float expand_pixels = .71f;
+	auto edge = [&](const xy::vec3 &q, const xy::vec2 &pr, float sign) {
+		auto tmp = params.view_proj * xy::vec4(q.x, q.y, q.z, 1.f);
+		auto offset = pr*expand_pixels / params.win_size.y;
+		if (sign < 0.f)
+			return xy::vec4(tmp.x / tmp.w - offset.x, tmp.y / tmp.w - offset.y, tmp.z / tmp.w, 1.f);
+		return xy::vec4(tmp.x / tmp.w + offset.x, tmp.y / tmp.w + offset.y, tmp.z / tmp.w, 1.f);
+	};
+	auto e0_root = edge(p0 - right0*radius0, proj_right0, -1.f);
+	auto e0_tip = edge(p1 - right1*radius1, proj_right1, -1.f);
+	auto e1_root = edge(p0 + right0*radius0, proj_right0, 1.f);
+	auto e1_tip = edge(p1 + right1*radius1, proj_right1, 1.f);
+	if (xy::Dot(proj_right0, proj_right1) < 0.f)
+		std::swap(e0_tip, e1_tip);
+
+	xy::vec4 win_root{ e0_root.x, e0_root.y, e1_root.x, e1_root.y };
+	xy::vec4 win_tip{ e0_tip.x, e0_tip.y, e1_tip.x, e1_tip.y };
+	return { {
+		{ e0_root, p0, t0, win_root },
+		{ e0_tip, p1, t1, win_tip },
+		{ e1_root, p0, t0, win_root },
+		{ e1_tip, p1, t1, win_tip } } };
+}
+
+// The pulled quads of shader/ppll_store.vert against the geometry shader
+// path they replace: every segment of the hair assets, drawn as
+// GpuArray::DrawLineStripsPulled splits the runs, gets the same triangles,
+// and a fixed segment hits golden corners.
+void TestFiberQuad()
+{
+	FiberQuadParams params;
+	params.eye = { 0.f, 0.f, 3.f };
+	params.view_proj = xy::Perspective(xy::DegreeToRadian(45.f), 16.f / 9.f, .1f, 100.f) *
+		xy::LookAt(params.eye, { 0.f, 0.f, 0.f }, { 0.f, 1.f, 0.f });
+	params.win_size = { 1280.f, 720.f };
+	params.hair_radius = 1.f;
+
+	auto near = [](const xy::vec4 &a, const xy::vec4 &b, float tolerance) {
+		return std::abs(a.x - b.x) <= tolerance && std::abs(a.y - b.y) <= tolerance &&
+			std::abs(a.z - b.z) <= tolerance && std::abs(a.w - b.w) <= tolerance;
+	};
+
+	// Golden corners, the tip turned over so the sides swap there.
+	{
+		xy::vec3 p0{ 0.f, 0.f, 0.f }, p1{ .1f, .2f, 0.f };
+		xy::vec4 t0{ 1.f, 2.f, 0.f, .75f }, t1{ -1.f, -2.f, 0.f, 1.25f };
+		const xy::vec4 golden[4] = {
+			{ 9.742607e-4f, -8.660094e-4f, .9352686f, 1.f },
+			{ 4.608262e-2f, .1602221f, .9352686f, 1.f },
+			{ -9.742607e-4f, 8.660094e-4f, .9352686f, 1.f },
+			{ 4.445040e-2f, .1616730f, .9352686f, 1.f } };
+		auto quad = GeometryShaderFiberQuad(params, p0, p1, t0, t1);
+		for (int corner = 0; corner < 4; ++corner) {
+			auto c = ExpandFiberCorner(params, p0, p1, t0, t1, corner);
+			if (!near(c.position, golden[corner], 1e-5f) || !near(quad[corner].position, golden[corner], 1e-5f))
+				XY_Die("fiber quad corner off its golden value");
+		}
+	}
+
+	for (auto name : { "hair/zigzag.ind", "hair/fibers_on_plane.ind", "simple_scene/simple_scene_fibers.ind",
+		"blender_girl/blender_girl_hair.ind", "yuksel/curly.ind" }) {
+		if (!std::experimental::filesystem::exists(xy_config::AssetRoot() + name))
+			continue;
+		FiberAsset asset;
+		asset.LoadFromFile(xy_config::GetAssetPath(name), "", "");
+
+		// The transform of one instance, applied as ppll_store.vert does.
+		auto model = xy::Translation({ .1f, -.2f, 0.f }) *
+			xy::QuatToMat4(xy::AngleAxisToQuat(.3f, { 0.f, 1.f, 0.f })) *
+			xy::Scale({ .5f, 1.f, .5f });
+		auto transform = InstanceTransform::FromModel(model);
+		auto center = model * xy::vec4(asset.bounds.Center().x, asset.bounds.Center().y, asset.bounds.Center().z, 1.f);
+		auto scene_params = params;
+		scene_params.eye = xy::vec3(center.x, center.y, center.z) + xy::vec3(0.f, 0.f, asset.bounds.Lengths().Norm());
+		scene_params.view_proj = xy::Perspective(xy::DegreeToRadian(45.f), 16.f / 9.f, .01f, 100.f) *
+			xy::LookAt(scene_params.eye, xy::vec3(center.x, center.y, center.z), { 0.f, 1.f, 0.f });
+
+		auto world = [&](int vert) {
+			const auto &p = asset.positions[vert];
+			auto w = model * xy::vec4(p.x, p.y, p.z, 1.f);
+			return xy::vec3(w.x, w.y, w.z);
+		};
+		auto tangent = [&](int vert) {
+			const auto &t = asset.tangents[vert];
+			auto w = t.x * transform.normal[0] + t.y * transform.normal[1] + t.z * transform.normal[2];
+			return xy::vec4(w.x, w.y, w.z, asset.scales[vert]);
+		};
+
+		// Runs of equal strips, as GpuArray::AppendLineStrips merges them.
+		std::vector<std::pair<int, int>> runs;
+		for (auto nverts : asset.num_verts_per_fiber)
+			if (!runs.empty() && runs.back().second == nverts)
+				++runs.back().first;
+			else
+				runs.push_back({ 1, nverts });
+
+		// The two triangles of a four vertex strip, the second wound back.
+		const int strip_triangles[6] = { 0,1,2,2,1,3 };
+		std::size_t num_segments = 0, num_expected = 0, num_bad = 0;
+		float max_diff = 0.f;
+		int first_vert = 0;
+		for (const auto &run : runs) {
+			int nverts = run.second;
+			if (nverts >= 2) {
+				int run_segments = run.first * (nverts - 1);
+				num_expected += run_segments;
+				for (int first = 0; first < run_segments; first += GpuArray::pull_segments_per_draw) {
+					int count = xy::Min(run_segments - first, GpuArray::pull_segments_per_draw);
+					for (int s = 0; s < count; ++s) {
+						++num_segments;
+						for (int k = 0; k < 6; ++k) {
+							auto pulled = PullFiberCorner(first_vert, nverts, first, 4 * s + fiber_quad_indices[k]);
+							int v = pulled.vert;
+							auto c = ExpandFiberCorner(scene_params, world(v), world(v + 1), tangent(v), tangent(v + 1), pulled.corner);
+
+							// The strip the geometry shader emitted for the same segment.
+							int strip = (first + s) / (nverts - 1);
+							int g = first_vert + strip * nverts + (first + s) % (nverts - 1);
+							auto quad = GeometryShaderFiberQuad(scene_params, world(g), world(g + 1), tangent(g), tangent(g + 1));
+							const auto &e = quad[strip_triangles[k]];
+
+							for (int i = 0; i < 4; ++i)
+								max_diff = xy::Max(max_diff, std::abs(c.position[i] - e.position[i]));
+							num_bad += v != g || !near(c.position, e.position, 1e-6f) ||
+								!near(c.win_e0e1, e.win_e0e1, 1e-6f) || !near(c.tangent, e.tangent, 0.f);
+						}
+					}
+				}
+			}
+			first_vert += run.first * nverts;
+		}
+		xy::Print("fiber quads {}: {} segments in {} runs, {} mismatched corners, max diff {}\n",
+			name, num_segments, runs.size(), num_bad, max_diff);
+		if (num_bad != 0 || num_segments != num_expected)
+			XY_Die("pulled fiber quads differ from the geometry shader");
+	}
+}
+
+// IND_HAIR data of num_fibers fibers of 32 vertices, made up as it is
+// read, so a groom of any size streams without a file.
+class SyntheticHairBuf : public std::streambuf {
+public:
+	static constexpr int verts_per_fiber = 32;
+
+	explicit SyntheticHairBuf(std::size_t num_fibers)
+		:
+		num_fibers_{ num_fibers },
+		next_fiber_{ 0 },
+		header_done_{ false }
+	{}
+
+	// Fibers stand on a grid, waving up in y.
+	static xy::vec3 Vertex(std::size_t fiber, int k)
+	{
+		float x = static_cast<float>(fiber % 4096) * .01f;
+		float z = static_cast<float>(fiber / 4096 % 4096) * .01f;
+		float phase = static_cast<float>(fiber % 97) * .1f;
+		return { x + .02f * std::sin(phase + k * .3f), k * .01f, z };
+	}
+
+	static std::size_t FileBytes(std::size_t num_fibers)
+	{
+		return 16 + num_fibers * (sizeof(unsigned) + verts_per_fiber * sizeof(xy::vec3));
+	}
+
+protected:
+	int_type underflow() override
+	{
+		buf_.clear();
+		auto append = [this](const void *src, std::size_t n) {
+			auto bytes = static_cast<const char*>(src);
+			buf_.insert(buf_.end(), bytes, bytes + n);
+		};
+		if (!header_done_) {
+			unsigned counts[2] = { static_cast<unsigned>(num_fibers_), static_cast<unsigned>(num_fibers_ * verts_per_fiber) };
+			append("IND_HAIR", 8);
+			append(counts, sizeof(counts));
+			header_done_ = true;
+		}
+		for (; next_fiber_ < num_fibers_ && buf_.size() < (1 << 20); ++next_fiber_) {
+			unsigned nverts = verts_per_fiber;
+			append(&nverts, sizeof(nverts));
+			for (int k = 0; k < verts_per_fiber; ++k) {
+				auto p = Vertex(next_fiber_, k);
+				append(&p, sizeof(p));
+			}
+		}
+		if (buf_.empty())
+			return traits_type::eof();
+		setg(buf_.data(), buf_.data(), buf_.data() + buf_.size());
+		return traits_type::to_int_type(buf_[0]);
+	}
+
+private:
+	std::size_t num_fibers_, next_fiber_;
+	bool header_done_;
+	std::vector<char> buf_;
+};
+
+// Streams the hair assets through a stand-in of the GL upload, in chunks
+// of a few fibers, and checks the chunks against LoadFromFile. Then
+// streams a synthetic groom of about file_bytes with the peak resident
+// memory compared against the chunk size.
+void TestFiberStreaming(std::size_t file_bytes, int fibers_per_chunk)
+{
+	for (auto name : { "hair/zigzag.ind", "hair/fibers_on_plane.ind", "simple_scene/simple_scene_fibers.ind" }) {
+		if (!std::experimental::filesystem::exists(xy_config::AssetRoot() + name))
+			continue;
+		FiberAsset loaded;
+		loaded.LoadFromFile(xy_config::GetAssetPath(name), "", "");
+
+		std::size_t num_mismatches = 0, num_fibers = 0;
+		FiberUploadApi api;
+		api.reserve = [&](std::size_t nfibers, std::size_t nverts) {
+			if (nfibers != loaded.num_verts_per_fiber.size() || nverts != loaded.positions.size())
+				++num_mismatches;
+		};
+		api.upload = [&](const FiberChunk &chunk) {
+			if (chunk.first_fiber != num_fibers)
+				++num_mismatches;
+			for (std::size_t i = 0; i < chunk.num_verts_per_fiber.size(); ++i)
+				num_mismatches += chunk.num_verts_per_fiber[i] != loaded.num_verts_per_fiber[num_fibers + i];
+			for (std::size_t i = 0; i < chunk.positions.size(); ++i) {
+				auto k = chunk.first_vert + i;
+				num_mismatches += std::memcmp(&chunk.positions[i], &loaded.positions[k], sizeof(xy::vec3)) != 0;
+				num_mismatches += std::memcmp(&chunk.tangents[i], &loaded.tangents[k], sizeof(xy::vec3)) != 0;
+				num_mismatches += chunk.scales[i] != loaded.scales[k];
+			}
+			num_fibers += chunk.num_verts_per_fiber.size();
+		};
+
+		FiberAsset streamed;
+		std::ifstream fp(xy_config::GetAssetPath(name), std::ios::binary);
+		auto stats = streamed.StreamFromFile(fp, 7, api);
+		if (std::memcmp(&streamed.bounds, &loaded.bounds, sizeof(AABB)) != 0)
+			++num_mismatches;
+		xy::Print("stream {}: {} fibers, {} verts, {} chunks, {} mismatches\n",
+			name, stats.num_fibers, stats.num_verts, stats.num_chunks, num_mismatches);
+		if (num_mismatches != 0)
+			XY_Die("streamed fibers differ from the loaded ones");
+	}
+
+	std::size_t num_fibers = file_bytes / SyntheticHairBuf::FileBytes(1);
+	SyntheticHairBuf buf(num_fibers);
+	std::istream in(&buf);
+
+	std::size_t num_bad = 0, reserved = 0, next_vert = 0;
+	FiberUploadApi api;
+	api.reserve = [&](std::size_t, std::size_t num_verts) { reserved = num_verts; };
+	api.upload = [&](const FiberChunk &chunk) {
+		if (chunk.first_vert != next_vert)
+			++num_bad;
+		// Every fiber's second vertex, and the direction it leaves in.
+		for (std::size_t i = 0; i < chunk.num_verts_per_fiber.size(); ++i) {
+			auto k = i * SyntheticHairBuf::verts_per_fiber + 1;
+			auto p = SyntheticHairBuf::Vertex(chunk.first_fiber + i, 1);
+			auto q = SyntheticHairBuf::Vertex(chunk.first_fiber + i, 2);
+			if ((chunk.positions[k] - p).Norm() > 1e-6f || (chunk.tangents[k] - xy::Normalize(q - p)).Norm() > 1e-4f)
+				++num_bad;
+		}
+		next_vert += chunk.positions.size();
+	};
+
+	auto rss_before = PeakResidentBytes();
+	FiberAsset asset;
+	FiberAsset::StreamStats stats;
+	auto elapse = xy::TimeProfile([&]() { stats = asset.StreamFromFile(in, fibers_per_chunk, api); }, 1);
+	auto rss_growth = PeakResidentBytes() - rss_before;
+
+	xy::Print("stream synthetic: {}MB, {} fibers, {} verts, {} chunks of {}KB, {} bad, {}ms, peak rss +{}MB\n",
+		SyntheticHairBuf::FileBytes(num_fibers) / (1024 * 1024), stats.num_fibers, stats.num_verts,
+		stats.num_chunks, stats.peak_chunk_bytes / 1024, num_bad, elapse, rss_growth / (1024 * 1024));
+	if (num_bad != 0 || reserved != stats.num_verts || next_vert != stats.num_verts)
+		XY_Die("synthetic groom streamed wrong");
+	// The chunk, plus the generator's buffer and allocator slack.
+	if (rss_growth > 2 * stats.peak_chunk_bytes + (std::size_t{ 8 } << 20))
+		XY_Die("streaming held more than a chunk");
+}
+
+// Noise summed over a grid with ParallelFor, from one thread to all of
+// them, then the scheduling rules: dependencies run first, main jobs on
+// the main thread, and one thread runs jobs in the same order every time.
+void BenchJobSystem()
+{
+	constexpr int grid = 1 << 8;
+	auto noise = [](int begin, int end, std::vector<float> &sums) {
+		for (int z = begin; z < end; ++z) {
+			float sum = 0.f;
+			for (int y = 0; y < grid; ++y)
+				for (int x = 0; x < grid; ++x)
+					sum += xy::Perlin(x * .05f, y * .05f, z * .05f);
+			sums[z] = sum;
+		}
+	};
+
+	int max_threads = static_cast<int>(std::thread::hardware_concurrency());
+	std::vector<int> thread_counts;
+	for (int num_threads = 1; num_threads < max_threads; num_threads *= 2)
+		thread_counts.push_back(num_threads);
+	thread_counts.push_back(xy::Max(max_threads, 1));
+
+	std::vector<float> reference(grid);
+	noise(0, grid, reference);
+	double single_ms = 0.;
+	for (auto num_threads : thread_counts) {
+		JobSystem jobs(num_threads);
+		std::vector<float> sums(grid);
+		auto op_time = std::chrono::steady_clock::now();
+		jobs.ParallelFor(0, grid, 4, [&](int begin, int end) { noise(begin, end, sums); });
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - op_time).count();
+		if (num_threads == 1)
+			single_ms = ms;
+		if (sums != reference)
+			XY_Die("parallel for left a hole");
+		xy::Print(
+			"job system(threads={}): {}ms, {}x, {} jobs, {} steals\n",
+			num_threads, ms, single_ms / ms, jobs.GetStats().num_jobs, jobs.GetStats().num_steals);
+	}
+
+	JobSystem jobs(max_threads);
+	std::atomic<int> step{ 0 };
+	std::atomic<bool> in_order{ true };
+	auto expect = [&](int at) {
+		return [&, at]() { in_order = in_order && step++ == at; };
+	};
+	auto first = jobs.Run(expect(0));
+	auto second = jobs.Run(expect(1), { first });
+	std::thread::id main_ran;
+	auto last = jobs.Run([&]() { expect(2)(); main_ran = std::this_thread::get_id(); }, { second }, JobAffinity::Main);
+	jobs.Wait(last);
+	if (!in_order || main_ran != std::this_thread::get_id())
+		XY_Die("job graph ran out of order");
+
+	auto trace = []() {
+		JobSystem single(1);
+		std::vector<int> order;
+		std::vector<JobSystem::Job> all;
+		for (int i = 0; i < 64; ++i)
+			all.push_back(single.Run([&order, i]() { order.push_back(i); }, { i >= 8 ? all[i - 8] : nullptr }));
+		for (const auto &job : all)
+			single.Wait(job);
+		return order;
+	};
+	if (trace() != trace())
+		XY_Die("single threaded job order changed between runs");
+	xy::Print("job system: graph in order, single threaded runs repeat\n");
+}
+
+// Strands solved per millisecond against the number of threads, on the
+// bundled grooms with the roots swinging about y. Roots have to stay on
+// the rest pose and segments near their rest length.
+void BenchStrandSim()
+{
+	for (auto name : { "hair/fibers_on_plane.ind", "simple_scene/simple_scene_fibers.ind" }) {
+		FiberAsset fiber_asset;
+		fiber_asset.LoadFromFile(
+			xy_config::GetAssetPath(name),
+			xy_config::GetAssetPath("hair/hair_base_color.jpg"),
+			xy_config::GetAssetPath("hair/hair_spec_offset.jpg"));
+
+		StrandSim sim;
+		sim.Init(fiber_asset, StrandSim::DefaultParams());
+		const auto &stats = sim.GetStats();
+		xy::Print(
+			"strand sim {}: {} strands, {} particles, {} padding\n",
+			name, stats.num_strands, stats.num_particles, stats.num_padding);
+
+		int max_threads = static_cast<int>(std::thread::hardware_concurrency());
+		std::vector<int> thread_counts;
+		for (int num_threads = 1; num_threads < max_threads; num_threads *= 2)
+			thread_counts.push_back(num_threads);
+		thread_counts.push_back(xy::Max(max_threads, 1));
+
+		constexpr int num_steps = 60;
+		for (auto num_threads : thread_counts) {
+			JobSystem jobs(num_threads);
+			sim.Reset();
+			double step_ms = 0.;
+			// Step 0 places the rest pose.
+			for (int step = 0; step <= num_steps; ++step) {
+				float angle = xy::DegreeToRadian(30.f) * std::sin(step * .2f);
+				sim.Step(1.f / 60.f, xy::QuatToMat4(xy::AngleAxisToQuat(angle, { 0.f, 1.f, 0.f })), jobs);
+				if (step > 0)
+					step_ms += stats.step_ms;
+			}
+			xy::Print(
+				"strand sim(threads={}): {}ms/step, {} strands/ms\n",
+				num_threads, step_ms / num_steps, num_steps * stats.num_strands / step_ms);
+		}
+
+		float root_drift = 0.f, max_stretch = 0.f;
+		const auto &pos = sim.Positions();
+		for (std::size_t fib = 0, first = 0; fib < fiber_asset.num_verts_per_fiber.size(); ++fib) {
+			int nverts = fiber_asset.num_verts_per_fiber[fib];
+			root_drift = xy::Max(root_drift, (pos[first] - fiber_asset.positions[first]).Norm());
+			for (int i = 1; i < nverts; ++i) {
+				float rest = (fiber_asset.positions[first + i] - fiber_asset.positions[first + i - 1]).Norm();
+				float len = (pos[first + i] - pos[first + i - 1]).Norm();
+				if (rest > 0.f)
+					max_stretch = xy::Max(max_stretch, std::abs(len / rest - 1.f));
+			}
+			first += nverts;
+		}
+		xy::Print("strand sim root drift {}, max stretch {}\n", root_drift, max_stretch);
+	}
+}
+
+// CPU build cost and GPU footprint of deep opacity maps against the
+// moment shadow map, at the resolutions Draw::Init picks.
+void BenchDeepOpacity()
+{
+	FiberAsset fiber_asset;
+	fiber_asset.LoadFromFile(
+		xy_config::GetAssetPath("hair/fibers_on_plane.ind"),
+		xy_config::GetAssetPath("hair/hair_base_color.jpg"),
+		xy_config::GetAssetPath("hair/hair_spec_offset.jpg"));
+
+	AABB world_bounds(fiber_asset.positions);
+	auto tgt = world_bounds.Center();
+	auto radius = world_bounds.Lengths().Norm()*.25f;
+	auto sun_light_dir = xy::vec3(1.f, 1.f, 1.f);
+	auto light_view_proj_matrix =
+		xy::Orthographic(-radius, radius, -radius, radius, 0.f, 4.f*radius) *
+		xy::LookAt(tgt + radius * sun_light_dir, tgt, { 0.f,1.f,0.f });
+
+	int width = xy_config::screen_width, height = xy_config::screen_height;
+
+	// Moment map: nearest depth per texel, converted to optimized moments.
+	int msm_width = 2 * width, msm_height = 2 * height;
+	std::vector<xy::vec4> moments;
+	auto msm_elapse = xy::TimeProfile([&]() {
+		std::vector<float> depth(msm_width*msm_height, 1.f);
+		DeepOpacityMap::RasterizeFibers(
+			fiber_asset.positions, fiber_asset.num_verts_per_fiber, light_view_proj_matrix,
+			msm_width, msm_height,
+			[&](int x, int y, float z) {
+			auto &d = depth[y*msm_width + x];
+			d = xy::Min(d, z);
+		});
+		moments.resize(depth.size());
+		for (std::size_t i = 0; i < depth.size(); ++i)
+			moments[i] = MSM_OptimizedMoments(depth[i]);
+	}, 1);
+
+	DeepOpacityMap dom;
+	for (int num_layers : {4, 8}) {
+		auto dom_elapse = xy::TimeProfile([&]() {
+			dom.Build(
+				fiber_asset.positions, fiber_asset.num_verts_per_fiber, light_view_proj_matrix,
+				width, height, num_layers, .005f, .9f);
+		}, 1);
+		xy::Print("dom({} layers): cpu build {}ms, gpu {}KB\n",
+			num_layers, dom_elapse, width*height*(4 + 2 * num_layers) / 1024);
+	}
+	xy::Print("msm: cpu build {}ms, gpu {}KB, filter temp {}KB\n", msm_elapse,
+		MSM::MemoryBytes(msm_width, msm_height) / 1024, MSM::TempBytes(msm_width, msm_height) / 1024);
+
+	// Transmittance along a column through the groom.
+	for (int i = 0; i <= 10; ++i) {
+		auto p = tgt + (.1f*i - .5f)*world_bounds.Lengths().y*xy::vec3(0.f, 1.f, 0.f);
+		xy::Print("dom transmittance at {}: {}\n", p, dom.Transmittance(light_view_proj_matrix, p, 1.f));
+	}
+}
+
+// Fragment lists standing in for a captured groom: list lengths uniform in
+// [0, max_frags], random colors at partial coverage, view depths within
+// depth_range projected to window depth with proj_z.
+struct SyntheticOIT {
+	OITFragmentLists lists;
+	xy::vec2 proj_z, depth_range;
+};
+
+SyntheticOIT SyntheticOITLists(int width, int height, int max_frags, uint64_t seed)
+{
+	SyntheticOIT out;
+	auto proj = xy::Perspective(xy::DegreeToRadian(45.f), 1.f, .1f, 100.f);
+	out.proj_z = xy::vec2(proj[2][2], proj[3][2]);
+	out.depth_range = xy::vec2(1.5f, 2.5f);
+
+	xy::RandomEngine eng{ seed };
+	auto &lists = out.lists;
+	lists.width = width;
+	lists.height = height;
+	lists.offsets.assign(1, 0);
+	for (int i = 0; i < width*height; ++i) {
+		int count = static_cast<int>(xy::Unif(eng)*(max_frags + 1));
+		for (int j = 0; j < count; ++j) {
+			float view_depth = xy::Lerp(out.depth_range.x, out.depth_range.y, xy::Unif(eng));
+			float ndc = out.proj_z.y / view_depth - out.proj_z.x;
+			xy::vec4 color(xy::Unif(eng), xy::Unif(eng), xy::Unif(eng), .1f + .5f*xy::Unif(eng));
+			lists.frags.push_back({ color, .5f*ndc + .5f });
+		}
+		lists.offsets.push_back(static_cast<int>(lists.frags.size()));
+	}
+	return out;
+}
+
+// Weighted blending against the exact sort on synthetic lists. The
+// transmittance is a product over the fragments and has to match; color
+// is approximate, its error has to stay within max_rmse.
+void TestWeightedOIT(double max_rmse)
+{
+	auto synth = SyntheticOITLists(64, 64, 32, 0xc01dbeef);
+	auto exact = xy::ResolveImage(synth.lists, xy::ResolveSorted);
+	auto weighted = xy::ResolveImage(synth.lists, [&synth](const OITFragment *frags, int count) {
+		return xy::ResolveWeighted(frags, count, synth.proj_z);
+	});
+
+	auto err = xy::CompareImages(weighted, exact);
+	float max_alpha_error = 0.f;
+	for (std::size_t i = 0; i < exact.size(); ++i)
+		max_alpha_error = xy::Max(max_alpha_error, fabsf(weighted[i].a - exact[i].a));
+
+	xy::Print("weighted oit: rmse={},max={},#diff_pixels={},max transmittance error {}\n",
+		err.rmse, err.max_abs, err.num_diff_pixels, max_alpha_error);
+	if (max_alpha_error > 1e-5f)
+		XY_Die("weighted oit transmittance differs from the exact resolve");
+	if (err.rmse > max_rmse)
+		XY_Die("weighted oit beyond its error bound");
+}
+
+// Moments against the exact sort on synthetic lists, with the bias and
+// overestimation of MBOITForHair. Transmittance is exact as with weighted
+// blending; color error has to stay within max_rmse.
+void TestMomentOIT(double max_rmse)
+{
+	auto synth = SyntheticOITLists(64, 64, 32, 0xc01dbeef);
+	auto exact = xy::ResolveImage(synth.lists, xy::ResolveSorted);
+	auto moments = xy::ResolveImage(synth.lists, [&synth](const OITFragment *frags, int count) {
+		return xy::ResolveMoments(frags, count, synth.proj_z, synth.depth_range,
+			MBOITForHair::moment_bias, MBOITForHair::overestimation);
+	});
+
+	auto err = xy::CompareImages(moments, exact);
+	float max_alpha_error = 0.f;
+	for (std::size_t i = 0; i < exact.size(); ++i)
+		max_alpha_error = xy::Max(max_alpha_error, fabsf(moments[i].a - exact[i].a));
+
+	xy::Print("moment oit: rmse={},max={},#diff_pixels={},max transmittance error {}\n",
+		err.rmse, err.max_abs, err.num_diff_pixels, max_alpha_error);
+	if (max_alpha_error > 1e-4f)
+		XY_Die("moment oit transmittance differs from the exact resolve");
+	if (err.rmse > max_rmse)
+		XY_Die("moment oit beyond its error bound");
+}
+
+// AnalyzeTiledOIT on an image with partial tiles at the right and bottom
+// edges, every pixel of tile t holding t fragments. Tile counts follow
+// from the tile areas, and the budget drops what exceeds it.
+void TestTiledOIT(int tile_size, std::size_t tile_budget)
+{
+	int num_tiles_x = 3, num_tiles_y = 2;
+	OITFragmentLists lists;
+	lists.width = num_tiles_x * tile_size - tile_size / 2;
+	lists.height = num_tiles_y * tile_size - tile_size / 2;
+	lists.offsets.assign(1, 0);
+	for (int y = 0; y < lists.height; ++y)
+		for (int x = 0; x < lists.width; ++x) {
+			int tile = (y / tile_size)*num_tiles_x + x / tile_size;
+			lists.frags.resize(lists.frags.size() + tile, OITFragment{ xy::vec4(1.f, 1.f, 1.f, .5f), .5f });
+			lists.offsets.push_back(static_cast<int>(lists.frags.size()));
+		}
+
+	int num_active = 0;
+	std::size_t num_frags = 0, num_dropped = 0, max_count = 0;
+	for (int ty = 0; ty < num_tiles_y; ++ty)
+		for (int tx = 0; tx < num_tiles_x; ++tx) {
+			std::size_t area =
+				xy::Min(tile_size, lists.width - tx * tile_size) *
+				xy::Min(tile_size, lists.height - ty * tile_size);
+			std::size_t count = area * (ty*num_tiles_x + tx);
+			num_active += count > 0;
+			num_frags += count;
+			num_dropped += count > tile_budget ? count - tile_budget : 0;
+			max_count = xy::Max(max_count, count);
+		}
+
+	auto stats = xy::AnalyzeTiledOIT(lists, tile_size, tile_budget);
+	xy::Print("tiled oit: {}/{} active tiles, {} frags, {} dropped, max {} mean {} per tile\n",
+		stats.num_active_tiles, stats.num_tiles, stats.num_frags, stats.num_dropped,
+		stats.max_tile_ops, stats.mean_tile_ops);
+	if (stats.num_tiles != num_tiles_x * num_tiles_y || stats.num_active_tiles != num_active)
+		XY_Die("tiled oit tile count mismatch");
+	if (stats.num_frags != num_frags || stats.ppll_counter_ops != num_frags)
+		XY_Die("tiled oit fragment count mismatch");
+	if (stats.max_tile_ops != max_count || stats.mean_tile_ops != static_cast<double>(num_frags) / num_active)
+		XY_Die("tiled oit per-tile counts mismatch");
+	if (stats.num_dropped != num_dropped)
+		XY_Die("tiled oit dropped fragments mismatch");
+}
+
+// AnalyzePPLLDispatch on synthetic lists longer than the last bucket.
+// Bucket b holds lists of b+1 fragments, the last one every longer list;
+// each list has to fall in exactly one bucket, and sorting the compact
+// list by bucket must not lower utilization.
+void TestPPLLDispatch(int simd_width, int num_buckets)
+{
+	auto synth = SyntheticOITLists(64, 64, 2 * num_buckets, 0xc01dbeef);
+	auto &lists = synth.lists;
+
+	std::vector<int> bucket_counts(num_buckets, 0);
+	std::size_t num_bucketed_frags = 0;
+	int num_misplaced = 0;
+	for (int i = 0; i < lists.NumPixels(); ++i) {
+		int count = lists.Count(i);
+		if (count == 0)
+			continue;
+		int num_buckets_in = 0, bucket = -1;
+		for (int b = 0; b < num_buckets; ++b)
+			if (count == b + 1 || (b == num_buckets - 1 && count > num_buckets)) {
+				++num_buckets_in;
+				++bucket_counts[b];
+				num_bucketed_frags += count;
+				bucket = b;
+			}
+		num_misplaced += num_buckets_in != 1 || bucket != xy::PPLLLengthBucket(count, num_buckets);
+	}
+
+	auto stats = xy::AnalyzePPLLDispatch(lists, simd_width, num_buckets);
+	xy::Print("ppll dispatch: {} active, utilization fullscreen {}, compact {}, sorted {}\n",
+		stats.num_active, stats.fullscreen.utilization,
+		stats.compact_unsorted.utilization, stats.compact_sorted.utilization);
+	if (num_misplaced != 0 || num_bucketed_frags != lists.frags.size())
+		XY_Die("ppll dispatch lists not in exactly one bucket");
+	if (stats.bucket_counts != bucket_counts)
+		XY_Die("ppll dispatch bucket counts mismatch");
+	if (std::accumulate(bucket_counts.begin(), bucket_counts.end(), 0) != stats.num_active)
+		XY_Die("ppll dispatch buckets miss active pixels");
+	if (stats.compact_sorted.utilization < stats.compact_unsorted.utilization)
+		XY_Die("ppll dispatch sorted by bucket lowers utilization");
+}
+
+// Error against the exact sort and CPU time of every resolve of the
+// hair modes: the K-buffers of ppll_blend.frag, weighted blending and
+// moments.
+void ReportOITResolves(const OITFragmentLists &lists, xy::vec2 proj_z, xy::vec2 depth_range)
+{
+	std::vector<xy::vec4> exact, kbuf, sorted_kbuf, weighted, moments;
+	auto exact_ms = xy::TimeProfile([&]() {
+		exact = xy::ResolveImage(lists, xy::ResolveSorted);
+	}, 1);
+	auto kbuf_ms = xy::TimeProfile([&]() {
+		kbuf = xy::ResolveImage(lists, [](const OITFragment *frags, int count) {
+			return xy::ResolvePPLLKBuffer(frags, count, 32);
+		});
+	}, 1);
+	auto sorted_kbuf_ms = xy::TimeProfile([&]() {
+		sorted_kbuf = xy::ResolveImage(lists, [](const OITFragment *frags, int count) {
+			return xy::ResolveSortedKBuffer(frags, count, 32);
+		});
+	}, 1);
+	auto weighted_ms = xy::TimeProfile([&]() {
+		weighted = xy::ResolveImage(lists, [proj_z](const OITFragment *frags, int count) {
+			return xy::ResolveWeighted(frags, count, proj_z);
+		});
+	}, 1);
+	auto moments_ms = xy::TimeProfile([&]() {
+		moments = xy::ResolveImage(lists, [proj_z, depth_range](const OITFragment *frags, int count) {
+			return xy::ResolveMoments(frags, count, proj_z, depth_range,
+				MBOITForHair::moment_bias, MBOITForHair::overestimation);
+		});
+	}, 1);
+
+	auto report = [](const char *name, const ImageError &err, long long ms) {
+		xy::Print("{}:rmse={},max={},#diff_pixels={},cpu_ms={}\n",
+			name, err.rmse, err.max_abs, err.num_diff_pixels, ms);
+	};
+	report("exact", xy::CompareImages(exact, exact), exact_ms);
+	report("selection_kbuf32", xy::CompareImages(kbuf, exact), kbuf_ms);
+	report("sorted_kbuf32", xy::CompareImages(sorted_kbuf, exact), sorted_kbuf_ms);
+	report("wboit", xy::CompareImages(weighted, exact), weighted_ms);
+	report("mboit", xy::CompareImages(moments, exact), moments_ms);
+}
+
+// ReportOITResolves on synthetic lists of the screen size, so quality and
+// speed of the resolves are measured without a window.
+void BenchOITResolve()
+{
+	auto synth = SyntheticOITLists(xy_config::screen_width, xy_config::screen_height, 64, 0xc01dbeef);
+	xy::Print("#fragments={},#pixels={}\n", synth.lists.frags.size(), synth.lists.NumPixels());
+	ReportOITResolves(synth.lists, synth.proj_z, synth.depth_range);
+}
+
+// The sorted K-buffer against the exact sort and the selection K-buffer
+// on synthetic lists up to twice kbuf_size long. Lists that fit the
+// K-buffer resolve exactly, and insertion needs fewer depth comparisons
+// than selection over the image.
+void TestSortedKBuffer(int kbuf_size)
+{
+	auto synth = SyntheticOITLists(64, 64, 2 * kbuf_size, 0xc01dbeef);
+	auto &lists = synth.lists;
+
+	std::size_t sorted_comparisons = 0, selection_comparisons = 0;
+	int num_fit = 0, num_mismatch = 0;
+	for (int i = 0; i < lists.NumPixels(); ++i) {
+		int count = lists.Count(i);
+		auto sorted = xy::ResolveSortedKBuffer(lists.Begin(i), count, kbuf_size, &sorted_comparisons);
+		xy::ResolvePPLLKBuffer(lists.Begin(i), count, kbuf_size, &selection_comparisons);
+		if (count > kbuf_size)
+			continue;
+		++num_fit;
+		auto exact = xy::ResolveSorted(lists.Begin(i), count);
+		for (int c = 0; c < 4; ++c)
+			num_mismatch += fabsf(sorted[c] - exact[c]) > 1e-6f;
+	}
+
+	xy::Print("sorted kbuffer(K={}): {} lists fit, {} mismatches, comparisons {} vs selection {}\n",
+		kbuf_size, num_fit, num_mismatch, sorted_comparisons, selection_comparisons);
+	if (num_mismatch != 0)
+		XY_Die("sorted kbuffer differs from the exact resolve on lists that fit");
+	if (sorted_comparisons >= selection_comparisons)
+		XY_Die("sorted kbuffer compares no less than selection");
+}
+
+// Comparisons per pixel, time and error against an exact sort of the
+// K-buffer resolves, on lists recorded by 'Compare hair modes' when path
+// exists, on synthetic lists otherwise.
+void BenchKBufferResolve(const std::string &path)
+{
+	OITFragmentLists lists;
+	if (std::ifstream(path)) {
+		xy::LoadOITFragmentLists(lists, path);
+	}
+	else {
+		xy::Print("{} not found, synthetic lists\n", path);
+		lists = SyntheticOITLists(xy_config::screen_width, xy_config::screen_height, 64, 0xc01dbeef).lists;
+	}
+
+	int num_active = 0, max_frags = 0;
+	for (int i = 0; i < lists.NumPixels(); ++i) {
+		num_active += lists.Count(i) > 0;
+		max_frags = xy::Max(max_frags, lists.Count(i));
+	}
+	xy::Print("#fragments={},#pixels={},max/pixel={}\n", lists.frags.size(), num_active, max_frags);
+
+	std::vector<xy::vec4> exact;
+	auto exact_ms = xy::TimeProfile([&]() {
+		exact = xy::ResolveImage(lists, xy::ResolveSorted);
+	}, 1);
+	xy::Print("exact: {}ms\n", exact_ms);
+
+	auto bench = [&](const char *name, int kbuf_size, auto resolve) {
+		std::size_t num_comparisons = 0;
+		std::vector<xy::vec4> image;
+		auto ms = xy::TimeProfile([&]() {
+			num_comparisons = 0;
+			image = xy::ResolveImage(lists, [&](const OITFragment *frags, int count) {
+				return resolve(frags, count, kbuf_size, &num_comparisons);
+			});
+		}, 1);
+		auto err = xy::CompareImages(image, exact);
+		xy::Print("{}(K={}): comparisons/pixel={},{}ms,rmse={},max={},#diff_pixels={}\n",
+			name, kbuf_size,
+			static_cast<double>(num_comparisons) / xy::Max(num_active, 1), ms,
+			err.rmse, err.max_abs, err.num_diff_pixels);
+	};
+
+	bench("selection", 32, xy::ResolvePPLLKBuffer);
+	for (int kbuf_size : {4, 8, 16, 32, 64})
+		bench("sorted", kbuf_size, xy::ResolveSortedKBuffer);
+}
+
+// Replays the barriers Draw::Render declares for a PPLL frame and the
+// frame pacing on a GL stand-in, whose GPU retires a frame gpu_lag frames
+// after it is fenced. In steady state no full flush is issued, every frame
+// issues the same barriers, and the CPU only blocks when the GPU lags
+// more frames than are in flight.
+void TestGpuSync(int frames_in_flight, int gpu_lag)
+{
+	long long frame = 0, retired = -1;
+	std::map<GLsync, long long> fenced;
+	std::uintptr_t next_sync = 1;
+	std::vector<GLbitfield> frame_barriers;
+	std::size_t num_finishes = 0;
+
+	GpuSyncApi api;
+	api.memory_barrier = [&](GLbitfield bits) { frame_barriers.push_back(bits); };
+	api.fence = [&]() {
+		auto sync = reinterpret_cast<GLsync>(next_sync++);
+		fenced[sync] = frame;
+		return sync;
+	};
+	api.client_wait = [&](GLsync sync, GLuint64 timeout_ns) {
+		// A blocking wait lets the GPU catch up to the fence.
+		if (timeout_ns > 0)
+			retired = xy::Max(retired, fenced[sync]);
+		return fenced[sync] <= retired;
+	};
+	api.delete_sync = [&](GLsync sync) { fenced.erase(sync); };
+	api.finish = [&]() { ++num_finishes; retired = frame; };
+
+	GpuHazardTracker hazards(api);
+	FramePacer pacer(frames_in_flight, api);
+	int shadow_map = hazards.Register("msm shadow map");
+	int heads = hazards.Register("ppll heads");
+	int nodes = hazards.Register("ppll nodes");
+	int counter = hazards.Register("ppll counter");
+
+	const int num_frames = 16;
+	std::vector<GLbitfield> steady_barriers;
+	bool same_barriers = true;
+	for (; frame < num_frames; ++frame) {
+		retired = xy::Max(retired, frame - gpu_lag);
+		frame_barriers.clear();
+
+		pacer.BeginFrame();
+		hazards.Access({ { shadow_map, GpuAccess::RenderTarget } });
+		hazards.Access({ { shadow_map, GpuAccess::ImageRead }, { shadow_map, GpuAccess::ImageWrite } });
+		hazards.Access({ { shadow_map, GpuAccess::TextureFetch } });
+		hazards.Access({ { heads, GpuAccess::Transfer }, { counter, GpuAccess::Transfer } });
+		hazards.Access({ { heads, GpuAccess::ImageWrite }, { nodes, GpuAccess::StorageWrite }, { counter, GpuAccess::AtomicCounter } });
+		hazards.Access({ { heads, GpuAccess::ImageRead }, { nodes, GpuAccess::StorageRead } });
+		pacer.EndFrame();
+
+		if (frame == 1)
+			steady_barriers = frame_barriers;
+		else if (frame > 1)
+			same_barriers = same_barriers && frame_barriers == steady_barriers;
+	}
+
+	const auto &stats = pacer.GetStats();
+	xy::Print("frames_in_flight={},gpu_lag={}:#finishes={},steady={},#barriers/frame={},same_barriers={},#blocked_waits={}/{}\n",
+		frames_in_flight, gpu_lag,
+		num_finishes, pacer.SteadyState(),
+		steady_barriers.size(), same_barriers,
+		stats.num_blocked_waits, stats.num_fence_waits);
+	if (num_finishes != 0 || !pacer.SteadyState() || !same_barriers)
+		XY_Die("full flush or unstable barriers in steady state");
+}
+
+// Replays the binds and switches of a PPLL frame twice on a GL stand-in
+// that tracks the state: unfiltered, as the passes issued them before the
+// cache, and through GlStateCache. The state seen by every draw has to
+// match, and at least min_redundant of the requests must be filtered.
+void TestGlState(int num_frames, double min_redundant)
+{
+	struct SimState {
+		GLuint program, draw_fb, read_fb, vao;
+		GLenum active_unit;
+		GLboolean depth_mask;
+		std::map<GLenum, bool> caps;
+		std::map<GLuint, GLuint> units;
+		std::map<GLuint, std::uint32_t> vao_attribs;
+
+		bool operator==(const SimState &o) const
+		{
+			return program == o.program && draw_fb == o.draw_fb && read_fb == o.read_fb &&
+				vao == o.vao && depth_mask == o.depth_mask && caps == o.caps && units == o.units &&
+				vao_attribs.at(vao) == o.vao_attribs.at(o.vao);
+		}
+	};
+
+	auto stand_in = [](SimState &sim, std::size_t &num_calls) {
+		GlStateApi api;
+		api.use_program = [&](GLuint program) { ++num_calls; sim.program = program; };
+		api.bind_framebuffer = [&](GLenum target, GLuint fb) {
+			++num_calls;
+			if (target != GL_READ_FRAMEBUFFER)
+				sim.draw_fb = fb;
+			if (target != GL_DRAW_FRAMEBUFFER)
+				sim.read_fb = fb;
+		};
+		api.set_capability = [&](GLenum cap, bool enabled) { ++num_calls; sim.caps[cap] = enabled; };
+		api.depth_mask = [&](GLboolean flag) { ++num_calls; sim.depth_mask = flag; };
+		api.active_texture = [&](GLenum unit) { ++num_calls; sim.active_unit = unit; };
+		api.bind_texture = [&](GLenum, GLuint texture) { ++num_calls; sim.units[sim.active_unit - GL_TEXTURE0] = texture; };
+		api.bind_vertex_array = [&](GLuint vao) { ++num_calls; sim.vao = vao; };
+		api.set_vertex_attrib = [&](GLuint vao, GLuint index, bool enabled) {
+			++num_calls;
+			if (enabled)
+				sim.vao_attribs[vao] |= 1u << index;
+			else
+				sim.vao_attribs[vao] &= ~(1u << index);
+		};
+		return api;
+	};
+
+	SimState raw_sim{}, cached_sim{};
+	std::size_t num_raw_calls = 0, num_cached_calls = 0;
+	GlStateApi raw = stand_in(raw_sim, num_raw_calls);
+	GlStateCache cache(stand_in(cached_sim, num_cached_calls));
+	raw_sim.vao_attribs[0] = cached_sim.vao_attribs[0] = 0;
+
+	std::size_t num_draws = 0, num_mismatches = 0;
+	auto draw = [&](GLuint vao, std::uint32_t attribs) {
+		// GpuArray used to enable around every draw and unbind after.
+		raw.bind_vertex_array(vao);
+		for (GLuint i = 0; i < 32; ++i)
+			if (attribs & (1u << i))
+				raw.set_vertex_attrib(vao, i, true);
+		auto raw_state = raw_sim;
+		for (GLuint i = 0; i < 32; ++i)
+			if (attribs & (1u << i))
+				raw.set_vertex_attrib(vao, i, false);
+		raw.bind_vertex_array(0);
+
+		cache.BindVertexArray(vao);
+		cache.SetVertexAttribs(vao, attribs);
+
+		++num_draws;
+		num_mismatches += raw_state == cached_sim ? 0 : 1;
+	};
+	auto bind = [&](GLuint unit, GLuint texture) {
+		raw.active_texture(GL_TEXTURE0 + unit);
+		raw.bind_texture(GL_TEXTURE_2D, texture);
+		cache.BindTexture(unit, GL_TEXTURE_2D, texture);
+	};
+	auto program = [&](GLuint handle) { raw.use_program(handle); cache.UseProgram(handle); };
+	auto framebuffer = [&](GLenum target, GLuint fb) { raw.bind_framebuffer(target, fb); cache.BindFramebuffer(target, fb); };
+	auto cap = [&](GLenum name, bool enabled) { raw.set_capability(name, enabled); cache.SetCapability(name, enabled); };
+	auto depth_mask = [&](GLboolean flag) { raw.depth_mask(flag); cache.DepthMask(flag); };
+
+	// Programs, framebuffers, textures and vertex arrays by name.
+	enum : GLuint { msm = 1, platte, ppll_store, composite };
+	enum : GLuint { shadow_fb = 1, composite_fb };
+	enum : GLuint { shadow_map = 1, hair_base, hair_spec, resolve_color, diffuse0 };
+	enum : GLuint { quad_vao = 1, fiber_vao, mesh_vao0 };
+	const int num_shapes = 4, num_fiber_batches = 3;
+
+	for (int frame = 0; frame < num_frames; ++frame) {
+		cache.Invalidate();
+
+		// Moment shadow map, meshes then the filter.
+		framebuffer(GL_FRAMEBUFFER, shadow_fb);
+		program(msm);
+		cap(GL_DEPTH_TEST, true);
+		for (int shape = 0; shape < num_shapes; ++shape)
+			draw(mesh_vao0 + shape, 0x1 | 0xf0);
+		program(0);
+		framebuffer(GL_FRAMEBUFFER, 0);
+
+		// Opaque meshes.
+		framebuffer(GL_FRAMEBUFFER, composite_fb);
+		cap(GL_BLEND, false);
+		cap(GL_DEPTH_TEST, true);
+		depth_mask(GL_TRUE);
+		for (int shape = 0; shape < num_shapes; ++shape) {
+			program(platte);
+			cap(GL_DEPTH_TEST, true);
+			bind(0, shadow_map);
+			bind(1, diffuse0 + shape / 2);
+			bind(2, diffuse0 + shape / 2);
+			draw(mesh_vao0 + shape, 0x7 | 0xf0);
+		}
+
+		// Hair store, uniforms and textures assigned per batch.
+		framebuffer(GL_FRAMEBUFFER, composite_fb);
+		cap(GL_DEPTH_TEST, true);
+		depth_mask(GL_FALSE);
+		program(ppll_store);
+		for (int batch = 0; batch < num_fiber_batches; ++batch) {
+			program(ppll_store);
+			bind(0, shadow_map);
+			bind(1, hair_base);
+			bind(2, hair_spec);
+			draw(fiber_vao, 0x3 | 0xf0);
+		}
+
+		// Composite over the opaque layer.
+		cap(GL_DEPTH_TEST, false);
+		program(composite);
+		bind(0, resolve_color);
+		cap(GL_BLEND, true);
+		draw(quad_vao, 0x1);
+		cap(GL_BLEND, false);
+		cap(GL_DEPTH_TEST, true);
+		depth_mask(GL_TRUE);
+		framebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	xy::Print("frames={}:#draws={},#mismatches={},#calls raw={},cached={},redundant={}\n",
+		num_frames, num_draws, num_mismatches, num_raw_calls, num_cached_calls, cache.RedundantRatio());
+	if (num_mismatches != 0)
+		XY_Die("the state cache changed what a draw sees");
+	if (cache.RedundantRatio() < min_redundant)
+		XY_Die("fewer redundant calls filtered than expected");
+}
+
+// Declares the passes of a PPLL frame at width x height, as Draw does,
+// on a hazard tracker whose barriers are recorded, and runs it for a few
+// frames. The deep opacity pass is culled with moment shadows, so is a
+// debug pass nothing reads. Passes keep their declared order, the moment
+// filter's temp shares the node arena's memory, the store pass waits for
+// the filter's writes to it, and the barriers settle after the first
+// frame. A tiled PPLL frame declared next has to fit its buffers in the
+// heap the PPLL frame made, so switching modes allocates nothing.
+void TestRenderGraph(int width, int height, ShadowMode shadow_mode)
+{
+	std::vector<std::pair<std::string, GLbitfield>> frame_barriers;
+	std::string current_pass;
+
+	GpuSyncApi api;
+	api.memory_barrier = [&](GLbitfield bits) { frame_barriers.push_back({ current_pass, bits }); };
+	api.fence = []() { return GLsync{}; };
+	api.client_wait = [](GLsync, GLuint64) { return true; };
+	api.delete_sync = [](GLsync) {};
+	api.finish = []() {};
+
+	GpuHazardTracker hazards(api);
+	RenderGraph graph(hazards);
+
+	std::size_t pixels = static_cast<std::size_t>(width)*height;
+	bool use_dom = (shadow_mode == ShadowMode::DOM);
+
+	const int num_frames = 4;
+	std::vector<std::pair<std::string, GLbitfield>> steady_barriers;
+	std::vector<std::string> executed;
+	bool same_barriers = true;
+	std::size_t num_misordered = 0;
+	int msm_temp = -1, heads = -1, nodes = -1;
+
+	for (int frame = 0; frame < num_frames; ++frame) {
+		frame_barriers.clear();
+		executed.clear();
+		graph.Reset();
+
+		int composite = graph.Import("composite layer", pixels * 8, true);
+		int shadow_map = graph.Import("msm shadow map", pixels * 4 * 12);
+		int dom_maps = graph.Import("dom maps", pixels * 20);
+		int counter = graph.Import("ppll counter", sizeof(GLuint));
+		msm_temp = graph.CreateTransient("msm temp", pixels * 4 * 8);
+		heads = graph.CreateTransient("ppll heads", pixels * 4);
+		nodes = graph.CreateTransient("ppll nodes", pixels * 200 * 16);
+		int heatmap = graph.CreateTransient("debug heatmap", pixels * 4);
+
+		std::vector<RenderGraph::Use> shadow_reads{ { shadow_map, GpuAccess::TextureFetch } };
+		if (use_dom)
+			shadow_reads.push_back({ dom_maps, GpuAccess::TextureFetch });
+		auto shaded = [&](std::vector<RenderGraph::Use> uses) {
+			uses.insert(uses.end(), shadow_reads.begin(), shadow_reads.end());
+			return uses;
+		};
+
+		auto run = [&](const char *name) { return [&executed, name]() { executed.push_back(name); }; };
+		graph.AddPass("msm store", { { shadow_map, GpuAccess::RenderTarget } }, run("msm store"));
+		graph.AddPass("msm filter", {
+			{ shadow_map, GpuAccess::ImageRead },
+			{ shadow_map, GpuAccess::ImageWrite },
+			{ msm_temp, GpuAccess::StorageWrite } }, run("msm filter"));
+		graph.AddPass("dom", { { dom_maps, GpuAccess::RenderTarget } }, run("dom"));
+		graph.AddPass("clear", { { composite, GpuAccess::RenderTarget } }, run("clear"));
+		graph.AddPass("platte", shaded({ { composite, GpuAccess::RenderTarget } }), run("platte"));
+		graph.AddPass("ppll clear", {
+			{ heads, GpuAccess::Transfer },
+			{ counter, GpuAccess::Transfer } }, run("ppll clear"));
+		graph.AddPass("ppll store", shaded({
+			{ composite, GpuAccess::RenderTarget },
+			{ heads, GpuAccess::StorageWrite },
+			{ nodes, GpuAccess::StorageWrite },
+			{ counter, GpuAccess::AtomicCounter } }), run("ppll store"));
+		graph.AddPass("debug heatmap", {
+			{ heads, GpuAccess::StorageRead },
+			{ nodes, GpuAccess::StorageRead },
+			{ heatmap, GpuAccess::ImageWrite } }, run("debug heatmap"));
+		graph.AddPass("ppll blend", {
+			{ composite, GpuAccess::RenderTarget },
+			{ heads, GpuAccess::StorageRead },
+			{ nodes, GpuAccess::StorageRead } }, run("ppll blend"));
+
+		graph.Compile();
+		graph.Execute(
+			[&](const std::string &name) { current_pass = name; },
+			[&]() { current_pass.clear(); });
+
+		// Only one pass is ready at a time here, or none of the ready
+		// ones waits on the last, so the declared order stands.
+		const auto &order = graph.Order();
+		for (std::size_t a = 0; a < order.size(); ++a)
+			for (std::size_t b = a + 1; b < order.size(); ++b)
+				if (order[b] < order[a])
+					++num_misordered;
+
+		if (frame == 1)
+			steady_barriers = frame_barriers;
+		else if (frame > 1)
+			same_barriers = same_barriers && frame_barriers == steady_barriers;
+	}
+
+	bool dom_culled = std::find(executed.begin(), executed.end(), "dom") == executed.end();
+	bool heatmap_culled = std::find(executed.begin(), executed.end(), "debug heatmap") == executed.end();
+	bool temp_aliased = graph.Slot(msm_temp) == graph.Slot(nodes) && graph.Slot(heads) != graph.Slot(nodes);
+
+	GLbitfield store_barrier = 0;
+	for (const auto &barrier : steady_barriers)
+		if (barrier.first == "ppll store")
+			store_barrier |= barrier.second;
+
+	const auto stats = graph.GetStats();
+
+	graph.Reset();
+	{
+		std::size_t tiles = static_cast<std::size_t>((width + 15) / 16)*((height + 15) / 16);
+		int composite = graph.Import("composite layer", pixels * 8, true);
+		int shadow_map = graph.Import("msm shadow map", pixels * 4 * 12);
+		int msm_temp = graph.CreateTransient("msm temp", pixels * 4 * 8);
+		int headers = graph.CreateTransient("tiled headers", tiles * 16);
+		int nodes = graph.CreateTransient("tiled nodes", pixels * 16 * 12);
+		int sorted = graph.CreateTransient("tiled sorted", pixels * 16 * 4);
+
+		auto run = []() {};
+		graph.AddPass("msm store", { { shadow_map, GpuAccess::RenderTarget } }, run);
+		graph.AddPass("msm filter", {
+			{ shadow_map, GpuAccess::ImageRead },
+			{ shadow_map, GpuAccess::ImageWrite },
+			{ msm_temp, GpuAccess::StorageWrite } }, run);
+		graph.AddPass("tiled count", {
+			{ composite, GpuAccess::RenderTarget },
+			{ shadow_map, GpuAccess::TextureFetch },
+			{ headers, GpuAccess::Transfer },
+			{ headers, GpuAccess::StorageWrite } }, run);
+		graph.AddPass("tiled store", {
+			{ composite, GpuAccess::RenderTarget },
+			{ shadow_map, GpuAccess::TextureFetch },
+			{ headers, GpuAccess::StorageWrite },
+			{ nodes, GpuAccess::StorageWrite } }, run);
+		graph.AddPass("tiled resolve", {
+			{ composite, GpuAccess::RenderTarget },
+			{ headers, GpuAccess::StorageRead },
+			{ nodes, GpuAccess::StorageRead },
+			{ sorted, GpuAccess::StorageWrite } }, run);
+		graph.Compile();
+		graph.Execute([](const std::string &) {}, []() {});
+	}
+	std::size_t tiled_heap_bytes = graph.HeapBytes();
+
+	xy::Print("{}x{},dom={}:#passes={},#culled={},#misordered={},dom_culled={},heatmap_culled={},temp_aliased={},store_barrier={},#barriers/frame={},same_barriers={},peak={}MB,unaliased={}MB,tiled heap={}MB of {}MB\n",
+		width, height, use_dom,
+		stats.num_passes, stats.num_culled, num_misordered,
+		dom_culled, heatmap_culled, temp_aliased,
+		store_barrier, steady_barriers.size(), same_barriers,
+		stats.PeakBytes() / (1024.*1024.), stats.PeakBytesUnaliased() / (1024.*1024.),
+		tiled_heap_bytes / (1024.*1024.), stats.heap_bytes / (1024.*1024.));
+
+	if (dom_culled == use_dom || !heatmap_culled)
+		XY_Die("render graph culled the wrong passes");
+	if (num_misordered != 0)
+		XY_Die("render graph reordered dependent passes");
+	if (!temp_aliased || stats.PeakBytes() >= stats.PeakBytesUnaliased())
+		XY_Die("render graph did not alias the transients");
+	if (!(store_barrier & GL_SHADER_STORAGE_BARRIER_BIT))
+		XY_Die("ppll store does not wait for the writes to the memory it reuses");
+	if (!same_barriers)
+		XY_Die("unstable barriers in steady state");
+	if (tiled_heap_bytes > stats.heap_bytes)
+		XY_Die("switching to tiled ppll grows the heap");
+}
+
+// Allocator cost of StreamBuffer on host memory, fenced through a GPU
+// stand-in that retires frames gpu_lag frames late. A frame streams
+// instance matrices, uniform blocks, indirect commands and a vertex
+// chunk. A checked run per ring size proves no allocation lands on memory
+// of a frame the GPU may still read; the timed runs compare against a new
+// host allocation per upload, as glBufferData makes one per update.
+void BenchStreamBuffer(int gpu_lag)
+{
+	const int num_frames = 4000;
+	const int num_instances = 1024, num_uniform_blocks = 256, num_draws = 64;
+	const std::size_t uniform_block = 192, vertex_chunk = 256 << 10;
+
+	struct DrawArraysIndirect {
+		GLuint count, instance_count, first, base_instance;
+	};
+	std::vector<xy::mat4> matrices(num_instances, xy::mat4(1.f));
+	std::vector<DrawArraysIndirect> commands(num_draws, { 4, 1, 0, 0 });
+	std::vector<unsigned char> uniforms(uniform_block, 1), vertices(vertex_chunk, 2);
+
+	long long frame = 0, retired = -1;
+	std::map<GLsync, long long> fenced;
+	std::uintptr_t next_sync = 1;
+
+	GpuSyncApi sync;
+	sync.memory_barrier = [](GLbitfield) {};
+	sync.fence = [&]() {
+		auto fence = reinterpret_cast<GLsync>(next_sync++);
+		fenced[fence] = frame;
+		return fence;
+	};
+	sync.client_wait = [&](GLsync fence, GLuint64 timeout_ns) {
+		// A blocking wait lets the GPU catch up to the fence.
+		if (timeout_ns > 0)
+			retired = xy::Max(retired, fenced[fence]);
+		return fenced[fence] <= retired;
+	};
+	sync.delete_sync = [&](GLsync fence) { fenced.erase(fence); };
+	sync.finish = [&]() { retired = frame; };
+
+	auto stream_frame = [&](StreamBuffer &stream, auto check) {
+		check(stream.Write(matrices, StreamUse::Vertex));
+		for (int i = 0; i < num_uniform_blocks; ++i) {
+			auto alloc = stream.Allocate(uniform_block, StreamUse::Uniform);
+			std::memcpy(alloc.data, uniforms.data(), uniform_block);
+			check(alloc);
+		}
+		check(stream.Write(commands, StreamUse::Indirect));
+		check(stream.Write(vertices, StreamUse::Vertex));
+	};
+	auto no_check = [](const StreamAlloc&) {};
+	const int allocs_per_frame = num_uniform_blocks + 3;
+
+	std::size_t frame_bytes = 0;
+	{
+		StreamBuffer probe(StreamBufferApi::Host(), sync);
+		probe.Init(std::size_t{ 64 } << 20);
+		stream_frame(probe, no_check);
+		probe.EndFrame();
+		frame_bytes = probe.GetStats().peak_frame_bytes;
+	}
+
+	for (double frames_of_room : { 1.5, gpu_lag + 2. }) {
+		std::size_t num_overlaps = 0;
+		long long elapse = 0;
+		StreamBuffer::Stats stats;
+
+		for (bool checked : { true, false }) {
+			frame = 0;
+			retired = -1;
+			StreamBuffer stream(StreamBufferApi::Host(), sync);
+			stream.Init(static_cast<std::size_t>(frame_bytes * frames_of_room));
+
+			// Frame that last wrote each 16 bytes.
+			std::vector<long long> owner(checked ? stream.Capacity() / 16 : 0, -1);
+			auto check = [&](const StreamAlloc &alloc) {
+				for (auto i = alloc.offset / 16; i < (alloc.offset + alloc.size + 15) / 16; ++i) {
+					if (owner[i] > retired && owner[i] != frame)
+						++num_overlaps;
+					owner[i] = frame;
+				}
+			};
+
+			auto run = [&]() {
+				for (frame = 0; frame < num_frames; ++frame) {
+					retired = xy::Max(retired, frame - gpu_lag);
+					if (checked)
+						stream_frame(stream, check);
+					else
+						stream_frame(stream, no_check);
+					stream.EndFrame();
+				}
+			};
+			if (checked) {
+				run();
+			}
+			else {
+				elapse = xy::TimeProfile(run, 1);
+				stats = stream.GetStats();
+			}
+		}
+
+		xy::Print("stream buffer(room={} frames,gpu_lag={}): {}KB/frame, {}ns/alloc, {}GB/s, {}/{} fence waits blocked, #overlaps={}\n",
+			frames_of_room, gpu_lag, frame_bytes / 1024,
+			1e6 * elapse / (static_cast<double>(num_frames) * allocs_per_frame),
+			stats.bytes_allocated / (1e6 * xy::Max(elapse, 1ll)),
+			stats.num_blocked_waits, stats.num_fence_waits, num_overlaps);
+		if (num_overlaps != 0)
+			XY_Die("stream buffer handed out memory the GPU may still read");
+	}
+
+	// A fresh allocation and copy per upload.
+	std::size_t sink = 0;
+	auto upload = [&](const void *src, std::size_t bytes) {
+		std::unique_ptr<unsigned char[]> dst(new unsigned char[bytes]);
+		std::memcpy(dst.get(), src, bytes);
+		sink += dst[bytes / 2];
+	};
+	auto elapse = xy::TimeProfile([&]() {
+		for (int i = 0; i < num_frames; ++i) {
+			upload(matrices.data(), matrices.size() * sizeof(xy::mat4));
+			for (int j = 0; j < num_uniform_blocks; ++j)
+				upload(uniforms.data(), uniform_block);
+			upload(commands.data(), commands.size() * sizeof(DrawArraysIndirect));
+			upload(vertices.data(), vertex_chunk);
+		}
+	}, 1);
+	xy::Print("allocation per upload: {}ns/alloc\n",
+		1e6 * elapse / (static_cast<double>(num_frames) * allocs_per_frame));
+
+	// Allocation alone: uniform blocks, nothing written, 10 runs.
+	frame = 0;
+	retired = -1;
+	StreamBuffer stream(StreamBufferApi::Host(), sync);
+	stream.Init(frame_bytes * (gpu_lag + 2));
+	auto stream_ms = xy::TimeProfile([&]() {
+		for (frame = 0; frame < num_frames; ++frame) {
+			retired = xy::Max(retired, frame - gpu_lag);
+			for (int j = 0; j < num_uniform_blocks; ++j)
+				sink += stream.Allocate(uniform_block, StreamUse::Uniform).offset;
+			stream.EndFrame();
+		}
+	}, 10);
+	auto new_ms = xy::TimeProfile([&]() {
+		for (int i = 0; i < num_frames; ++i)
+			for (int j = 0; j < num_uniform_blocks; ++j) {
+				std::unique_ptr<unsigned char[]> dst(new unsigned char[uniform_block]);
+				sink += reinterpret_cast<std::uintptr_t>(dst.get()) & 1;
+			}
+	}, 10);
+	xy::Print("alloc only: stream {}ns, new[] {}ns (sink {})\n",
+		1e5 * stream_ms / (static_cast<double>(num_frames) * num_uniform_blocks),
+		1e5 * new_ms / (static_cast<double>(num_frames) * num_uniform_blocks), sink);
+}
+
+// Profiles frames on a GL stand-in whose timestamps resolve gpu_lag
+// frames after they are issued. Results come back without the CPU
+// waiting, frames are dropped only when the lag exceeds the ring, and the
+// trace is written.
+void TestProfiler(int ring_frames, int gpu_lag)
 {
+	long long frame = 0;
+	GLuint next_query = 1;
+	GLuint64 gpu_clock = 0;
+	std::map<GLuint, std::pair<long long, GLuint64>> stamps;
+
+	GpuTimerApi api;
+	api.gen_query = [&](GLuint *query) { *query = next_query++; };
+	api.delete_query = [&](GLuint query) { stamps.erase(query); };
+	api.timestamp = [&](GLuint query) { gpu_clock += 250000; stamps[query] = { frame, gpu_clock }; };
+	api.available = [&](GLuint query) { return stamps[query].first <= frame - gpu_lag; };
+	api.result = [&](GLuint query) { return stamps[query].second; };
+	api.gpu_now = [&]() { return gpu_clock; };
+
+	Profiler profiler(ring_frames, 240, api);
+	const int num_frames = 32;
+	for (; frame < num_frames; ++frame) {
+		profiler.BeginFrame();
+		{
+			ProfileScope zone(profiler, "msm store", true);
+		}
+		{
+			ProfileScope zone(profiler, "ppll store", true);
+			ProfileScope inner(profiler, "draw strips");
+		}
+		profiler.EndFrame();
+	}
+
+	for (const auto &summary : profiler.Summarize())
+		xy::Print("{} {}:mean={}ms,max={}ms\n", summary.gpu ? "gpu" : "cpu", summary.name, summary.mean_ms, summary.max_ms);
+	const auto &history = profiler.History();
+	xy::Print("ring_frames={},gpu_lag={}:#profiled={},#dropped={}\n",
+		ring_frames, gpu_lag, history.size(), profiler.NumDroppedFrames());
+
+	// The last min(gpu_lag, ring_frames) frames are still in flight.
+	const bool drops = gpu_lag >= ring_frames;
+	std::size_t num_pending = xy::Min(gpu_lag, ring_frames);
+	if (history.size() + profiler.NumDroppedFrames() + num_pending != static_cast<std::size_t>(num_frames))
+		XY_Die("profiled frames lost");
+	if (drops != (profiler.NumDroppedFrames() > 0))
+		XY_Die(drops ? "frames not dropped behind the ring" : "frames dropped within the ring");
+	if (!drops && history.empty())
+		XY_Die("no frames profiled");
+	for (std::size_t i = 0; i < history.size(); ++i) {
+		const auto &profiled = history[i];
+		if (i > 0 && profiled.index <= history[i - 1].index)
+			XY_Die("profile history out of order");
+		if (profiled.cpu.size() != 3 || profiled.gpu.size() != 2)
+			XY_Die("profile zones lost");
+		for (const auto &zone : profiled.gpu)
+			if (zone.end_ms < zone.begin_ms)
+				XY_Die("gpu zone ends before it begins");
+	}
+
+	profiler.WriteChromeTrace("test_trace.json");
+}
+
+int main(int argc, char **argv)
+{
+	// The GL thread is the main thread of the jobs.
+	JobSystem::Global();
+
+	OfflineArgs offline_args;
+	if (ParseOfflineArgs(argc, argv, offline_args)) {
+		if (offline_args.self_test)
+			return RunSelfTests();
+		if (!offline_args.bench.empty())
+			return RunBench(offline_args.bench);
+		return offline_args.bench_instancing ? BenchInstancing(offline_args) : RenderOffline(offline_args);
+	}
+
 	GameALL();
 
 }
@@ -173,7 +2093,8 @@ void ImguiInit(GLFWwindow *window)
 }
 
 void ImguiOverlay(
-	GameParams &params
+	GameParams &params,
+	Draw &draw
 )
 {
 	ImGui_ImplOpenGL3_NewFrame();
@@ -181,17 +2102,149 @@ void ImguiOverlay(
 	ImGui::NewFrame();
 	ImGui::Begin("Tweak");
 	ImGui::Text("(%.2fms,%.0ffps)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+
+	const auto &sync = draw.Pacer().GetStats();
+	ImGui::SliderInt("Frames in flight", &params.frames_in_flight, 1, 4);
+	ImGui::Text("GPU sync: %s, %d full flushes, %.1f barriers/frame, %d/%d fence waits blocked (%.1fms)",
+		draw.Pacer().SteadyState() ? "steady" : "flushed",
+		static_cast<int>(sync.num_full_flushes),
+		static_cast<double>(draw.Hazards().NumBarriers()) / xy::Max(sync.num_frames, std::size_t{ 1 }),
+		static_cast<int>(sync.num_blocked_waits), static_cast<int>(sync.num_fence_waits),
+		sync.blocked_ms);
+
+	const auto &shaders = ShaderLibrary::Global().Stats();
+	ImGui::Text("Shaders: %d programs, %d from cache, %d compiled, %d reloads, %d failed",
+		static_cast<int>(shaders.num_programs), static_cast<int>(shaders.num_cache_hits),
+		static_cast<int>(shaders.num_compiled), static_cast<int>(shaders.num_reloads),
+		static_cast<int>(shaders.num_failed_reloads));
+
+	const auto &gl_state = GlStateCache::Global().GetStats();
+	ImGui::Text("GL state: %d of %d binds and switches redundant (%.0f%%)",
+		static_cast<int>(gl_state.num_requests - gl_state.num_issued), static_cast<int>(gl_state.num_requests),
+		100. * GlStateCache::Global().RedundantRatio());
+
+	const auto &graph = draw.Graph().GetStats();
+	ImGui::Text("Render graph: %d passes, %d culled, %d barriers, peak %.1fMB (%.1fMB unaliased)",
+		graph.num_passes, graph.num_culled, static_cast<int>(graph.num_barriers),
+		graph.PeakBytes() / (1024.*1024.), graph.PeakBytesUnaliased() / (1024.*1024.));
+
+	ImGui::Checkbox("Stream readback", &params.stream_readback);
+	if (params.stream_readback) {
+		auto readback = draw.GetReadbackStats();
+		ImGui::Text("Streamed frame mean %.1f", params.stream_mean);
+		ImGui::Text("Readback: %d/%d delivered, latency %.2fms mean %.2fms max, %.0ffps, %.0fMB/s, %d stalls",
+			static_cast<int>(readback.num_delivered), static_cast<int>(readback.num_issued),
+			readback.mean_latency_ms, readback.max_latency_ms,
+			readback.frames_per_sec, readback.mb_per_sec,
+			static_cast<int>(readback.num_stalls));
+	}
+
+	ImGui::Checkbox("Simulate hair", &params.simulate_hair);
+	if (params.simulate_hair)
+		ImGui::Text("Hair simulation %.2fms", params.hair_sim_ms);
+
+	ImGui::Checkbox("Hair curves", &params.hair_curves);
+	if (params.hair_curves) {
+		ImGui::SliderFloat("Curve tolerance", &params.curve_tolerance, 1e-5f, 1e-2f, "%.5f");
+		ImGui::SliderFloat("Curve pixels per piece", &params.curve_pixels, 1.f, 32.f);
+		ImGui::Text("Hair vertices %.1fMB dense, %.1fMB as curves, %.1fMB resampled",
+			params.curve_dense_mb, params.curve_mb, params.curve_resampled_mb);
+	}
+
 	ImGui::SliderFloat("Hair radius", &params.ppll_hair_radius, 0.f, 5.f);
 	ImGui::SliderFloat("Hair transparency", &params.ppll_hair_transparency, 0.f, 1.f);
+	ImGui::SliderInt("K-buffer size", &params.ppll_kbuf_size, 1, 64);
 
 	ImGui::SliderFloat("MSM moments offset", &params.msm_moments_offset, 0.f, 1.f);
 	ImGui::SliderFloat("MSM depth offset", &params.msm_depth_offset, 0.f, 1.f);
 
+	ImGui::RadioButton("MSM hair shadow", &params.shadow_mode, static_cast<int>(ShadowMode::MSM));
+	ImGui::SameLine();
+	ImGui::RadioButton("DOM hair shadow", &params.shadow_mode, static_cast<int>(ShadowMode::DOM));
+	ImGui::SliderFloat("DOM layer size", &params.dom_layer_size, 1e-4f, 5e-2f, "%.4f");
+	ImGui::SliderFloat("DOM absorption", &params.dom_absorption, 0.f, 4.f);
+
+	ImGui::RadioButton("PPLL hair", &params.hair_mode, static_cast<int>(HairMode::PPLL));
+	ImGui::SameLine();
+	ImGui::RadioButton("WBOIT hair", &params.hair_mode, static_cast<int>(HairMode::WBOIT));
+	ImGui::SameLine();
+	ImGui::RadioButton("MBOIT hair", &params.hair_mode, static_cast<int>(HairMode::MBOIT));
+	ImGui::SameLine();
+	ImGui::RadioButton("Tiled PPLL hair", &params.hair_mode, static_cast<int>(HairMode::TiledPPLL));
+	ImGui::SameLine();
+	ImGui::RadioButton("PPLL compute resolve", &params.hair_mode, static_cast<int>(HairMode::PPLLCompute));
+	if (ImGui::Button("Compare hair modes"))
+		params.compare_hair_modes = true;
+
 	ImGui::End();
+
+	ImguiProfiler(draw.GetProfiler());
+
 	ImGui::Render();
 	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
+// Pass timeline of the latest profiled frame, CPU zones above GPU zones,
+// and per-pass means over the history.
+void ImguiProfiler(Profiler &profiler)
+{
+	ImGui::Begin("Profiler");
+
+	const auto &history = profiler.History();
+	if (history.empty()) {
+		ImGui::Text("No frame profiled yet.");
+		ImGui::End();
+		return;
+	}
+
+	const auto &frame = history.back();
+	double t0 = frame.begin_ms, t1 = frame.end_ms;
+	for (const auto &zone : frame.gpu) {
+		t0 = xy::Min(t0, zone.begin_ms);
+		t1 = xy::Max(t1, zone.end_ms);
+	}
+	ImGui::Text("frame %d: cpu %.2fms, span %.2fms, %d dropped",
+		static_cast<int>(frame.index), frame.end_ms - frame.begin_ms, t1 - t0,
+		static_cast<int>(profiler.NumDroppedFrames()));
+
+	const float row_height = 18.f;
+	auto origin = ImGui::GetCursorScreenPos();
+	float width = ImGui::GetContentRegionAvailWidth();
+	float scale = static_cast<float>(width / xy::Max(t1 - t0, 1e-3));
+	auto *draw_list = ImGui::GetWindowDrawList();
+	auto mouse = ImGui::GetIO().MousePos;
+
+	auto draw_row = [&](const std::vector<ProfileZone> &zones, float top) {
+		for (const auto &zone : zones) {
+			ImVec2 a(origin.x + static_cast<float>(zone.begin_ms - t0)*scale, top + zone.depth*row_height);
+			ImVec2 b(xy::Max(a.x + 1.f, origin.x + static_cast<float>(zone.end_ms - t0)*scale), a.y + row_height - 1.f);
+			auto hue = static_cast<float>(std::hash<std::string>{}(zone.name) % 64) / 64.f;
+			draw_list->AddRectFilled(a, b, ImColor::HSV(hue, .6f, .8f));
+			if (mouse.x >= a.x && mouse.x < b.x && mouse.y >= a.y && mouse.y < b.y)
+				ImGui::SetTooltip("%s: %.3fms", zone.name.c_str(), zone.end_ms - zone.begin_ms);
+		}
+	};
+
+	int cpu_depth = 1, gpu_depth = 1;
+	for (const auto &zone : frame.cpu)
+		cpu_depth = xy::Max(cpu_depth, zone.depth + 1);
+	for (const auto &zone : frame.gpu)
+		gpu_depth = xy::Max(gpu_depth, zone.depth + 1);
+
+	draw_row(frame.cpu, origin.y);
+	draw_row(frame.gpu, origin.y + (cpu_depth + .5f)*row_height);
+	ImGui::Dummy(ImVec2(width, (cpu_depth + gpu_depth + .5f)*row_height));
+
+	for (const auto &summary : profiler.Summarize())
+		ImGui::Text("%s %s: %.3fms mean, %.3fms max",
+			summary.gpu ? "gpu" : "cpu", summary.name.c_str(), summary.mean_ms, summary.max_ms);
+
+	if (ImGui::Button("Write Chrome trace"))
+		profiler.WriteChromeTrace("frame_trace.json");
+
+	ImGui::End();
+}
+
 void ImguiExit()
 {
 	ImGui_ImplOpenGL3_Shutdown();
@@ -202,36 +2255,28 @@ void ImguiExit()
 int GameALL()
 {
 	GLFWWindowDesc window(xy_config::screen_width, xy_config::screen_height, "c01dbeef");
+	Scene scene;
+	LoadScene("blender_girl", scene);
+
 	WanderCamera camera;
-	camera.Init({ 0,1.f,2.f }, { 0,1.f,0 }, xy_config::screen_width, xy_config::screen_height, xy::DegreeToRadian(45.f));
+	if (scene.has_camera)
+		camera.Init(scene.camera_eye, scene.camera_target, xy_config::screen_width, xy_config::screen_height, xy::DegreeToRadian(45.f));
+	else
+		camera.Init({ 0,1.f,2.f }, { 0,1.f,0 }, xy_config::screen_width, xy_config::screen_height, xy::DegreeToRadian(45.f));
 
 	HandleInput(window, camera);
 
-	AABB world_bound({ {-4,-4,-4}, {4,4,4} });
-	FiberAsset fiber_asset;
-	//fiber_asset.LoadFromFile(
-	//	xy_config::GetAssetPath("yuksel/curly.ind"),
-	//	xy_config::GetAssetPath("hair/hair_base_color.jpg"),
-	//	xy_config::GetAssetPath("hair/hair_spec_offset.jpg"));
-	//xy::Print("#fibers={}\n", fiber_asset.num_verts_per_fiber.size());
-
-	fiber_asset.LoadFromFile(
-		xy_config::GetAssetPath("blender_girl/blender_girl_hair.ind"),
-		//xy_config::GetAssetPath("fibers_on_plane.ind"),
-		xy_config::GetAssetPath("hair/hair_base_color.jpg"),
-		xy_config::GetAssetPath("hair/hair_spec_offset.jpg"));
-
-	fiber_asset.CreateGpuRes();
-	fiber_asset.model_matrix = xy::mat4(1.f);
+	// Written by readback callbacks, so outlives draw.
+	std::atomic<float> stream_mean{ 0.f };
 
-	ObjAsset obj_asset;
-	//obj_asset.LoadFromFile(xy_config::GetAssetPath("yuksel/woman.obj"), xy_config::GetAssetPath("yuksel/"));
-	obj_asset.LoadFromFile(xy_config::GetAssetPath("blender_girl/blender_girl.obj"), xy_config::GetAssetPath("blender_girl/"));
-	obj_asset.CreateGpuRes();
-	obj_asset.model_matrix = xy::mat4(1.f);
+	ShaderLibrary::Global().SetCacheDir(xy_config::ShaderCacheDir());
 
 	Draw draw;
-	draw.Init(xy_config::screen_width, xy_config::screen_height, 0);
+	draw.Init(xy_config::screen_width, xy_config::screen_height, 0, Draw::StreamFrameBytes(scene));
+
+	// Edits under the shader root are picked up between frames.
+	ShaderLibrary::Global().Watch();
+	bool first_frame = true;
 
 	// FPS counter.
 	int frame_cnt = 0;
@@ -243,34 +2288,133 @@ int GameALL()
 	// Setting Dear ImGUI.
 	ImguiInit(window.wptr);
 
-	GameParams game_params;
-	game_params.ppll_hair_radius = 1.f;
-	game_params.ppll_hair_transparency = .9f;
-	game_params.msm_moments_offset = .0f;
-	game_params.msm_depth_offset = .0f;
+	auto game_params = DefaultGameParams();
 
-	xy::vec3 sun_light_dir(1.f, 1.f, 1.f);
+	// One simulation per groom, pinned to its first instance. Instances
+	// share the asset's vertex array, so all of them show that pose.
+	std::vector<StrandSim> hair_sims;
+	bool hair_streamed = false;
+	// Rest pose only, off while simulating.
+	HairCurves hair_curves;
+	bool curves_attached = false;
+	auto last_frame = std::chrono::steady_clock::now();
 
 	while (!glfwWindowShouldClose(window.wptr) && window.alive) {
 
 		glfwPollEvents();
+		ShaderLibrary::Global().Poll();
+		JobSystem::Global().RunMainJobs();
 
-		draw.Render(
-			world_bound,
-			obj_asset,
-			fiber_asset,
-			camera,
-			bg,
-			sun_light_dir,
-			game_params.msm_moments_offset,
-			game_params.msm_depth_offset,
-			game_params.ppll_hair_radius,
-			game_params.ppll_hair_transparency
-		);
+		auto now = std::chrono::steady_clock::now();
+		float dt = xy::Min(std::chrono::duration<float>(now - last_frame).count(), 1.f / 30.f);
+		last_frame = now;
+
+		// Detached ahead of the simulation, attached after it restores.
+		bool use_curves = game_params.hair_curves && !game_params.simulate_hair;
+		if (!use_curves && curves_attached) {
+			hair_curves.Detach(scene);
+			curves_attached = false;
+		}
+
+		if (game_params.simulate_hair) {
+			if (hair_sims.empty()) {
+				hair_sims.resize(scene.fibers.size());
+				for (std::size_t i = 0; i < hair_sims.size(); ++i)
+					hair_sims[i].Init(scene.fibers[i], StrandSim::DefaultParams());
+			}
+			game_params.hair_sim_ms = 0.;
+			int last_asset = -1;
+			// Rows are sorted by asset.
+			for (const auto &instance : scene.fiber_instances) {
+				// Streamed grooms have no host strands to simulate.
+				if (instance.asset == last_asset || scene.fibers[instance.asset].streamed)
+					continue;
+				last_asset = instance.asset;
+				auto &sim = hair_sims[instance.asset];
+				sim.Step(dt, instance.model_matrix);
+				sim.Stream(draw.Stream(), scene.fibers[instance.asset].vao);
+				game_params.hair_sim_ms += sim.GetStats().step_ms;
+			}
+			hair_streamed = true;
+		}
+		else if (hair_streamed) {
+			for (std::size_t i = 0; i < hair_sims.size(); ++i) {
+				hair_sims[i].Reset();
+				scene.fibers[i].vao.RestoreBuf(0);
+				scene.fibers[i].vao.RestoreBuf(1);
+			}
+			hair_streamed = false;
+		}
+
+		if (use_curves) {
+			if (!hair_curves.Initialized() || hair_curves.Tolerance() != game_params.curve_tolerance) {
+				hair_curves.Init(scene, game_params.curve_tolerance);
+				game_params.curve_dense_mb = game_params.curve_mb = game_params.curve_resampled_mb = 0.;
+				for (std::size_t i = 0; i < scene.fibers.size(); ++i) {
+					if (!hair_curves.Active(static_cast<int>(i)))
+						continue;
+					const auto &stats = hair_curves.Curves(static_cast<int>(i)).GetStats();
+					game_params.curve_dense_mb += stats.dense_bytes / (1024.*1024.);
+					game_params.curve_mb += stats.curve_bytes / (1024.*1024.);
+					game_params.curve_resampled_mb += stats.resampled_bytes / (1024.*1024.);
+				}
+			}
+			hair_curves.Resample(scene, draw.Stream(), camera.Proj()*camera.View(),
+				{ static_cast<float>(xy_config::screen_width), static_cast<float>(xy_config::screen_height) },
+				game_params.curve_pixels);
+			curves_attached = true;
+		}
+
+		auto render = [&](HairMode hair_mode) {
+			draw.Render(
+				scene,
+				camera,
+				bg,
+				scene.sun_light_dir,
+				game_params.msm_moments_offset,
+				game_params.msm_depth_offset,
+				game_params.ppll_hair_radius,
+				game_params.ppll_hair_transparency,
+				static_cast<ShadowMode>(game_params.shadow_mode),
+				game_params.dom_layer_size,
+				game_params.dom_absorption,
+				hair_mode
+			);
+		};
+
+		draw.SetHairKBufferSize(game_params.ppll_kbuf_size);
+		draw.SetFramesInFlight(game_params.frames_in_flight);
+
+		if (game_params.compare_hair_modes) {
+			CompareHairModes(draw, camera, scene, render);
+			game_params.compare_hair_modes = false;
+		}
+
+		render(static_cast<HairMode>(game_params.hair_mode));
 
 		draw.OutputFrame();
 
-		ImguiOverlay(game_params);
+		if (first_frame) {
+			ReportFirstFrame(draw);
+			first_frame = false;
+		}
+
+		// Stands in for a stream encoder: the mean color of every frame,
+		// taken on the readback worker from the mapped buffer.
+		if (game_params.stream_readback) {
+			draw.ReadFrameAsync([&stream_mean](const ReadbackView &view) {
+				std::size_t sum = 0;
+				for (int y = 0; y < view.height; ++y) {
+					const unsigned char *row = view.Row(y);
+					for (std::size_t i = 0; i < view.row_bytes; ++i)
+						sum += row[i];
+				}
+				stream_mean = static_cast<float>(sum) / (view.height*view.row_bytes);
+			});
+			game_params.stream_mean = stream_mean;
+		}
+
+		ImguiOverlay(game_params, draw);
 
 		glfwSwapBuffers(window.wptr);
 
@@ -279,4 +2423,460 @@ int GameALL()
 	ImguiExit();
 
 	return 0;
-}
\ No newline at end of file
+}
+
+GameParams DefaultGameParams()
+{
+	GameParams game_params;
+	game_params.ppll_hair_radius = 1.f;
+	game_params.ppll_hair_transparency = .9f;
+	game_params.msm_moments_offset = .0f;
+	game_params.msm_depth_offset = .0f;
+	game_params.shadow_mode = static_cast<int>(ShadowMode::MSM);
+	game_params.dom_layer_size = .005f;
+	game_params.dom_absorption = 1.f;
+	game_params.hair_mode = static_cast<int>(HairMode::PPLL);
+	game_params.compare_hair_modes = false;
+	game_params.ppll_kbuf_size = 32;
+	game_params.frames_in_flight = 2;
+	game_params.stream_readback = false;
+	game_params.stream_mean = 0.f;
+	game_params.simulate_hair = false;
+	game_params.hair_sim_ms = 0.;
+	game_params.hair_curves = false;
+	game_params.curve_tolerance = 1e-3f;
+	game_params.curve_pixels = 4.f;
+	game_params.curve_dense_mb = 0.;
+	game_params.curve_mb = 0.;
+	game_params.curve_resampled_mb = 0.;
+	return game_params;
+}
+
+// A scene name under the asset root's scenes/, or a path to a .scene file.
+// Asset paths inside the file are relative to the asset root.
+void LoadScene(const std::string &scene, Scene &out)
+{
+	auto path = scene;
+	if (path.size() < 6 || path.compare(path.size() - 6, 6, ".scene") != 0)
+		path = xy_config::GetAssetPath("scenes/" + scene + ".scene");
+
+	out.LoadFromFile(path, [](const std::string &asset_path) {
+		return xy_config::GetAssetPath(asset_path);
+	});
+	out.CreateGpuRes();
+
+	xy::Print("scene {}:load={}ms,#meshes={},#fibers={},#mesh instances={},#fiber instances={}\n",
+		scene, out.load_ms, out.meshes.size(), out.fibers.size(),
+		out.mesh_instances.size(), out.fiber_instances.size());
+}
+
+// xyapp --headless [--scene name|path.scene] [--camera path.txt]
+//       [--size 1024x1024] [--frames 1] [--out frames] [--hair-mode 0]
+//       [--shader-root dir] [--asset-root dir] [--bench-instancing]
+//       [--shader-cache dir] [--no-shader-cache]
+// Returns whether to render offline; the roots and the shader cache apply
+// either way.
+bool ParseOfflineArgs(int argc, char **argv, OfflineArgs &args)
+{
+	args.scene = "blender_girl";
+	args.out_dir = "frames";
+	args.width = xy_config::screen_width;
+	args.height = xy_config::screen_height;
+	args.num_frames = 1;
+	args.hair_mode = static_cast<int>(HairMode::PPLL);
+	args.bench_instancing = false;
+	args.self_test = false;
+
+	bool headless = false;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		auto value = [&]() -> std::string {
+			if (i + 1 >= argc)
+				XY_Die(arg + " needs a value");
+			return argv[++i];
+		};
+
+		if (arg == "--headless")
+			headless = true;
+		else if (arg == "--bench-instancing")
+			headless = args.bench_instancing = true;
+		else if (arg == "--self-test")
+			headless = args.self_test = true;
+		else if (arg == "--bench") {
+			args.bench = value();
+			headless = true;
+		}
+		else if (arg == "--scene")
+			args.scene = value();
+		else if (arg == "--camera")
+			args.camera_path = value();
+		else if (arg == "--out")
+			args.out_dir = value();
+		else if (arg == "--frames")
+			args.num_frames = std::stoi(value());
+		else if (arg == "--hair-mode")
+			args.hair_mode = std::stoi(value());
+		else if (arg == "--shader-root")
+			xy_config::SetShaderRoot(value());
+		else if (arg == "--asset-root")
+			xy_config::SetAssetRoot(value());
+		else if (arg == "--shader-cache")
+			xy_config::ShaderCacheDir() = value();
+		else if (arg == "--no-shader-cache")
+			xy_config::ShaderCacheDir().clear();
+		else if (arg == "--size") {
+			auto size = value();
+			auto x = size.find('x');
+			if (x == std::string::npos)
+				XY_Die("--size takes WxH");
+			args.width = std::stoi(size.substr(0, x));
+			args.height = std::stoi(size.substr(x + 1));
+		}
+		else
+			XY_Die("unknown argument " + arg);
+	}
+
+	// The MSM filter and the tiled passes work in 16x16 blocks.
+	if (args.width <= 0 || args.height <= 0 || args.width % 16 || args.height % 16)
+		XY_Die("frame size must be a positive multiple of 16");
+	if (args.num_frames <= 0)
+		XY_Die("at least one frame");
+
+	return headless;
+}
+
+// The checks that run on GL stand-ins or on the CPU alone, no window is
+// opened. A failed check dies with exit code 1, so 0 means all passed;
+// ctest runs this as self_test.
+int RunSelfTests()
+{
+	const std::vector<std::pair<std::string, std::function<void()>>> tests{
+		{ "gpu sync", []() {
+			TestGpuSync(2, 1);
+			TestGpuSync(3, 5);
+		} },
+		{ "gl state", []() { TestGlState(8, .5); } },
+		{ "render graph", []() {
+			TestRenderGraph(1280, 720, ShadowMode::MSM);
+			TestRenderGraph(1280, 720, ShadowMode::DOM);
+		} },
+		{ "profiler", []() {
+			TestProfiler(4, 2);
+			TestProfiler(2, 3);
+		} },
+		{ "fiber bvh", []() {
+			TestFiberBVHDegenerate(120);
+			TestFiberBVHRays(256, 4096);
+		} },
+		{ "fiber quad", TestFiberQuad },
+		{ "affine inverse", []() { TestAffineInverse(100000); } },
+		{ "fiber streaming", []() { TestFiberStreaming(std::size_t{ 64 } << 20, 1 << 14); } },
+		{ "strand curves", []() { TestStrandCurves(1e-3f); } },
+		{ "weighted oit", []() { TestWeightedOIT(.12); } },
+		{ "moment oit", []() { TestMomentOIT(.06); } },
+		{ "sorted kbuffer", []() { TestSortedKBuffer(32); } },
+		{ "tiled oit", []() { TestTiledOIT(8, 90); } },
+		{ "ppll dispatch", []() { TestPPLLDispatch(64, 16); } },
+	};
+
+	for (const auto &test : tests) {
+		xy::Print("self test {}\n", test.first);
+		test.second();
+	}
+	xy::Print("{} self tests passed\n", tests.size());
+	return 0;
+}
+
+// CPU benchmarks by name; --bench list prints the names.
+int RunBench(const std::string &name)
+{
+	const std::vector<std::pair<std::string, std::function<void()>>> benches{
+		{ "fiber-bvh", BenchFiberBVH },
+		{ "deep-opacity", BenchDeepOpacity },
+		{ "oit-resolve", BenchOITResolve },
+		{ "kbuffer-resolve", []() { BenchKBufferResolve("hair_fragments.oitl"); } },
+		{ "stream-buffer", []() { BenchStreamBuffer(2); } },
+		{ "strand-sim", BenchStrandSim },
+		{ "job-system", BenchJobSystem },
+		{ "asset-loading", BenchAssetLoading },
+	};
+
+	for (const auto &bench : benches)
+		if (bench.first == name) {
+			bench.second();
+			return 0;
+		}
+	for (const auto &bench : benches)
+		xy::Print("{}\n", bench.first);
+	return name == "list" ? 0 : 1;
+}
+
+// Renders args.num_frames frames along the camera path into a hidden
+// window's context and writes them as PNGs through the frame writer.
+int RenderOffline(const OfflineArgs &args)
+{
+	GLFWWindowDesc window(args.width, args.height, "xyapp offline", false);
+
+	Scene scene;
+	auto load_ms = xy::TimeProfile([&]() {
+		LoadScene(args.scene, scene);
+	}, 1);
+
+	std::vector<std::pair<xy::vec3, xy::vec3>> keys;
+	if (!args.camera_path.empty()) {
+		std::ifstream in(args.camera_path);
+		if (!in)
+			XY_Die("failed to open " + args.camera_path);
+		xy::vec3 eye, target;
+		while (in >> eye.x >> eye.y >> eye.z >> target.x >> target.y >> target.z)
+			keys.push_back({ eye, target });
+		if (keys.empty())
+			XY_Die(args.camera_path + " holds no camera keys");
+	}
+
+	auto camera_at = [&](int frame) -> std::pair<xy::vec3, xy::vec3> {
+		float t = args.num_frames > 1 ? static_cast<float>(frame) / (args.num_frames - 1) : 0.f;
+		if (keys.empty()) {
+			// Around the scene camera's target, at its distance and height.
+			xy::vec3 eye(0.f, 1.f, 2.f), target(0.f, 1.f, 0.f);
+			if (scene.has_camera) {
+				eye = scene.camera_eye;
+				target = scene.camera_target;
+			}
+			auto offset = eye - target;
+			float distance = sqrtf(offset.x*offset.x + offset.z*offset.z);
+			float angle = 2.f*3.14159265f*t;
+			return { target + xy::vec3(distance*sinf(angle), offset.y, distance*cosf(angle)), target };
+		}
+		float key = t * (keys.size() - 1);
+		int k0 = static_cast<int>(key), k1 = xy::Min(k0 + 1, static_cast<int>(keys.size()) - 1);
+		float w = key - k0;
+		return {
+			xy::Lerp(keys[k0].first, keys[k1].first, w),
+			xy::Lerp(keys[k0].second, keys[k1].second, w) };
+	};
+
+	std::experimental::filesystem::create_directories(args.out_dir);
+
+	ShaderLibrary::Global().SetCacheDir(xy_config::ShaderCacheDir());
+
+	Draw draw;
+	draw.Init(args.width, args.height, 0, Draw::StreamFrameBytes(scene));
+
+	FrameWriter writer;
+	writer.Init(args.width, args.height);
+
+	auto params = DefaultGameParams();
+	xy::vec4 bg(1, 1, 1, 1);
+	WanderCamera camera;
+
+	auto render_ms = xy::TimeProfile([&]() {
+		for (int frame = 0; frame < args.num_frames; ++frame) {
+			auto view = camera_at(frame);
+			camera.Init(view.first, view.second, args.width, args.height, xy::DegreeToRadian(45.f));
+
+			draw.Render(
+				scene,
+				camera,
+				bg,
+				scene.sun_light_dir,
+				params.msm_moments_offset,
+				params.msm_depth_offset,
+				params.ppll_hair_radius,
+				params.ppll_hair_transparency,
+				static_cast<ShadowMode>(params.shadow_mode),
+				params.dom_layer_size,
+				params.dom_absorption,
+				static_cast<HairMode>(args.hair_mode));
+			draw.OutputFrame();
+
+			if (frame == 0)
+				ReportFirstFrame(draw);
+
+			char name[32];
+			std::snprintf(name, sizeof(name), "/frame_%05d.png", frame);
+			writer.Capture(draw.CompositeFramebuffer(), args.out_dir + name);
+			writer.Poll();
+		}
+		writer.Finish();
+	}, 1);
+
+	auto stats = writer.Stats();
+	xy::Print("scene {}:load={}ms,#frames={},render+write={}ms,{}ms/frame,#stalls={}\n",
+		args.scene, load_ms, writer.NumWritten(), render_ms,
+		static_cast<double>(render_ms) / args.num_frames, stats.num_stalls);
+	xy::Print("readback:latency mean={}ms,max={}ms,{}fps,{}MB/s\n",
+		stats.mean_latency_ms, stats.max_latency_ms, stats.frames_per_sec, stats.mb_per_sec);
+	return 0;
+}
+
+// Waits for the first frame, then prints the time since the process
+// started and how the shaders got built. Run once with a cold cache
+// (--no-shader-cache or an empty cache directory) and once warm.
+void ReportFirstFrame(Draw &draw)
+{
+	draw.Finish();
+	auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - process_start).count();
+
+	const auto &library = ShaderLibrary::Global();
+	const auto &stats = library.Stats();
+	xy::Print("time to first frame={}ms,shaders={}ms,#programs={},#cached={},#compiled={},#stale={},cache={}\n",
+		ms, stats.build_ms, stats.num_programs, stats.num_cache_hits, stats.num_compiled,
+		stats.num_stale_binaries, library.CacheDir().empty() ? "off" : library.CacheDir());
+}
+
+// CPU submit cost of 1 to 1000 copies of the scene's first mesh and
+// groom, drawn as instanced batches and, for reference, as one draw per
+// instance. Frames are timed without the pacer's waits on the GPU.
+int BenchInstancing(const OfflineArgs &args)
+{
+	GLFWWindowDesc window(args.width, args.height, "xyapp bench", false);
+	ShaderLibrary::Global().SetCacheDir(xy_config::ShaderCacheDir());
+
+	Scene scene;
+	LoadScene(args.scene, scene);
+	if (scene.mesh_instances.empty() || scene.fiber_instances.empty())
+		XY_Die("instancing bench needs a mesh and a groom");
+	auto mesh = scene.mesh_instances[0], fiber = scene.fiber_instances[0];
+
+	Draw draw;
+	draw.Init(args.width, args.height, 0, Draw::StreamFrameBytes(scene));
+
+	auto params = DefaultGameParams();
+	xy::vec4 bg(1, 1, 1, 1);
+	WanderCamera camera;
+	int num_frames = xy::Max(args.num_frames, 32);
+
+	for (int num_instances : { 1, 10, 100, 1000 }) {
+		int side = static_cast<int>(ceilf(sqrtf(static_cast<float>(num_instances))));
+		scene.mesh_instances.clear();
+		scene.fiber_instances.clear();
+		for (int i = 0; i < num_instances; ++i) {
+			auto offset = xy::Translation(xy::vec3(i % side - .5f*(side - 1), 0.f, i / side - .5f*(side - 1)));
+			scene.mesh_instances.push_back({ offset*mesh.model_matrix, mesh.asset, mesh.material });
+			scene.fiber_instances.push_back({ offset*fiber.model_matrix, fiber.asset, fiber.material });
+		}
+		scene.Build();
+
+		auto eye = scene.bounds.Center() + xy::vec3(0.f, .5f, 1.f)*scene.bounds.Lengths().Norm();
+		camera.Init(eye, scene.bounds.Center(), args.width, args.height, xy::DegreeToRadian(45.f));
+
+		auto instanced_batches = std::make_pair(scene.mesh_batches, scene.fiber_batches);
+		for (bool instanced : { true, false }) {
+			if (instanced) {
+				scene.mesh_batches = instanced_batches.first;
+				scene.fiber_batches = instanced_batches.second;
+			}
+			else {
+				// Batches of one, a draw and uniform update per instance.
+				for (auto *batches : { &scene.mesh_batches, &scene.fiber_batches }) {
+					std::vector<SceneBatch> single;
+					for (const auto &batch : *batches)
+						for (int i = 0; i < batch.num_instances; ++i)
+							single.push_back({ batch.asset, batch.material, batch.first_instance + i, 1 });
+					batches->swap(single);
+				}
+			}
+
+			draw.Finish();
+			double blocked_ms = draw.Pacer().GetStats().blocked_ms;
+			auto total_ms = xy::TimeProfile([&]() {
+				draw.Render(
+					scene,
+					camera,
+					bg,
+					scene.sun_light_dir,
+					params.msm_moments_offset,
+					params.msm_depth_offset,
+					params.ppll_hair_radius,
+					params.ppll_hair_transparency,
+					static_cast<ShadowMode>(params.shadow_mode),
+					params.dom_layer_size,
+					params.dom_absorption,
+					static_cast<HairMode>(args.hair_mode));
+				draw.OutputFrame();
+			}, num_frames);
+			blocked_ms = draw.Pacer().GetStats().blocked_ms - blocked_ms;
+
+			xy::Print("#instances={},{}:#batches={},submit={}ms/frame\n",
+				num_instances, instanced ? "instanced" : "per instance",
+				scene.mesh_batches.size() + scene.fiber_batches.size(),
+				(total_ms - blocked_ms) / num_frames);
+		}
+	}
+
+	draw.Finish();
+	return 0;
+}
+
+// Renders the current view with every hair mode. The PPLL lists are read
+// back and resolved on the CPU: exactly sorted, with the K-buffer of
+// ppll_blend.frag, with the weighted blend and with moments. The GPU
+// frames of the OIT modes are compared against the PPLL frame, and every
+// mode is timed with the GPU drained after each frame.
+void CompareHairModes(Draw &draw, Camera &camera, const Scene &scene, std::function<void(HairMode)> render)
+{
+	OITFragmentLists lists;
+	std::vector<xy::vec4> ppll_frame, frame;
+
+	render(HairMode::PPLL);
+	draw.OutputFrame();
+	draw.ReadFrame(ppll_frame);
+	draw.CaptureHairFragments(lists);
+	// Input of BenchKBufferResolve.
+	xy::SaveOITFragmentLists(lists, "hair_fragments.oitl");
+
+	int max_frags = 0;
+	for (int i = 0; i < lists.NumPixels(); ++i)
+		max_frags = xy::Max(max_frags, lists.Count(i));
+	xy::Print("#fragments={},max/pixel={}\n", lists.frags.size(), max_frags);
+
+	auto proj_z = xy::vec2(camera.Proj()[2][2], camera.Proj()[3][2]);
+	auto depth_range = Draw::HairDepthRange(scene, camera);
+
+	ReportOITResolves(lists, proj_z, depth_range);
+
+	auto tiled = xy::AnalyzeTiledOIT(lists,
+		TiledPPLLForHair::tile_size, TiledPPLLForHair::default_tile_budget);
+	xy::Print("tiled:#active_tiles={}/{},#dropped={}\n",
+		tiled.num_active_tiles, tiled.num_tiles, tiled.num_dropped);
+	xy::Print("tiled contention:ppll_counter_ops={},max_tile_ops={},mean_tile_ops={}\n",
+		tiled.ppll_counter_ops, tiled.max_tile_ops, tiled.mean_tile_ops);
+	xy::Print("tiled locality:lines/tile ppll={},tiled={};span/tile ppll={}KB,tiled={}KB\n",
+		tiled.ppll_lines_per_tile, tiled.tiled_lines_per_tile,
+		tiled.ppll_span_bytes_per_tile / 1024., tiled.tiled_span_bytes_per_tile / 1024.);
+
+	auto dispatch = xy::AnalyzePPLLDispatch(lists, 64, PPLLForHair::num_buckets);
+	auto report_dispatch = [](const char *name, const DispatchCost &cost) {
+		xy::Print("resolve {}:#groups={},lane_steps={},utilization={}\n",
+			name, cost.num_groups, cost.lane_steps, cost.utilization);
+	};
+	xy::Print("resolve:#active_pixels={}/{}\n", dispatch.num_active, dispatch.num_pixels);
+	report_dispatch("fullscreen", dispatch.fullscreen);
+	report_dispatch("compact", dispatch.compact_unsorted);
+	report_dispatch("compact_sorted", dispatch.compact_sorted);
+
+	const int num_timed_frames = 10;
+	const std::pair<HairMode, const char*> modes[] = {
+		{ HairMode::PPLL, "ppll" },
+		{ HairMode::WBOIT, "wboit" },
+		{ HairMode::MBOIT, "mboit" },
+		{ HairMode::TiledPPLL, "tiled_ppll" },
+		{ HairMode::PPLLCompute, "ppll_compute" } };
+	for (auto &mode : modes) {
+		auto ms = xy::TimeProfile([&]() {
+			render(mode.first);
+			draw.OutputFrame();
+			draw.Finish();
+		}, num_timed_frames);
+
+		draw.ReadFrame(frame);
+		auto gpu_err = xy::CompareImages(frame, ppll_frame);
+
+		xy::Print("gpu {}:frame_ms={},memory={}MB,vs ppll rmse={},max={},#diff_pixels={}\n",
+			mode.second,
+			static_cast<float>(ms) / num_timed_frames,
+			draw.HairMemoryBytes(mode.first) / (1024.*1024.),
+			gpu_err.rmse, gpu_err.max_abs, gpu_err.num_diff_pixels);
+	}
+}
@@ -1,4 +1,5 @@
 #include <string>
+#include <cstring>
 
 #include "xy/shader.h"
 #include "xy/asset.h"
@@ -7,14 +8,36 @@
 #include "xy_config.h"
 #include "xy/camera.h"
 #include "xy/aabb.h"
+#include "xy/oit.h"
+#include "xy/gpu_sync.h"
+#include "xy/profiler.h"
+#include "xy/readback_ring.h"
+#include "xy/scene.h"
+#include "xy/shader_library.h"
+#include "xy/gl_state.h"
+#include "xy/render_graph.h"
+#include "xy/stream_buffer.h"
+#include "xy/strand_curves.h"
+
+
+// Binds and switches of the passes go through here, redundant ones are
+// dropped.
+inline GlStateCache &GlState() { return GlStateCache::Global(); }
+
+// Stage from a file under the shader root.
+inline ShaderStage ShaderFile(GLenum type, const char *name, ShaderDefines defines = {})
+{
+	return ShaderStage{ type, xy_config::GetShaderPath(name), defines };
+}
 
 
 class MSM {
 
 public:
 
+	// Model matrices come from the instance buffer.
 	struct ParamsL {
-		xy::mat4 g_LightModelViewProj;
+		xy::mat4 g_LightViewProj;
 	};
 
 public:
@@ -25,20 +48,20 @@ public:
 		height_ = height;
 
 		rl_.Init(GL_RGBA16, GL_DEPTH_COMPONENT24, 1, width_, height_);
-		sm_tmp_.Init(GL_RGBA16, width_, height_);
 
-		render_.Init(
-			xy::ReadFile(xy_config::GetShaderPath("msm_store.vert")),
-			xy::ReadFile(xy_config::GetShaderPath("msm_store.frag")));
+		render_.Init({
+			ShaderFile(GL_VERTEX_SHADER, "msm_store.vert"),
+			ShaderFile(GL_FRAGMENT_SHADER, "msm_store.frag") });
 
-		filter_.Init(xy::ReadFile(xy_config::GetShaderPath("msm_filter.comp")));
+		filter_.Init({
+			ShaderFile(GL_COMPUTE_SHADER, "msm_filter.comp") });
 	}
 
 	void BindPass()
 	{
-		glBindFramebuffer(GL_FRAMEBUFFER, rl_.Get());
-		glUseProgram(render_.Get());
-		glEnable(GL_DEPTH_TEST);
+		GlState().BindFramebuffer(GL_FRAMEBUFFER, rl_.Get());
+		GlState().UseProgram(render_.Get());
+		GlState().Enable(GL_DEPTH_TEST);
 
 		glClearColor(1.f, 1.f, 1.f, 1.f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -48,18 +71,20 @@ public:
 
 	void PassParams(ParamsL &params)
 	{
-		glUseProgram(render_.Get());
-		render_.Assign("g_LightModelViewProj", params.g_LightModelViewProj);
+		GlState().UseProgram(render_.Get());
+		render_.Assign("g_LightViewProj", params.g_LightViewProj);
 	}
 
-	void ProcessShadowMap()
+	// Separable blur of the moments, the vertical pass goes through tmp,
+	// a range of TempBytes.
+	void ProcessShadowMap(const BufferRange &tmp)
 	{
-		glUseProgram(filter_.Get());
+		GlState().UseProgram(filter_.Get());
 
 		filter_.Assign("g_KthPass", static_cast<int>(0));
 
-		glBindImageTexture(0, rl_.GetColor(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16);
-		glBindImageTexture(1, sm_tmp_.Get(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16);
+		glBindImageTexture(0, rl_.GetColor(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA16);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, tmp.buffer, tmp.offset, tmp.size);
 
 		glDispatchCompute(
 			width_ / 16,
@@ -67,34 +92,219 @@ public:
 			1
 		);
 
-		glFinish();
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
-		glUseProgram(filter_.Get());
+		GlState().UseProgram(filter_.Get());
 
 		filter_.Assign("g_KthPass", static_cast<int>(1));
 
-		glBindImageTexture(0, sm_tmp_.Get(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16);
-		glBindImageTexture(1, rl_.GetColor(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16);
-
 		glDispatchCompute(
 			width_ / 16,
 			height_ / 16,
 			1
 		);
 
-		glUseProgram(0);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		GlState().UseProgram(0);
+		GlState().BindFramebuffer(GL_FRAMEBUFFER, 0);
 	}
 
 	GLuint ShadowMap() const { return rl_.GetColor(); }
 
+	std::size_t MemoryBytes() const { return MemoryBytes(width_, height_); }
+
+	// Of a map Init with width and height, without a GL context.
+	static std::size_t MemoryBytes(int width, int height)
+	{
+		// RGBA16 moments and 24-bit depth.
+		return static_cast<std::size_t>(width)*height*(8 + 4);
+	}
+
+	// Packed RGBA16 moments between the filter passes.
+	std::size_t TempBytes() const { return TempBytes(width_, height_); }
+	static std::size_t TempBytes(int width, int height) { return static_cast<std::size_t>(width)*height * 8; }
+
 private:
 	int width_, height_;
 	FrameLayer rl_;
-	TextureLayer sm_tmp_;
 	Shader render_, filter_;
 };
 
+enum class ShadowMode { MSM = 0, DOM = 1 };
+
+// Deep opacity maps for hair self-shadowing. Layers start at the depth of
+// the first occluder seen from the light, see DeepOpacityMap for the CPU
+// reference.
+class DOM {
+
+public:
+
+	// Model matrices come from the instance buffer.
+	struct ParamsL {
+		xy::mat4 g_LightViewProj;
+	};
+
+public:
+
+	DOM()
+		:
+		width_{ 0 },
+		height_{ 0 },
+		num_layers_{ 0 },
+		depth_fbo_{ 0 },
+		layer_fbo_{ 0 }
+	{}
+
+	// num_layers is 4 or 8, four layers per RGBA16F target.
+	void Init(int width, int height, int num_layers)
+	{
+		if (num_layers != 4 && num_layers != 8)
+			XY_Die("DOM supports 4 or 8 layers");
+
+		width_ = width;
+		height_ = height;
+		num_layers_ = num_layers;
+
+		depth_.Init(GL_DEPTH_COMPONENT32F, width_, height_, 1, GL_NEAREST, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, depth_.Get());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glGenFramebuffers(1, &depth_fbo_);
+		GlState().BindFramebuffer(GL_FRAMEBUFFER, depth_fbo_);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_.Get(), 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			XY_Die("DOM depth framebuffer not complete");
+
+		glGenFramebuffers(1, &layer_fbo_);
+		GlState().BindFramebuffer(GL_FRAMEBUFFER, layer_fbo_);
+		for (int i = 0; i < NumLayerMaps(); ++i) {
+			layers_[i].Init(GL_RGBA16F, width_, height_, 1, GL_LINEAR, GL_LINEAR);
+			glBindTexture(GL_TEXTURE_2D, layers_[i].Get());
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, layers_[i].Get(), 0);
+		}
+		GLenum draw_bufs[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(NumLayerMaps(), draw_bufs);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			XY_Die("DOM layer framebuffer not complete");
+		GlState().BindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		depth_pass_.Init({
+			ShaderFile(GL_VERTEX_SHADER, "msm_store.vert"),
+			ShaderFile(GL_FRAGMENT_SHADER, "dom_depth.frag") });
+
+		store_pass_.Init({
+			ShaderFile(GL_VERTEX_SHADER, "msm_store.vert"),
+			ShaderFile(GL_FRAGMENT_SHADER, "dom_store.frag") });
+	}
+
+	void BindDepthPass()
+	{
+		GlState().BindFramebuffer(GL_FRAMEBUFFER, depth_fbo_);
+		GlState().UseProgram(depth_pass_.Get());
+		GlState().Enable(GL_DEPTH_TEST);
+		GlState().DepthMask(GL_TRUE);
+
+		glClear(GL_DEPTH_BUFFER_BIT);
+
+		glViewport(0, 0, width_, height_);
+	}
+
+	void BindStorePass(float layer_size, float fiber_opacity)
+	{
+		GlState().BindFramebuffer(GL_FRAMEBUFFER, layer_fbo_);
+		GlState().UseProgram(store_pass_.Get());
+		GlState().Disable(GL_DEPTH_TEST);
+
+		glClearColor(0.f, 0.f, 0.f, 0.f);
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		GlState().Enable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE);
+
+		glViewport(0, 0, width_, height_);
+
+		store_pass_.Assign("g_DOMDepth", 0);
+		store_pass_.Assign("g_DOMLayerSize", layer_size);
+		store_pass_.Assign("g_DOMFiberOpacity", fiber_opacity);
+		store_pass_.Assign("g_DOMNumLayers", num_layers_);
+
+		GlState().BindTexture(0, GL_TEXTURE_2D, depth_.Get());
+	}
+
+	void DepthPassParams(ParamsL &params)
+	{
+		GlState().UseProgram(depth_pass_.Get());
+		depth_pass_.Assign("g_LightViewProj", params.g_LightViewProj);
+	}
+
+	void StorePassParams(ParamsL &params)
+	{
+		GlState().UseProgram(store_pass_.Get());
+		store_pass_.Assign("g_LightViewProj", params.g_LightViewProj);
+	}
+
+	void EndPass()
+	{
+		GlState().Disable(GL_BLEND);
+		GlState().Enable(GL_DEPTH_TEST);
+		GlState().UseProgram(0);
+		GlState().BindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	int NumLayers() const { return num_layers_; }
+	GLuint DepthMap() { return depth_.Get(); }
+	GLuint LayerMap(int i) { return i < NumLayerMaps() ? layers_[i].Get() : 0; }
+
+	std::size_t MemoryBytes() const
+	{
+		// 32-bit float depth plus one RGBA16F target per four layers.
+		return static_cast<std::size_t>(width_)*height_*(4 + 8 * NumLayerMaps());
+	}
+
+	~DOM()
+	{
+		glDeleteFramebuffers(1, &depth_fbo_);
+		glDeleteFramebuffers(1, &layer_fbo_);
+	}
+
+private:
+	int NumLayerMaps() const { return num_layers_ / 4; }
+
+	int width_, height_, num_layers_;
+	GLuint depth_fbo_, layer_fbo_;
+	TextureLayer depth_, layers_[2];
+	Shader depth_pass_, store_pass_;
+};
+
+// Shadow lookup state shared by the platte and hair store passes.
+struct ShadowParams {
+	ShadowMode g_ShadowMode;
+	GLuint g_DOMDepthMap;
+	GLuint g_DOMLayerMap0;
+	GLuint g_DOMLayerMap1;
+	float g_DOMLayerSize;
+	float g_DOMAbsorption;
+	int g_DOMNumLayers;
+
+	void Assign(Shader &shader) const
+	{
+		shader.Assign("g_ShadowMode", static_cast<int>(g_ShadowMode));
+		shader.Assign("g_DOMLayerSize", g_DOMLayerSize);
+		shader.Assign("g_DOMAbsorption", g_DOMAbsorption);
+		shader.Assign("g_DOMNumLayers", g_DOMNumLayers);
+
+		GlState().BindTexture(3, GL_TEXTURE_2D, g_DOMDepthMap);
+
+		GlState().BindTexture(4, GL_TEXTURE_2D, g_DOMLayerMap0);
+
+		GlState().BindTexture(5, GL_TEXTURE_2D, g_DOMLayerMap1);
+	}
+};
+
 class Platte {
 
 public:
@@ -107,10 +317,11 @@ public:
 		float g_DepthOffset;
 		float g_MomentOffset;
 		GLuint g_ShadowMap;
+		ShadowParams g_Shadow;
 	};
 
+	// Per blob; model and normal matrices come from the instance buffer.
 	struct ParamsL {
-		xy::mat4 g_Model;
 		GLuint g_DiffuseMap;
 		GLuint g_AlphaMap;
 	};
@@ -125,16 +336,15 @@ public:
 		width_ = width;
 		height_ = height;
 
-		render_.Init(
-			xy::ReadFile(xy_config::GetShaderPath("platte.vert")),
-			xy::ReadFile(xy_config::GetShaderPath("platte.frag"))
-		);
+		render_.Init({
+			ShaderFile(GL_VERTEX_SHADER, "platte.vert"),
+			ShaderFile(GL_FRAGMENT_SHADER, "platte.frag") });
 	}
 
 	void BindPass()
 	{
-		glUseProgram(render_.Get());
-		glEnable(GL_DEPTH_TEST);
+		GlState().UseProgram(render_.Get());
+		GlState().Enable(GL_DEPTH_TEST);
 
 		glViewport(0, 0, width_, height_);
 
@@ -145,7 +355,7 @@ public:
 
 	void PassParams(ParamsG &params)
 	{
-		glUseProgram(render_.Get());
+		GlState().UseProgram(render_.Get());
 
 		render_.Assign("g_LightViewProj", params.g_LightViewProj);
 		render_.Assign("g_ViewProj", params.g_ViewProj);
@@ -154,21 +364,18 @@ public:
 		render_.Assign("g_MomentOffset", params.g_MomentOffset);
 		render_.Assign("g_DepthOffset", params.g_DepthOffset);
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, params.g_ShadowMap);
+		GlState().BindTexture(0, GL_TEXTURE_2D, params.g_ShadowMap);
+
+		params.g_Shadow.Assign(render_);
 	}
 
 	void PassParams(ParamsL &params)
 	{
-		glUseProgram(render_.Get());
+		GlState().UseProgram(render_.Get());
 
-		render_.Assign("g_Model", params.g_Model);
+		GlState().BindTexture(1, GL_TEXTURE_2D, params.g_DiffuseMap);
 
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, params.g_DiffuseMap);
-
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, params.g_AlphaMap);
+		GlState().BindTexture(2, GL_TEXTURE_2D, params.g_AlphaMap);
 
 		if (params.g_AlphaMap == 0)
 			render_.Assign("g_EnableAlphaToCoverage", static_cast<int>(-1));
@@ -198,15 +405,24 @@ public:
 		float g_DepthOffset;
 		float g_MomentOffset;
 		GLuint g_ShadowMap;
+		ShadowParams g_Shadow;
 
 		GLuint g_HairBaseColorTex;
 		GLuint g_HairSpecOffsetTex;
-	};
 
-	struct ParamsL {
-		xy::mat4 g_Model;
+		// (P[2][2],P[3][2]) of the camera projection, WBOIT and MBOIT.
+		xy::vec2 g_ProjZ;
+		// View depth range of the hair, MBOIT only.
+		xy::vec2 g_MomentDepthRange;
 	};
 
+	// List lengths binned by the compute resolve, one bucket per length.
+	// ppll_histogram.comp clears and flushes one bucket per invocation of
+	// its 16x16 group.
+	static constexpr int num_buckets = 256;
+	static_assert(num_buckets == 16 * 16, "ppll_histogram.comp needs one invocation per bucket");
+	static constexpr int resolve_group_size = 64;
+
 public:
 
 	PPLLForHair()
@@ -214,13 +430,18 @@ public:
 		screen_width_{ 0 },
 		screen_height_{ 0 },
 		num_link_list_nodes_{ 0 },
+		kbuf_size_{ 0 },
 		counter_buf_{ 0 },
-		ll_head_tex_{ 0 },
-		ll_head_clear_buf_{ 0 },
-		ll_buf_{ 0 }
+		heads_{ 0, 0, 0 },
+		nodes_{ 0, 0, 0 },
+		bucket_buf_{ 0 },
+		pixel_counts_{ 0, 0, 0 },
+		compact_{ 0, 0, 0 },
+		blend_pass_{ nullptr },
+		resolve_pass_{ nullptr }
 	{}
 
-	void Init(int screen_width, int screen_height, int num_link_list_nodes)
+	void Init(int screen_width, int screen_height, int num_link_list_nodes, int kbuf_size = 32)
 	{
 		////
 		// Init variables.
@@ -240,56 +461,125 @@ public:
 		GLuint counter_zero_state = 0;
 		glBufferStorage(GL_ATOMIC_COUNTER_BUFFER, sizeof(GLuint), &counter_zero_state, GL_DYNAMIC_STORAGE_BIT);
 
-		// Link-list head buffer is an image.
-		glGenTextures(1, &ll_head_tex_);
-		glBindTexture(GL_TEXTURE_2D, ll_head_tex_);
-		glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32UI, screen_width_, screen_height_);
-
-		// We need another texture to clear the head buffer.
-		std::vector<GLuint> clear_(screen_width_*screen_height_, 0xffffffff);
-		glGenBuffers(1, &ll_head_clear_buf_);
-		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ll_head_clear_buf_);
-		glBufferData(GL_PIXEL_UNPACK_BUFFER, clear_.size() * sizeof(GLuint), clear_.data(), GL_STATIC_COPY);
-		// ImGUI will be affected had we not set the following.
-		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-
-		// Link-list arena buffer.
-		glGenBuffers(1, &ll_buf_);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ll_buf_);
-		glBufferStorage(GL_SHADER_STORAGE_BUFFER, num_link_list_nodes_ * sizeof(PPLLNode), nullptr, GL_NONE);
+		// Heads and node arena are transients of the render graph, see
+		// SetLists.
+
+		// Compute resolve: bucket histogram with the indirect dispatch
+		// args in front. Per-pixel list lengths and the compact pixel
+		// list are transients, see SetResolveLists, the result is made by
+		// InitTargets.
+		glGenBuffers(1, &bucket_buf_);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, bucket_buf_);
+		glBufferStorage(GL_SHADER_STORAGE_BUFFER, (4 + 2 * num_buckets) * sizeof(GLuint), nullptr, GL_DYNAMIC_STORAGE_BIT);
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-		store_pass_.Init(
-			xy::ReadFile(xy_config::GetShaderPath("ppll_store.vert")),
-			xy::ReadFile(xy_config::GetShaderPath("ppll_store.geom")),
-			xy::ReadFile(xy_config::GetShaderPath("ppll_store.frag"))
-		);
+		ShaderDefines bucket_defines{
+			{ "NUM_BUCKETS", std::to_string(num_buckets) },
+			{ "RESOLVE_GROUP_SIZE", std::to_string(resolve_group_size) } };
 
-		blend_pass_.Init(
-			xy::ReadFile(xy_config::GetShaderPath("ppll_blend.vert")),
-			xy::ReadFile(xy_config::GetShaderPath("ppll_blend.frag"))
-		);
+		histogram_pass_.Init({
+			ShaderFile(GL_COMPUTE_SHADER, "ppll_histogram.comp", bucket_defines) });
+		bucket_scan_pass_.Init({
+			ShaderFile(GL_COMPUTE_SHADER, "ppll_bucket_scan.comp", bucket_defines) });
+		compact_pass_.Init({
+			ShaderFile(GL_COMPUTE_SHADER, "ppll_compact.comp", bucket_defines) });
+
+		composite_pass_.Init({
+			ShaderFile(GL_VERTEX_SHADER, "ppll_blend.vert"),
+			ShaderFile(GL_FRAGMENT_SHADER, "hair_composite.frag") });
+
+		store_pass_.Init({
+			ShaderFile(GL_VERTEX_SHADER, "ppll_store.vert"),
+			ShaderFile(GL_FRAGMENT_SHADER, "ppll_store.frag") });
+
+		blend_variants_.Init({
+			ShaderFile(GL_VERTEX_SHADER, "ppll_blend.vert"),
+			ShaderFile(GL_FRAGMENT_SHADER, "ppll_blend.frag") });
+		resolve_variants_.Init({
+			ShaderFile(GL_COMPUTE_SHADER, "ppll_resolve.comp", bucket_defines) });
+
+		SetKBufferSize(kbuf_size);
 	}
 
-	void BindStorePass()
+	// K of the blend and compute resolve, compiled in as KBUF_SIZE. Each K
+	// is built once, switching back to it is free.
+	void SetKBufferSize(int kbuf_size)
+	{
+		if (kbuf_size == kbuf_size_)
+			return;
+		if (kbuf_size <= 0)
+			XY_Die("K-buffer size must be positive");
+		kbuf_size_ = kbuf_size;
+
+		ShaderDefines kbuf_defines{ { "KBUF_SIZE", std::to_string(kbuf_size_) } };
+		blend_pass_ = &blend_variants_.Get(kbuf_defines);
+		resolve_pass_ = &resolve_variants_.Get(kbuf_defines);
+	}
+
+	int KBufferSize() const { return kbuf_size_; }
+
+	// One head per pixel, row by row, and the node arena.
+	std::size_t HeadsBytes() const { return static_cast<std::size_t>(screen_width_)*screen_height_*sizeof(GLuint); }
+	std::size_t NodesBytes() const { return static_cast<std::size_t>(num_link_list_nodes_)*sizeof(PPLLNode); }
+
+	// Where the passes of this frame keep the lists, the ranges hold
+	// HeadsBytes and NodesBytes.
+	void SetLists(const BufferRange &heads, const BufferRange &nodes)
+	{
+		heads_ = heads;
+		nodes_ = nodes;
+	}
+
+	// Per-pixel list lengths and compact pixel list of the compute
+	// resolve, ResolveListBytes each.
+	std::size_t ResolveListBytes() const { return static_cast<std::size_t>(screen_width_)*screen_height_*sizeof(GLuint); }
+
+	void SetResolveLists(const BufferRange &pixel_counts, const BufferRange &compact)
+	{
+		pixel_counts_ = pixel_counts;
+		compact_ = compact;
+	}
+
+	// RGBA16F result of the compute resolve, only held while that mode is
+	// drawn. Repeated calls are ignored.
+	void InitTargets()
+	{
+		if (!resolve_color_.Initialized())
+			resolve_color_.Init(GL_RGBA16F, screen_width_, screen_height_, 1, GL_NEAREST, GL_NEAREST);
+	}
+
+	void ReleaseTargets()
+	{
+		if (!resolve_color_.Initialized())
+			return;
+
+		// GL may hand the name out again while the cache holds it.
+		GlState().Invalidate();
+		resolve_color_.Release();
+	}
+
+	// Before the store pass, by transfers.
+	void ClearLists()
 	{
 		// Clear linked list heads.
-		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ll_head_clear_buf_);
-		glBindTexture(GL_TEXTURE_2D, ll_head_tex_);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, screen_width_, screen_height_,
-			GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
-		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		GLuint ppll_null = 0xffffffff;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, heads_.buffer);
+		glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, heads_.offset, heads_.size,
+			GL_RED_INTEGER, GL_UNSIGNED_INT, &ppll_null);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
 		// Counter reset to 0.
 		GLuint tmp = 0;
 		glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, counter_buf_);
 		glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &tmp);
+	}
 
-		glUseProgram(store_pass_.Get());
+	void BindStorePass()
+	{
+		GlState().UseProgram(store_pass_.Get());
 
 		glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, counter_buf_);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ll_buf_);
-		glBindImageTexture(0, ll_head_tex_, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+		BindLists();
 
 		store_pass_.Assign("g_ShadowMap", 0);
 		store_pass_.Assign("g_HairBaseColorTex", 1);
@@ -298,54 +588,186 @@ public:
 
 	void StorePassParams(ParamsG params)
 	{
-		glUseProgram(store_pass_.Get());
-		store_pass_.Assign("g_HairRadius", params.g_HairRadius);
-		store_pass_.Assign("g_HairTransparency", params.g_HairTransparency);
-		store_pass_.Assign("g_Eye", params.g_Eye);
-		store_pass_.Assign("g_ViewProj", params.g_ViewProj);
-		store_pass_.Assign("g_WinSize", params.g_WinSize);
+		GlState().UseProgram(store_pass_.Get());
+		AssignHairShadingParams(store_pass_, params);
 		store_pass_.Assign("g_NumNodes", static_cast<GLuint>(num_link_list_nodes_));
+		store_pass_.Assign("g_PPLLPitch", screen_width_);
+	}
 
-		store_pass_.Assign("g_LightViewProj", params.g_LightViewProj);
-		store_pass_.Assign("g_SunLightDir", params.g_SunLightDir);
-		store_pass_.Assign("g_MomentOffset", params.g_MomentOffset);
-		store_pass_.Assign("g_DepthOffset", params.g_DepthOffset);
+	// Uniforms of shader/hair_shading.glsl and the store vertex stages,
+	// shared by every hair store pass.
+	static void AssignHairShadingParams(Shader &shader, const ParamsG &params)
+	{
+		shader.Assign("g_HairRadius", params.g_HairRadius);
+		shader.Assign("g_HairTransparency", params.g_HairTransparency);
+		shader.Assign("g_Eye", params.g_Eye);
+		shader.Assign("g_ViewProj", params.g_ViewProj);
+		shader.Assign("g_WinSize", params.g_WinSize);
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, params.g_ShadowMap);
+		shader.Assign("g_LightViewProj", params.g_LightViewProj);
+		shader.Assign("g_SunLightDir", params.g_SunLightDir);
+		shader.Assign("g_MomentOffset", params.g_MomentOffset);
+		shader.Assign("g_DepthOffset", params.g_DepthOffset);
 
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, params.g_HairBaseColorTex);
+		GlState().BindTexture(0, GL_TEXTURE_2D, params.g_ShadowMap);
 
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, params.g_HairSpecOffsetTex);
-	}
+		GlState().BindTexture(1, GL_TEXTURE_2D, params.g_HairBaseColorTex);
 
-	void StorePassParams(ParamsL params)
-	{
-		glUseProgram(store_pass_.Get());
-		store_pass_.Assign("g_Model", params.g_Model);
+		GlState().BindTexture(2, GL_TEXTURE_2D, params.g_HairSpecOffsetTex);
+
+		params.g_Shadow.Assign(shader);
 	}
 
 	void BlendPassParams(ParamsG &params)
 	{
-		glUseProgram(blend_pass_.Get());
+		GlState().UseProgram(blend_pass_->Get());
 
-		blend_pass_.Assign("g_WinSize", params.g_WinSize);
-		blend_pass_.Assign("g_NumNodes", static_cast<GLuint>(num_link_list_nodes_));
+		blend_pass_->Assign("g_WinSize", params.g_WinSize);
+		blend_pass_->Assign("g_NumNodes", static_cast<GLuint>(num_link_list_nodes_));
+		blend_pass_->Assign("g_PPLLPitch", screen_width_);
 	}
 
 	void BindBlendPass()
 	{
-		glUseProgram(blend_pass_.Get());
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ll_buf_);
-		glBindImageTexture(0, ll_head_tex_, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+		GlState().UseProgram(blend_pass_->Get());
+		BindLists();
+	}
+
+	// Resolves only pixels with a list. Lengths are counted and binned
+	// per pixel, non-empty pixels compacted into one list, longest lists
+	// first, and resolved by an indirect dispatch. See
+	// xy::AnalyzePPLLDispatch for the CPU model. The caller orders the
+	// store pass before it.
+	void ResolveCompute()
+	{
+		GLuint zero = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, bucket_buf_);
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+		GLfloat no_hair[] = { 0.f,0.f,0.f,1.f };
+		glClearTexImage(resolve_color_.Get(), 0, GL_RGBA, GL_FLOAT, no_hair);
+
+		BindLists();
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, bucket_buf_);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, pixel_counts_.buffer, pixel_counts_.offset, pixel_counts_.size);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 3, compact_.buffer, compact_.offset, compact_.size);
+		glBindImageTexture(1, resolve_color_.Get(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+		int num_groups_x = (screen_width_ + 15) / 16, num_groups_y = (screen_height_ + 15) / 16;
+		auto win_size = xy::vec2(screen_width_, screen_height_);
+
+		GlState().UseProgram(histogram_pass_.Get());
+		histogram_pass_.Assign("g_WinSize", win_size);
+		histogram_pass_.Assign("g_PPLLPitch", screen_width_);
+		glDispatchCompute(num_groups_x, num_groups_y, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		GlState().UseProgram(bucket_scan_pass_.Get());
+		glDispatchCompute(1, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+		GlState().UseProgram(compact_pass_.Get());
+		compact_pass_.Assign("g_WinSize", win_size);
+		glDispatchCompute(num_groups_x, num_groups_y, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		GlState().UseProgram(resolve_pass_->Get());
+		resolve_pass_->Assign("g_PPLLPitch", screen_width_);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, bucket_buf_);
+		glDispatchComputeIndirect(0);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+
+	// Composites the compute resolve over the layer bound by the caller.
+	void BindComputeCompositePass()
+	{
+		GlState().Disable(GL_DEPTH_TEST);
+		GlState().UseProgram(composite_pass_.Get());
+
+		GlState().BindTexture(0, GL_TEXTURE_2D, resolve_color_.Get());
+
+		GlState().Enable(GL_BLEND);
+		glBlendFuncSeparate(GL_ONE, GL_SRC_ALPHA, GL_ONE, GL_ONE);
+	}
+
+	// Reads back the lists of the last store pass, for the CPU resolves
+	// in xy/oit.h. Slow, debugging only.
+	void CaptureFragments(OITFragmentLists &lists)
+	{
+		if (heads_.buffer == 0)
+			XY_Die("no PPLL frame to capture");
+
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+		GLuint num_used = 0;
+		glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counter_buf_);
+		glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &num_used);
+		num_used = xy::Min(num_used, static_cast<GLuint>(num_link_list_nodes_));
+
+		std::vector<GLuint> heads(screen_width_*screen_height_);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, heads_.buffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, heads_.offset, HeadsBytes(), heads.data());
+
+		std::vector<PPLLNode> nodes(num_used);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, nodes_.buffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, nodes_.offset, num_used * sizeof(PPLLNode), nodes.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		auto unpack = [](GLuint val) {
+			return xy::vec4(
+				((val >> 24) & 0xff) / 255.f,
+				((val >> 16) & 0xff) / 255.f,
+				((val >> 8) & 0xff) / 255.f,
+				(val & 0xff) / 255.f);
+		};
+
+		lists.width = screen_width_;
+		lists.height = screen_height_;
+		lists.offsets.assign(1, 0);
+		lists.frags.clear();
+		lists.frags.reserve(num_used);
+		lists.addrs.clear();
+		lists.addrs.reserve(num_used);
+		for (auto node_addr : heads) {
+			// Nodes past the arena were never written.
+			for (; node_addr < num_used; node_addr = nodes[node_addr].next) {
+				float depth;
+				std::memcpy(&depth, &nodes[node_addr].depth, sizeof(float));
+				lists.frags.push_back({ unpack(nodes[node_addr].color), depth });
+				lists.addrs.push_back(node_addr);
+			}
+			lists.offsets.push_back(static_cast<int>(lists.frags.size()));
+		}
+	}
+
+	std::size_t MemoryBytes(bool compute_resolve) const
+	{
+		// Node arena and heads, held in the render graph heap, and the
+		// compute resolve's lengths, compact list and RGBA16F result.
+		std::size_t bytes = NodesBytes() + HeadsBytes() + (4 + 2 * num_buckets) * sizeof(GLuint);
+		if (compute_resolve)
+			bytes += 2 * ResolveListBytes() + static_cast<std::size_t>(screen_width_)*screen_height_ * 8;
+		return bytes;
 	}
 
 private:
+	// Nodes at storage binding 0, heads at 4, see shader/ppll_node.glsl.
+	void BindLists()
+	{
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, nodes_.buffer, nodes_.offset, nodes_.size);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 4, heads_.buffer, heads_.offset, heads_.size);
+	}
+
 	int screen_width_, screen_height_;
 	int num_link_list_nodes_;
-	GLuint counter_buf_, ll_head_tex_, ll_head_clear_buf_, ll_buf_;
+	int kbuf_size_;
+	GLuint counter_buf_;
+	BufferRange heads_, nodes_;
+	GLuint bucket_buf_;
+	BufferRange pixel_counts_, compact_;
+	TextureLayer resolve_color_;
 
 	struct PPLLNode {
 		GLuint depth;
@@ -354,20 +776,767 @@ private:
 		GLuint next;
 	};
 
-	Shader store_pass_, blend_pass_;
+	Shader store_pass_;
+	Shader histogram_pass_, bucket_scan_pass_, compact_pass_, composite_pass_;
+	// Permutations by K-buffer size, and the ones in use.
+	ShaderVariants blend_variants_, resolve_variants_;
+	Shader *blend_pass_, *resolve_pass_;
+};
+
+enum class HairMode { PPLL = 0, WBOIT = 1, MBOIT = 2, TiledPPLL = 3, PPLLCompute = 4 };
+
+// Weighted blended order-independent transparency (McGuire and Bavoil
+// 2013) for hair. Needs two screen targets instead of the PPLL node arena,
+// at the cost of approximating the order. Takes the same params as
+// PPLLForHair, see xy::ResolveWeighted for the CPU reference.
+class WBOITForHair {
+
+public:
+
+	WBOITForHair()
+		:
+		screen_width_{ 0 },
+		screen_height_{ 0 },
+		fbo_{ 0 }
+	{}
+
+	// Targets are made by InitTargets.
+	void Init(int screen_width, int screen_height)
+	{
+		screen_width_ = screen_width;
+		screen_height_ = screen_height;
+
+		store_pass_.Init({
+			ShaderFile(GL_VERTEX_SHADER, "ppll_store.vert"),
+			ShaderFile(GL_FRAGMENT_SHADER, "wboit_store.frag") });
+
+		composite_pass_.Init({
+			ShaderFile(GL_VERTEX_SHADER, "ppll_blend.vert"),
+			ShaderFile(GL_FRAGMENT_SHADER, "wboit_composite.frag") });
+	}
+
+	// Screen targets, only held while the mode is drawn. Repeated calls
+	// are ignored.
+	void InitTargets()
+	{
+		if (fbo_ != 0)
+			return;
+
+		accum_.Init(GL_RGBA16F, screen_width_, screen_height_, 1, GL_NEAREST, GL_NEAREST);
+		revealage_.Init(GL_R16F, screen_width_, screen_height_, 1, GL_NEAREST, GL_NEAREST);
+		// Same format as the composite layer so its depth can be blitted.
+		depth_.Init(GL_DEPTH_COMPONENT24, screen_width_, screen_height_, 1, GL_NEAREST, GL_NEAREST);
+
+		glGenFramebuffers(1, &fbo_);
+		GlState().BindFramebuffer(GL_FRAMEBUFFER, fbo_);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accum_.Get(), 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, revealage_.Get(), 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_.Get(), 0);
+		GLenum draw_bufs[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(2, draw_bufs);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			XY_Die("WBOIT framebuffer not complete");
+		GlState().BindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	void ReleaseTargets()
+	{
+		if (fbo_ == 0)
+			return;
+
+		// GL may hand the names out again while the cache holds them.
+		GlState().Invalidate();
+		glDeleteFramebuffers(1, &fbo_);
+		fbo_ = 0;
+		accum_.Release();
+		revealage_.Release();
+		depth_.Release();
+	}
+
+	// Opaque depth comes from the layer the hair is composited on.
+	void BindStorePass(const FrameLayer &opaque)
+	{
+		GlState().BindFramebuffer(GL_READ_FRAMEBUFFER, opaque.Get());
+		GlState().BindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo_);
+		glBlitFramebuffer(
+			0, 0, screen_width_, screen_height_,
+			0, 0, screen_width_, screen_height_,
+			GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		GlState().BindFramebuffer(GL_FRAMEBUFFER, fbo_);
+
+		GLfloat accum_zero[] = { 0.f,0.f,0.f,0.f };
+		GLfloat revealage_one[] = { 1.f,1.f,1.f,1.f };
+		glClearBufferfv(GL_COLOR, 0, accum_zero);
+		glClearBufferfv(GL_COLOR, 1, revealage_one);
+
+		GlState().UseProgram(store_pass_.Get());
+		store_pass_.Assign("g_ShadowMap", 0);
+		store_pass_.Assign("g_HairBaseColorTex", 1);
+		store_pass_.Assign("g_HairSpecOffsetTex", 2);
+
+		GlState().Enable(GL_DEPTH_TEST);
+		GlState().DepthMask(GL_FALSE);
+
+		GlState().Enable(GL_BLEND);
+		glBlendFunci(0, GL_ONE, GL_ONE);
+		glBlendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+	}
+
+	void StorePassParams(const PPLLForHair::ParamsG &params)
+	{
+		GlState().UseProgram(store_pass_.Get());
+		PPLLForHair::AssignHairShadingParams(store_pass_, params);
+		store_pass_.Assign("g_ProjZ", params.g_ProjZ);
+	}
+
+	// Composites over the layer bound by the caller.
+	void BindCompositePass()
+	{
+		GlState().Disable(GL_DEPTH_TEST);
+		GlState().UseProgram(composite_pass_.Get());
+
+		GlState().BindTexture(0, GL_TEXTURE_2D, accum_.Get());
+		GlState().BindTexture(1, GL_TEXTURE_2D, revealage_.Get());
+
+		GlState().Enable(GL_BLEND);
+		glBlendFuncSeparate(GL_ONE, GL_SRC_ALPHA, GL_ONE, GL_ONE);
+	}
+
+	std::size_t MemoryBytes() const
+	{
+		// RGBA16F accumulation, R16F revealage and 24-bit depth.
+		return static_cast<std::size_t>(screen_width_)*screen_height_*(8 + 2 + 4);
+	}
+
+	~WBOITForHair()
+	{
+		glDeleteFramebuffers(1, &fbo_);
+	}
+
+private:
+	int screen_width_, screen_height_;
+	GLuint fbo_;
+	TextureLayer accum_, revealage_, depth_;
+	Shader store_pass_, composite_pass_;
+};
+
+// Moment-based order-independent transparency (Muenstermann et al. 2018)
+// for hair. The moment pass sums optical depth and its four power moments
+// per pixel, the resolve pass shades every fragment again and attenuates
+// it by the transmittance reconstructed from the moments. Fixed memory
+// per pixel, no linked list. See xy::ResolveMoments for the CPU reference.
+class MBOITForHair {
+
+public:
+
+	static constexpr float moment_bias = 5e-5f;
+	static constexpr float overestimation = .25f;
+
+public:
+
+	MBOITForHair()
+		:
+		screen_width_{ 0 },
+		screen_height_{ 0 },
+		moment_fbo_{ 0 },
+		resolve_fbo_{ 0 }
+	{}
+
+	// Targets are made by InitTargets.
+	void Init(int screen_width, int screen_height)
+	{
+		screen_width_ = screen_width;
+		screen_height_ = screen_height;
+
+		moment_pass_.Init({
+			ShaderFile(GL_VERTEX_SHADER, "ppll_store.vert"),
+			ShaderFile(GL_FRAGMENT_SHADER, "mboit_moments.frag") });
+
+		resolve_pass_.Init({
+			ShaderFile(GL_VERTEX_SHADER, "ppll_store.vert"),
+			ShaderFile(GL_FRAGMENT_SHADER, "mboit_resolve.frag") });
+
+		composite_pass_.Init({
+			ShaderFile(GL_VERTEX_SHADER, "ppll_blend.vert"),
+			ShaderFile(GL_FRAGMENT_SHADER, "mboit_composite.frag") });
+	}
+
+	// Screen targets, only held while the mode is drawn. Repeated calls
+	// are ignored.
+	void InitTargets()
+	{
+		if (moment_fbo_ != 0)
+			return;
+
+		moments_.Init(GL_RGBA32F, screen_width_, screen_height_, 1, GL_NEAREST, GL_NEAREST);
+		optical_depth_.Init(GL_R32F, screen_width_, screen_height_, 1, GL_NEAREST, GL_NEAREST);
+		accum_.Init(GL_RGBA16F, screen_width_, screen_height_, 1, GL_NEAREST, GL_NEAREST);
+		// Same format as the composite layer so its depth can be blitted.
+		depth_.Init(GL_DEPTH_COMPONENT24, screen_width_, screen_height_, 1, GL_NEAREST, GL_NEAREST);
+
+		glGenFramebuffers(1, &moment_fbo_);
+		GlState().BindFramebuffer(GL_FRAMEBUFFER, moment_fbo_);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, moments_.Get(), 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, optical_depth_.Get(), 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_.Get(), 0);
+		GLenum draw_bufs[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(2, draw_bufs);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			XY_Die("MBOIT moment framebuffer not complete");
+
+		glGenFramebuffers(1, &resolve_fbo_);
+		GlState().BindFramebuffer(GL_FRAMEBUFFER, resolve_fbo_);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accum_.Get(), 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_.Get(), 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			XY_Die("MBOIT resolve framebuffer not complete");
+		GlState().BindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	void ReleaseTargets()
+	{
+		if (moment_fbo_ == 0)
+			return;
+
+		// GL may hand the names out again while the cache holds them.
+		GlState().Invalidate();
+		glDeleteFramebuffers(1, &moment_fbo_);
+		glDeleteFramebuffers(1, &resolve_fbo_);
+		moment_fbo_ = resolve_fbo_ = 0;
+		moments_.Release();
+		optical_depth_.Release();
+		accum_.Release();
+		depth_.Release();
+	}
+
+	// Opaque depth comes from the layer the hair is composited on.
+	void BindMomentPass(const FrameLayer &opaque)
+	{
+		GlState().BindFramebuffer(GL_READ_FRAMEBUFFER, opaque.Get());
+		GlState().BindFramebuffer(GL_DRAW_FRAMEBUFFER, moment_fbo_);
+		glBlitFramebuffer(
+			0, 0, screen_width_, screen_height_,
+			0, 0, screen_width_, screen_height_,
+			GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		GlState().BindFramebuffer(GL_FRAMEBUFFER, moment_fbo_);
+
+		GLfloat zero[] = { 0.f,0.f,0.f,0.f };
+		glClearBufferfv(GL_COLOR, 0, zero);
+		glClearBufferfv(GL_COLOR, 1, zero);
+
+		BindHairPass(moment_pass_);
+	}
+
+	void BindResolvePass()
+	{
+		GlState().BindFramebuffer(GL_FRAMEBUFFER, resolve_fbo_);
+
+		GLfloat zero[] = { 0.f,0.f,0.f,0.f };
+		glClearBufferfv(GL_COLOR, 0, zero);
+
+		BindHairPass(resolve_pass_);
+
+		GlState().BindTexture(6, GL_TEXTURE_2D, moments_.Get());
+		GlState().BindTexture(7, GL_TEXTURE_2D, optical_depth_.Get());
+	}
+
+	void MomentPassParams(const PPLLForHair::ParamsG &params) { HairPassParams(moment_pass_, params); }
+	void ResolvePassParams(const PPLLForHair::ParamsG &params) { HairPassParams(resolve_pass_, params); }
+
+	// Composites over the layer bound by the caller.
+	void BindCompositePass()
+	{
+		GlState().Disable(GL_DEPTH_TEST);
+		GlState().UseProgram(composite_pass_.Get());
+
+		GlState().BindTexture(0, GL_TEXTURE_2D, accum_.Get());
+		GlState().BindTexture(1, GL_TEXTURE_2D, optical_depth_.Get());
+
+		GlState().Enable(GL_BLEND);
+		glBlendFuncSeparate(GL_ONE, GL_SRC_ALPHA, GL_ONE, GL_ONE);
+	}
+
+	std::size_t MemoryBytes() const
+	{
+		// RGBA32F moments, R32F optical depth, RGBA16F accumulation and
+		// 24-bit depth.
+		return static_cast<std::size_t>(screen_width_)*screen_height_*(16 + 4 + 8 + 4);
+	}
+
+	~MBOITForHair()
+	{
+		glDeleteFramebuffers(1, &moment_fbo_);
+		glDeleteFramebuffers(1, &resolve_fbo_);
+	}
+
+private:
+	// Both passes add up, depth tested against the opaque scene.
+	void BindHairPass(Shader &pass)
+	{
+		GlState().UseProgram(pass.Get());
+		pass.Assign("g_ShadowMap", 0);
+		pass.Assign("g_HairBaseColorTex", 1);
+		pass.Assign("g_HairSpecOffsetTex", 2);
+		pass.Assign("g_MBOITMomentBias", moment_bias);
+		pass.Assign("g_MBOITOverestimation", overestimation);
+
+		GlState().Enable(GL_DEPTH_TEST);
+		GlState().DepthMask(GL_FALSE);
+
+		GlState().Enable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE);
+	}
+
+	void HairPassParams(Shader &pass, const PPLLForHair::ParamsG &params)
+	{
+		GlState().UseProgram(pass.Get());
+		PPLLForHair::AssignHairShadingParams(pass, params);
+		pass.Assign("g_ProjZ", params.g_ProjZ);
+		pass.Assign("g_MomentDepthRange", params.g_MomentDepthRange);
+	}
+
+	int screen_width_, screen_height_;
+	GLuint moment_fbo_, resolve_fbo_;
+	TextureLayer moments_, optical_depth_, accum_, depth_;
+	Shader moment_pass_, resolve_pass_, composite_pass_;
+};
+
+// PPLL variant where every 16x16 screen tile allocates from its own
+// contiguous node pool. A counting pass sizes the pools (capped by a per
+// tile budget), a scan places them in the arena, the store pass appends
+// to the tile's pool, and a compute pass sorts and blends each tile. See
+// xy::AnalyzeTiledOIT for the CPU model of contention and locality.
+class TiledPPLLForHair {
+
+public:
+
+	static constexpr int tile_size = 16;
+	// Hot tiles may take up to 64 nodes per pixel.
+	static constexpr int default_tile_budget = tile_size * tile_size * 64;
+
+public:
+
+	TiledPPLLForHair()
+		:
+		screen_width_{ 0 },
+		screen_height_{ 0 },
+		num_tiles_x_{ 0 },
+		num_tiles_y_{ 0 },
+		num_nodes_{ 0 },
+		tile_budget_{ 0 },
+		kbuf_size_{ 0 },
+		tiles_{ 0, 0, 0 },
+		nodes_{ 0, 0, 0 },
+		sorted_{ 0, 0, 0 },
+		resolve_pass_{ nullptr }
+	{}
+
+	// tile_budget caps the nodes of one tile, the arena caps the sum.
+	// Buffers are transients, see SetBuffers, the result is made by
+	// InitTargets.
+	void Init(int screen_width, int screen_height, int num_nodes, int tile_budget, int kbuf_size = 32)
+	{
+		screen_width_ = screen_width;
+		screen_height_ = screen_height;
+		num_tiles_x_ = (screen_width_ + tile_size - 1) / tile_size;
+		num_tiles_y_ = (screen_height_ + tile_size - 1) / tile_size;
+		num_nodes_ = num_nodes;
+		tile_budget_ = tile_budget;
+
+		ShaderDefines tile_defines{ { "TILE_SIZE", std::to_string(tile_size) } };
+
+		count_pass_.Init({
+			ShaderFile(GL_VERTEX_SHADER, "ppll_store.vert"),
+			ShaderFile(GL_FRAGMENT_SHADER, "tiled_count.frag", tile_defines) });
+
+		store_pass_.Init({
+			ShaderFile(GL_VERTEX_SHADER, "ppll_store.vert"),
+			ShaderFile(GL_FRAGMENT_SHADER, "tiled_store.frag", tile_defines) });
+
+		scan_pass_.Init({
+			ShaderFile(GL_COMPUTE_SHADER, "tiled_scan.comp", tile_defines) });
+		resolve_variants_.Init({
+			ShaderFile(GL_COMPUTE_SHADER, "tiled_resolve.comp", tile_defines) });
+
+		composite_pass_.Init({
+			ShaderFile(GL_VERTEX_SHADER, "ppll_blend.vert"),
+			ShaderFile(GL_FRAGMENT_SHADER, "hair_composite.frag") });
+
+		SetKBufferSize(kbuf_size);
+	}
+
+	// Per pixel K of the tile resolve, compiled in as KBUF_SIZE.
+	void SetKBufferSize(int kbuf_size)
+	{
+		if (kbuf_size == kbuf_size_)
+			return;
+		if (kbuf_size <= 0)
+			XY_Die("K-buffer size must be positive");
+		kbuf_size_ = kbuf_size;
+		resolve_pass_ = &resolve_variants_.Get({ { "KBUF_SIZE", std::to_string(kbuf_size_) } });
+	}
+
+	// Tile headers, node arena and sorted node addresses.
+	std::size_t TilesBytes() const { return NumTiles() * sizeof(TileHeader); }
+	std::size_t NodesBytes() const { return static_cast<std::size_t>(num_nodes_)*sizeof(TiledNode); }
+	std::size_t SortedBytes() const { return static_cast<std::size_t>(num_nodes_)*sizeof(GLuint); }
+
+	// Where the passes of this frame keep the tiles, the ranges hold
+	// TilesBytes, NodesBytes and SortedBytes.
+	void SetBuffers(const BufferRange &tiles, const BufferRange &nodes, const BufferRange &sorted)
+	{
+		tiles_ = tiles;
+		nodes_ = nodes;
+		sorted_ = sorted;
+	}
+
+	// RGBA16F result, only held while the mode is drawn. Repeated calls
+	// are ignored.
+	void InitTargets()
+	{
+		if (!color_.Initialized())
+			color_.Init(GL_RGBA16F, screen_width_, screen_height_, 1, GL_NEAREST, GL_NEAREST);
+	}
+
+	void ReleaseTargets()
+	{
+		if (!color_.Initialized())
+			return;
+
+		// GL may hand the name out again while the cache holds it.
+		GlState().Invalidate();
+		color_.Release();
+	}
+
+	// Depth tested against the bound layer, nothing written to it.
+	void BindCountPass()
+	{
+		GLuint zero = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, tiles_.buffer);
+		glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, tiles_.offset, tiles_.size,
+			GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, nodes_.buffer, nodes_.offset, nodes_.size);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, tiles_.buffer, tiles_.offset, tiles_.size);
+
+		GlState().UseProgram(count_pass_.Get());
+		count_pass_.Assign("g_NumTilesX", num_tiles_x_);
+
+		GlState().Enable(GL_DEPTH_TEST);
+		GlState().DepthMask(GL_FALSE);
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	}
+
+	// Places the tile pools, then binds the store pass.
+	void BindStorePass()
+	{
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		GlState().UseProgram(scan_pass_.Get());
+		scan_pass_.Assign("g_NumTiles", static_cast<GLuint>(NumTiles()));
+		scan_pass_.Assign("g_TileBudget", static_cast<GLuint>(tile_budget_));
+		scan_pass_.Assign("g_NumNodes", static_cast<GLuint>(num_nodes_));
+		glDispatchCompute(1, 1, 1);
+
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		GlState().UseProgram(store_pass_.Get());
+		store_pass_.Assign("g_ShadowMap", 0);
+		store_pass_.Assign("g_HairBaseColorTex", 1);
+		store_pass_.Assign("g_HairSpecOffsetTex", 2);
+		store_pass_.Assign("g_NumTilesX", num_tiles_x_);
+	}
+
+	void CountPassParams(const PPLLForHair::ParamsG &params)
+	{
+		GlState().UseProgram(count_pass_.Get());
+		PPLLForHair::AssignHairShadingParams(count_pass_, params);
+	}
+
+	void StorePassParams(const PPLLForHair::ParamsG &params)
+	{
+		GlState().UseProgram(store_pass_.Get());
+		PPLLForHair::AssignHairShadingParams(store_pass_, params);
+	}
+
+	// One workgroup per tile.
+	void Resolve()
+	{
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		GlState().UseProgram(resolve_pass_->Get());
+		resolve_pass_->Assign("g_NumTilesX", num_tiles_x_);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, sorted_.buffer, sorted_.offset, sorted_.size);
+		glBindImageTexture(0, color_.Get(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+		glDispatchCompute(num_tiles_x_, num_tiles_y_, 1);
+
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+
+	// Composites over the layer bound by the caller.
+	void BindCompositePass()
+	{
+		GlState().Disable(GL_DEPTH_TEST);
+		GlState().UseProgram(composite_pass_.Get());
+
+		GlState().BindTexture(0, GL_TEXTURE_2D, color_.Get());
+
+		GlState().Enable(GL_BLEND);
+		glBlendFuncSeparate(GL_ONE, GL_SRC_ALPHA, GL_ONE, GL_ONE);
+	}
+
+	std::size_t MemoryBytes() const
+	{
+		// Node arena, sorted addresses and tile headers, held in the
+		// render graph heap, and the RGBA16F result.
+		return NodesBytes() + SortedBytes() + TilesBytes() +
+			static_cast<std::size_t>(screen_width_)*screen_height_ * 8;
+	}
+
+private:
+	int NumTiles() const { return num_tiles_x_ * num_tiles_y_; }
+
+	int screen_width_, screen_height_;
+	int num_tiles_x_, num_tiles_y_;
+	int num_nodes_, tile_budget_, kbuf_size_;
+	BufferRange tiles_, nodes_, sorted_;
+	TextureLayer color_;
+
+	struct TileHeader {
+		GLuint count;
+		GLuint offset;
+		GLuint size;
+		GLuint cursor;
+	};
+
+	struct TiledNode {
+		GLuint depth;
+		GLuint color;
+		GLuint pixel;
+	};
+
+	Shader count_pass_, store_pass_, scan_pass_, composite_pass_;
+	// Permutations by K-buffer size, and the one in use.
+	ShaderVariants resolve_variants_;
+	Shader *resolve_pass_;
+};
+
+// Fiber assets drawn from curves. Only the control points stay on the
+// GPU, the dense vertex buffers are released while attached. Every frame
+// strand_count.comp counts the pieces of every curve, strand_scan.comp
+// lays them out and strand_resample.comp writes the vertices packed into
+// the stream buffer, laid out as the dense vertex buffers, with the pair
+// of every segment. The asset's vertex array points at them and draws
+// them indirectly, with the counts the scan wrote. See StrandCurves for
+// the fitter and the CPU reference.
+class HairCurves {
+public:
+	static constexpr int group_size = 64;
+
+	HairCurves()
+		:
+		tolerance_{ 0.f }
+	{}
+
+	// Stream room of the curves of an asset in a frame, at most
+	// StrandCurves::MaxResampledVerts of them.
+	static std::size_t FrameBytes(std::size_t num_dense_verts, std::size_t num_fibers)
+	{
+		return StrandCurves::ResampledBytes(num_dense_verts / 2) + LayoutBytes(num_fibers) + 5 * StreamBuffer::max_alignment;
+	}
+
+	// Fits every fiber asset of the scene within tolerance, in model space.
+	// Assets streamed without host vertices, or whose controls would not
+	// fit a frame, stay dense.
+	void Init(Scene &scene, float tolerance)
+	{
+		Detach(scene);
+		Release();
+		tolerance_ = tolerance;
+
+		if (!resample_pass_.Get()) {
+			ShaderDefines defines{
+				{ "MAX_SUBDIVISIONS", std::to_string(StrandCurves::max_subdivisions) },
+				{ "GROUP_SIZE", std::to_string(group_size) } };
+			count_pass_.Init({ ShaderFile(GL_COMPUTE_SHADER, "strand_count.comp", defines) });
+			scan_pass_.Init({ ShaderFile(GL_COMPUTE_SHADER, "strand_scan.comp", defines) });
+			resample_pass_.Init({ ShaderFile(GL_COMPUTE_SHADER, "strand_resample.comp", defines) });
+		}
+
+		entries_.resize(scene.fibers.size());
+		for (std::size_t i = 0; i < entries_.size(); ++i) {
+			auto &entry = entries_[i];
+			entry.attached = false;
+			if (!scene.fibers[i].streamed)
+				entry.curves.Fit(scene.fibers[i], tolerance);
+			const auto &curves = entry.curves;
+			entry.active = !curves.Curves().empty() && curves.Controls().size() <= curves.MaxResampledVerts();
+
+			auto storage = [](GLuint &buf, std::size_t bytes, const void *data) {
+				glGenBuffers(1, &buf);
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, buf);
+				// Empty buffers still get a name to bind.
+				glBufferStorage(GL_SHADER_STORAGE_BUFFER, xy::Max(bytes, std::size_t{ 16 }), bytes > 0 ? data : nullptr, GL_NONE);
+			};
+			storage(entry.control_buf, sizeof(xy::vec4)*curves.Controls().size(), curves.Controls().data());
+			storage(entry.curve_buf, sizeof(StrandCurves::Curve)*curves.Curves().size(), curves.Curves().data());
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		}
+	}
+
+	bool Initialized() const { return !entries_.empty(); }
+	float Tolerance() const { return tolerance_; }
+	const StrandCurves &Curves(int asset) const { return entries_[asset].curves; }
+	// Drawn as curves, not dense.
+	bool Active(int asset) const { return entries_[asset].active; }
+
+	// Resamples every asset for the screen size of its first instance,
+	// the other instances draw the same vertices, into this frame's part
+	// of stream, and attaches it.
+	void Resample(Scene &scene, StreamBuffer &stream, const xy::mat4 &view_proj, xy::vec2 win_size, float pixels_per_piece)
+	{
+		int last_asset = -1;
+		// Rows are sorted by asset.
+		for (const auto &instance : scene.fiber_instances) {
+			if (instance.asset == last_asset)
+				continue;
+			last_asset = instance.asset;
+			auto &entry = entries_[instance.asset];
+			if (!entry.active)
+				continue;
+			const auto &curves = entry.curves;
+			auto num_curves = static_cast<GLuint>(curves.Curves().size());
+			auto max_verts = curves.MaxResampledVerts();
+
+			// The layout the scan writes, then the vertices and the pairs
+			// of their segments.
+			auto layout = stream.Allocate(LayoutBytes(num_curves), StreamUse::Storage);
+			StreamAlloc out[4] = {
+				stream.Allocate(sizeof(xy::vec3)*max_verts, StreamUse::Storage),
+				stream.Allocate(sizeof(xy::vec3)*max_verts, StreamUse::Storage),
+				stream.Allocate(sizeof(float)*max_verts, StreamUse::Storage),
+				stream.Allocate(2 * sizeof(std::uint32_t)*max_verts, StreamUse::Storage) };
+
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, entry.control_buf);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, entry.curve_buf);
+			glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, layout.buffer, layout.offset, layout.size);
+			for (int k = 0; k < 4; ++k)
+				glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 3 + k, out[k].buffer, out[k].offset, out[k].size);
+
+			auto assign = [&](Shader &pass) {
+				GlState().UseProgram(pass.Get());
+				pass.Assign("g_ModelViewProj", view_proj * instance.model_matrix);
+				pass.Assign("g_WinSize", win_size);
+				pass.Assign("g_PixelsPerPiece", pixels_per_piece);
+				pass.Assign("g_NumCurves", num_curves);
+				pass.Assign("g_NumControls", static_cast<GLuint>(curves.Controls().size()));
+				pass.Assign("g_MaxVerts", static_cast<GLuint>(max_verts));
+			};
+			assign(count_pass_);
+			glDispatchCompute((num_curves + group_size - 1) / group_size, 1, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+			assign(scan_pass_);
+			glDispatchCompute(1, 1, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+			assign(resample_pass_);
+			glDispatchCompute((num_curves + group_size - 1) / group_size, 1, 1);
+
+			auto &fiber = scene.fibers[instance.asset];
+			if (!entry.attached) {
+				for (int k = 0; k < 3; ++k)
+					fiber.vao.ReleaseBuf(k);
+				entry.attached = true;
+			}
+			for (int k = 0; k < 3; ++k)
+				fiber.vao.PointBuf(k, out[k].buffer, out[k].offset);
+			fiber.vao.SetAsIndirectLines(out[3].buffer, out[3].offset, layout.buffer, layout.offset, max_verts);
+		}
+
+		// Hair store passes pull the vertices from storage buffers, the
+		// shadow and opacity passes fetch them as vertices and elements,
+		// every draw copies its count.
+		glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT |
+			GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+		GlState().UseProgram(0);
+	}
+
+	// Back to the dense vertices, uploaded again from the host copies.
+	void Detach(Scene &scene)
+	{
+		for (std::size_t i = 0; i < entries_.size(); ++i) {
+			auto &entry = entries_[i];
+			if (!entry.attached)
+				continue;
+			auto &fiber = scene.fibers[i];
+			fiber.vao.ResubmitBuf(0, fiber.positions);
+			fiber.vao.ResubmitBuf(1, fiber.tangents);
+			fiber.vao.ResubmitBuf(2, fiber.scales);
+			fiber.vao.SetAsLineStrips(fiber.num_verts_per_fiber);
+			entry.attached = false;
+		}
+	}
+
+	~HairCurves()
+	{
+		Release();
+	}
+
+private:
+	// ResampleLayout of strand_curve.glsl: the counts, the cap and a
+	// word of padding, and the pieces of every curve under every cap.
+	static std::size_t LayoutBytes(std::size_t num_curves)
+	{
+		return sizeof(GpuArray::IndirectLineCounts) + 2 * sizeof(std::uint32_t) +
+			StrandCurves::num_caps * sizeof(std::uint32_t)*num_curves;
+	}
+
+	struct Entry {
+		StrandCurves curves;
+		bool active, attached;
+		GLuint control_buf, curve_buf;
+	};
+
+	void Release()
+	{
+		for (auto &entry : entries_) {
+			glDeleteBuffers(1, &entry.control_buf);
+			glDeleteBuffers(1, &entry.curve_buf);
+		}
+		entries_.clear();
+	}
+
+	float tolerance_;
+	std::vector<Entry> entries_;
+	Shader count_pass_, scan_pass_, resample_pass_;
 };
 
 class Draw {
 public:
+	// Least room for streamed instances and vertices, and the frames the
+	// ring holds: two in flight, as the pacer starts with, and the one
+	// being written.
+	static constexpr std::size_t stream_bytes = std::size_t{ 64 } << 20;
+	static constexpr int stream_frames = 3;
 
 	Draw()
+		:
+		pacer_{ 2 },
+		graph_{ hazards_ },
+		heap_buf_{ 0 },
+		heap_bytes_{ 0 }
 	{}
 
-	void Init(int screen_width, int screen_height, int msaa_level)
+	// stream_frame_bytes is the most one frame streams, see
+	// StreamFrameBytes.
+	void Init(int screen_width, int screen_height, int msaa_level, std::size_t stream_frame_bytes)
 	{
 
 		screen_width_ = screen_width;
 		screen_height_ = screen_height;
+		msaa_level_ = msaa_level;
 
 		////
 		// Main frame settings.
@@ -382,6 +1551,16 @@ public:
 		int num_link_list_nodes = screen_width_ * screen_height_ * 200;
 		ppll_.Init(screen_width_, screen_height_, num_link_list_nodes);
 
+		// Screen targets of the hair modes are made once a mode is drawn,
+		// see SelectHairTargets.
+		wboit_.Init(screen_width_, screen_height_);
+		mboit_.Init(screen_width_, screen_height_);
+
+		// 16 nodes per pixel on average.
+		tiled_ppll_.Init(screen_width_, screen_height_,
+			screen_width_ * screen_height_ * 16,
+			TiledPPLLForHair::default_tile_budget);
+
 		// Screen quad for PPLLForHair second pass.
 		std::vector<xy::vec3> quad{ {-1,-1,0},{1,-1,0},{1,1,0},{-1,1,0} };
 		screen_quad_vao_.SubmitBuf(quad, { 3 });
@@ -392,59 +1571,163 @@ public:
 
 		msm_.Init(screen_width_*2, screen_height_*2);
 
+		////
+		// Deep opacity map settings.
+		////
+
+		dom_.Init(screen_width_, screen_height_, 8);
+
 		////
 		// Poly-rendering settings.
 		////
 
 		platte_.Init(screen_width_, screen_height_);
+
+		////
+		// Per-frame dynamic data.
+		////
+
+		stream_.Init(xy::Max(stream_bytes, stream_frames * stream_frame_bytes));
+	}
+
+	// Instance transforms of the scene and, for every groom loaded to
+	// host memory, a simulated pose as StrandSim::Stream writes it or its
+	// resampled curves, whichever is larger; a frame has one or the other.
+	static std::size_t StreamFrameBytes(const Scene &scene)
+	{
+		std::size_t num_assets = scene.meshes.size() + scene.fibers.size();
+		std::size_t bytes = scene.NumInstances() * sizeof(InstanceTransform) + num_assets * StreamBuffer::max_alignment;
+		for (const auto &fiber : scene.fibers)
+			bytes += xy::Max(
+				2 * (fiber.positions.size() * sizeof(xy::vec3) + StreamBuffer::max_alignment),
+				HairCurves::FrameBytes(fiber.positions.size(), fiber.num_verts_per_fiber.size()));
+		return bytes;
 	}
 
+	// The scene's instance transforms go through the stream buffer.
 	void Render(
-		AABB &world_bounds,
-		ObjAsset &obj_asset,
-		FiberAsset &fiber_asset,
+		Scene &scene,
 		Camera &camera,
 		xy::vec4 background,
 		xy::vec3 sun_light_dir,
 		float msm_moment_offset,
 		float msm_depth_offset,
 		float ppll_HairRadius,
-		float ppll_HairTransparency
+		float ppll_HairTransparency,
+		ShadowMode shadow_mode,
+		float dom_layer_size,
+		float dom_absorption,
+		HairMode hair_mode
 	)
 	{
 		// Compute matrices.
-		auto tgt = world_bounds.Center();
-		auto radius = world_bounds.Lengths().Norm()*.25f;
+		auto tgt = scene.bounds.Center();
+		auto radius = scene.bounds.Lengths().Norm()*.25f;
 		auto light_view_matrix = xy::LookAt(tgt + radius * sun_light_dir, tgt, { 0.f,1.f,0.f });
 		auto light_proj_matrix = xy::Orthographic(-radius, radius, -radius, radius, 0.f, 4.f*radius);
 		auto light_view_proj_matrix = light_proj_matrix * light_view_matrix;
 
 		auto camera_view_proj_matrix = camera.Proj()*camera.View();
 
+		// ImGui and the loaders bind behind the state cache.
+		GlState().Invalidate();
+
+		// Waits only when the GPU is frames_in_flight frames behind.
+		pacer_.BeginFrame();
+		profiler_.BeginFrame();
+
+		// Edited instance tables show without an upload.
+		scene.StreamInstances(stream_);
+
+		// With deep opacity maps the moment map only holds meshes.
+		bool use_dom = (shadow_mode == ShadowMode::DOM);
+
+		////
+		// Passes declare what they touch. The graph orders them, culls
+		// the deep opacity pass when nothing samples its maps, issues the
+		// barriers and places the transients in heap_buf_.
+		////
+
+		graph_.Reset();
+
+		int composite = graph_.Import("composite layer", CompositeBytes(), true);
+		int shadow_map = graph_.Import("msm shadow map", msm_.MemoryBytes());
+		int dom_maps = graph_.Import("dom maps", dom_.MemoryBytes());
+		int msm_temp = graph_.CreateTransient("msm temp", msm_.TempBytes());
+
+		// Mesh and hair shading sample the shadow maps in use.
+		std::vector<RenderGraph::Use> shadow_reads{ { shadow_map, GpuAccess::TextureFetch } };
+		if (use_dom)
+			shadow_reads.push_back({ dom_maps, GpuAccess::TextureFetch });
+		auto shaded = [&](std::vector<RenderGraph::Use> uses) {
+			uses.insert(uses.end(), shadow_reads.begin(), shadow_reads.end());
+			return uses;
+		};
+
 		//////
 		//// Create moment shadow map.
 		//////
 
-		MSM::ParamsL msm_params;
+		graph_.AddPass("msm store", { { shadow_map, GpuAccess::RenderTarget } }, [&]() {
+			MSM::ParamsL msm_params;
+			msm_.BindPass();
 
-		msm_.BindPass();
+			msm_params.g_LightViewProj = light_view_proj_matrix;
+			msm_.PassParams(msm_params);
 
-		msm_params.g_LightModelViewProj = light_view_proj_matrix * obj_asset.model_matrix;
+			for (const auto &batch : scene.mesh_batches)
+				for (const auto &shape : scene.meshes[batch.asset].shapes)
+					for (const auto &vao : shape.vaos)
+						vao.DrawInstanced(GL_TRIANGLES, { 0 }, batch.first_instance, batch.num_instances);
 
-		msm_.PassParams(msm_params);
+			glLineWidth(1.f);
+			if (!use_dom)
+				for (const auto &batch : scene.fiber_batches)
+					scene.fibers[batch.asset].vao.DrawLineStripsInstanced({ 0 }, .1f, batch.first_instance, batch.num_instances);
+		});
 
-		for (auto &shape : obj_asset.shapes)
-			for (const auto &vao : shape.vaos)
-				vao.Draw(GL_TRIANGLES, { 0 });
+		graph_.AddPass("msm filter", {
+			{ shadow_map, GpuAccess::ImageRead },
+			{ shadow_map, GpuAccess::ImageWrite },
+			{ msm_temp, GpuAccess::StorageWrite } }, [&]() {
+			msm_.ProcessShadowMap(HeapRange(msm_temp));
+		});
 
-		glLineWidth(1.f);
-		fiber_asset.vao.DrawLineStrips({ 0 },.1f);
-
-		msm_.ProcessShadowMap();
+		//////
+		//// Create deep opacity map.
+		//////
 
-		glBindFramebuffer(GL_FRAMEBUFFER, composite_layer_.Get());
-		glClearColor(background.r, background.g, background.b, background.a);
-		glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+		graph_.AddPass("dom", { { dom_maps, GpuAccess::RenderTarget } }, [&]() {
+			DOM::ParamsL dom_params;
+			dom_params.g_LightViewProj = light_view_proj_matrix;
+
+			dom_.BindDepthPass();
+			dom_.DepthPassParams(dom_params);
+			for (const auto &batch : scene.fiber_batches)
+				scene.fibers[batch.asset].vao.DrawLineStripsInstanced({ 0 }, 1.f, batch.first_instance, batch.num_instances);
+
+			dom_.BindStorePass(dom_layer_size, ppll_HairTransparency);
+			dom_.StorePassParams(dom_params);
+			for (const auto &batch : scene.fiber_batches)
+				scene.fibers[batch.asset].vao.DrawLineStripsInstanced({ 0 }, 1.f, batch.first_instance, batch.num_instances);
+
+			dom_.EndPass();
+		});
+
+		ShadowParams shadow_params;
+		shadow_params.g_ShadowMode = shadow_mode;
+		shadow_params.g_DOMDepthMap = dom_.DepthMap();
+		shadow_params.g_DOMLayerMap0 = dom_.LayerMap(0);
+		shadow_params.g_DOMLayerMap1 = dom_.LayerMap(1);
+		shadow_params.g_DOMLayerSize = dom_layer_size;
+		shadow_params.g_DOMAbsorption = dom_absorption;
+		shadow_params.g_DOMNumLayers = dom_.NumLayers();
+
+		graph_.AddPass("clear", { { composite, GpuAccess::RenderTarget } }, [&]() {
+			GlState().BindFramebuffer(GL_FRAMEBUFFER, composite_layer_.Get());
+			glClearColor(background.r, background.g, background.b, background.a);
+			glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+		});
 
 		////
 		// Obj pass.
@@ -457,18 +1740,19 @@ public:
 		platte_params_g.g_MomentOffset = msm_moment_offset;
 		platte_params_g.g_DepthOffset = msm_depth_offset;
 		platte_params_g.g_ShadowMap = msm_.ShadowMap();
+		platte_params_g.g_Shadow = shadow_params;
 
-		platte_.BindPass();
-		platte_.PassParams(platte_params_g);
+		graph_.AddPass("platte", shaded({ { composite, GpuAccess::RenderTarget } }), [&]() {
+			platte_.BindPass();
+			platte_.PassParams(platte_params_g);
 
-		DrawObj(platte_, obj_asset);
+			DrawMeshes(platte_, scene);
+		});
 
 		////
 		// PPLL pass.
 		////
 
-		glBindFramebuffer(GL_FRAMEBUFFER, composite_layer_.Get());
-
 		PPLLForHair::ParamsG ppll_params_g;
 		ppll_params_g.g_Eye = camera.Pos();
 		ppll_params_g.g_HairRadius = ppll_HairRadius;
@@ -480,100 +1764,450 @@ public:
 		ppll_params_g.g_DepthOffset = msm_depth_offset;
 		ppll_params_g.g_MomentOffset = msm_moment_offset;
 		ppll_params_g.g_ShadowMap = msm_.ShadowMap();
-		ppll_params_g.g_HairBaseColorTex = fiber_asset.map_base_color;
-		ppll_params_g.g_HairSpecOffsetTex = fiber_asset.map_spec_offset;
-
-		PPLLForHair::ParamsL ppll_params_l;
-
-		// Store pass.
-		ppll_.BindStorePass();
-
-		ppll_.StorePassParams(ppll_params_g);
-
-		glEnable(GL_DEPTH_TEST);
-		glDepthMask(GL_FALSE);
-		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-
-		ppll_params_l.g_Model = fiber_asset.model_matrix;
-		ppll_.StorePassParams(ppll_params_l);
-
-		fiber_asset.vao.DrawLineStrips({ 0,1,2 },1.f);
-
-		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		ppll_params_g.g_Shadow = shadow_params;
+		ppll_params_g.g_ProjZ = xy::vec2(camera.Proj()[2][2], camera.Proj()[3][2]);
+		ppll_params_g.g_MomentDepthRange = HairDepthRange(scene, camera);
+
+		// The screen targets of the OIT techniques are their own, only
+		// the composite layer they test against and blend into is
+		// declared. Their buffers are transients.
+		SelectHairTargets(hair_mode);
+		std::vector<RenderGraph::Use> hair_store = shaded({ { composite, GpuAccess::RenderTarget } });
+		std::vector<RenderGraph::Use> hair_composite{ { composite, GpuAccess::RenderTarget } };
+
+		if (hair_mode == HairMode::WBOIT) {
+			graph_.AddPass("wboit store", hair_store, [&]() {
+				wboit_.BindStorePass(composite_layer_);
+				DrawFibers(scene, ppll_params_g,
+					[&](const PPLLForHair::ParamsG &params) { wboit_.StorePassParams(params); });
+			});
+
+			graph_.AddPass("wboit composite", hair_composite, [&]() {
+				GlState().BindFramebuffer(GL_FRAMEBUFFER, composite_layer_.Get());
+				wboit_.BindCompositePass();
+
+				screen_quad_vao_.Draw(GL_TRIANGLE_FAN, { 0 });
+			});
+		}
+		else if (hair_mode == HairMode::MBOIT) {
+			graph_.AddPass("mboit moments", hair_store, [&]() {
+				mboit_.BindMomentPass(composite_layer_);
+				DrawFibers(scene, ppll_params_g,
+					[&](const PPLLForHair::ParamsG &params) { mboit_.MomentPassParams(params); });
+			});
+
+			graph_.AddPass("mboit resolve", hair_store, [&]() {
+				mboit_.BindResolvePass();
+				DrawFibers(scene, ppll_params_g,
+					[&](const PPLLForHair::ParamsG &params) { mboit_.ResolvePassParams(params); });
+			});
+
+			graph_.AddPass("mboit composite", hair_composite, [&]() {
+				GlState().BindFramebuffer(GL_FRAMEBUFFER, composite_layer_.Get());
+				mboit_.BindCompositePass();
+
+				screen_quad_vao_.Draw(GL_TRIANGLE_FAN, { 0 });
+			});
+		}
+		else if (hair_mode == HairMode::TiledPPLL) {
+			int tiles = graph_.CreateTransient("tiled headers", tiled_ppll_.TilesBytes());
+			int nodes = graph_.CreateTransient("tiled nodes", tiled_ppll_.NodesBytes());
+			int sorted = graph_.CreateTransient("tiled sorted", tiled_ppll_.SortedBytes());
+
+			auto tiled_count = hair_store;
+			tiled_count.insert(tiled_count.end(), {
+				{ tiles, GpuAccess::Transfer },
+				{ tiles, GpuAccess::StorageWrite } });
+			graph_.AddPass("tiled count", tiled_count, [&, tiles, nodes, sorted]() {
+				tiled_ppll_.SetBuffers(HeapRange(tiles), HeapRange(nodes), HeapRange(sorted));
+				GlState().BindFramebuffer(GL_FRAMEBUFFER, composite_layer_.Get());
+				tiled_ppll_.BindCountPass();
+				DrawFibers(scene, ppll_params_g,
+					[&](const PPLLForHair::ParamsG &params) { tiled_ppll_.CountPassParams(params); });
+			});
+
+			auto tiled_store = hair_store;
+			tiled_store.insert(tiled_store.end(), {
+				{ tiles, GpuAccess::StorageWrite },
+				{ nodes, GpuAccess::StorageWrite } });
+			graph_.AddPass("tiled store", tiled_store, [&]() {
+				tiled_ppll_.BindStorePass();
+				DrawFibers(scene, ppll_params_g,
+					[&](const PPLLForHair::ParamsG &params) { tiled_ppll_.StorePassParams(params); });
+			});
+
+			graph_.AddPass("tiled resolve", {
+				{ composite, GpuAccess::RenderTarget },
+				{ tiles, GpuAccess::StorageRead },
+				{ nodes, GpuAccess::StorageRead },
+				{ sorted, GpuAccess::StorageWrite } }, [&]() {
+				tiled_ppll_.Resolve();
+
+				tiled_ppll_.BindCompositePass();
+
+				screen_quad_vao_.Draw(GL_TRIANGLE_FAN, { 0 });
+			});
+		}
+		else {
+			// Lists only live from the store to the resolve, the arena
+			// shares its memory with the moment filter's temp.
+			int heads = graph_.CreateTransient("ppll heads", ppll_.HeadsBytes());
+			int nodes = graph_.CreateTransient("ppll nodes", ppll_.NodesBytes());
+			int counter = graph_.Import("ppll counter", sizeof(GLuint));
+
+			// Heads and counter are cleared by transfers, after the last
+			// frame's stores.
+			graph_.AddPass("ppll clear", {
+				{ heads, GpuAccess::Transfer },
+				{ counter, GpuAccess::Transfer } }, [&, heads, nodes]() {
+				ppll_.SetLists(HeapRange(heads), HeapRange(nodes));
+				ppll_.ClearLists();
+			});
+
+			auto ppll_store = hair_store;
+			ppll_store.insert(ppll_store.end(), {
+				{ heads, GpuAccess::StorageWrite },
+				{ nodes, GpuAccess::StorageWrite },
+				{ counter, GpuAccess::AtomicCounter } });
+
+			graph_.AddPass("ppll store", ppll_store, [&]() {
+				GlState().BindFramebuffer(GL_FRAMEBUFFER, composite_layer_.Get());
+				ppll_.BindStorePass();
+
+				GlState().Enable(GL_DEPTH_TEST);
+				GlState().DepthMask(GL_FALSE);
+				glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+				DrawFibers(scene, ppll_params_g,
+					[&](const PPLLForHair::ParamsG &params) { ppll_.StorePassParams(params); });
+
+				glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			});
+
+			// Both resolves walk the lists the store pass wrote, the
+			// compute one through lengths and a compact list of its own.
+			bool compute_resolve = (hair_mode == HairMode::PPLLCompute);
+			std::vector<RenderGraph::Use> ppll_resolve{
+				{ composite, GpuAccess::RenderTarget },
+				{ heads, GpuAccess::StorageRead },
+				{ nodes, GpuAccess::StorageRead } };
+			int pixel_counts = -1, compact = -1;
+			if (compute_resolve) {
+				pixel_counts = graph_.CreateTransient("ppll pixel counts", ppll_.ResolveListBytes());
+				compact = graph_.CreateTransient("ppll compact", ppll_.ResolveListBytes());
+				ppll_resolve.insert(ppll_resolve.end(), {
+					{ pixel_counts, GpuAccess::StorageWrite },
+					{ compact, GpuAccess::StorageWrite } });
+			}
 
-		//// Two-pass sync.
-		glFinish();
+			graph_.AddPass(compute_resolve ? "ppll compute resolve" : "ppll blend", ppll_resolve,
+				[&, compute_resolve, pixel_counts, compact]() {
+				if (compute_resolve) {
+					ppll_.SetResolveLists(HeapRange(pixel_counts), HeapRange(compact));
+					ppll_.ResolveCompute();
+					ppll_.BindComputeCompositePass();
+				}
+				else {
+					GlState().Disable(GL_DEPTH_TEST);
+					ppll_.BindBlendPass();
+					ppll_.BlendPassParams(ppll_params_g);
 
-		glDisable(GL_DEPTH_TEST);
-		ppll_.BindBlendPass();
-		ppll_.BlendPassParams(ppll_params_g);
+					GlState().Enable(GL_BLEND);
+					glBlendFuncSeparate(GL_ONE, GL_SRC_ALPHA, GL_ONE, GL_ONE);
+				}
 
-		glEnable(GL_BLEND);
-		glBlendFuncSeparate(GL_ONE, GL_SRC_ALPHA, GL_ONE, GL_ONE);
+				screen_quad_vao_.Draw(GL_TRIANGLE_FAN, { 0 });
+			});
+		}
 
-		screen_quad_vao_.Draw(GL_TRIANGLE_FAN, { 0 });
+		graph_.Compile();
+		ReserveHeap(graph_.HeapBytes());
+		graph_.Execute(
+			[&](const std::string &name) { BeginPass(name.c_str()); },
+			[&]() { EndPass(); });
 
-		glDisable(GL_BLEND);
+		GlState().Disable(GL_BLEND);
 
-		glEnable(GL_DEPTH_TEST);
-		glDepthMask(GL_TRUE);
+		GlState().Enable(GL_DEPTH_TEST);
+		GlState().DepthMask(GL_TRUE);
 	}
 
 	void OutputFrame()
 	{
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		BeginPass("blit");
+		GlState().BindFramebuffer(GL_FRAMEBUFFER, 0);
 		glClearColor(1, 1, 1, 1);
 		glClear(GL_COLOR_BUFFER_BIT);
 
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, composite_layer_.Get());
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		GlState().BindFramebuffer(GL_READ_FRAMEBUFFER, composite_layer_.Get());
+		GlState().BindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 		glBlitFramebuffer(
 			0, 0,
 			screen_width_, screen_height_,
 			0, 0,
 			screen_width_, screen_height_,
 			GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		EndPass();
+
+		if (readback_.Initialized())
+			readback_.Poll();
+
+		stream_.EndFrame();
+		profiler_.EndFrame();
+		pacer_.EndFrame();
+	}
+
+	// Queues a readback of the composite layer as RGBA8; callback runs on
+	// the ring's worker thread a few frames later. The ring is created by
+	// the first call.
+	void ReadFrameAsync(ReadbackRing::Callback callback, int depth = 3)
+	{
+		if (msaa_level_ > 0)
+			XY_Die("readback needs a single-sample composite layer");
+		if (!readback_.Initialized())
+			readback_.Init(screen_width_, screen_height_, depth);
+		readback_.Read(composite_layer_.Get(), std::move(callback));
+	}
+
+	ReadbackStats GetReadbackStats()
+	{
+		return readback_.Stats();
+	}
+
+	// Full pipeline flush, counted by the pacer. Only for timing and
+	// readback outside the frame loop.
+	void Finish()
+	{
+		pacer_.Finish();
+	}
+
+	void SetFramesInFlight(int frames_in_flight)
+	{
+		pacer_.SetFramesInFlight(frames_in_flight);
+	}
+
+	// RGBA8, single-sample when Init with msaa_level 0.
+	GLuint CompositeFramebuffer() const { return composite_layer_.Get(); }
+
+	const FramePacer &Pacer() const { return pacer_; }
+	const GpuHazardTracker &Hazards() const { return hazards_; }
+	// Passes, culling and memory of the last frame.
+	const RenderGraph &Graph() const { return graph_; }
+	// Allocations are fenced by OutputFrame.
+	StreamBuffer &Stream() { return stream_; }
+	Profiler &GetProfiler() { return profiler_; }
+
+	void SetHairKBufferSize(int kbuf_size)
+	{
+		ppll_.SetKBufferSize(kbuf_size);
+		tiled_ppll_.SetKBufferSize(kbuf_size);
+	}
+
+	// Fragment lists of the last PPLL frame.
+	void CaptureHairFragments(OITFragmentLists &lists)
+	{
+		ppll_.CaptureFragments(lists);
+	}
+
+	// Premultiplied hair color and transmittance are not kept apart from
+	// the scene, so the frame is read after OutputFrame.
+	void ReadFrame(std::vector<xy::vec4> &pixels)
+	{
+		pixels.resize(screen_width_*screen_height_);
+		GlState().BindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		glReadPixels(0, 0, screen_width_, screen_height_, GL_RGBA, GL_FLOAT, pixels.data());
+	}
+
+	std::size_t HairMemoryBytes(HairMode hair_mode) const
+	{
+		switch (hair_mode) {
+		case HairMode::WBOIT:
+			return wboit_.MemoryBytes();
+		case HairMode::MBOIT:
+			return mboit_.MemoryBytes();
+		case HairMode::TiledPPLL:
+			return tiled_ppll_.MemoryBytes();
+		default:
+			return ppll_.MemoryBytes(hair_mode == HairMode::PPLLCompute);
+		}
+	}
+
+	// View depth range of the bounds of every hair instance, kept in front
+	// of the near plane.
+	static xy::vec2 HairDepthRange(const Scene &scene, const Camera &camera)
+	{
+		xy::vec2 range{ std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest() };
+		for (const auto &instance : scene.fiber_instances) {
+			auto model_view = camera.View()*instance.model_matrix;
+			const auto &bounds = scene.fibers[instance.asset].bounds;
+
+			for (int corner = 0; corner < 8; ++corner) {
+				xy::vec4 p(
+					corner & 1 ? bounds.sup.x : bounds.inf.x,
+					corner & 2 ? bounds.sup.y : bounds.inf.y,
+					corner & 4 ? bounds.sup.z : bounds.inf.z,
+					1.f);
+				float view_depth = -(model_view*p).z;
+				range.x = xy::Min(range.x, view_depth);
+				range.y = xy::Max(range.y, view_depth);
+			}
+		}
+
+		auto proj = camera.Proj();
+		float near_plane = proj[3][2] / (proj[2][2] - 1.f);
+		range.x = xy::Max(range.x, near_plane);
+		range.y = xy::Max(range.y, range.x + 1e-3f);
+		return range;
 	}
 
 private:
 
-	void DrawObj(Platte &platte, ObjAsset &asset)
+	// CPU and GPU zone of a pass.
+	void BeginPass(const char *name)
 	{
+		profiler_.BeginCpuZone(name);
+		profiler_.BeginGpuZone(name);
+	}
+
+	void EndPass()
+	{
+		profiler_.EndGpuZone();
+		profiler_.EndCpuZone();
+	}
 
+	// Only the drawn mode holds its screen targets, the others are freed
+	// on the frame the mode changes.
+	void SelectHairTargets(HairMode hair_mode)
+	{
+		if (hair_mode == HairMode::WBOIT)
+			wboit_.InitTargets();
+		else
+			wboit_.ReleaseTargets();
+
+		if (hair_mode == HairMode::MBOIT)
+			mboit_.InitTargets();
+		else
+			mboit_.ReleaseTargets();
+
+		if (hair_mode == HairMode::TiledPPLL)
+			tiled_ppll_.InitTargets();
+		else
+			tiled_ppll_.ReleaseTargets();
+
+		if (hair_mode == HairMode::PPLLCompute)
+			ppll_.InitTargets();
+		else
+			ppll_.ReleaseTargets();
+	}
+
+	// RGBA8 and 24-bit depth per sample.
+	std::size_t CompositeBytes() const
+	{
+		return static_cast<std::size_t>(screen_width_)*screen_height_*(4 + 4)*xy::Max(msaa_level_, 1);
+	}
+
+	void ReserveHeap(std::size_t bytes)
+	{
+		if (bytes <= heap_bytes_)
+			return;
+
+		if (heap_buf_ != 0)
+			glDeleteBuffers(1, &heap_buf_);
+		glGenBuffers(1, &heap_buf_);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, heap_buf_);
+		glBufferStorage(GL_SHADER_STORAGE_BUFFER, bytes, nullptr, GL_NONE);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		heap_bytes_ = bytes;
+	}
+
+	BufferRange HeapRange(int resource) const
+	{
+		return {
+			heap_buf_,
+			static_cast<GLintptr>(graph_.Offset(resource)),
+			static_cast<GLsizeiptr>(graph_.Bytes(resource)) };
+	}
+
+	// Batches are sorted by asset, so the textures of a blob are bound
+	// once and drawn with one instanced call per batch.
+	void DrawMeshes(Platte &platte, const Scene &scene)
+	{
 		Platte::ParamsL platte_params_l;
 
-		platte_params_l.g_Model = asset.model_matrix;
+		const auto &batches = scene.mesh_batches;
+		for (std::size_t first = 0; first < batches.size();) {
+			auto last = first;
+			while (last < batches.size() && batches[last].asset == batches[first].asset)
+				++last;
 
-		for (auto &shape : asset.shapes) {
-			int num_blobs = shape.blobs.size();
-			for (int i = 0; i < num_blobs; ++i) {
+			for (const auto &shape : scene.meshes[batches[first].asset].shapes) {
+				int num_blobs = shape.blobs.size();
+				for (int i = 0; i < num_blobs; ++i) {
 
-				platte_params_l.g_AlphaMap = shape.map_d_textures[i];
-				platte_params_l.g_DiffuseMap = shape.map_Kd_textures[i];
+					platte_params_l.g_AlphaMap = shape.map_d_textures[i];
+					platte_params_l.g_DiffuseMap = shape.map_Kd_textures[i];
 
-				platte.PassParams(platte_params_l);
+					platte.PassParams(platte_params_l);
 
-				bool enable_alpha_to_coverage = (shape.map_d_textures[i] != 0);
+					bool enable_alpha_to_coverage = (shape.map_d_textures[i] != 0);
+					if (enable_alpha_to_coverage)
+						GlState().Enable(GL_SAMPLE_ALPHA_TO_COVERAGE);
 
-				if (enable_alpha_to_coverage) {
-					glEnable(GL_SAMPLE_ALPHA_TO_COVERAGE);
-					shape.vaos[i].Draw(GL_TRIANGLES, { 0,1,2 });
-					glDisable(GL_SAMPLE_ALPHA_TO_COVERAGE);
-				}
-				else {
-					shape.vaos[i].Draw(GL_TRIANGLES, { 0,1,2 });
-				}
+					for (auto k = first; k < last; ++k)
+						shape.vaos[i].DrawInstanced(GL_TRIANGLES, { 0,1,2 }, batches[k].first_instance, batches[k].num_instances);
 
+					if (enable_alpha_to_coverage)
+						GlState().Disable(GL_SAMPLE_ALPHA_TO_COVERAGE);
+				}
 			}
+
+			first = last;
 		}
 	}
 
-	int screen_width_, screen_height_;
+	// One instanced draw per batch. Hair uniforms, textures and material
+	// scales, are assigned once per batch.
+	template<typename AssignG>
+	void DrawFibers(const Scene &scene, PPLLForHair::ParamsG params_g, AssignG assign_g)
+	{
+		float hair_radius = params_g.g_HairRadius;
+		float hair_transparency = params_g.g_HairTransparency;
+
+		for (const auto &batch : scene.fiber_batches) {
+			const auto &fiber = scene.fibers[batch.asset];
+			const auto &hair_material = scene.hair_materials[batch.material];
+
+			params_g.g_HairRadius = hair_radius * hair_material.radius_scale;
+			params_g.g_HairTransparency = hair_transparency * hair_material.transparency_scale;
+			params_g.g_HairBaseColorTex = fiber.map_base_color;
+			params_g.g_HairSpecOffsetTex = fiber.map_spec_offset;
+			assign_g(params_g);
+
+			fiber.vao.DrawLineStripsPulled(batch.first_instance, batch.num_instances);
+		}
+	}
+
+	int screen_width_, screen_height_, msaa_level_;
 
 	MSM msm_;
+	DOM dom_;
 	Platte platte_;
 	PPLLForHair ppll_;
+	WBOITForHair wboit_;
+	MBOITForHair mboit_;
+	TiledPPLLForHair tiled_ppll_;
 	FrameLayer composite_layer_;
 
 	GpuArray screen_quad_vao_;
+
+	GpuHazardTracker hazards_;
+	FramePacer pacer_;
+	Profiler profiler_;
+	ReadbackRing readback_;
+	RenderGraph graph_;
+	StreamBuffer stream_;
+	// Transients of the graph. Only grows, switching hair modes does not
+	// reallocate it.
+	GLuint heap_buf_;
+	std::size_t heap_bytes_;
 };